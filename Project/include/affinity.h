@@ -0,0 +1,94 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <sched.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// CPUs of each NUMA node, read from /sys/devices/system/node (Linux). Without
+// that directory the machine is one node holding the CPUs this process may use
+struct CpuTopology {
+    std::vector<std::vector<int>> nodeCpus;
+
+    static CpuTopology detect();
+
+    int numNodes() const { return static_cast<int>(nodeCpus.size()); }
+
+    // Node of a CPU, -1 if it is not listed
+    int nodeOfCpu(int cpu) const;
+};
+
+// Placement of worker threads (thread_affinity):
+// - none: threads are not pinned (default)
+// - compact: worker t runs on the t-th CPU, filling one NUMA node before the next
+// - scatter: workers alternate between the nodes (worker t on node t % nodes)
+// - a CPU list such as "0,2,4-7": worker t runs on the t-th CPU of the list
+// Threads beyond the number of CPUs wrap around. Worker t is the thread index of
+// the simulator's contiguous body ranges, so with first touch (Simulation) a
+// worker's bodies live on the node it runs on.
+class ThreadPlacement {
+public:
+    ThreadPlacement();
+
+    // Parse a thread_affinity value against the detected topology. Returns false
+    // (placement unchanged) for an unknown mode, a bad list or CPUs this process
+    // may not run on
+    bool parse(const std::string& spec);
+
+    bool isEnabled() const { return !cpus.empty(); }
+
+    // CPU of worker t, -1 when threads are not pinned
+    int cpuOf(int t) const;
+
+    // Pin the calling thread to the CPU of worker t (nothing when not pinned).
+    // Returns false if the system refused. A region that runs worker 0 on the
+    // calling thread holds a ScopedThreadAffinity around it
+    bool pin(int t) const;
+
+    // "none", or the mode and the CPU order, for the startup banner
+    std::string describe() const;
+
+    const CpuTopology& getTopology() const { return topology; }
+
+private:
+    std::string mode;
+    std::vector<int> cpus;  // CPU of worker t is cpus[t % size]
+    CpuTopology topology;
+};
+
+// Saves the CPU mask of the calling thread and restores it when it goes out of
+// scope. Parallel regions that run worker 0 on the calling thread hold one, so the
+// main thread is not left pinned to worker 0's CPU: threads it creates later
+// (mergers, trajectory codec, analysis, child processes) inherit its mask.
+// Does nothing when placement is not enabled
+class ScopedThreadAffinity {
+public:
+    explicit ScopedThreadAffinity(const ThreadPlacement& placement);
+    ~ScopedThreadAffinity();
+
+    ScopedThreadAffinity(const ScopedThreadAffinity&) = delete;
+    ScopedThreadAffinity& operator=(const ScopedThreadAffinity&) = delete;
+
+private:
+    bool saved;
+    cpu_set_t mask;
+};
+
+// Parse a CPU list such as "0,2,4-7"
+bool parseCpuList(const std::string& text, std::vector<int>& cpus);
+
+// Pin the calling thread to one CPU; false if the system refused
+bool pinCurrentThread(int cpu);
+
+// Ask for transparent huge pages behind [data, data + bytes) (madvise). Takes
+// effect for pages faulted in afterwards. Returns false if the kernel refused
+bool adviseHugePages(void* data, size_t bytes);
+
+// Fault in the whole pages of [data, data + bytes) from the calling thread without
+// writing to them (MADV_POPULATE_WRITE), so under the default first-touch policy
+// they are allocated on this thread's NUMA node. Returns false if the kernel does
+// not support it (Linux < 5.14)
+bool touchPages(void* data, size_t bytes);
+
+#endif // AFFINITY_H
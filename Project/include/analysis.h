@@ -0,0 +1,159 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "body.h"
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// In-situ analysis (analysis = density,radial,dispersion).
+//
+// Every analysis_interval-th output step the simulator copies the bodies into a
+// snapshot and hands it to the analyses, each on its own worker thread. The next
+// step runs while they work; the snapshot is only reused once they have finished,
+// so a step waits only when the analyses are slower than the stepping.
+//
+// Maps cover the square [-extent, extent]^2 with grid x grid cells, rows in y then
+// columns in x. They are written as binary files:
+//   header : AnalysisMapHeader (24 bytes)
+//   frames : { int64_t step; double time; float value[grid * grid] } repeated
+// The radial profile is a CSV file with one row per bin and snapshot.
+
+// A copy of the bodies at one output step
+struct Snapshot {
+    int step;
+    double time;
+    std::vector<Body> bodies;
+
+    Snapshot() : step(0), time(0.0) {}
+};
+
+// Settings shared by the built-in analyses
+struct AnalysisSettings {
+    std::string prefix;   // output files are <prefix>_<name>.<ext>
+    int grid;             // map cells per side
+    int bins;             // radial profile bins
+    double extent;        // half-width of the maps and outer radius of the profile
+
+    AnalysisSettings() : prefix("analysis"), grid(128), bins(64), extent(0.0) {}
+};
+
+struct AnalysisMapHeader {
+    char magic[4];        // "NBMP"
+    int32_t version;
+    int32_t grid;
+    int32_t reserved;
+    double extent;
+};
+
+// Plugin interface. analyse() runs on a worker thread; calls for one analysis never
+// overlap and come in step order, so an analysis needs no locking of its own state
+class Analysis {
+public:
+    virtual ~Analysis() {}
+
+    // Short name, also the suffix of the output file
+    virtual std::string name() const = 0;
+
+    // Open the output. Returns false (the analysis is dropped) on failure
+    virtual bool open(const AnalysisSettings& settings) = 0;
+
+    virtual void analyse(const Snapshot& snapshot) = 0;
+
+    // Flush and close the output after the last snapshot
+    virtual void close() = 0;
+};
+
+// Built-in analyses by name ("density", "radial", "dispersion"); nullptr if unknown
+std::unique_ptr<Analysis> createAnalysis(const std::string& name);
+
+// Surface density (mass per unit area) of every map cell
+class DensityMap : public Analysis {
+public:
+    std::string name() const override { return "density"; }
+    bool open(const AnalysisSettings& settings) override;
+    void analyse(const Snapshot& snapshot) override;
+    void close() override;
+
+private:
+    AnalysisSettings settings;
+    std::ofstream file;
+    std::vector<float> values;
+};
+
+// Mass-weighted one-dimensional velocity dispersion sqrt((<|v|^2> - |<v>|^2) / 2)
+// of every map cell, 0 in cells with fewer than two bodies
+class DispersionMap : public Analysis {
+public:
+    std::string name() const override { return "dispersion"; }
+    bool open(const AnalysisSettings& settings) override;
+    void analyse(const Snapshot& snapshot) override;
+    void close() override;
+
+private:
+    AnalysisSettings settings;
+    std::ofstream file;
+    std::vector<double> mass, vx, vy, v2;
+    std::vector<int> count;
+    std::vector<float> values;
+};
+
+// Mass in equal-width annuli around the centre of mass, out to extent:
+// step,time,r_inner,r_outer,count,mass,enclosed_mass,surface_density
+class RadialProfile : public Analysis {
+public:
+    std::string name() const override { return "radial"; }
+    bool open(const AnalysisSettings& settings) override;
+    void analyse(const Snapshot& snapshot) override;
+    void close() override;
+
+private:
+    AnalysisSettings settings;
+    std::ofstream file;
+};
+
+class AnalysisPipeline {
+public:
+    AnalysisPipeline();
+    ~AnalysisPipeline();
+
+    int interval;         // output steps between snapshots, 0 = off
+
+    // Add an analysis and open its output. Returns false if it could not be opened
+    bool add(std::unique_ptr<Analysis> analysis);
+
+    // Settings for analyses added from now on. An extent of 0 is replaced by the
+    // largest coordinate of bodies plus 5%
+    void configure(const AnalysisSettings& newSettings, const std::vector<Body>& bodies);
+    const AnalysisSettings& getSettings() const { return settings; }
+
+    bool isEnabled() const { return interval > 0 && !analyses.empty(); }
+    bool isDue(int step) const { return isEnabled() && step % interval == 0; }
+
+    // Copy bodies into the snapshot and start the analyses on it. Waits for the
+    // previous snapshot's analyses first
+    void submit(int step, double time, const std::vector<Body>& bodies);
+
+    // Wait for running analyses and close every output
+    void finish();
+
+    int getNumSnapshots() const { return numSnapshots; }
+
+    // Time submit() spent waiting for the previous snapshot, in ms
+    double getWaitMs() const { return waitMs; }
+
+private:
+    std::vector<std::unique_ptr<Analysis>> analyses;
+    std::vector<std::thread> workers;
+    Snapshot snapshot;
+    AnalysisSettings settings;
+    int numSnapshots;
+    double waitMs;
+
+    void wait();
+};
+
+#endif // ANALYSIS_H
@@ -0,0 +1,82 @@
+#ifndef AUTOTUNER_H
+#define AUTOTUNER_H
+
+#include "direct_sum.h"
+#include <ostream>
+#include <vector>
+
+class Simulation;
+
+// One point of the search space and what it measured
+struct TuneCandidate {
+    ForceSolver solver;
+    double theta;
+    int leafSize;
+    int threads;
+    double forceMs;      // prepareForces + force calculation, per step
+    double errorP99;     // relative force error against the direct sum
+
+    TuneCandidate();
+};
+
+// Picks solver, theta, leaf size and thread count for a Simulation by measuring
+// them on the current bodies (autotune = true).
+//
+// A tuning pass runs at the start of a step and leaves positions untouched:
+// 1. For each leaf size, build the tree once and walk only a sample of bodies at
+//    every theta. Keep the largest theta whose p99 force error (against a direct
+//    sum on the same sample) is within the budget.
+// 2. Time a full force calculation for each (leaf size, theta) pair at the maximum
+//    thread count.
+// 3. Time the fastest pair at every thread count (powers of two up to numThreads).
+// 4. For small N, time the direct sum as well; it has no error.
+// The fastest candidate within the budget is locked in. A leaf size that misses the
+// budget even at the smallest theta is dropped; if all do, the direct sum is used
+// whatever N is. Every `interval` steps the tuner compares the mean step cost since
+// the last pass with the cost it measured, and re-checks the error on a small
+// sample. If either has drifted (the bodies have clustered or spread out), it tunes
+// again.
+class Autotuner {
+public:
+    Autotuner();
+
+    bool enabled;
+    double errorBudget;   // p99 relative force error allowed
+    int interval;         // steps between drift checks
+    int samples;          // bodies used for error estimates
+    double drift;         // relative change of step cost that triggers a re-tune
+
+    // Tune now if it is the first step, or if a drift check at this step fails
+    void maybeTune(Simulation& sim, int stepNumber);
+
+    // Cost of the force part of a step, for drift detection
+    void recordStep(double forceMs);
+
+    const TuneCandidate& getChoice() const { return choice; }
+    int getNumTunes() const { return numTunes; }
+
+private:
+    bool tuned;
+    int numTunes;
+    int lastCheckStep;
+    double costSum;
+    int costSteps;
+    TuneCandidate choice;
+    int maxThreads;
+
+    // Run the search and apply the winner to sim
+    void tune(Simulation& sim, std::ostream& os);
+
+    // Cheap check of the current choice; true if a re-tune is needed
+    bool drifted(Simulation& sim);
+
+    // Milliseconds per prepareForces + force calculation with the current settings
+    static double timeForces(Simulation& sim);
+
+    static void apply(Simulation& sim, const TuneCandidate& candidate);
+};
+
+// "tree theta=0.5 leaf=4 threads=8"
+std::ostream& operator<<(std::ostream& os, const TuneCandidate& candidate);
+
+#endif // AUTOTUNER_H
@@ -2,18 +2,22 @@
 #define BODY_H
 
 #include "vec2.h"
+#include "vec3.h"
 
-class Body {
+// A point mass in D dimensions. The simulation drivers use the 2D Body; the 3D
+// instantiation (Body3) is used with the octree (see quadtree.h)
+template <int D>
+class BasicBody {
 public:
     int id;
     double mass;
-    Vec2 position;
-    Vec2 velocity;
-    Vec2 acceleration;
-    Vec2 force;
+    Vec<D> position;
+    Vec<D> velocity;
+    Vec<D> acceleration;
+    Vec<D> force;
 
-    Body();
-    Body(int id, double mass, const Vec2& position, const Vec2& velocity);
+    BasicBody();
+    BasicBody(int id, double mass, const Vec<D>& position, const Vec<D>& velocity);
 
     // Reset force accumulator for new calculation step
     void resetForce();
@@ -31,4 +35,7 @@ public:
     double getVisualRadius() const;
 };
 
+typedef BasicBody<2> Body;
+typedef BasicBody<3> Body3;
+
 #endif // BODY_H
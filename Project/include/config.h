@@ -20,6 +20,72 @@ public:
 
     // Parallel parameters
     int numThreads;
+    std::string threadAffinity; // none | compact | scatter | CPU list ("0,2,4-7")
+    bool hugePages;             // madvise body and tree arrays for transparent huge pages
+
+    // Solver parameters
+    std::string solver;         // tree | direct
+    std::string forceKernel;    // exact | rsqrt
+    int forceErrorInterval;     // steps between direct-sum error checks, 0 = off
+    int forceErrorSamples;      // bodies checked, 0 = all
+    int diagnosticsInterval;    // steps between energy/momentum diagnostics, 0 = off
+    bool deterministicReductions; // fixed-order sums, same bits for any thread/rank count
+    int leafSize;               // max bodies per quadtree leaf
+    bool treeRefit;             // refit the tree between steps instead of rebuilding
+    double treeRebuildFraction; // rebuild after this fraction of bodies changed cell
+    bool interactionLists;      // reuse each body group's interaction list across steps
+    int interactionListSteps;   // steps a list is reused before the group is walked again
+    double interactionListMargin; // lists are recorded with theta * (1 - margin)
+    int interactionGroupSize;   // max bodies per group
+
+    // Block (individual) timestep parameters
+    bool blockTimesteps;        // per-body power-of-two substeps of time_step
+    int blockMaxLevel;          // finest substep is time_step / 2^blockMaxLevel
+    double blockEta;            // accuracy parameter of the step criterion
+
+    // Periodic boundary parameters
+    double periodicBox;         // side of the periodic box centred on the origin, 0 = open
+
+    // Collision and merger parameters
+    bool mergers;               // merge bodies closer than the sum of their radii
+    double mergeRadius;         // fixed collision radius, 0 = scaled visual radius
+    double mergeRadiusScale;    // collision radius / sqrt(mass) when mergeRadius is 0
+
+    // Autotuner parameters
+    bool autotune;              // pick solver/theta/leaf size/threads at run time
+    double autotuneError;       // p99 relative force error budget
+    int autotuneInterval;       // steps between drift checks, 0 = tune once
+    int autotuneSamples;        // bodies used for error estimates
+
+    // Output parameters
+    std::string outputFormat;   // text | binary | compressed | none
+    double trajectoryError;     // compressed: largest position error, 0 = lossless
+
+    // In-situ analysis parameters (see analysis.h)
+    std::string analysis;       // comma list of density, radial, dispersion; empty = off
+    int analysisInterval;       // output steps between snapshots
+    int analysisGrid;           // map cells per side
+    int analysisBins;           // radial profile bins
+    double analysisExtent;      // map half-width and profile radius, 0 = from the bodies
+    std::string analysisPrefix; // output files are <prefix>_<name>.bin/.csv
+
+    // Profiling parameters
+    bool profile;               // per-phase timers and walk counters
+    std::string profileReport;  // report file, CSV if it ends in .csv, JSON otherwise
+
+    // MPI parameters
+    std::string mpiWireFormat;  // double | float32 | delta32
+    bool mpiSharedTree;         // one body array + tree per host in MPI shared windows
+
+    // Ensemble parameters (nbody_ensemble, see ensemble.h)
+    int ensembleSize;           // independent members made from this config
+    double ensemblePerturbation; // noise on members 1..K-1, relative to rms position/velocity
+    std::string ensembleSweep;  // "<key> <from> <to>": parameter varied linearly over members
+
+    // Synthetic bodies appended after the listed ones (see generator.h)
+    int generateCount;
+    std::string generateDistribution;   // disk | uniform | plummer
+    unsigned int generateSeed;
 
     // Bodies loaded from config
     std::vector<Body> bodies;
@@ -33,6 +99,9 @@ public:
     void print() const;
 
 private:
+    // Parse a boolean value (true/false, yes/no, on/off, 1/0)
+    bool parseBool(const std::string& value) const;
+
     // Helper to trim whitespace
     std::string trim(const std::string& str) const;
     
@@ -0,0 +1,46 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include "body.h"
+#include <ostream>
+#include <vector>
+
+// Conserved quantities of the bodies at one output step (diagnostics_interval = k).
+// Every field is a plain sum over bodies, so partial results of threads or MPI ranks
+// combine by adding them (see toArray / MPI_Allreduce).
+struct Diagnostics {
+    int step;                 // output step the state belongs to (0 = initial)
+    double mass;
+    double kinetic;           // sum m v^2 / 2
+    double potential;         // sum over pairs -G m_i m_j / sqrt(d^2 + eps^2), from
+                              // the force solver (tree-approximated for the tree)
+    Vec2 momentum;            // sum m v
+    double angularMomentum;   // sum m (x v_y - y v_x), about the origin
+    bool hasPotential;        // false in a periodic box (no periodic potential)
+
+    Diagnostics();
+
+    double energy() const { return kinetic + potential; }
+
+    // Component-wise sum (step and hasPotential are kept)
+    void add(const Diagnostics& other);
+
+    // Summed fields as a flat array, for MPI_Allreduce
+    static const int NUM_FIELDS = 6;
+    void toArray(double* fields) const;
+    void fromArray(const double* fields);
+};
+
+// Mass, kinetic energy and momenta of bodies[startIdx, endIdx) (potential left at 0)
+Diagnostics measureBodies(const Body* bodies, int startIdx, int endIdx);
+
+// One log line: energy, its drift since first, momentum and angular momentum
+void printDiagnostics(std::ostream& os, const Diagnostics& current, const Diagnostics& first);
+
+// Relative energy drift |E - E0| / |E0| (0 if E0 is 0)
+double energyDrift(const Diagnostics& current, const Diagnostics& first);
+
+// Largest energy drift over a run, against its first record
+double maxEnergyDrift(const std::vector<Diagnostics>& records);
+
+#endif // DIAGNOSTICS_H
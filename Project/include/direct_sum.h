@@ -0,0 +1,91 @@
+#ifndef DIRECT_SUM_H
+#define DIRECT_SUM_H
+
+#include "body.h"
+#include "quadtree.h"
+#include <string>
+#include <vector>
+
+// Force solver used by Simulation
+enum class ForceSolver {
+    Tree,    // Barnes-Hut quadtree, O(N log N)
+    Direct   // exact pairwise sum, O(N^2); faster than the tree for small N
+};
+
+// Parse a solver name ("tree", "direct")
+bool parseForceSolver(const std::string& name, ForceSolver& solver);
+
+const char* forceSolverName(ForceSolver solver);
+
+// Exact O(N^2) pairwise forces, the reference for the tree's approximation error.
+// Positions and masses are copied into structure-of-arrays form by load(). The
+// kernel then runs over blocks of sources (kept in L1) against fixed-size tiles of
+// targets. The inner loop runs over the targets of a tile, so it has no
+// loop-carried reduction and the compiler vectorises it without -ffast-math. Each
+// target sums its sources in index order, so results do not depend on the vector
+// width, the tile size or how the targets are split across threads.
+// Uses the same softened force law as the tree walk:
+//   F = G * m_i * m_j * d / (|d|^2 + softening^2)^(3/2)
+class DirectSum {
+public:
+    DirectSum();
+
+    // Periodic box (nullptr or a disabled box for open boundaries). In a periodic
+    // box each pair interacts through its nearest image plus the Ewald correction,
+    // in a scalar loop
+    void setPeriodicBox(const PeriodicBox* box) { periodic = box; }
+
+    // Keep the sources in storage (3 * numBodies doubles owned by someone else,
+    // e.g. an MPI shared window) instead of private memory. One process load()s
+    // them, every process attached to the same block reads them
+    void attach(double* storage, int numBodies);
+
+    // Snapshot positions and masses of the source bodies
+    void load(const Body* bodies, int numBodies);
+
+    // Set bodies[i].force for i in [startIdx, endIdx) from all loaded sources.
+    // bodies must be the array passed to load() (a body does not act on itself)
+    void calculateForces(Body* bodies, int startIdx, int endIdx, double G, double softening,
+                         WalkStats* stats = nullptr) const;
+
+    // Forces on the loaded bodies listed in targets, written to forces[k]
+    void calculateForces(const int* targets, int count, Vec2* forces, double G, double softening) const;
+
+    // Sum of m_i * phi_i over the loaded bodies [startIdx, endIdx), phi_i being the
+    // exact softened potential of all other sources (open boundaries)
+    double calculatePotential(int startIdx, int endIdx, double G, double softening) const;
+
+    int getNumBodies() const { return numSources; }
+
+private:
+    const PeriodicBox* periodic;
+
+    // Structure-of-arrays copy of the sources: x, y and mass, numSources each, in
+    // owned or in the attached block
+    std::vector<double> owned;
+    double* external;
+    int numSources;
+
+    const double* x() const { return external ? external : owned.data(); }
+    const double* y() const { return x() + numSources; }
+    const double* mass() const { return x() + 2 * static_cast<size_t>(numSources); }
+};
+
+// Distribution of the relative force error |F - F_ref| / |F_ref| over a set of bodies
+struct ForceErrorStats {
+    int samples;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+
+    ForceErrorStats() : samples(0), p50(0.0), p90(0.0), p99(0.0), max(0.0) {}
+};
+
+// count evenly spaced indices out of numBodies (all of them if count is 0 or >= numBodies)
+void sampleBodies(int numBodies, int count, std::vector<int>& targets);
+
+// Percentiles of the relative error of forces[k] against reference[k]
+ForceErrorStats computeForceError(const Vec2* forces, const Vec2* reference, int count);
+
+#endif // DIRECT_SUM_H
@@ -0,0 +1,88 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "body.h"
+#include "config.h"
+#include "diagnostics.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+// One independent simulation of an ensemble
+struct EnsembleMember {
+    std::string source;         // config file it came from
+    int index;                  // member number within that file
+    int numSteps;
+    double timeStep;
+    double softening;
+    double gravitationalConstant;
+    std::vector<Body> bodies;   // initial state, final state after Ensemble::run
+    Diagnostics initial;        // energy and momenta before and after the run
+    Diagnostics final;
+
+    EnsembleMember();
+};
+
+// Many small, independent simulations run side by side (nbody_ensemble).
+//
+// A 10-body system is too small to split across threads, so instead of
+// parallelising inside one simulation the ensemble runs many of them at once.
+// Members with the same body count and step count are packed into batches of
+// LANES members, stored structure-of-arrays by body and then by member:
+// x[i * LANES + k] is body i of member k. The direct-sum kernel runs the members of
+// a batch in its innermost loop, so it vectorises across the ensemble with no
+// reduction, however few bodies each member has. Each lane keeps its own G,
+// softening and time step, so parameter sweeps batch as well. Partial batches are
+// padded with massless lanes whose results are discarded.
+// Batches are split across threads in contiguous ranges. Every member does exactly
+// the arithmetic of nbody_sim with solver = direct, so its final state is the same
+// bit for bit, whatever the batch, lane or thread it ran on.
+class Ensemble {
+public:
+    // Members per batch (the vectorised loop's trip count)
+    static const int LANES = 8;
+
+    Ensemble();
+
+    // Add the members described by config: ensemble_size copies, with
+    // ensemble_perturbation and ensemble_sweep applied. Returns false (with a
+    // message on std::cerr) if the sweep cannot be parsed
+    bool addConfig(const Config& config, const std::string& source);
+
+    // Run every member for its number of steps on numThreads threads
+    void run(int numThreads);
+
+    // Members in the order they were added
+    const std::vector<EnsembleMember>& getMembers() const { return members; }
+
+    int getNumBatches() const { return static_cast<int>(batches.size()); }
+
+    // Simulation steps and body steps of all members together
+    long long getMemberSteps() const;
+    long long getBodySteps() const;
+
+    // One line per member (up to maxListed) with its parameters and energy drift
+    void printSummary(std::ostream& os, size_t maxListed) const;
+
+    // Final states as "member k source" headers followed by "id mass x y vx vy" lines
+    bool writeFinalStates(const std::string& filename) const;
+
+private:
+    struct Batch {
+        int numBodies;
+        int numSteps;
+        std::vector<int> members;   // member index of each used lane
+        std::vector<double> x, y, vx, vy, mass;
+        double g[LANES];
+        double eps2[LANES];
+        double dt[LANES];
+    };
+
+    std::vector<EnsembleMember> members;
+    std::vector<Batch> batches;
+
+    void buildBatches();
+    void storeBatch(const Batch& batch);
+};
+
+#endif // ENSEMBLE_H
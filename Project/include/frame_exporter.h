@@ -0,0 +1,82 @@
+#ifndef FRAME_EXPORTER_H
+#define FRAME_EXPORTER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Image files written by the headless export: PNG (libpng) or binary PPM, which is
+// uncompressed RGB and cheap to encode. Both are read by ffmpeg as an image sequence.
+enum class ImageFormat {
+    Png,
+    Ppm
+};
+
+// "png" or "ppm"; false if the name is unknown
+bool parseImageFormat(const std::string& name, ImageFormat& format);
+const char* imageExtension(ImageFormat format);
+
+// Pool of worker threads encoding RGBA frames to <prefix>_<index>.<ext>, index with
+// six digits. Frames are handed over by move and their buffers are recycled, so the
+// render loop neither copies nor allocates per frame. It only waits if maxPending
+// frames are still queued or being encoded.
+class FrameEncoder {
+public:
+    FrameEncoder();
+    ~FrameEncoder();
+
+    bool start(const std::string& prefix, ImageFormat format, int width, int height,
+               int numThreads, int maxPending);
+
+    // A buffer from an already encoded frame, or an empty one
+    std::vector<uint8_t> acquireBuffer();
+
+    // Queue frame index, RGBA with the bottom row first as read from OpenGL
+    void submit(int64_t index, std::vector<uint8_t>&& pixels);
+
+    // Encode the remaining frames and stop the workers. False if any file failed
+    bool finish();
+
+    int64_t getFramesWritten() const { return framesWritten; }
+    int64_t getBytesWritten() const { return bytesWritten; }
+    int getMaxQueued() const { return maxQueued; }
+
+    // Time submit() spent waiting for a free slot, in ms
+    double getStallMs() const { return stallMs; }
+
+private:
+    struct Job {
+        int64_t index;
+        std::vector<uint8_t> pixels;
+    };
+
+    std::string prefix;
+    ImageFormat format;
+    int width;
+    int height;
+    int maxPending;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable slotAvailable;
+    std::deque<Job> queue;
+    std::vector<std::vector<uint8_t>> freeBuffers;
+    std::vector<std::thread> workers;
+    int inFlight;         // queued plus being encoded
+    bool stopping;
+    bool failed;
+
+    int64_t framesWritten;
+    int64_t bytesWritten;
+    int maxQueued;
+    double stallMs;
+
+    void workerLoop();
+    bool encode(const Job& job, int64_t& bytes, std::vector<uint8_t>& row) const;
+};
+
+#endif // FRAME_EXPORTER_H
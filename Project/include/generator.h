@@ -0,0 +1,17 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include "body.h"
+#include <string>
+#include <vector>
+
+// Synthetic initial conditions for benchmarks and large runs
+// distribution:
+//   "disk"    - rotating disk of radius `radius`, bodies on circular orbits
+//   "uniform" - uniform square of half-width `radius`, at rest
+//   "plummer" - Plummer sphere projected to 2D with scale `radius / 10`, small random velocities
+// Ids start at firstId. Same seed, same bodies.
+bool generateBodies(std::vector<Body>& bodies, int count, const std::string& distribution,
+                    unsigned int seed, double G, double radius = 300.0, int firstId = 1);
+
+#endif // GENERATOR_H
@@ -0,0 +1,121 @@
+#ifndef INTERACTION_CACHE_H
+#define INTERACTION_CACHE_H
+
+#include "body.h"
+#include "quadtree.h"
+#include "profiler.h"
+#include "affinity.h"
+#include <ostream>
+#include <vector>
+
+// Cached interaction lists (interaction_lists = true, tree solver with tree_refit).
+//
+// The bodies are split into groups: the largest subtrees of the tree with at most
+// groupSize bodies. A group walk records, for the whole group at once, the nodes
+// accepted as a single mass (far list) and the leaves whose bodies are summed one
+// by one (near list). A node is accepted when its width is below
+// theta * (1 - margin) times the distance from its centre of mass to the group's
+// cell, so it passes the ordinary theta test for any body of the group.
+//
+// Later steps evaluate the list against the refitted node moments without walking.
+// Refits keep the cells, so the far and near entries still cover every body
+// exactly once, whichever cell each body has moved to. Before the list is used,
+// each far node is tested again at its current centre of mass with theta itself.
+// The margin is the room the centres of mass have to move before that test fails.
+// A group is walked again when the test fails, after maxReuse steps, or when its
+// sources no longer hold the tree's total mass: a refit that drops an emptied
+// subtree puts later arrivals in cells the list does not know. The groups are
+// formed again after a rebuild, or when they no longer hold every body.
+//
+// Interactions are summed in double with the kernel's formula, so with mixed
+// precision the cached forces do not use the float far-field path.
+class InteractionCache {
+public:
+    InteractionCache();
+
+    bool enabled;
+    int maxReuse;       // steps a list is used before the group is walked again
+    double margin;      // lists are recorded with theta * (1 - margin)
+    int groupSize;      // maximum bodies per group when the groups are formed
+
+    // Forces on all bodies from tree, which must be refitted (or built) for
+    // their current positions, on numThreads threads placed by placement. Walk
+    // counters and force times go to the profiler's thread slots when it is enabled
+    void calculateForces(const QuadTree& tree, std::vector<Body>& bodies,
+                         double theta, double G, double softening, ForceKernel kernel,
+                         int numThreads, const ThreadPlacement& placement, Profiler& profiler);
+
+    // Groups walked and groups evaluated from an existing list, all calls
+    long long getNumWalks() const { return numWalks; }
+    long long getNumReuses() const { return numReuses; }
+
+    // Lists dropped because a far node failed the theta test or bodies were missing
+    long long getNumInvalidated() const { return numInvalidated; }
+
+    // Times the groups were formed
+    long long getNumRegroups() const { return numRegroups; }
+
+    // Nodes visited by group walks, and nodes the reused lists' walks visited when
+    // they were recorded (the traversal the cache saved)
+    long long getWalkVisits() const { return walkVisits; }
+    long long getSkippedVisits() const { return skippedVisits; }
+
+    // One line with the counters above
+    void printSummary(std::ostream& os) const;
+
+private:
+    struct Group {
+        int node;               // root of the group's subtree
+        std::vector<int> far;   // nodes used as a single mass
+        std::vector<int> near;  // leaves (or subtrees split since) summed body by body
+        long long visits;       // nodes visited by the walk that recorded the lists
+        int age;                // steps evaluated from the lists, -1 = not recorded
+
+        Group() : node(0), visits(0), age(-1) {}
+    };
+
+    // Per-thread counters, summed after the threads join
+    struct Counters {
+        long long walks;
+        long long reuses;
+        long long invalidated;
+        long long walkVisits;
+        long long skippedVisits;
+        long long bodies;       // bodies of the evaluated groups
+
+        Counters() : walks(0), reuses(0), invalidated(0), walkVisits(0), skippedVisits(0), bodies(0) {}
+    };
+
+    std::vector<Group> groups;
+    std::vector<int> subtreeCount;
+
+    // Tree state and parameters the groups were formed for
+    int treeBuilds;
+    double listTheta;
+    int listGroupSize;
+
+    long long numWalks;
+    long long numReuses;
+    long long numInvalidated;
+    long long walkVisits;
+    long long skippedVisits;
+    long long numRegroups;
+
+    // Split the tree into groups, none of them recorded yet
+    void formGroups(const QuadTree& tree);
+
+    // Forces on all groups on numThreads threads; returns the number of bodies covered
+    long long evaluateGroups(const QuadTree& tree, std::vector<Body>& bodies,
+                             double theta, double G, double softening, ForceKernel kernel,
+                             int numThreads, const ThreadPlacement& placement, Profiler& profiler);
+
+    // Forces on the bodies of one group, walking it first if needed
+    void evaluateGroup(const QuadTree& tree, Group& group, std::vector<Body>& bodies,
+                       double theta, double G, double softening, ForceKernel kernel,
+                       WalkStats* stats, Counters& counters);
+
+    // Record the far and near lists of a group with the opening angle recordTheta
+    void recordGroup(const QuadTree& tree, Group& group, double recordTheta, double softening);
+};
+
+#endif // INTERACTION_CACHE_H
@@ -0,0 +1,55 @@
+#ifndef MERGER_H
+#define MERGER_H
+
+#include "body.h"
+#include "quadtree.h"
+#include <vector>
+
+// Collisions and mergers (mergers = true).
+// Two bodies collide when their distance is below the sum of their radii. The
+// radius of a body is merge_radius if that is set, otherwise merge_radius_scale
+// times its visual radius (sqrt(mass)). Colliding pairs are found with the tree of
+// the current positions: each body queries the circle of twice its radius and
+// keeps only partners that are smaller (or as large with a higher index), so every
+// pair is found once, by its larger body. Pairs are joined into groups (a chain a-b, b-c is one group) and each
+// group becomes one body: the heaviest member (the lowest index on ties) keeps its
+// id and place in the array and takes the total mass, the centre of mass position
+// and the centre of mass velocity. Mass and momentum are conserved exactly up to
+// rounding; kinetic energy is not (the collision is perfectly inelastic). The other
+// members are removed and the array is compacted in order (in parallel, from a prefix
+// sum of the survivor counts), so the result does not depend on the thread count.
+// In a periodic box (the tree's) separations and the centre of mass use the
+// nearest images. Only bodies stored in the tree are found. With leaf size 1 the tree cannot store
+// two bodies at exactly the same position (the force walk misses them as well).
+class Merger {
+public:
+    Merger();
+
+    bool enabled;
+    double radius;        // fixed collision radius (0 = use radiusScale)
+    double radiusScale;   // collision radius as a multiple of the visual radius
+
+    // Merge the colliding bodies in place. tree must hold the current positions of
+    // bodies (it is not updated). Returns the number of bodies removed
+    int apply(std::vector<Body>& bodies, const QuadTree& tree, int numThreads);
+
+    // Collision radius of a body
+    double bodyRadius(const Body& body) const;
+
+    long long getNumRemoved() const { return numRemoved; }
+    long long getNumEvents() const { return numEvents; }
+
+private:
+    long long numRemoved;   // bodies absorbed, all calls
+    long long numEvents;    // groups merged, all calls
+
+    // Scratch, kept between calls
+    std::vector<int> parent;
+    std::vector<int> survivor;
+    std::vector<Body> compacted;
+    std::vector<std::vector<int>> threadPairs;
+
+    int findRoot(int i);
+};
+
+#endif // MERGER_H
@@ -0,0 +1,89 @@
+#ifndef MPI_EXCHANGE_H
+#define MPI_EXCHANGE_H
+
+#include <mpi.h>
+#include "body.h"
+#include <vector>
+#include <string>
+#include <cstddef>
+
+// Wire format used for the per-step position exchange between ranks.
+//
+// Error introduced on the positions a rank receives for bodies it does not own
+// (owners always integrate their own bodies in full double precision, so the
+// error never accumulates across steps):
+// - Double:  exact, 16 bytes per body per step
+// - Float32: |error| <= 2^-24 * |x| per component (~6e-8 relative); at |x| = 350
+//            that is ~2e-5 length units, giving a relative force error of about
+//            2e-5 / r for a pair at distance r. 8 bytes per body per step
+// - Delta32: float deltas against the last exchanged position;
+//            |error| <= 2^-24 * |x_step| where x_step is the distance moved since the
+//            last exchange (v * dt, ~0.02 for our config -> ~1e-9). 8 bytes per body
+enum class WireFormat {
+    Double,
+    Float32,
+    Delta32
+};
+
+// Parse a wire format name ("double", "float32", "delta32")
+bool parseWireFormat(const std::string& name, WireFormat& format);
+
+// Human readable name of a wire format
+const char* wireFormatName(WireFormat format);
+
+// Contiguous block decomposition of n items over parts (same split used everywhere)
+void blockRange(int n, int parts, int index, int& startIdx, int& endIdx);
+
+// Broadcast a string from root (resizes it on the other ranks)
+void broadcastString(std::string& value, int root, MPI_Comm comm);
+
+// Datatype selecting id, mass, position and velocity of one Body.
+// Extent is sizeof(Body), so a count of N addresses a whole std::vector<Body>.
+// Used once at start-up: id and mass never change afterwards.
+MPI_Datatype createBodyInitType();
+
+// Datatype selecting only Body::position, extent sizeof(Body)
+MPI_Datatype createBodyPositionType();
+
+// Per-step exchange of body positions.
+// Every rank integrates its own block of bodies; exchange() then makes the
+// updated positions of all blocks visible on every rank.
+class PositionExchange {
+public:
+    PositionExchange(MPI_Comm comm, const std::vector<Body>& bodies, WireFormat format);
+    ~PositionExchange();
+
+    PositionExchange(const PositionExchange&) = delete;
+    PositionExchange& operator=(const PositionExchange&) = delete;
+
+    // Allgather positions of every rank's block into bodies
+    void exchange(std::vector<Body>& bodies);
+
+    WireFormat getFormat() const { return format; }
+
+    // Payload bytes sent per body per step
+    size_t bytesPerBody() const;
+
+private:
+    MPI_Comm comm;
+    int rank;
+    int size;
+    int numBodies;
+    int startIdx;
+    int endIdx;
+    WireFormat format;
+
+    // Receive counts and displacements in bodies (Double) or floats (Float32/Delta32)
+    std::vector<int> recvCounts;
+    std::vector<int> displs;
+
+    MPI_Datatype positionType;
+
+    // Float payload for the compressed formats
+    std::vector<float> wireData;
+
+    // Delta32: last exchanged (decoded) position of every body, identical on all ranks
+    std::vector<Vec2> reference;
+};
+
+#endif // MPI_EXCHANGE_H
@@ -0,0 +1,47 @@
+#ifndef MPI_IO_H
+#define MPI_IO_H
+
+#include <mpi.h>
+#include "body.h"
+#include <string>
+#include <vector>
+
+// Parallel writer for the binary trajectory format (see trajectory.h).
+// Every rank writes the positions of its own block of bodies straight into the
+// shared file with MPI_File_write_at_all, so output bandwidth scales with the
+// number of ranks instead of funnelling through rank 0.
+class MpiTrajectoryWriter {
+public:
+    explicit MpiTrajectoryWriter(MPI_Comm comm);
+    ~MpiTrajectoryWriter();
+
+    MpiTrajectoryWriter(const MpiTrajectoryWriter&) = delete;
+    MpiTrajectoryWriter& operator=(const MpiTrajectoryWriter&) = delete;
+
+    // Collective: create/truncate the file and write header and id table.
+    // This rank writes bodies [startIdx, endIdx) of every frame. Returns false on
+    // every rank if any rank failed to open the file
+    bool open(const std::string& filename, const Body* bodies, int numBodies,
+              int startIdx, int endIdx);
+
+    // Collective: write this rank's block of the next frame
+    void writeFrame(int stepNumber, const Body* bodies);
+
+    // Collective
+    void close();
+
+    bool isOpen() const { return opened; }
+
+private:
+    MPI_Comm comm;
+    MPI_File fileHandle;
+    bool opened;
+    int rank;
+    int numBodies;
+    int startIdx;
+    int endIdx;
+    long long frameIndex;
+    std::vector<char> buffer;
+};
+
+#endif // MPI_IO_H
@@ -0,0 +1,123 @@
+#ifndef MPI_SHARED_H
+#define MPI_SHARED_H
+
+#include <mpi.h>
+#include "body.h"
+#include "quadtree.h"
+#include "direct_sum.h"
+#include <vector>
+#include <cstddef>
+
+// Node-level shared storage for nbody_mpi (mpi_shared_tree = true).
+// All ranks on one host share a single body array and a single flattened quadtree
+// allocated with MPI_Win_allocate_shared, instead of each rank holding its own
+// full copy. The node leader (lowest rank on the host) builds and refits the tree
+// directly in the windows (nodes, and the bodies of multi-body leaves with
+// leaf_size > 1); every rank on the host walks it in place. The direct solver's
+// source arrays live in a window as well and are loaded once per host.
+//
+// Work is split per host first (contiguous block per host, in leader order) and
+// then per rank inside the host, so a host's bodies form one contiguous block that
+// the leaders exchange with MPI_Allgatherv.
+class NodeSharedState {
+public:
+    NodeSharedState(MPI_Comm world, int numBodies);
+    ~NodeSharedState();
+
+    NodeSharedState(const NodeSharedState&) = delete;
+    NodeSharedState& operator=(const NodeSharedState&) = delete;
+
+    Body* getBodies() { return bodies; }
+    const QuadTreeNode* getNodes() const { return nodes; }
+    int getNumNodes() const { return numNodes; }
+
+    // Bodies of the tree's multi-body leaves; nullptr if every leaf holds at most one
+    const LeafBody* getLeafBodies() const { return numLeafBodies > 0 ? leafBodies : nullptr; }
+
+    bool isLeader() const { return nodeRank == 0; }
+    int getNumHosts() const { return numHosts; }
+    int getRanksPerHost() const { return nodeSize; }
+
+    // Bodies this rank computes and integrates
+    int getStartIdx() const { return startIdx; }
+    int getEndIdx() const { return endIdx; }
+
+    // Collective on all ranks: world rank 0 passes the bodies, the others pass
+    // nullptr. The bodies reach the window of every host through the leaders, so
+    // the other ranks never hold a copy
+    void loadBodies(const Body* source);
+
+    // Collective on the host: the leader's tree keeps its nodes and leaf bodies in
+    // the windows from now on (tree is ignored on the other ranks)
+    void shareTree(QuadTree& tree);
+
+    // Collective on the host, after the leader built or refitted the shared tree
+    // (the other ranks pass nullptr). A pool that spilled out of its window grows
+    // the windows collectively and moves back in; otherwise nothing is copied. On
+    // return every rank sees the tree through getNodes() and getLeafBodies()
+    void publishTree(QuadTree* tree);
+
+    // Collective on the host: directSum keeps its sources in a window on every rank
+    // of the host. Only the leader load()s it; synchronize() before reading
+    void shareDirectSum(DirectSum& directSum);
+
+    // Collective on all ranks: leaders exchange the positions of their host's block,
+    // then the host is synchronised so every rank sees all positions
+    void exchangePositions();
+
+    // Make local writes to the windows visible to the other ranks of the host
+    void synchronize();
+
+    // Bytes of window memory held by this host
+    size_t sharedBytes() const;
+
+private:
+    MPI_Comm nodeComm;
+    MPI_Comm leaderComm;
+    int nodeRank;
+    int nodeSize;
+    int hostIndex;
+    int numHosts;
+
+    int numBodies;
+    int hostStartIdx;
+    int hostEndIdx;
+    int startIdx;
+    int endIdx;
+
+    MPI_Win bodyWindow;
+    Body* bodies;
+
+    MPI_Win treeWindow;
+    QuadTreeNode* nodes;
+    int numNodes;
+    int nodeCapacity;
+
+    MPI_Win leafWindow;
+    LeafBody* leafBodies;
+    int numLeafBodies;
+    int leafCapacity;
+
+    MPI_Win sourceWindow;
+    double* sources;
+
+    // Leader-only: per host block counts/displacements in bodies
+    std::vector<int> hostCounts;
+    std::vector<int> hostDispls;
+    MPI_Datatype positionType;
+
+    void allocateTreeWindow(int capacity);
+    void freeTreeWindow();
+    void allocateLeafWindow(int capacity);
+    void freeLeafWindow();
+
+    // Window of bytes owned by the leader, mapped on every rank of the host and
+    // locked for the run
+    void* allocateWindow(size_t bytes, int unit, MPI_Win& window);
+    void freeWindow(MPI_Win& window);
+
+    // Point the leader's tree pools at the current windows
+    void attachTree(QuadTree& tree);
+};
+
+#endif // MPI_SHARED_H
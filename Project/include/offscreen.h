@@ -0,0 +1,68 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <cstdint>
+#include <vector>
+
+// Desktop OpenGL context on an EGL pbuffer, for rendering without a window or a
+// display server. The first EGL device is tried first (a GPU, or Mesa's software
+// renderer on machines without one), then the default display.
+class OffscreenContext {
+public:
+    OffscreenContext();
+    ~OffscreenContext();
+
+    // Create a width x height pbuffer and make its context current
+    bool create(int width, int height);
+    void destroy();
+    bool isValid() const { return context != EGL_NO_CONTEXT; }
+
+private:
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+
+    bool createOn(EGLDisplay candidate, int width, int height);
+};
+
+// Asynchronous glReadPixels through a ring of pixel buffer objects.
+//
+// read() starts the copy of the framebuffer into the next buffer and returns without
+// waiting for it. A buffer is only mapped when the ring wraps around to it, ringSize
+// frames later, by which time the GPU has normally finished the copy.
+class PixelReadback {
+public:
+    PixelReadback();
+    ~PixelReadback();
+
+    bool initialize(int width, int height, int ringSize);
+    void release();
+
+    // Start reading the current framebuffer (RGBA, bottom row first) as frame tag.
+    // When the ring was full, the oldest frame is copied into pixels first and
+    // true is returned with its tag in readyTag
+    bool read(int64_t tag, std::vector<uint8_t>& pixels, int64_t& readyTag);
+
+    // Copy out the oldest pending frame, waiting for it. False when none is pending
+    bool drain(std::vector<uint8_t>& pixels, int64_t& readyTag);
+
+    // Frames whose copy had not finished when they were mapped
+    int64_t getSyncWaits() const { return syncWaits; }
+
+private:
+    int width;
+    int height;
+    int ringSize;
+    int head;             // slot read() fills next
+    int pending;          // slots holding frames not yet copied out
+    int64_t syncWaits;
+    std::vector<GLuint> buffers;
+    std::vector<GLsync> fences;
+    std::vector<int64_t> tags;
+
+    bool collect(std::vector<uint8_t>& pixels, int64_t& readyTag);
+};
+
+#endif // OFFSCREEN_H
@@ -0,0 +1,73 @@
+#ifndef PERIODIC_H
+#define PERIODIC_H
+
+#include "vec2.h"
+#include <cmath>
+#include <vector>
+
+// Periodic square box [-size/2, size/2)^2 (periodic_box = size, 0 = open boundaries).
+//
+// A body feels every periodic image of every other body, against a uniform
+// background of the same mean density (otherwise the sum has no finite limit).
+// The force is split into the nearest image, softened as usual, plus the
+// contribution of all other images and the background. That second part is a
+// smooth function of the minimum-image separation d alone. It is precomputed
+// once by Ewald summation on a grid over one quadrant of the box, and looked up
+// with bilinear interpolation:
+//   F = G m_i m_j * (d / (|d|^2 + eps^2)^(3/2) + ewaldCorrection(d))
+// The correction is odd in each component, so only |d.x|, |d.y| are tabulated.
+// It scales as 1 / size^2, so one unit-box table serves any box size.
+class PeriodicBox {
+public:
+    PeriodicBox();
+
+    // Set the box size and build the correction table (size <= 0 disables it)
+    void setSize(double size);
+
+    bool isEnabled() const { return size > 0.0; }
+    double getSize() const { return size; }
+
+    // Separation d of two points in the box mapped to its nearest image, each
+    // component in [-size/2, size/2]. The points being in the box, one shift is
+    // enough (cheaper than rounding, which is a libm call on baseline x86-64)
+    Vec2 minimumImage(const Vec2& d) const {
+        return Vec2(nearestImage(d.x), nearestImage(d.y));
+    }
+
+    // Position mapped into the box [-size/2, size/2)
+    Vec2 wrap(const Vec2& position) const {
+        Vec2 wrapped(position.x - size * std::floor(position.x * invSize + 0.5),
+                     position.y - size * std::floor(position.y * invSize + 0.5));
+        // Rounding can land a point exactly on the upper face
+        if (wrapped.x >= 0.5 * size) wrapped.x -= size;
+        if (wrapped.y >= 0.5 * size) wrapped.y -= size;
+        return wrapped;
+    }
+
+    // Field of all images but the nearest one (and the background) at minimum-image
+    // separation d, per unit source mass
+    Vec2 ewaldCorrection(const Vec2& d) const;
+
+    // The same by direct Ewald summation, for any d (used to fill the table)
+    static Vec2 ewaldCorrectionExact(const Vec2& d, double size);
+
+    // Grid intervals per half box side
+    static const int TABLE_CELLS = 64;
+
+private:
+    double nearestImage(double x) const {
+        return (x > halfSize) ? x - size : ((x < -halfSize) ? x + size : x);
+    }
+
+    double size;
+    double halfSize;
+    double invSize;
+    double tableScale;   // grid cells per unit length
+    double fieldScale;   // 1 / size^2
+
+    // Unit-box correction at (i, j) * 0.5 / TABLE_CELLS, i and j in [0, TABLE_CELLS],
+    // x and y interleaved so one lookup touches two cache lines
+    std::vector<double> table;
+};
+
+#endif // PERIODIC_H
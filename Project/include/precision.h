@@ -0,0 +1,36 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+// Precision policy of the tree walk, selected at compile time.
+// Positions, centres of mass, the opening test and the force accumulators are
+// always double, and so is every interaction with a single body. Far is the scalar
+// type of far-field node interactions (a node approximated by its centre of mass).
+// With a narrower Far these are not applied as the walk finds them: they are
+// collected per target and evaluated in one vectorised loop, which is where the
+// wider SIMD lanes pay off. The sum over them is taken in double.
+template <typename FarScalar>
+struct PrecisionPolicy {
+    typedef FarScalar Far;
+    static const bool BatchFarField = sizeof(FarScalar) < sizeof(double);
+};
+
+typedef PrecisionPolicy<double> DoublePrecision;
+typedef PrecisionPolicy<float> MixedPrecision;
+
+// make PRECISION=mixed defines NBODY_MIXED_PRECISION
+#ifdef NBODY_MIXED_PRECISION
+typedef MixedPrecision ForcePrecision;
+#else
+typedef DoublePrecision ForcePrecision;
+#endif
+
+// "double" or "mixed", for logs and benchmark reports
+inline const char* forcePrecisionName() {
+#ifdef NBODY_MIXED_PRECISION
+    return "mixed";
+#else
+    return "double";
+#endif
+}
+
+#endif // PRECISION_H
@@ -0,0 +1,126 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "quadtree.h"
+#include "diagnostics.h"
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Phases of one simulation step
+enum class Phase {
+    TreeBuild,
+    ForceWalk,
+    Integration,
+    Output,
+    Communication,  // MPI collectives and shared-window synchronisation
+    Merge,          // collision search and mergers (mergers = true)
+    Diagnostics     // energy and momentum sums (diagnostics_interval > 0)
+};
+
+const int NUM_PHASES = 7;
+
+// Short name used in reports ("tree_build", "force_walk", ...)
+const char* phaseName(Phase phase);
+
+// Force-walk time and work of one worker thread in one step
+struct ThreadRecord {
+    double forceMs;
+    WalkStats walk;
+
+    ThreadRecord() : forceMs(0.0) {}
+};
+
+// Everything measured in one step
+struct StepRecord {
+    int step;
+    double phaseMs[NUM_PHASES];
+    WalkStats walk;
+    int treeDepth;
+    int treeNodes;
+    long peakRssKiB;  // process high-water mark at the end of the step
+    std::vector<ThreadRecord> threads;
+
+    StepRecord();
+};
+
+// Per-step phase timers and counters for one process.
+// All methods except thread() are called from the driving thread only; each worker
+// writes to its own ThreadRecord slot. When disabled, ScopedTimer does not read the
+// clock and callers pass no WalkStats to the tree walk, so the cost is one branch
+// per phase.
+class Profiler {
+public:
+    Profiler();
+
+    void setEnabled(bool enabled) { this->enabled = enabled; }
+    bool isEnabled() const { return enabled; }
+
+    // Start a record for a step with the given number of worker threads
+    void beginStep(int step, int numThreads);
+
+    // Fold the per-thread counters into the step totals
+    void endStep();
+
+    // Add time to a phase of the current (or last finished) step
+    void addPhaseTime(Phase phase, double ms);
+
+    void setTreeStats(int depth, int numNodes);
+
+    // Slot of worker thread t in the current step
+    ThreadRecord& thread(int t) { return steps.back().threads[t]; }
+
+    const std::vector<StepRecord>& getSteps() const { return steps; }
+
+    // Sum of all steps (tree depth and peak RSS are the maximum, tree nodes the mean)
+    StepRecord totals() const;
+
+    // Human readable phase breakdown
+    void printSummary(std::ostream& os) const;
+
+    // Serialisation for gathering records across MPI ranks (thread slots are summed)
+    std::vector<double> flatten() const;
+    static std::vector<StepRecord> unflatten(const std::vector<double>& data);
+    static const int FLAT_FIELDS = NUM_PHASES + 7;
+
+    // Write a report for one or more ranks; CSV if filename ends in ".csv", JSON otherwise.
+    // diagnostics (global, not per rank) go into a "diagnostics" list in JSON and
+    // into extra columns of the step that produced the state in CSV
+    static bool writeReport(const std::string& filename,
+                            const std::vector<std::vector<StepRecord>>& ranks,
+                            const std::vector<Diagnostics>& diagnostics = std::vector<Diagnostics>());
+
+private:
+    bool enabled;
+    std::vector<StepRecord> steps;
+};
+
+// Adds the lifetime of the timer to a phase of the profiler
+class ScopedTimer {
+public:
+    ScopedTimer(Profiler& profiler, Phase phase)
+        : profiler(profiler), phase(phase), active(profiler.isEnabled()) {
+        if (active) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~ScopedTimer() {
+        if (active) {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            profiler.addPhaseTime(phase, elapsed.count());
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Profiler& profiler;
+    Phase phase;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif // PROFILER_H
@@ -2,82 +2,350 @@
 #define QUADTREE_H
 
 #include "vec2.h"
+#include "vec3.h"
 #include "body.h"
+#include "precision.h"
+#include "periodic.h"
 #include <vector>
+#include <string>
 #include <memory>
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <utility>
 
-// Axis-Aligned Bounding Box for quadtree regions
-class AABB {
+// The tree is generic in the dimension D: a cell has 2^D children, a quadtree in
+// 2D and an octree in 3D. QuadTree, AABB, QuadTreeNode and LeafBody name the 2D
+// instantiations used by the simulation; Octree and Body3 are the 3D ones. Both are
+// compiled explicitly in quadtree.cpp. The periodic box is 2D only.
+
+// Axis-aligned bounding cube of a tree cell
+template <int D>
+class BoundingBox {
 public:
-    Vec2 center;
+    static const int NUM_CHILDREN = 1 << D;
+
+    Vec<D> center;
     double halfSize;
 
-    AABB();
-    AABB(const Vec2& center, double halfSize);
+    BoundingBox();
+    BoundingBox(const Vec<D>& center, double halfSize);
 
-    bool contains(const Vec2& point) const;
-    
-    // Get quadrant index (0=NE, 1=NW, 2=SW, 3=SE)
-    int getQuadrant(const Vec2& point) const;
-    
-    // Create child AABB for given quadrant
-    AABB getChildAABB(int quadrant) const;
+    bool contains(const Vec<D>& point) const;
+
+    // Index of the child cell holding point. The bits of the sides the point lies
+    // on (bit d set below the centre along axis d) are read as a Gray code, which
+    // in 2D gives 0 = NE, 1 = NW, 2 = SW, 3 = SE
+    int getChildIndex(const Vec<D>& point) const;
+
+    // Bounds of child cell index
+    BoundingBox getChildBox(int index) const;
+};
+
+typedef BoundingBox<2> AABB;
+
+// Arithmetic of the force kernels (tree walk and direct sum)
+enum class ForceKernel {
+    Exact,   // sqrt and divisions as written; the reference for validation
+    Rsqrt    // squared opening test and F = G m M d * rsqrt(d^2)^3; the float
+             // far-field loop (PRECISION=mixed) uses the hardware rsqrt estimate
+             // refined by one Newton step
+};
+
+// Parse a kernel name ("exact", "rsqrt")
+bool parseForceKernel(const std::string& name, ForceKernel& kernel);
+
+const char* forceKernelName(ForceKernel kernel);
+
+// Work counters for a force walk
+struct WalkStats {
+    long long nodesVisited;
+    long long interactions;
+
+    WalkStats() : nodesVisited(0), interactions(0) {}
+
+    void add(const WalkStats& other) {
+        nodesVisited += other.nodesVisited;
+        interactions += other.interactions;
+    }
+};
+
+// Copy of a body stored in a leaf that holds more than one body (leaf size > 1),
+// so the tree walk does not have to reach back into the body array
+template <int D>
+struct TreeLeafBody {
+    Vec<D> position;
+    double mass;
+    int index;
+};
+
+typedef TreeLeafBody<2> LeafBody;
+
+// Storage for the nodes or leaf bodies of a tree. It grows like a std::vector, but it
+// can also be attached to a block owned by someone else (e.g. an MPI shared window),
+// so the tree is built and refitted in that block. An attached pool cannot grow: when
+// it runs out of room it moves its contents to private memory and reports spilled()
+// until it is attached to a larger block
+template <typename T>
+class TreePool {
+public:
+    TreePool() : external(nullptr), externalCapacity(0), count(0), spill(false) {}
+
+    // Use storage (room for capacity elements) from now on. The current contents are
+    // copied into it, so the previous storage must still be valid; private memory is
+    // released
+    void attach(T* storage, size_t capacity) {
+        size_t n = size();
+        if (n > 0 && storage != data()) {
+            std::copy(data(), data() + n, storage);
+        }
+        std::vector<T>().swap(owned);
+        external = storage;
+        externalCapacity = capacity;
+        count = n;
+        spill = false;
+    }
+
+    bool isAttached() const { return external != nullptr; }
+
+    // An attached pool overflowed and now lives in private memory
+    bool spilled() const { return spill; }
+
+    T* data() { return external ? external : owned.data(); }
+    const T* data() const { return external ? external : owned.data(); }
+    size_t size() const { return external ? count : owned.size(); }
+    size_t capacity() const { return external ? externalCapacity : owned.capacity(); }
+    bool empty() const { return size() == 0; }
+
+    // No-op for an attached pool, whose capacity is fixed
+    void reserve(size_t n) {
+        if (!external) {
+            owned.reserve(n);
+        }
+    }
+
+    void clear() {
+        owned.clear();
+        count = 0;
+    }
+
+    template <typename... Args>
+    void emplace_back(Args&&... args) {
+        if (external) {
+            if (count < externalCapacity) {
+                new (external + count) T(std::forward<Args>(args)...);
+                count++;
+                return;
+            }
+            moveToPrivate();
+        }
+        owned.emplace_back(std::forward<Args>(args)...);
+    }
+
+    void push_back(const T& value) { emplace_back(value); }
+
+    T& operator[](size_t i) { return data()[i]; }
+    const T& operator[](size_t i) const { return data()[i]; }
+    T& back() { return data()[size() - 1]; }
+    T* begin() { return data(); }
+    T* end() { return data() + size(); }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + size(); }
+
+private:
+    std::vector<T> owned;
+    T* external;
+    size_t externalCapacity;
+    size_t count;
+    bool spill;
+
+    void moveToPrivate() {
+        owned.reserve(std::max<size_t>(2 * externalCapacity, 16));
+        owned.assign(external, external + count);
+        external = nullptr;
+        externalCapacity = 0;
+        count = 0;
+        spill = true;
+    }
 };
 
-// QuadTree node for Barnes-Hut algorithm
-class QuadTreeNode {
+// Tree node for the Barnes-Hut algorithm
+// Nodes are stored in one contiguous array and refer to each other by index, so a
+// tree is pointer-free: it can be copied as raw memory (e.g. into an MPI shared window)
+template <int D>
+class TreeNode {
 public:
-    AABB bounds;
+    BoundingBox<D> bounds;
     
     // Center of mass and total mass for this node
-    Vec2 centerOfMass;
+    Vec<D> centerOfMass;
     double totalMass;
     
-    // If this is a leaf with a single body
-    Body* body;
-    bool isLeaf;
-    bool isEmpty;
-    
-    // Children: NE, NW, SW, SE
-    std::unique_ptr<QuadTreeNode> children[4];
+    // Leaf with one body: index of the body. Leaf with several bodies: offset of
+    // its entries in QuadTree::leafBodies. -1 for empty leaves and internal nodes
+    int body;
 
-    QuadTreeNode(const AABB& bounds);
+    // Number of bodies in a leaf (0 for internal nodes), at most the tree's leaf size
+    int bodyCount;
 
-    // Insert a body into the tree
-    void insert(Body* body);
+    // Index of the first child; the other 2^D - 1 follow it in getChildIndex order
+    // (NE, NW, SW, SE in 2D). -1 for a leaf
+    int firstChild;
 
-    // Calculate force on a body using Barnes-Hut approximation
-    // theta: opening angle threshold (typically 0.5)
-    // G: gravitational constant
-    // softening: softening parameter to avoid singularities
-    void calculateForce(Body* target, double theta, double G, double softening) const;
+    TreeNode(const BoundingBox<D>& bounds);
 
-private:
-    void subdivide();
-    bool isExternal() const;
+    bool isLeaf() const { return firstChild < 0; }
+    bool isEmpty() const { return isLeaf() && bodyCount == 0; }
+    bool isExternal() const { return isLeaf() && bodyCount > 0; }
 };
 
-// QuadTree manager class - builds and manages the tree
-class QuadTree {
+typedef TreeNode<2> QuadTreeNode;
+
+// Tree manager class - builds and manages the tree
+template <int D>
+class OrthTree {
 public:
-    std::unique_ptr<QuadTreeNode> root;
+    typedef BasicBody<D> BodyType;
+    typedef TreeNode<D> Node;
+    typedef TreeLeafBody<D> LeafBodyType;
+
+    // Flat node array, nodes[0] is the root
+    TreePool<Node> nodes;
+
+    // Bodies of the leaves holding more than one body, grouped by leaf
+    TreePool<LeafBodyType> leafBodies;
     
-    QuadTree();
+    OrthTree();
+
+    // Maximum number of bodies per leaf (default 1, the classic Barnes-Hut tree).
+    // Larger leaves give shallower trees and replace the deepest part of the walk
+    // with a short direct loop over the leaf's bodies
+    void setLeafSize(int size) { leafSize = std::max(1, size); }
+    int getLeafSize() const { return leafSize; }
+
+    // Periodic box (nullptr or a disabled box for open boundaries). In a periodic
+    // box the root cell is the box itself, so it never grows, and the walk uses
+    // nearest images plus the box's Ewald correction. Bodies must lie in the box.
+    // 2D only: the 3D tree ignores it
+    void setPeriodicBox(const PeriodicBox* box) { periodic = box; }
+    const PeriodicBox* getPeriodicBox() const { return periodic; }
 
     // Build tree from a vector of bodies
-    void build(std::vector<Body>& bodies);
+    void build(const std::vector<BodyType>& bodies);
+
+    // Build tree from a raw body array (e.g. bodies living in shared memory)
+    void build(const BodyType* bodies, int numBodies);
+
+    // Update the tree of the last build for the bodies' new positions, keeping its
+    // cells. Bodies that left their leaf cell are moved to the right one, then mass
+    // and centre of mass are refitted bottom-up in O(nodes). Falls back to build()
+    // (and returns false) when a body left the root, the body count changed, or
+    // more than rebuildFraction * numBodies bodies have moved cell since the last
+    // build. bodies must be in the same order as in that build
+    bool refit(const BodyType* bodies, int numBodies, double rebuildFraction);
 
     // Calculate forces on all bodies in a range (for parallel processing)
     // This is designed to be easily adaptable for MPI
-    void calculateForces(std::vector<Body>& bodies, int startIdx, int endIdx, 
-                         double theta, double G, double softening) const;
+    // stats: optional work counters, nullptr runs the uninstrumented walk
+    void calculateForces(std::vector<BodyType>& bodies, int startIdx, int endIdx, 
+                         double theta, double G, double softening,
+                         WalkStats* stats = nullptr, ForceKernel kernel = ForceKernel::Exact) const;
+
+    // Calculate forces on the bodies listed in indices (e.g. the active bodies of a
+    // block-timestep substep)
+    void calculateForces(std::vector<BodyType>& bodies, const int* indices, int count,
+                         double theta, double G, double softening,
+                         WalkStats* stats = nullptr, ForceKernel kernel = ForceKernel::Exact) const;
+
+    // Same as above for a tree given as a raw node array (nodes[0] is the root).
+    // leafBodies may be nullptr if no leaf holds more than one body (e.g. leaf size
+    // 1), which selects the walk without the multi-body leaf branch. periodic is
+    // the box the tree was built for, if any
+    static void calculateForces(const Node* nodes, int numNodes, const LeafBodyType* leafBodies,
+                                BodyType* bodies,
+                                int startIdx, int endIdx,
+                                double theta, double G, double softening,
+                                WalkStats* stats = nullptr, ForceKernel kernel = ForceKernel::Exact,
+                                const PeriodicBox* periodic = nullptr);
+
+    // Calculate force on bodies[targetIdx] from the subtree at nodeIdx
+    // theta: opening angle threshold (typically 0.5)
+    // G: gravitational constant
+    // softening: softening parameter to avoid singularities
+    static void calculateForce(const Node* nodes, const LeafBodyType* leafBodies, int nodeIdx,
+                               BodyType& target, int targetIdx,
+                               double theta, double G, double softening,
+                               ForceKernel kernel = ForceKernel::Exact,
+                               const PeriodicBox* periodic = nullptr);
+
+    // Sum of m_i * phi_i over bodies[startIdx, endIdx), where phi_i is the softened
+    // potential -G sum_j m_j / sqrt(d^2 + eps^2) of the tree at body i, with the
+    // opening test of the exact force walk. The potential energy is half of this
+    // sum over all bodies. Open boundaries only
+    double calculatePotential(const BodyType* bodies, int startIdx, int endIdx,
+                              double theta, double G, double softening) const;
+
+    // Same for a tree given as a raw node array
+    static double calculatePotential(const Node* nodes, int numNodes, const LeafBodyType* leafBodies,
+                                     const BodyType* bodies, int startIdx, int endIdx,
+                                     double theta, double G, double softening);
+
+    // Append to out the indices of the bodies within radius of center (neighbour
+    // search for the merger stage). Uses the positions of the last build or refit;
+    // in a periodic box the distances are to the nearest image
+    void findNeighbours(const Vec<D>& center, double radius, std::vector<int>& out) const;
 
     // Clear the tree
     void clear();
 
+    bool empty() const { return nodes.empty(); }
+    int getNumNodes() const { return static_cast<int>(nodes.size()); }
+
+    // Depth of the deepest node of the last build (root = 0)
+    int getDepth() const { return depth; }
+
+    // Full builds and refits since construction
+    int getNumBuilds() const { return numBuilds; }
+    int getNumRefits() const { return numRefits; }
+
 private:
+    int depth;
+    int leafSize;
+    const PeriodicBox* periodic;
+
+    // Leaf membership, kept between steps for refit():
+    // leafHead[node] is the first body of a leaf's list, nextInLeaf[body] the next
+    // one (-1 ends both), bodyLeaf[body] the leaf holding the body
+    std::vector<int> leafHead;
+    std::vector<int> nextInLeaf;
+    std::vector<int> bodyLeaf;
+
+    // Refit state
+    std::vector<int> moved;
+    long long migratedSinceBuild;
+    int numBuilds;
+    int numRefits;
+
+    // Insert bodies[bodyIdx] into the subtree at nodeIdx (at level nodeDepth)
+    void insert(int nodeIdx, const BodyType* bodies, int bodyIdx, int nodeDepth);
+
+    // Append the 2^D children of nodeIdx
+    void subdivide(int nodeIdx);
+
+    // Set each leaf's body field from its list; multi-body leaves get a range of leafBodies
+    void flattenLeaves(const BodyType* bodies);
+
+    // Unlink bodyIdx from the list of leaf nodeIdx
+    void removeFromLeaf(int nodeIdx, int bodyIdx);
+
+    // Recompute mass and centre of mass of one node from its bodies or children
+    void refitNode(int nodeIdx, const BodyType* bodies);
+
     // Calculate bounding box that contains all bodies
-    AABB calculateBounds(const std::vector<Body>& bodies) const;
+    BoundingBox<D> calculateBounds(const BodyType* bodies, int numBodies) const;
 };
 
+typedef OrthTree<2> QuadTree;
+typedef OrthTree<3> Octree;
+
 #endif // QUADTREE_H
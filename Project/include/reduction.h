@@ -0,0 +1,48 @@
+#ifndef REDUCTION_H
+#define REDUCTION_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Fixed-order sums for reproducible runs (deterministic_reductions = true).
+//
+// Element i of a sum over [0, count) is a vector of width doubles. The sum is
+// defined by one binary tree over the indices: the node at level k and index j
+// holds elements [j * 2^k, (j + 1) * 2^k), and its value is the sum of its two
+// children, or its left child alone when the right one starts at or past count.
+// A thread or rank that owns a contiguous range adds the values of the largest
+// nodes lying inside it ("pieces"). Combining pieces from any partition of
+// [0, count) rebuilds the same tree, so the total has the same bits whatever the
+// number of threads or ranks. Floating-point addition is commutative, so only the
+// tree shape matters.
+class PairwiseSum {
+public:
+    PairwiseSum(long long count, int width);
+
+    // Add the pieces covering elements [start, end); value(i, out) writes the width
+    // values of element i to out. Cost is one call and width additions per element
+    void addRange(long long start, long long end, const std::function<void(long long, double*)>& value);
+
+    // Add the pieces of another sum over the same count and width
+    void merge(const PairwiseSum& other);
+
+    // Pieces as (level, index, width values) records, for an MPI exchange
+    const std::vector<double>& getPieces() const { return pieces; }
+    void addPieces(const double* data, size_t size);
+
+    // Sum of all elements into out[0..width). Returns false (out zeroed) when some
+    // element is not covered by any piece. Overlapping pieces are not detected
+    bool total(double* out) const;
+
+    long long getCount() const { return count; }
+    int getWidth() const { return width; }
+
+private:
+    long long count;
+    int width;
+    int levels;                 // level of the root: smallest k with 2^k >= count
+    std::vector<double> pieces;
+};
+
+#endif // REDUCTION_H
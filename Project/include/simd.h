@@ -0,0 +1,29 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Function multiversioning for the vectorised kernels (make ARCH=clones).
+// GCC compiles a marked function once per listed target and picks one when the
+// program is loaded, so one portable binary still runs the AVX2 / AVX-512 code on
+// CPUs that have it. make ARCH=native instead builds everything for the host CPU.
+#if defined(NBODY_TARGET_CLONES) && defined(__GNUC__) && defined(__x86_64__)
+#define NBODY_KERNEL_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define NBODY_KERNEL_CLONES
+#endif
+
+// Reciprocal square root of four floats for the Rsqrt force kernel: the hardware
+// estimate (about 12 bits) refined by one Newton step,
+// y' = y * (1.5 - 0.5 * x * y^2), which gives about 22 bits. x must be positive
+// and finite.
+#if defined(__SSE2__)
+#define NBODY_HAVE_SSE2 1
+#include <emmintrin.h>
+
+inline __m128 rsqrtNewton(__m128 x) {
+    __m128 y = _mm_rsqrt_ps(x);
+    __m128 halfX = _mm_mul_ps(_mm_set1_ps(0.5f), x);
+    return _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(halfX, _mm_mul_ps(y, y))));
+}
+#endif
+
+#endif // SIMD_H
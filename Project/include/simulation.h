@@ -4,6 +4,16 @@
 #include "body.h"
 #include "quadtree.h"
 #include "config.h"
+#include "trajectory.h"
+#include "trajectory_codec.h"
+#include "profiler.h"
+#include "direct_sum.h"
+#include "autotuner.h"
+#include "merger.h"
+#include "interaction_cache.h"
+#include "affinity.h"
+#include "reduction.h"
+#include "analysis.h"
 #include <vector>
 #include <string>
 #include <thread>
@@ -24,15 +34,86 @@ public:
     double gravitationalConstant;
     int numThreads;
 
+    // CPU of each worker thread (thread_affinity). With pinned threads the body and
+    // tree arrays are placed by first touch: each worker faults in the pages of
+    // its own body range, and the tree's node pool is spread over all workers
+    ThreadPlacement placement;
+
+    // Back the body and tree arrays with transparent huge pages (huge_pages = true)
+    bool hugePages;
+
     // Bodies in the simulation
     std::vector<Body> bodies;
 
+    // Force solver: Barnes-Hut quadtree or exact direct sum (small N)
+    ForceSolver solver;
+
+    // Arithmetic of the force kernels: exact (default) or rsqrt (opt-in)
+    ForceKernel forceKernel;
+
+    // Periodic box (periodic_box > 0), shared by the tree and the direct sum
+    PeriodicBox periodicBox;
+
     // Quadtree for Barnes-Hut
     QuadTree tree;
+    int leafSize;
+
+    // Refit the tree between steps instead of rebuilding it (tree_refit = true);
+    // rebuild once this fraction of the bodies has changed cell
+    bool treeRefit;
+    double treeRebuildFraction;
+
+    // Group interaction lists reused across steps (interaction_lists = true)
+    InteractionCache interactionCache;
+
+    // Block timesteps (block_timesteps = true): body i advances with
+    // timeStep / 2^level[i]; one step() is split into 2^blockMaxLevel substeps
+    bool blockTimesteps;
+    int blockMaxLevel;
+    double blockEta;
+    std::vector<int> bodyLevel;
+    long long blockForceEvaluations;   // bodies whose force was computed, all steps
+    long long blockSubsteps;           // substeps with at least one active body
+
+    // Collisions and mergers (mergers = true), applied at the start of each step
+    Merger merger;
+
+    // Structure-of-arrays sources for the direct sum (solver = direct and error checks)
+    DirectSum directSum;
+
+    // Compare the step's forces against a direct sum every forceErrorInterval steps
+    // (0 = never), on forceErrorSamples evenly spaced bodies (0 = all)
+    int forceErrorInterval;
+    int forceErrorSamples;
+    ForceErrorStats lastForceError;
+
+    // Energy, momentum and angular momentum of the state at every
+    // diagnosticsInterval-th output step and at the end (0 = never)
+    int diagnosticsInterval;
+    std::vector<Diagnostics> diagnosticsLog;
+
+    // Sum the diagnostics over a fixed tree of body indices (PairwiseSum) instead of
+    // per-thread partial sums, so they do not depend on the thread or rank count
+    bool deterministicReductions;
 
     // Output file
     std::string outputFilename;
+    OutputFormat outputFormat;
     std::ofstream outputFile;
+    TrajectoryWriter trajectoryWriter;
+    CompressedTrajectoryWriter compressedWriter;
+    double trajectoryError;     // compressed output: largest position error, 0 = lossless
+
+    // Density maps and profiles of output-step snapshots, computed on worker
+    // threads while the run continues (analysis = ...)
+    AnalysisPipeline analysis;
+
+    // Chooses solver, theta, leaf size and threads at run time (autotune = true)
+    Autotuner autotuner;
+
+    // Per-phase timers and counters (profile = true)
+    Profiler profiler;
+    std::string profileReport;
 
     Simulation();
     ~Simulation();
@@ -52,6 +133,9 @@ public:
     // Write current state to output file
     void writeState(int stepNumber);
 
+    // Write the given body array as one output step (bodies not owned by the simulation)
+    void writeBodies(int stepNumber, const Body* stateBodies, int count);
+
     // Close output file
     void closeOutput();
 
@@ -61,18 +145,70 @@ public:
     // Set bodies (for external updates, e.g., from MPI)
     void setBodies(const std::vector<Body>& newBodies);
 
+    // Copy source into bodies. With thread_affinity each worker first touches the
+    // pages of its own range; huge_pages advises the new array first
+    void placeBodies(const std::vector<Body>& source);
+
+    // Reserve the tree's node and leaf pools for the current bodies and place them
+    // the same way (initialize calls this; nothing without placement or huge pages)
+    void placeTree();
+
     // --- Methods designed for parallel/MPI scalability ---
     
     // Build the quadtree from current body positions
     void buildTree();
 
+    // Per-step solver setup: build the tree or load the direct-sum sources
+    void prepareForces();
+
+    // Merge colliding bodies. The tree must hold the current positions (it is
+    // built first when the solver is direct). Returns the number of bodies removed
+    int mergeBodies();
+
+    // Whether the state of output step stateStep gets diagnostics
+    bool diagnosticsDue(int stateStep) const {
+        return diagnosticsInterval > 0 && stateStep % diagnosticsInterval == 0;
+    }
+
+    // Diagnostics of bodies[startIdx, endIdx): partial sums for one thread or MPI
+    // rank. The potential uses the prepared solver (tree or direct-sum snapshot)
+    Diagnostics measureDiagnosticsRange(int startIdx, int endIdx) const;
+
+    // Add the diagnostics of each body of [startIdx, endIdx) to sum (width
+    // Diagnostics::NUM_FIELDS), for deterministic_reductions
+    void addDiagnosticsPieces(PairwiseSum& sum, int startIdx, int endIdx) const;
+
+    // Threaded diagnostics of all bodies; forces must be prepared for the current positions
+    Diagnostics measureDiagnostics();
+
+    // Append to diagnosticsLog and print one line
+    void recordDiagnostics(const Diagnostics& diagnostics);
+
+    // Drift summary of diagnosticsLog
+    void printDiagnosticsSummary(std::ostream& os) const;
+
+    // Relative error of the forces currently in bodies against a threaded direct sum
+    ForceErrorStats measureForceError();
+
+    // Keep stats as lastForceError and print one line for the step
+    void recordForceError(int stepNumber, const ForceErrorStats& stats);
+
+    // Exact forces on the listed bodies (threaded direct sum), written to forces[k]
+    void calculateReferenceForces(const int* targets, int count, Vec2* forces);
+
     // Calculate forces for a range of bodies (thread/MPI worker function)
-    void calculateForcesRange(int startIdx, int endIdx);
+    // stats: optional walk counters, only collected when profiling
+    void calculateForcesRange(int startIdx, int endIdx, WalkStats* stats = nullptr);
+
+    // Calculate forces for the listed bodies only (block-timestep active set)
+    void calculateForcesList(const int* indices, int count, WalkStats* stats = nullptr);
 
     // Update positions and velocities for a range of bodies
     void updateBodiesRange(int startIdx, int endIdx);
 
 private:
+    friend class Autotuner;
+
     // Worker function for threaded force calculation
     void threadWorker(int threadId, int totalThreads);
 
@@ -82,6 +218,28 @@ private:
     // Parallel position/velocity update using threads
     void updateBodiesParallel();
 
+    // step() with block timesteps: substeps over the active bodies
+    void stepBlock(int stepNumber);
+
+    // Force error check of force_error_interval, on the forces just computed
+    void checkForceError(int stepNumber);
+
+    // Threaded calculateForcesList over activeBodies
+    void calculateActiveForcesParallel();
+
+    // Level for body i from its acceleration and velocity, restricted to levels
+    // whose step starts at substep
+    int chooseLevel(int i, int substep) const;
+
+    // measureDiagnostics + recordDiagnostics for the state of output step stateStep
+    void diagnoseState(int stateStep);
+
+    // Hand the state of output step stateStep to the analyses if one is due
+    void analyseState(int stateStep);
+
+    std::vector<int> activeBodies;
+    std::vector<std::vector<int>> dueBodies;   // block timesteps: bodies due at each substep
+
     std::mutex outputMutex;
 };
 
@@ -0,0 +1,85 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include "body.h"
+#include "vec2.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Binary trajectory file layout (native byte order):
+//   header : TrajectoryHeader (16 bytes)
+//   ids    : int32_t[numBodies], zero padded to a multiple of 8 bytes
+//   frames : { int64_t step; double x, y for every body } repeated
+// All frames have the same size, so body i of frame f lives at a computed offset
+// and every MPI rank can write its own block of a frame independently.
+
+enum class OutputFormat {
+    Text,   // "step N" followed by "id x y" lines (default)
+    Binary, // layout above
+    Compressed, // predicted and entropy-coded frames (trajectory_codec.h)
+    None    // no trajectory (e.g. only in-situ analysis output)
+};
+
+// Parse an output format name ("text", "binary", "compressed", "none")
+bool parseOutputFormat(const std::string& name, OutputFormat& format);
+
+struct TrajectoryHeader {
+    char magic[4];      // "NBTR"
+    int32_t version;
+    int32_t numBodies;
+    int32_t reserved;
+};
+
+// Byte offsets inside a binary trajectory
+int64_t trajectoryHeaderBytes(int numBodies);
+int64_t trajectoryFrameBytes(int numBodies);
+int64_t trajectoryFrameOffset(int numBodies, int64_t frameIndex);
+
+// Fill header and id table for the given bodies (ids padded to 8 bytes)
+void makeTrajectoryHeader(const Body* bodies, int numBodies, std::vector<char>& buffer);
+
+// True if the file starts with the binary trajectory magic
+bool isBinaryTrajectory(const std::string& filename);
+
+// Serial writer, used by nbody_sim
+class TrajectoryWriter {
+public:
+    TrajectoryWriter();
+
+    bool open(const std::string& filename, const Body* bodies, int numBodies);
+    void writeFrame(int stepNumber, const Body* bodies, int numBodies);
+    void close();
+    bool isOpen() const;
+
+private:
+    std::ofstream file;
+    std::vector<char> frameBuffer;
+};
+
+// Random-access reader; frames that are only partially written are ignored
+class TrajectoryReader {
+public:
+    TrajectoryReader();
+
+    bool open(const std::string& filename);
+    void close();
+
+    int getNumBodies() const { return numBodies; }
+    const std::vector<int>& getIds() const { return ids; }
+
+    // Number of complete frames currently in the file
+    int64_t getNumFrames();
+
+    // Read one frame; positions are resized to getNumBodies()
+    bool readFrame(int64_t frameIndex, int64_t& stepNumber, std::vector<Vec2>& positions);
+
+private:
+    std::ifstream file;
+    int numBodies;
+    std::vector<int> ids;
+    std::vector<char> frameBuffer;
+};
+
+#endif // TRAJECTORY_H
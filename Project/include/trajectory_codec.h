@@ -0,0 +1,125 @@
+#ifndef TRAJECTORY_CODEC_H
+#define TRAJECTORY_CODEC_H
+
+#include "body.h"
+#include "vec2.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Compressed trajectory (output_format = compressed), no external dependencies.
+//
+// Every coordinate is predicted from the same body's previous frames: p1 + (p1 - p0)
+// with two frames of history, p1 with one. Keyframes have no history, and each body
+// is predicted from the previous body of its block instead. A keyframe is written
+// every keyframeInterval frames, so a reader can seek without decoding from the start.
+//
+// - Lossless (error bound 0): the residual is the XOR of the value's and the
+//   prediction's bits, coded as in Gorilla. A zero XOR costs one bit. Otherwise the
+//   nonzero bits are written inside the previous window of leading and trailing
+//   zeros when they fit ('10'), or with a new window ('11', 5 bits leading zeros,
+//   6 bits length).
+// - Lossy (error bound e > 0): coordinates are rounded to multiples of q = 2e, so
+//   every decoded value is within e of the original. The integer residual against
+//   the integer prediction is zigzag mapped and written with an exp-Golomb code
+//   whose order suits the block (6 bits per block and frame), so a zero residual
+//   costs one bit. Predictions use decoded values, so the error does not accumulate.
+//
+// The bodies are split into blocks of blockSize with independent streams, so blocks
+// are encoded and decoded on separate threads.
+//
+// File layout (native byte order):
+//   header : CompressedTrajectoryHeader (32 bytes)
+//   ids    : int32_t[numBodies], zero padded to a multiple of 8 bytes
+//   frames : { uint64_t bytes (rest of the frame); int64_t step; int32_t numBlocks;
+//              uint32_t blockBytes[numBlocks]; block streams } repeated
+
+struct CompressedTrajectoryHeader {
+    char magic[4];            // "NBTZ"
+    int32_t version;
+    int32_t numBodies;
+    int32_t blockSize;
+    int32_t keyframeInterval;
+    int32_t reserved;
+    double quantum;           // q = 2 * error bound, 0 = lossless
+};
+
+// True if the file starts with the compressed trajectory magic
+bool isCompressedTrajectory(const std::string& filename);
+
+// Per-block predictor history shared by the encoder and the decoder
+struct CodecHistory {
+    std::vector<double> x0, y0, x1, y1;     // lossless: two frames back, one frame back
+    std::vector<int64_t> qx0, qy0, qx1, qy1; // lossy: the same in multiples of q
+    int frames;                             // frames since the last keyframe, capped at 2
+
+    CodecHistory() : frames(0) {}
+    void resize(int numBodies);
+};
+
+class CompressedTrajectoryWriter {
+public:
+    CompressedTrajectoryWriter();
+
+    // errorBound: largest absolute position error, 0 for lossless. Blocks of a frame
+    // are encoded on numThreads threads
+    bool open(const std::string& filename, const Body* bodies, int numBodies,
+              double errorBound, int numThreads);
+    void writeFrame(int stepNumber, const Body* bodies, int numBodies);
+    void close();
+    bool isOpen() const;
+
+    // Bytes written so far, and what the same frames take in a binary trajectory
+    int64_t getBytesWritten() const { return bytesWritten; }
+    int64_t getRawBytes() const;
+
+private:
+    std::ofstream file;
+    int numBodies;
+    int numThreads;
+    double quantum;
+    int64_t numFrames;
+    int64_t bytesWritten;
+    CodecHistory history;
+    std::vector<std::vector<uint8_t>> blockStreams;
+    std::vector<double> xs, ys;
+};
+
+// Reader with an index of frame offsets. Reading frames in order decodes each once;
+// any other frame is decoded forward from its keyframe
+class CompressedTrajectoryReader {
+public:
+    CompressedTrajectoryReader();
+
+    // Blocks of a frame are decoded on numThreads threads
+    bool open(const std::string& filename, int numThreads = 1);
+    void close();
+
+    int getNumBodies() const { return header.numBodies; }
+    const std::vector<int>& getIds() const { return ids; }
+    double getErrorBound() const { return 0.5 * header.quantum; }
+
+    // Number of complete frames currently in the file
+    int64_t getNumFrames();
+
+    // Read one frame; positions are resized to getNumBodies()
+    bool readFrame(int64_t frameIndex, int64_t& stepNumber, std::vector<Vec2>& positions);
+
+private:
+    std::ifstream file;
+    CompressedTrajectoryHeader header;
+    std::vector<int> ids;
+    int numThreads;
+    std::vector<int64_t> frameOffsets;  // start of every complete frame found so far
+    int64_t scanOffset;                 // where the index scan continues
+    int64_t decodedFrame;               // frame held in history, -1 = none
+    int64_t decodedStep;
+    CodecHistory history;
+    std::vector<char> frameBuffer;
+    std::vector<double> xs, ys;
+
+    bool decodeFrame(int64_t frameIndex);
+};
+
+#endif // TRAJECTORY_CODEC_H
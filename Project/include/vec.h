@@ -0,0 +1,10 @@
+#ifndef VEC_H
+#define VEC_H
+
+// Fixed-size vector of D doubles. Only the specialisations exist: Vec<2> (Vec2,
+// vec2.h) and Vec<3> (Vec3, vec3.h) spell out their components, so 2D code keeps
+// reading p.x and p.y, while dimension-generic code (the tree) loops over p[d].
+template <int D>
+class Vec;
+
+#endif // VEC_H
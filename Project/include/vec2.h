@@ -1,16 +1,24 @@
 #ifndef VEC2_H
 #define VEC2_H
 
+#include "vec.h"
 #include <cmath>
 #include <iostream>
 
-class Vec2 {
+template <>
+class Vec<2> {
 public:
+    typedef Vec<2> Vec2;
+
     double x;
     double y;
 
-    Vec2() : x(0.0), y(0.0) {}
-    Vec2(double x, double y) : x(x), y(y) {}
+    Vec() : x(0.0), y(0.0) {}
+    Vec(double x, double y) : x(x), y(y) {}
+
+    // Component d (0 = x, 1 = y); folds to a plain member access for a constant d
+    double& operator[](int d) { return d == 0 ? x : y; }
+    double operator[](int d) const { return d == 0 ? x : y; }
 
     Vec2 operator+(const Vec2& other) const {
         return Vec2(x + other.x, y + other.y);
@@ -86,4 +94,6 @@ public:
     }
 };
 
+typedef Vec<2> Vec2;
+
 #endif // VEC2_H
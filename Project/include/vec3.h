@@ -0,0 +1,89 @@
+#ifndef VEC3_H
+#define VEC3_H
+
+#include "vec.h"
+#include <cmath>
+#include <iostream>
+
+// 3D counterpart of Vec2, for the octree instantiation of the tree
+template <>
+class Vec<3> {
+public:
+    typedef Vec<3> Vec3;
+
+    double x;
+    double y;
+    double z;
+
+    Vec() : x(0.0), y(0.0), z(0.0) {}
+    Vec(double x, double y, double z) : x(x), y(y), z(z) {}
+
+    // Component d (0 = x, 1 = y, 2 = z)
+    double& operator[](int d) { return d == 0 ? x : (d == 1 ? y : z); }
+    double operator[](int d) const { return d == 0 ? x : (d == 1 ? y : z); }
+
+    Vec3 operator+(const Vec3& other) const {
+        return Vec3(x + other.x, y + other.y, z + other.z);
+    }
+
+    Vec3 operator-(const Vec3& other) const {
+        return Vec3(x - other.x, y - other.y, z - other.z);
+    }
+
+    Vec3 operator*(double scalar) const {
+        return Vec3(x * scalar, y * scalar, z * scalar);
+    }
+
+    Vec3 operator/(double scalar) const {
+        return Vec3(x / scalar, y / scalar, z / scalar);
+    }
+
+    Vec3& operator+=(const Vec3& other) {
+        x += other.x;
+        y += other.y;
+        z += other.z;
+        return *this;
+    }
+
+    Vec3& operator-=(const Vec3& other) {
+        x -= other.x;
+        y -= other.y;
+        z -= other.z;
+        return *this;
+    }
+
+    Vec3& operator*=(double scalar) {
+        x *= scalar;
+        y *= scalar;
+        z *= scalar;
+        return *this;
+    }
+
+    Vec3& operator/=(double scalar) {
+        x /= scalar;
+        y /= scalar;
+        z /= scalar;
+        return *this;
+    }
+
+    double dot(const Vec3& other) const {
+        return x * other.x + y * other.y + z * other.z;
+    }
+
+    double lengthSquared() const {
+        return x * x + y * y + z * z;
+    }
+
+    double length() const {
+        return std::sqrt(lengthSquared());
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const Vec3& v) {
+        os << "(" << v.x << ", " << v.y << ", " << v.z << ")";
+        return os;
+    }
+};
+
+typedef Vec<3> Vec3;
+
+#endif // VEC3_H
@@ -8,8 +8,13 @@
 #include <string>
 #include <fstream>
 #include <map>
+#include <algorithm>
 #include "body.h"
 #include "vec2.h"
+#include "offscreen.h"
+#include "frame_exporter.h"
+#include "trajectory.h"
+#include "trajectory_codec.h"
 
 struct BodyState {
     int id;
@@ -17,20 +22,88 @@ struct BodyState {
     double radius;
 };
 
+// Bounding box (body radii included) and centroid of a frame, gathered while its
+// bodies are parsed. Trajectories carry no masses, so the centroid is unweighted
+struct FrameSummary {
+    double minX, maxX, minY, maxY;
+    Vec2 positionSum;
+    int count;
+
+    FrameSummary() : minX(1e300), maxX(-1e300), minY(1e300), maxY(-1e300), count(0) {}
+
+    void add(const BodyState& body) {
+        minX = std::min(minX, body.position.x - body.radius);
+        maxX = std::max(maxX, body.position.x + body.radius);
+        minY = std::min(minY, body.position.y - body.radius);
+        maxY = std::max(maxY, body.position.y + body.radius);
+        positionSum += body.position;
+        count++;
+    }
+
+    void add(const FrameSummary& other) {
+        minX = std::min(minX, other.minX);
+        maxX = std::max(maxX, other.maxX);
+        minY = std::min(minY, other.minY);
+        maxY = std::max(maxY, other.maxY);
+        positionSum += other.positionSum;
+        count += other.count;
+    }
+
+    bool isEmpty() const { return count == 0; }
+    Vec2 centroid() const { return (count > 0) ? positionSum / count : Vec2(); }
+};
+
 struct SimulationFrame {
     int stepNumber;
     std::vector<BodyState> bodies;
+    FrameSummary summary;
+};
+
+// Where parsing of a trajectory file stopped. Parsing again appends only the frames
+// written since, so a file can be viewed while the simulation is still writing it
+struct TrajectoryCursor {
+    enum class Kind { Unknown, Text, Binary, Compressed };
+
+    std::string filename;
+    Kind kind;
+    std::streamoff textOffset;        // start of the first text frame not yet parsed
+    TrajectoryReader binaryReader;
+    CompressedTrajectoryReader compressedReader;
+
+    TrajectoryCursor() : kind(Kind::Unknown), textOffset(0) {}
+};
+
+// Headless export: the trajectory rendered at a fixed frame rate to an image sequence
+struct ExportSettings {
+    std::string prefix;   // frames are <prefix>_<index>.<png|ppm>
+    ImageFormat format;
+    double fps;           // frames per second of the exported video
+    double speed;         // trajectory frames per second of video (5 = interactive speed)
+    int encoderThreads;
+    int readbackBuffers;  // pixel buffer objects in the readback ring
+    int maxPending;       // frames queued for encoding before the render loop waits
+
+    ExportSettings()
+        : prefix("frame"), format(ImageFormat::Png), fps(30.0), speed(5.0), encoderThreads(4),
+          readbackBuffers(3), maxPending(32) {}
 };
 
 class Visualizer {
 private:
     GLFWwindow* window;
+    OffscreenContext offscreen;
     int windowWidth;
     int windowHeight;
     
     // Simulation data
     std::vector<SimulationFrame> threadedFrames;
     std::vector<SimulationFrame> mpiFrames;
+    TrajectoryCursor threadedCursor;
+    TrajectoryCursor mpiCursor;
+    FrameSummary worldSummary;      // union of every loaded frame
+    bool followFiles;               // poll the files for new frames while running
+    bool fitCurrentFrame;           // frame the current frame instead of the whole run
+    double lastPollTime;
     
     // Animation control
     int currentFrame;
@@ -53,6 +126,21 @@ private:
     };
     
     std::map<int, Color> bodyColors;
+
+    // Level of detail: bodies drawn smaller than lodPixels in crowded parts of the
+    // screen are counted into a screen-resolution density grid, drawn as one
+    // tone-mapped texture
+    bool lodEnabled;
+    double lodPixels;
+    int renderThreads;
+    std::vector<float> splatCounts;                 // one grid per thread, summed into the first
+    std::vector<int> splatCells;                    // per thread: small bodies per crowding cell
+    std::vector<std::vector<int>> splatLarge;       // per thread: bodies drawn as circles
+    std::vector<uint8_t> splatPixels;               // RGBA texture data
+    std::vector<uint8_t> splatRamp;                 // 256 RGBA colours, low to high density
+    GLuint splatTexture;
+    int splatTextureWidth;
+    int splatTextureHeight;
     
 public:
     Visualizer(int width = 1600, int height = 800);
@@ -60,16 +148,30 @@ public:
     
     // Initialization
     bool initialize();
+    bool initializeHeadless();   // offscreen EGL context, no window or display needed
     void setupColors();
     
     // Data loading
     bool loadSimulationData(const std::string& threadedFile, const std::string& mpiFile);
-    bool parseOutputFile(const std::string& filename, std::vector<SimulationFrame>& frames);
+    // Append frames written since the last load or poll; true if there were any
+    bool pollSimulationData();
+    void setFollow(bool enabled) { followFiles = enabled; }
+    // Parsers append the frames after frames.size() and return false if there are none
+    bool parseOutputFile(TrajectoryCursor& cursor, std::vector<SimulationFrame>& frames);
+    bool parseTextFile(TrajectoryCursor& cursor, std::vector<SimulationFrame>& frames);
+    bool parseBinaryFile(TrajectoryCursor& cursor, std::vector<SimulationFrame>& frames);
+    bool parseCompressedFile(TrajectoryCursor& cursor, std::vector<SimulationFrame>& frames);
+    static double radiusForId(int id);
     
     // Rendering
     void render();
     void renderSimulation(const std::vector<SimulationFrame>& frames, float offsetX, float width);
     void renderBodies(const std::vector<BodyState>& bodies, float offsetX, float width);
+    void renderDensitySplat(const std::vector<BodyState>& bodies, float offsetX, float width);
+    void drawBody(const BodyState& body, float offsetX, float width);
+    float drawnRadius(const BodyState& body) const;   // circle radius in pixels
+    // Bodies drawn with a radius below pixels become density splats where crowded
+    void setLevelOfDetail(bool enabled, double pixels = 8.0) { lodEnabled = enabled; lodPixels = pixels; }
     void renderUI();
     
     // Utility functions
@@ -77,6 +179,7 @@ public:
     void drawText(float x, float y, const std::string& text);
     Vec2 worldToScreen(const Vec2& worldPos, float offsetX, float width);
     void calculateWorldBounds();
+    void setWorldBounds(const FrameSummary& summary);
     void updateAnimation();
     
     // Input handling
@@ -86,9 +189,13 @@ public:
     
     // Main loop
     void run();
+    bool exportFrames(const ExportSettings& settings);
     bool shouldClose() const;
     void swapBuffers();
     void pollEvents();
+
+private:
+    bool initializeGL(bool headless);
 };
 
 #endif // VISUALIZER_H
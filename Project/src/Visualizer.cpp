@@ -1,5 +1,10 @@
 // File: Project/src/visualizer.cpp
 #include "visualizer.h"
+#include "trajectory.h"
+#include "trajectory_codec.h"
+#include <chrono>
+#include <functional>
+#include <thread>
 #include <iostream>
 #include <sstream>
 #include <algorithm>
@@ -10,15 +15,24 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+// Side of the cells in which the level of detail measures crowding, in pixels
+static const int LOD_CELL_PIXELS = 8;
+
 Visualizer::Visualizer(int width, int height)
     : window(nullptr), windowWidth(width), windowHeight(height),
+    followFiles(false), fitCurrentFrame(false), lastPollTime(0.0),
     currentFrame(0), maxFrames(0), isPlaying(true), showBothSims(true),
     animationSpeed(1.0), lastFrameTime(0.0), viewScale(1.0), viewCenter(0, 0),
-    minX(-300), maxX(300), minY(-300), maxY(300) {
+    minX(-300), maxX(300), minY(-300), maxY(300),
+    lodEnabled(true), lodPixels(8.0), renderThreads(std::max(1u, std::thread::hardware_concurrency())),
+    splatTexture(0), splatTextureWidth(0), splatTextureHeight(0) {
     setupColors();
 }
 
 Visualizer::~Visualizer() {
+    if (splatTexture) {
+        glDeleteTextures(1, &splatTexture);
+    }
     if (window) {
         glfwDestroyWindow(window);
         glfwTerminate();
@@ -54,9 +68,37 @@ bool Visualizer::initialize() {
     glfwSetKeyCallback(window, keyCallback);
     glfwSetScrollCallback(window, scrollCallback);
 
+    if (!initializeGL(false)) {
+        return false;
+    }
+
+    // Enable VSync
+    glfwSwapInterval(1);
+
+    return true;
+}
+
+bool Visualizer::initializeHeadless() {
+    if (!offscreen.create(windowWidth, windowHeight)) {
+        return false;
+    }
+    return initializeGL(true);
+}
+
+bool Visualizer::initializeGL(bool headless) {
     // Initialize GLEW
     glewExperimental = GL_TRUE; // Enable experimental features
-    if (glewInit() != GLEW_OK) {
+    GLenum glewStatus = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // GLEW built for GLX loads the GL functions first and then fails on the missing
+    // X display, which an EGL context does not need
+    if (headless && glewStatus == GLEW_ERROR_NO_GLX_DISPLAY) {
+        glewStatus = GLEW_OK;
+    }
+#else
+    (void)headless;
+#endif
+    if (glewStatus != GLEW_OK) {
         std::cerr << "Failed to initialize GLEW" << std::endl;
         return false;
     }
@@ -69,9 +111,6 @@ bool Visualizer::initialize() {
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glClearColor(0.1f, 0.1f, 0.2f, 1.0f); // Dark blue background
 
-    // Enable VSync
-    glfwSwapInterval(1);
-
     std::cout << "OpenGL Renderer: " << glGetString(GL_RENDERER) << std::endl;
     std::cout << "OpenGL Version: " << glGetString(GL_VERSION) << std::endl;
 
@@ -90,15 +129,33 @@ void Visualizer::setupColors() {
     bodyColors[8] = Color(0.0f, 0.5f, 1.0f, 1.0f);  // Light Blue
     bodyColors[9] = Color(1.0f, 1.0f, 1.0f, 1.0f);  // White
     bodyColors[10] = Color(0.7f, 0.7f, 0.7f, 1.0f); // Gray
+
+    // Density ramp: dark purple through red and orange to near white
+    const float stops[5][3] = {
+        {0.15f, 0.05f, 0.35f}, {0.55f, 0.10f, 0.45f}, {0.90f, 0.30f, 0.20f}, {1.00f, 0.70f, 0.10f}, {1.00f, 1.00f, 0.85f}
+    };
+    splatRamp.resize(256 * 4);
+    for (int i = 0; i < 256; i++) {
+        float position = i / 255.0f * 4.0f;
+        int stop = std::min(3, static_cast<int>(position));
+        float f = position - stop;
+        for (int c = 0; c < 3; c++) {
+            float value = stops[stop][c] + f * (stops[stop + 1][c] - stops[stop][c]);
+            splatRamp[4 * i + c] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+        }
+        splatRamp[4 * i + 3] = 255;
+    }
 }
 
 bool Visualizer::loadSimulationData(const std::string& threadedFile, const std::string& mpiFile) {
     std::cout << "Loading simulation data..." << std::endl;
 
-    bool threadedLoaded = parseOutputFile(threadedFile, threadedFrames);
-    bool mpiLoaded = parseOutputFile(mpiFile, mpiFrames);
+    threadedCursor.filename = threadedFile;
+    mpiCursor.filename = mpiFile;
+    bool threadedLoaded = parseOutputFile(threadedCursor, threadedFrames);
+    bool mpiLoaded = parseOutputFile(mpiCursor, mpiFrames);
 
-    if (!threadedLoaded && !mpiLoaded) {
+    if (!threadedLoaded && !mpiLoaded && !followFiles) {
         std::cerr << "Failed to load simulation data from both files" << std::endl;
         return false;
     }
@@ -120,6 +177,10 @@ bool Visualizer::loadSimulationData(const std::string& threadedFile, const std::
     std::cout << "Total frames: " << maxFrames << std::endl;
 
     if (maxFrames == 0) {
+        if (followFiles) {
+            std::cout << "Waiting for frames..." << std::endl;
+            return true;
+        }
         std::cerr << "No simulation data loaded!" << std::endl;
         return false;
     }
@@ -129,46 +190,213 @@ bool Visualizer::loadSimulationData(const std::string& threadedFile, const std::
     return true;
 }
 
-bool Visualizer::parseOutputFile(const std::string& filename, std::vector<SimulationFrame>& frames) {
-    std::ifstream file(filename);
+bool Visualizer::pollSimulationData() {
+    size_t before = threadedFrames.size() + mpiFrames.size();
+    parseOutputFile(threadedCursor, threadedFrames);
+    parseOutputFile(mpiCursor, mpiFrames);
+    if (threadedFrames.size() + mpiFrames.size() == before) {
+        return false;
+    }
+
+    maxFrames = std::max(threadedFrames.size(), mpiFrames.size());
+    showBothSims = !threadedFrames.empty() && !mpiFrames.empty();
+    std::cout << "\nFollowing: " << threadedFrames.size() << " threaded, " << mpiFrames.size() << " MPI frames"
+              << std::endl;
+    return true;
+}
+
+double Visualizer::radiusForId(int id) {
+    // Calculate radius based on body ID (adjust based on your simulation)
+    if (id == 1) {
+        return 15.0; // Largest body
+    }
+    else if (id <= 5) {
+        return 8.0;  // Medium bodies
+    }
+    return 5.0;      // Small bodies
+}
+
+bool Visualizer::parseBinaryFile(TrajectoryCursor& cursor, std::vector<SimulationFrame>& frames) {
+    TrajectoryReader& reader = cursor.binaryReader;
+    bool initial = frames.empty();
+    if (initial && !reader.open(cursor.filename)) {
+        std::cerr << "Could not open file: " << cursor.filename << std::endl;
+        return false;
+    }
+
+    if (initial) {
+        std::cout << "Parsing binary trajectory: " << cursor.filename << std::endl;
+    }
+
+    const std::vector<int>& ids = reader.getIds();
+    int64_t numFrames = reader.getNumFrames();
+    frames.reserve(numFrames);
+
+    std::vector<Vec2> positions;
+    for (int64_t f = frames.size(); f < numFrames; f++) {
+        int64_t stepNumber;
+        if (!reader.readFrame(f, stepNumber, positions)) {
+            break;
+        }
+
+        SimulationFrame frame;
+        frame.stepNumber = static_cast<int>(stepNumber);
+        frame.bodies.resize(positions.size());
+        for (size_t i = 0; i < positions.size(); i++) {
+            frame.bodies[i].id = ids[i];
+            frame.bodies[i].position = positions[i];
+            frame.bodies[i].radius = radiusForId(ids[i]);
+            frame.summary.add(frame.bodies[i]);
+        }
+        worldSummary.add(frame.summary);
+        frames.push_back(std::move(frame));
+    }
+
+    if (initial) {
+        std::cout << "  Loaded " << frames.size() << " frames of " << reader.getNumBodies()
+                  << " bodies from " << cursor.filename << std::endl;
+    }
+
+    return !frames.empty();
+}
+
+bool Visualizer::parseCompressedFile(TrajectoryCursor& cursor, std::vector<SimulationFrame>& frames) {
+    CompressedTrajectoryReader& reader = cursor.compressedReader;
+    bool initial = frames.empty();
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    if (initial && !reader.open(cursor.filename, threads)) {
+        std::cerr << "Could not open file: " << cursor.filename << std::endl;
+        return false;
+    }
+
+    if (initial) {
+        std::cout << "Parsing compressed trajectory: " << cursor.filename << std::endl;
+    }
+
+    const std::vector<int>& ids = reader.getIds();
+    int64_t numFrames = reader.getNumFrames();
+    frames.reserve(numFrames);
+
+    // Frames in order, so each one is decoded once from the previous
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Vec2> positions;
+    for (int64_t f = frames.size(); f < numFrames; f++) {
+        int64_t stepNumber;
+        if (!reader.readFrame(f, stepNumber, positions)) {
+            break;
+        }
+
+        SimulationFrame frame;
+        frame.stepNumber = static_cast<int>(stepNumber);
+        frame.bodies.resize(positions.size());
+        for (size_t i = 0; i < positions.size(); i++) {
+            frame.bodies[i].id = ids[i];
+            frame.bodies[i].position = positions[i];
+            frame.bodies[i].radius = radiusForId(ids[i]);
+            frame.summary.add(frame.bodies[i]);
+        }
+        worldSummary.add(frame.summary);
+        frames.push_back(std::move(frame));
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (initial) {
+        std::cout << "  Loaded " << frames.size() << " frames of " << reader.getNumBodies()
+                  << " bodies from " << cursor.filename << " in " << elapsed.count() * 1000.0 << " ms";
+        if (reader.getErrorBound() > 0.0) {
+            std::cout << " (positions within " << reader.getErrorBound() << ")";
+        }
+        std::cout << std::endl;
+    }
+
+    return !frames.empty();
+}
+
+bool Visualizer::parseOutputFile(TrajectoryCursor& cursor, std::vector<SimulationFrame>& frames) {
+    if (cursor.kind == TrajectoryCursor::Kind::Unknown) {
+        if (isBinaryTrajectory(cursor.filename)) {
+            cursor.kind = TrajectoryCursor::Kind::Binary;
+        } else if (isCompressedTrajectory(cursor.filename)) {
+            cursor.kind = TrajectoryCursor::Kind::Compressed;
+        } else {
+            // An empty file may still turn out to be binary once its header is written
+            std::ifstream probe(cursor.filename);
+            if (!probe.is_open()) {
+                if (!followFiles) {
+                    std::cerr << "Could not open file: " << cursor.filename << std::endl;
+                }
+                return false;
+            }
+            if (probe.peek() == std::ifstream::traits_type::eof()) {
+                return false;
+            }
+            cursor.kind = TrajectoryCursor::Kind::Text;
+        }
+    }
+
+    switch (cursor.kind) {
+    case TrajectoryCursor::Kind::Binary:
+        return parseBinaryFile(cursor, frames);
+    case TrajectoryCursor::Kind::Compressed:
+        return parseCompressedFile(cursor, frames);
+    default:
+        return parseTextFile(cursor, frames);
+    }
+}
+
+bool Visualizer::parseTextFile(TrajectoryCursor& cursor, std::vector<SimulationFrame>& frames) {
+    std::ifstream file(cursor.filename);
     if (!file.is_open()) {
-        std::cerr << "Could not open file: " << filename << std::endl;
+        std::cerr << "Could not open file: " << cursor.filename << std::endl;
         return false;
     }
+    file.seekg(cursor.textOffset);
 
-    frames.clear();
+    bool initial = frames.empty();
     std::string line;
     SimulationFrame currentFrame;
     bool inFrame = false;
     int lineCount = 0;
 
-    std::cout << "Parsing file: " << filename << std::endl;
+    if (initial) {
+        std::cout << "Parsing file: " << cursor.filename << std::endl;
+    }
+
+    auto finishFrame = [&]() {
+        if (inFrame && !currentFrame.bodies.empty()) {
+            worldSummary.add(currentFrame.summary);
+            frames.push_back(std::move(currentFrame));
+        }
+        currentFrame = SimulationFrame();
+        inFrame = false;
+    };
 
     while (std::getline(file, line)) {
         lineCount++;
 
         // Skip empty lines
         if (line.empty()) {
-            if (inFrame && !currentFrame.bodies.empty()) {
-                frames.push_back(currentFrame);
-                inFrame = false;
+            finishFrame();
+            // Everything up to here is parsed; a later call continues after it
+            if (!file.eof()) {
+                cursor.textOffset = file.tellg();
             }
             continue;
         }
 
         // Check for step header
         if (line.substr(0, 4) == "step") {
-            if (inFrame && !currentFrame.bodies.empty()) {
-                frames.push_back(currentFrame);
+            finishFrame();
+            if (!file.eof()) {
+                cursor.textOffset = static_cast<std::streamoff>(file.tellg()) - static_cast<std::streamoff>(line.size() + 1);
             }
 
             std::istringstream iss(line);
             std::string stepWord;
             iss >> stepWord >> currentFrame.stepNumber;
-            currentFrame.bodies.clear();
             inFrame = true;
 
-            if (frames.size() % 50 == 0 && frames.size() > 0) {
+            if (initial && frames.size() % 50 == 0 && frames.size() > 0) {
                 std::cout << "  Loaded " << frames.size() << " frames..." << std::endl;
             }
         }
@@ -177,55 +405,45 @@ bool Visualizer::parseOutputFile(const std::string& filename, std::vector<Simula
             std::istringstream iss(line);
             BodyState body;
             if (iss >> body.id >> body.position.x >> body.position.y) {
-                // Calculate radius based on body ID (adjust based on your simulation)
-                if (body.id == 1) {
-                    body.radius = 15.0; // Largest body
-                }
-                else if (body.id <= 5) {
-                    body.radius = 8.0;  // Medium bodies
-                }
-                else {
-                    body.radius = 5.0;  // Small bodies
-                }
+                body.radius = radiusForId(body.id);
                 currentFrame.bodies.push_back(body);
+                currentFrame.summary.add(body);
             }
         }
     }
 
-    // Don't forget the last frame
-    if (inFrame && !currentFrame.bodies.empty()) {
-        frames.push_back(currentFrame);
+    // Don't forget the last frame. Without the empty line that ends it, a followed file
+    // may still be writing it, so it is left for the next call
+    if (!followFiles) {
+        finishFrame();
     }
 
     file.close();
 
-    std::cout << "  Parsed " << lineCount << " lines, loaded " << frames.size() << " frames from " << filename << std::endl;
+    if (initial) {
+        std::cout << "  Parsed " << lineCount << " lines, loaded " << frames.size() << " frames from "
+                  << cursor.filename << std::endl;
+    }
 
     return !frames.empty();
 }
 
 void Visualizer::calculateWorldBounds() {
-    if (threadedFrames.empty() && mpiFrames.empty()) {
+    if (worldSummary.isEmpty()) {
         std::cout << "No frames to calculate bounds from" << std::endl;
         return;
     }
 
-    minX = minY = 1e9;
-    maxX = maxY = -1e9;
+    setWorldBounds(worldSummary);
 
-    auto updateBounds = [&](const std::vector<SimulationFrame>& frames) {
-        for (const auto& frame : frames) {
-            for (const auto& body : frame.bodies) {
-                minX = std::min(minX, body.position.x - body.radius);
-                maxX = std::max(maxX, body.position.x + body.radius);
-                minY = std::min(minY, body.position.y - body.radius);
-                maxY = std::max(maxY, body.position.y + body.radius);
-            }
-        }
-        };
+    std::cout << "World bounds: (" << minX << ", " << minY << ") to (" << maxX << ", " << maxY << ")" << std::endl;
+}
 
-    updateBounds(threadedFrames);
-    updateBounds(mpiFrames);
+void Visualizer::setWorldBounds(const FrameSummary& summary) {
+    minX = summary.minX;
+    maxX = summary.maxX;
+    minY = summary.minY;
+    maxY = summary.maxY;
 
     // Add some padding
     double paddingX = (maxX - minX) * 0.1;
@@ -234,8 +452,6 @@ void Visualizer::calculateWorldBounds() {
     maxX += paddingX;
     minY -= paddingY;
     maxY += paddingY;
-
-    std::cout << "World bounds: (" << minX << ", " << minY << ") to (" << maxX << ", " << maxY << ")" << std::endl;
 }
 
 void Visualizer::render() {
@@ -260,6 +476,22 @@ void Visualizer::render() {
         return;
     }
 
+    // Frame the view from the summaries, so it follows frames as they are loaded
+    if (fitCurrentFrame) {
+        FrameSummary current;
+        if (currentFrame < static_cast<int>(threadedFrames.size())) {
+            current.add(threadedFrames[currentFrame].summary);
+        }
+        if (currentFrame < static_cast<int>(mpiFrames.size())) {
+            current.add(mpiFrames[currentFrame].summary);
+        }
+        if (!current.isEmpty()) {
+            setWorldBounds(current);
+        }
+    } else if (!worldSummary.isEmpty()) {
+        setWorldBounds(worldSummary);
+    }
+
     if (showBothSims && !threadedFrames.empty() && !mpiFrames.empty()) {
         // Draw both simulations side by side
         renderSimulation(threadedFrames, 0, windowWidth / 2.0f);
@@ -326,27 +558,225 @@ void Visualizer::renderSimulation(const std::vector<SimulationFrame>& frames, fl
 }
 
 void Visualizer::renderBodies(const std::vector<BodyState>& bodies, float offsetX, float width) {
+    if (lodEnabled) {
+        renderDensitySplat(bodies, offsetX, width);
+        return;
+    }
     for (const auto& body : bodies) {
+        drawBody(body, offsetX, width);
+    }
+}
+
+void Visualizer::drawBody(const BodyState& body, float offsetX, float width) {
+    Vec2 screenPos = worldToScreen(body.position, offsetX, width);
+
+    // Skip bodies outside viewport
+    if (screenPos.x < offsetX - 50 || screenPos.x > offsetX + width + 50 ||
+        screenPos.y < -50 || screenPos.y > windowHeight + 50) {
+        return;
+    }
+
+    // Get color for this body
+    Color color = Color(1.0f, 1.0f, 1.0f, 1.0f);  // Default white
+    auto it = bodyColors.find(body.id);
+    if (it != bodyColors.end()) {
+        color = it->second;
+    }
+
+    drawCircle(screenPos.x, screenPos.y, drawnRadius(body), color);
+}
+
+float Visualizer::drawnRadius(const BodyState& body) const {
+    // Scale radius for screen display
+    float screenRadius = static_cast<float>(body.radius * viewScale);
+    return std::max(3.0f, std::min(50.0f, screenRadius)); // Clamp radius
+}
+
+void Visualizer::renderDensitySplat(const std::vector<BodyState>& bodies, float offsetX, float width) {
+    int gridWidth = std::max(1, static_cast<int>(width));
+    int gridHeight = std::max(1, windowHeight);
+    size_t cells = static_cast<size_t>(gridWidth) * gridHeight;
+    int numBodies = static_cast<int>(bodies.size());
+
+    // Crowding is counted on a coarse grid of LOD_CELL_PIXELS cells
+    int coarseWidth = (gridWidth + LOD_CELL_PIXELS - 1) / LOD_CELL_PIXELS;
+    int coarseHeight = (gridHeight + LOD_CELL_PIXELS - 1) / LOD_CELL_PIXELS;
+    size_t coarseCells = static_cast<size_t>(coarseWidth) * coarseHeight;
+    double cellArea = static_cast<double>(LOD_CELL_PIXELS) * LOD_CELL_PIXELS;
+
+    // Threads only pay off for large frames; each one works on a contiguous range of
+    // bodies with its own grids and keeps the bodies that are drawn as circles
+    int totalThreads = std::max(1, std::min(renderThreads, numBodies / 20000));
+    splatCounts.resize(cells * totalThreads);
+    splatCells.resize(coarseCells * totalThreads);
+    splatLarge.resize(totalThreads);
+    std::vector<int> numSplatted(totalThreads, 0);
+
+    // Panel pixel of a body; false if it is off the panel
+    auto pixelOf = [&](const BodyState& body, int& px, int& py) {
         Vec2 screenPos = worldToScreen(body.position, offsetX, width);
+        double x = std::floor(screenPos.x - offsetX);
+        double y = std::floor(screenPos.y);
+        if (x < 0 || y < 0 || x >= gridWidth || y >= gridHeight) {
+            return false;
+        }
+        px = static_cast<int>(x);
+        py = static_cast<int>(y);
+        return true;
+    };
+
+    // Small bodies per coarse cell
+    auto count = [&](int t) {
+        int perThread = numBodies / totalThreads;
+        int remainder = numBodies % totalThreads;
+        int start = t * perThread + std::min(t, remainder);
+        int end = start + perThread + (t < remainder ? 1 : 0);
+        int* grid = splatCells.data() + coarseCells * t;
+        std::fill(grid, grid + coarseCells, 0);
+        for (int i = start; i < end; i++) {
+            int px, py;
+            if (drawnRadius(bodies[i]) < lodPixels && pixelOf(bodies[i], px, py)) {
+                grid[static_cast<size_t>(py / LOD_CELL_PIXELS) * coarseWidth + px / LOD_CELL_PIXELS]++;
+            }
+        }
+    };
+
+    // A small body is splatted when its cell holds enough bodies that their circles
+    // would cover the cell; a body alone in its cell, or off the panel, stays a circle
+    auto bin = [&](int t) {
+        int perThread = numBodies / totalThreads;
+        int remainder = numBodies % totalThreads;
+        int start = t * perThread + std::min(t, remainder);
+        int end = start + perThread + (t < remainder ? 1 : 0);
+        float* grid = splatCounts.data() + cells * t;
+        std::fill(grid, grid + cells, 0.0f);
+        splatLarge[t].clear();
+
+        for (int i = start; i < end; i++) {
+            const BodyState& body = bodies[i];
+            float radius = drawnRadius(body);
+            int px, py;
+            if (radius >= lodPixels || !pixelOf(body, px, py)) {
+                splatLarge[t].push_back(i);
+                continue;
+            }
+            size_t cell = static_cast<size_t>(py / LOD_CELL_PIXELS) * coarseWidth + px / LOD_CELL_PIXELS;
+            int crowd = splatCells[cell];
+            if (crowd < 2 || crowd * M_PI * radius * radius <= cellArea) {
+                splatLarge[t].push_back(i);
+                continue;
+            }
+            grid[static_cast<size_t>(py) * gridWidth + static_cast<size_t>(px)] += 1.0f;
+            numSplatted[t]++;
+        }
+    };
+
+    // Sum the grids into the first and tone-map, rows split across threads
+    std::vector<float> rowMax(totalThreads, 0.0f);
+    auto reduce = [&](int t) {
+        int perThread = gridHeight / totalThreads;
+        int remainder = gridHeight % totalThreads;
+        size_t start = static_cast<size_t>(t * perThread + std::min(t, remainder)) * gridWidth;
+        size_t end = start + static_cast<size_t>(perThread + (t < remainder ? 1 : 0)) * gridWidth;
+        float* total = splatCounts.data();
+        for (int other = 1; other < totalThreads; other++) {
+            const float* grid = splatCounts.data() + cells * other;
+            for (size_t c = start; c < end; c++) {
+                total[c] += grid[c];
+            }
+        }
+        for (size_t c = start; c < end; c++) {
+            rowMax[t] = std::max(rowMax[t], total[c]);
+        }
+    };
+
+    float maxCount = 0.0f;
+    auto toneMap = [&](int t) {
+        int perThread = gridHeight / totalThreads;
+        int remainder = gridHeight % totalThreads;
+        size_t start = static_cast<size_t>(t * perThread + std::min(t, remainder)) * gridWidth;
+        size_t end = start + static_cast<size_t>(perThread + (t < remainder ? 1 : 0)) * gridWidth;
+        // Logarithmic, so single bodies stay visible next to the densest pixel
+        float invLogMax = 255.0f / std::log1p(maxCount);
+        for (size_t c = start; c < end; c++) {
+            float count = splatCounts[c];
+            uint8_t* pixel = &splatPixels[4 * c];
+            if (count <= 0.0f) {
+                pixel[0] = pixel[1] = pixel[2] = pixel[3] = 0;
+                continue;
+            }
+            int level = std::min(255, static_cast<int>(std::log1p(count) * invLogMax));
+            std::copy(&splatRamp[4 * level], &splatRamp[4 * level] + 4, pixel);
+        }
+    };
 
-        // Skip bodies outside viewport
-        if (screenPos.x < offsetX - 50 || screenPos.x > offsetX + width + 50 ||
-            screenPos.y < -50 || screenPos.y > windowHeight + 50) {
-            continue;
+    auto runThreads = [&](const std::function<void(int)>& work) {
+        std::vector<std::thread> threads;
+        for (int t = 1; t < totalThreads; t++) {
+            threads.emplace_back(work, t);
         }
+        work(0);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    };
 
-        // Get color for this body
-        Color color = Color(1.0f, 1.0f, 1.0f, 1.0f);  // Default white
-        auto it = bodyColors.find(body.id);
-        if (it != bodyColors.end()) {
-            color = it->second;
+    runThreads(count);
+    for (int t = 1; t < totalThreads; t++) {
+        const int* grid = splatCells.data() + coarseCells * t;
+        for (size_t c = 0; c < coarseCells; c++) {
+            splatCells[c] += grid[c];
+        }
+    }
+    runThreads(bin);
+    int splatted = 0;
+    for (int count : numSplatted) {
+        splatted += count;
+    }
+    if (splatted > 0) {
+        runThreads(reduce);
+        maxCount = *std::max_element(rowMax.begin(), rowMax.end());
+        splatPixels.resize(cells * 4);
+        runThreads(toneMap);
+
+        if (!splatTexture) {
+            glGenTextures(1, &splatTexture);
+        }
+        glBindTexture(GL_TEXTURE_2D, splatTexture);
+        if (splatTextureWidth != gridWidth || splatTextureHeight != gridHeight) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, gridWidth, gridHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                         splatPixels.data());
+            splatTextureWidth = gridWidth;
+            splatTextureHeight = gridHeight;
+        } else {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, gridWidth, gridHeight, GL_RGBA, GL_UNSIGNED_BYTE,
+                            splatPixels.data());
         }
 
-        // Scale radius for screen display
-        float screenRadius = static_cast<float>(body.radius * viewScale);
-        screenRadius = std::max(3.0f, std::min(50.0f, screenRadius)); // Clamp radius
+        // One quad over the panel; grid row 0 is the top of the screen
+        glEnable(GL_TEXTURE_2D);
+        glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+        glBegin(GL_QUADS);
+        glTexCoord2f(0.0f, 0.0f);
+        glVertex2f(offsetX, 0);
+        glTexCoord2f(1.0f, 0.0f);
+        glVertex2f(offsetX + gridWidth, 0);
+        glTexCoord2f(1.0f, 1.0f);
+        glVertex2f(offsetX + gridWidth, gridHeight);
+        glTexCoord2f(0.0f, 1.0f);
+        glVertex2f(offsetX, gridHeight);
+        glEnd();
+        glDisable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
 
-        drawCircle(screenPos.x, screenPos.y, screenRadius, color);
+    // Large bodies as circles on top, in body order
+    for (const auto& large : splatLarge) {
+        for (int i : large) {
+            drawBody(bodies[i], offsetX, width);
+        }
     }
 }
 
@@ -530,6 +960,18 @@ void Visualizer::keyCallback(GLFWwindow* window, int key, int /*scancode*/, int
             vis->viewScale = 1.0;
             std::cout << "\nReset zoom" << std::endl;
             break;
+        case GLFW_KEY_F:
+            vis->fitCurrentFrame = !vis->fitCurrentFrame;
+            std::cout << "\nFraming " << (vis->fitCurrentFrame ? "the current frame" : "the whole run") << std::endl;
+            if (vis->currentFrame < static_cast<int>(vis->threadedFrames.size())) {
+                const FrameSummary& summary = vis->threadedFrames[vis->currentFrame].summary;
+                std::cout << "Centroid: " << summary.centroid() << std::endl;
+            }
+            break;
+        case GLFW_KEY_L:
+            vis->lodEnabled = !vis->lodEnabled;
+            std::cout << "\nDensity splats " << (vis->lodEnabled ? "on" : "off") << std::endl;
+            break;
         }
     }
 }
@@ -548,10 +990,16 @@ void Visualizer::run() {
     std::cout << "UP/DOWN: Increase/Decrease animation speed" << std::endl;
     std::cout << "Mouse wheel: Zoom in/out" << std::endl;
     std::cout << "1: Reset zoom to 1x" << std::endl;
+    std::cout << "L: Toggle density splats for sub-pixel bodies" << std::endl;
+    std::cout << "F: Frame the current frame / the whole run" << std::endl;
     std::cout << "ESC: Exit" << std::endl;
     std::cout << "====================================\n" << std::endl;
 
     while (!shouldClose()) {
+        if (followFiles && glfwGetTime() - lastPollTime > 1.0) {
+            lastPollTime = glfwGetTime();
+            pollSimulationData();
+        }
         pollEvents();
         handleInput();
         updateAnimation();
@@ -566,6 +1014,67 @@ void Visualizer::run() {
     }
 }
 
+bool Visualizer::exportFrames(const ExportSettings& settings) {
+    if (maxFrames == 0 || settings.fps <= 0.0 || settings.speed <= 0.0) {
+        std::cerr << "Nothing to export" << std::endl;
+        return false;
+    }
+
+    FrameEncoder encoder;
+    if (!encoder.start(settings.prefix, settings.format, windowWidth, windowHeight,
+                       settings.encoderThreads, settings.maxPending)) {
+        return false;
+    }
+    PixelReadback readback;
+    if (!readback.initialize(windowWidth, windowHeight, settings.readbackBuffers)) {
+        std::cerr << "Failed to create pixel buffer objects" << std::endl;
+        return false;
+    }
+
+    // Fixed frame rate: video frame i shows trajectory frame i * speed / fps, whatever
+    // the time it takes to render
+    int64_t numOutput = static_cast<int64_t>(std::floor((maxFrames - 1) * settings.fps / settings.speed)) + 1;
+    std::cout << "Exporting " << numOutput << " frames (" << windowWidth << "x" << windowHeight << ", "
+              << settings.fps << " fps, " << settings.encoderThreads << " encoder threads) to "
+              << settings.prefix << "_*." << imageExtension(settings.format) << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> pixels = encoder.acquireBuffer();
+    int64_t readyIndex = 0;
+    for (int64_t i = 0; i < numOutput; i++) {
+        currentFrame = std::min(maxFrames - 1, static_cast<int>(std::floor(i * settings.speed / settings.fps)));
+        render();
+        if (readback.read(i, pixels, readyIndex)) {
+            encoder.submit(readyIndex, std::move(pixels));
+            pixels = encoder.acquireBuffer();
+        }
+    }
+    while (readback.drain(pixels, readyIndex)) {
+        encoder.submit(readyIndex, std::move(pixels));
+        pixels = encoder.acquireBuffer();
+    }
+    std::chrono::duration<double, std::milli> renderLoop = std::chrono::steady_clock::now() - start;
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        std::cerr << "OpenGL Error: " << error << std::endl;
+    }
+    readback.release();
+    bool ok = encoder.finish();
+    std::chrono::duration<double, std::milli> total = std::chrono::steady_clock::now() - start;
+
+    std::cout << "  Wrote " << encoder.getFramesWritten() << " frames, " << encoder.getBytesWritten()
+              << " bytes in " << total.count() << " ms" << std::endl;
+    std::cout << "  Render loop " << renderLoop.count() / numOutput << " ms/frame, waited "
+              << encoder.getStallMs() << " ms for encoders (at most " << encoder.getMaxQueued()
+              << " queued), " << readback.getSyncWaits() << " unfinished readbacks" << std::endl;
+    if (ok) {
+        std::cout << "  ffmpeg -framerate " << settings.fps << " -i " << settings.prefix << "_%06d."
+                  << imageExtension(settings.format) << " -pix_fmt yuv420p movie.mp4" << std::endl;
+    }
+    return ok;
+}
+
 bool Visualizer::shouldClose() const {
     return glfwWindowShouldClose(window);
 }
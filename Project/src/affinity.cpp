@@ -0,0 +1,250 @@
+#include "affinity.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <sstream>
+
+// ============================================================================
+// CpuTopology Implementation
+// ============================================================================
+
+// CPUs this process may run on
+static std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    if (cpus.empty()) {
+        cpus.push_back(0);
+    }
+    return cpus;
+}
+
+CpuTopology CpuTopology::detect() {
+    CpuTopology topology;
+    std::vector<int> allowed = allowedCpus();
+    std::vector<int> nodes;
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string line;
+    if (online.is_open() && std::getline(online, line) && parseCpuList(line, nodes)) {
+        for (int node : nodes) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::vector<int> listed;
+            std::vector<int> cpus;
+            if (file.is_open() && std::getline(file, line) && parseCpuList(line, listed)) {
+                for (int cpu : listed) {
+                    if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+                        cpus.push_back(cpu);
+                    }
+                }
+            }
+            // Memory-only nodes and nodes outside our CPU set hold no workers
+            if (!cpus.empty()) {
+                topology.nodeCpus.push_back(cpus);
+            }
+        }
+    }
+    if (topology.nodeCpus.empty()) {
+        topology.nodeCpus.push_back(allowed);
+    }
+    return topology;
+}
+
+int CpuTopology::nodeOfCpu(int cpu) const {
+    for (int node = 0; node < numNodes(); node++) {
+        const std::vector<int>& cpus = nodeCpus[node];
+        if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+            return node;
+        }
+    }
+    return -1;
+}
+
+// ============================================================================
+// ThreadPlacement Implementation
+// ============================================================================
+
+ThreadPlacement::ThreadPlacement() : mode("none") {}
+
+bool ThreadPlacement::parse(const std::string& spec) {
+    CpuTopology detected = CpuTopology::detect();
+    std::vector<int> order;
+    if (spec == "none" || spec.empty()) {
+        // Unpinned
+    } else if (spec == "compact") {
+        for (const std::vector<int>& cpus : detected.nodeCpus) {
+            order.insert(order.end(), cpus.begin(), cpus.end());
+        }
+    } else if (spec == "scatter") {
+        size_t longest = 0;
+        for (const std::vector<int>& cpus : detected.nodeCpus) {
+            longest = std::max(longest, cpus.size());
+        }
+        for (size_t i = 0; i < longest; i++) {
+            for (const std::vector<int>& cpus : detected.nodeCpus) {
+                if (i < cpus.size()) {
+                    order.push_back(cpus[i]);
+                }
+            }
+        }
+    } else {
+        if (!parseCpuList(spec, order)) {
+            return false;
+        }
+        std::vector<int> allowed = allowedCpus();
+        for (int cpu : order) {
+            if (std::find(allowed.begin(), allowed.end(), cpu) == allowed.end()) {
+                return false;
+            }
+        }
+    }
+
+    mode = (spec.empty() ? "none" : spec);
+    cpus = order;
+    topology = detected;
+    return true;
+}
+
+int ThreadPlacement::cpuOf(int t) const {
+    if (cpus.empty()) {
+        return -1;
+    }
+    return cpus[t % cpus.size()];
+}
+
+bool ThreadPlacement::pin(int t) const {
+    if (cpus.empty()) {
+        return true;
+    }
+    return pinCurrentThread(cpuOf(t));
+}
+
+std::string ThreadPlacement::describe() const {
+    if (cpus.empty()) {
+        return "none";
+    }
+    std::ostringstream os;
+    os << mode << " (CPUs";
+    for (size_t i = 0; i < cpus.size() && i < 16; i++) {
+        os << (i == 0 ? " " : ",") << cpus[i];
+    }
+    if (cpus.size() > 16) {
+        os << ",...";
+    }
+    os << " on " << topology.numNodes() << " NUMA node" << (topology.numNodes() == 1 ? "" : "s") << ")";
+    return os.str();
+}
+
+// ============================================================================
+// ScopedThreadAffinity Implementation
+// ============================================================================
+
+ScopedThreadAffinity::ScopedThreadAffinity(const ThreadPlacement& placement) : saved(false) {
+    CPU_ZERO(&mask);
+    if (placement.isEnabled()) {
+        saved = (pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask) == 0);
+    }
+}
+
+ScopedThreadAffinity::~ScopedThreadAffinity() {
+    if (saved) {
+        pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    }
+}
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+bool parseCpuList(const std::string& text, std::vector<int>& cpus) {
+    std::vector<int> result;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        item.erase(std::remove_if(item.begin(), item.end(), ::isspace), item.end());
+        if (item.empty()) {
+            continue;
+        }
+        size_t dash = item.find('-');
+        try {
+            int first = std::stoi(item.substr(0, dash));
+            int last = (dash == std::string::npos) ? first : std::stoi(item.substr(dash + 1));
+            if (first < 0 || last < first || last >= CPU_SETSIZE) {
+                return false;
+            }
+            for (int cpu = first; cpu <= last; cpu++) {
+                result.push_back(cpu);
+            }
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    if (result.empty()) {
+        return false;
+    }
+    cpus = result;
+    return true;
+}
+
+bool pinCurrentThread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+// Whole pages inside [data, data + bytes)
+static bool pageRange(void* data, size_t bytes, char*& begin, size_t& length) {
+    uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t start = reinterpret_cast<uintptr_t>(data);
+    uintptr_t first = (start + page - 1) / page * page;
+    uintptr_t last = (start + bytes) / page * page;
+    if (data == nullptr || last <= first) {
+        return false;
+    }
+    begin = reinterpret_cast<char*>(first);
+    length = last - first;
+    return true;
+}
+
+bool adviseHugePages(void* data, size_t bytes) {
+#ifdef MADV_HUGEPAGE
+    char* begin;
+    size_t length;
+    if (!pageRange(data, bytes, begin, length)) {
+        return true;
+    }
+    return madvise(begin, length, MADV_HUGEPAGE) == 0;
+#else
+    (void)data;
+    (void)bytes;
+    return false;
+#endif
+}
+
+bool touchPages(void* data, size_t bytes) {
+#ifdef MADV_POPULATE_WRITE
+    char* begin;
+    size_t length;
+    if (!pageRange(data, bytes, begin, length)) {
+        return true;
+    }
+    return madvise(begin, length, MADV_POPULATE_WRITE) == 0;
+#else
+    (void)data;
+    (void)bytes;
+    return false;
+#endif
+}
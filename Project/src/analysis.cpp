@@ -0,0 +1,250 @@
+#include "analysis.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+static const char MAP_MAGIC[4] = {'N', 'B', 'M', 'P'};
+static const int32_t MAP_VERSION = 1;
+
+// Cell of a position in the map, -1 outside it. The range is checked in double,
+// so far-away and NaN positions are never converted to int
+static int mapCell(const Vec2& position, const AnalysisSettings& settings) {
+    double scale = settings.grid / (2.0 * settings.extent);
+    double x = std::floor((position.x + settings.extent) * scale);
+    double y = std::floor((position.y + settings.extent) * scale);
+    if (!(x >= 0.0 && x < settings.grid && y >= 0.0 && y < settings.grid)) {
+        return -1;
+    }
+    return static_cast<int>(y) * settings.grid + static_cast<int>(x);
+}
+
+static bool openMap(std::ofstream& file, const std::string& name, const AnalysisSettings& settings) {
+    file.open(settings.prefix + "_" + name + ".bin", std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    AnalysisMapHeader header;
+    std::memcpy(header.magic, MAP_MAGIC, sizeof(header.magic));
+    header.version = MAP_VERSION;
+    header.grid = settings.grid;
+    header.reserved = 0;
+    header.extent = settings.extent;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return file.good();
+}
+
+static void writeMapFrame(std::ofstream& file, const Snapshot& snapshot, const std::vector<float>& values) {
+    int64_t step = snapshot.step;
+    file.write(reinterpret_cast<const char*>(&step), sizeof(step));
+    file.write(reinterpret_cast<const char*>(&snapshot.time), sizeof(snapshot.time));
+    file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+}
+
+std::unique_ptr<Analysis> createAnalysis(const std::string& name) {
+    if (name == "density") {
+        return std::unique_ptr<Analysis>(new DensityMap());
+    } else if (name == "dispersion") {
+        return std::unique_ptr<Analysis>(new DispersionMap());
+    } else if (name == "radial") {
+        return std::unique_ptr<Analysis>(new RadialProfile());
+    }
+    return nullptr;
+}
+
+// ============================================================================
+// DensityMap Implementation
+// ============================================================================
+
+bool DensityMap::open(const AnalysisSettings& newSettings) {
+    settings = newSettings;
+    values.assign(static_cast<size_t>(settings.grid) * settings.grid, 0.0f);
+    return openMap(file, name(), settings);
+}
+
+void DensityMap::analyse(const Snapshot& snapshot) {
+    std::vector<double> mass(values.size(), 0.0);
+    for (const Body& body : snapshot.bodies) {
+        int cell = mapCell(body.position, settings);
+        if (cell >= 0) {
+            mass[cell] += body.mass;
+        }
+    }
+    double cellSize = 2.0 * settings.extent / settings.grid;
+    double invArea = 1.0 / (cellSize * cellSize);
+    for (size_t c = 0; c < values.size(); c++) {
+        values[c] = static_cast<float>(mass[c] * invArea);
+    }
+    writeMapFrame(file, snapshot, values);
+}
+
+void DensityMap::close() {
+    file.close();
+}
+
+// ============================================================================
+// DispersionMap Implementation
+// ============================================================================
+
+bool DispersionMap::open(const AnalysisSettings& newSettings) {
+    settings = newSettings;
+    values.assign(static_cast<size_t>(settings.grid) * settings.grid, 0.0f);
+    return openMap(file, name(), settings);
+}
+
+void DispersionMap::analyse(const Snapshot& snapshot) {
+    size_t cells = values.size();
+    mass.assign(cells, 0.0);
+    vx.assign(cells, 0.0);
+    vy.assign(cells, 0.0);
+    v2.assign(cells, 0.0);
+    count.assign(cells, 0);
+    for (const Body& body : snapshot.bodies) {
+        int cell = mapCell(body.position, settings);
+        if (cell < 0) {
+            continue;
+        }
+        mass[cell] += body.mass;
+        vx[cell] += body.mass * body.velocity.x;
+        vy[cell] += body.mass * body.velocity.y;
+        v2[cell] += body.mass * body.velocity.lengthSquared();
+        count[cell]++;
+    }
+    for (size_t c = 0; c < cells; c++) {
+        if (count[c] < 2 || mass[c] <= 0.0) {
+            values[c] = 0.0f;
+            continue;
+        }
+        double meanX = vx[c] / mass[c];
+        double meanY = vy[c] / mass[c];
+        double variance = v2[c] / mass[c] - (meanX * meanX + meanY * meanY);
+        values[c] = static_cast<float>(std::sqrt(std::max(0.0, 0.5 * variance)));
+    }
+    writeMapFrame(file, snapshot, values);
+}
+
+void DispersionMap::close() {
+    file.close();
+}
+
+// ============================================================================
+// RadialProfile Implementation
+// ============================================================================
+
+bool RadialProfile::open(const AnalysisSettings& newSettings) {
+    settings = newSettings;
+    file.open(settings.prefix + "_" + name() + ".csv");
+    if (!file.is_open()) {
+        return false;
+    }
+    file << "step,time,r_inner,r_outer,count,mass,enclosed_mass,surface_density\n";
+    file.precision(9);
+    return file.good();
+}
+
+void RadialProfile::analyse(const Snapshot& snapshot) {
+    Vec2 center;
+    double totalMass = 0.0;
+    for (const Body& body : snapshot.bodies) {
+        center += body.position * body.mass;
+        totalMass += body.mass;
+    }
+    if (totalMass > 0.0) {
+        center = center / totalMass;
+    }
+
+    int bins = settings.bins;
+    double width = settings.extent / bins;
+    std::vector<double> mass(bins, 0.0);
+    std::vector<int> count(bins, 0);
+    for (const Body& body : snapshot.bodies) {
+        // Checked in double first, as for the maps
+        double radius = (body.position - center).length();
+        if (!(radius < settings.extent)) {
+            continue;
+        }
+        int bin = static_cast<int>(radius / width);
+        if (bin < bins) {
+            mass[bin] += body.mass;
+            count[bin]++;
+        }
+    }
+
+    const double pi = 3.14159265358979323846;
+    double enclosed = 0.0;
+    for (int b = 0; b < bins; b++) {
+        double inner = b * width;
+        double outer = (b + 1) * width;
+        enclosed += mass[b];
+        file << snapshot.step << "," << snapshot.time << "," << inner << "," << outer << ","
+             << count[b] << "," << mass[b] << "," << enclosed << ","
+             << mass[b] / (pi * (outer * outer - inner * inner)) << "\n";
+    }
+}
+
+void RadialProfile::close() {
+    file.close();
+}
+
+// ============================================================================
+// AnalysisPipeline Implementation
+// ============================================================================
+
+AnalysisPipeline::AnalysisPipeline() : interval(0), numSnapshots(0), waitMs(0.0) {}
+
+AnalysisPipeline::~AnalysisPipeline() {
+    finish();
+}
+
+void AnalysisPipeline::configure(const AnalysisSettings& newSettings, const std::vector<Body>& bodies) {
+    settings = newSettings;
+    settings.grid = std::max(1, settings.grid);
+    settings.bins = std::max(1, settings.bins);
+    if (settings.extent <= 0.0) {
+        double largest = 0.0;
+        for (const Body& body : bodies) {
+            largest = std::max(largest, std::max(std::abs(body.position.x), std::abs(body.position.y)));
+        }
+        settings.extent = (largest > 0.0) ? 1.05 * largest : 1.0;
+    }
+}
+
+bool AnalysisPipeline::add(std::unique_ptr<Analysis> analysis) {
+    if (!analysis || !analysis->open(settings)) {
+        return false;
+    }
+    analyses.push_back(std::move(analysis));
+    return true;
+}
+
+void AnalysisPipeline::wait() {
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void AnalysisPipeline::submit(int step, double time, const std::vector<Body>& bodies) {
+    auto waitStart = std::chrono::steady_clock::now();
+    wait();
+    std::chrono::duration<double, std::milli> waited = std::chrono::steady_clock::now() - waitStart;
+    waitMs += waited.count();
+
+    snapshot.step = step;
+    snapshot.time = time;
+    snapshot.bodies.assign(bodies.begin(), bodies.end());
+    numSnapshots++;
+    for (auto& analysis : analyses) {
+        Analysis* worker = analysis.get();
+        workers.emplace_back([this, worker]() { worker->analyse(snapshot); });
+    }
+}
+
+void AnalysisPipeline::finish() {
+    wait();
+    for (auto& analysis : analyses) {
+        analysis->close();
+    }
+    analyses.clear();
+}
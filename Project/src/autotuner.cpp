@@ -0,0 +1,223 @@
+#include "autotuner.h"
+#include "simulation.h"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+// Search grid
+static const double TUNE_THETAS[] = {0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 1.0};
+static const int TUNE_LEAF_SIZES[] = {1, 4, 8, 16};
+
+// The direct sum is only timed up to this N (its cost grows as N^2)
+static const int DIRECT_MAX_BODIES = 8192;
+
+TuneCandidate::TuneCandidate()
+    : solver(ForceSolver::Tree), theta(0.5), leafSize(1), threads(1), forceMs(0.0), errorP99(0.0) {}
+
+std::ostream& operator<<(std::ostream& os, const TuneCandidate& candidate) {
+    os << forceSolverName(candidate.solver);
+    if (candidate.solver == ForceSolver::Tree) {
+        os << " theta=" << candidate.theta << " leaf=" << candidate.leafSize;
+    }
+    os << " threads=" << candidate.threads;
+    return os;
+}
+
+// p99 force error of the tree currently in sim.tree at the given theta, on the
+// sampled targets only
+static double treeError(Simulation& sim, double theta, const std::vector<int>& targets,
+                        const std::vector<Vec2>& reference) {
+    std::vector<Vec2> forces(targets.size());
+    for (size_t k = 0; k < targets.size(); k++) {
+        Body probe = sim.bodies[targets[k]];
+        probe.resetForce();
+        QuadTree::calculateForce(sim.tree.nodes.data(), sim.tree.leafBodies.data(), 0, probe, targets[k],
+                                 theta, sim.gravitationalConstant, sim.softening, sim.forceKernel,
+                                 &sim.periodicBox);
+        forces[k] = probe.force;
+    }
+    return computeForceError(forces.data(), reference.data(), static_cast<int>(targets.size())).p99;
+}
+
+// ============================================================================
+// Autotuner Implementation
+// ============================================================================
+
+Autotuner::Autotuner()
+    : enabled(false), errorBudget(0.01), interval(200), samples(500), drift(0.3),
+      tuned(false), numTunes(0), lastCheckStep(0), costSum(0.0), costSteps(0), maxThreads(1) {}
+
+void Autotuner::apply(Simulation& sim, const TuneCandidate& candidate) {
+    sim.solver = candidate.solver;
+    sim.theta = candidate.theta;
+    sim.leafSize = candidate.leafSize;
+    sim.numThreads = candidate.threads;
+}
+
+double Autotuner::timeForces(Simulation& sim) {
+    // Worker threads must not write into the profiler's step records here
+    bool profiling = sim.profiler.isEnabled();
+    sim.profiler.setEnabled(false);
+
+    // Repeat short runs so the timer resolution does not dominate
+    int reps = 0;
+    double totalMs = 0.0;
+    do {
+        auto start = std::chrono::steady_clock::now();
+        sim.prepareForces();
+        sim.calculateForcesParallel();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        totalMs += elapsed.count();
+        reps++;
+    } while (totalMs < 2.0 && reps < 50);
+
+    sim.profiler.setEnabled(profiling);
+    return totalMs / reps;
+}
+
+void Autotuner::maybeTune(Simulation& sim, int stepNumber) {
+    if (!enabled || sim.bodies.empty()) {
+        return;
+    }
+    if (!tuned) {
+        maxThreads = std::max(1, sim.numThreads);
+        std::cout << "Autotune at step " << stepNumber << ": ";
+        tune(sim, std::cout);
+        lastCheckStep = stepNumber;
+        return;
+    }
+    if (interval <= 0 || stepNumber - lastCheckStep < interval) {
+        return;
+    }
+
+    lastCheckStep = stepNumber;
+    if (drifted(sim)) {
+        std::cout << "Autotune at step " << stepNumber << " (distribution changed): ";
+        tune(sim, std::cout);
+    }
+}
+
+void Autotuner::recordStep(double forceMs) {
+    costSum += forceMs;
+    costSteps++;
+}
+
+bool Autotuner::drifted(Simulation& sim) {
+    double meanMs = (costSteps > 0) ? costSum / costSteps : choice.forceMs;
+    costSum = 0.0;
+    costSteps = 0;
+    if (choice.forceMs > 0.0 && std::abs(meanMs / choice.forceMs - 1.0) > drift) {
+        return true;
+    }
+    if (choice.solver == ForceSolver::Direct) {
+        return false;
+    }
+
+    // The same theta can become too coarse when bodies cluster
+    std::vector<int> targets;
+    sampleBodies(static_cast<int>(sim.bodies.size()), std::max(16, samples / 8), targets);
+    std::vector<Vec2> reference(targets.size());
+    sim.calculateReferenceForces(targets.data(), static_cast<int>(targets.size()), reference.data());
+    sim.buildTree();
+    return treeError(sim, choice.theta, targets, reference) > errorBudget;
+}
+
+void Autotuner::tune(Simulation& sim, std::ostream& os) {
+    int numBodies = static_cast<int>(sim.bodies.size());
+    numTunes++;
+
+    std::vector<int> targets;
+    sampleBodies(numBodies, samples, targets);
+    std::vector<Vec2> reference(targets.size());
+    sim.numThreads = maxThreads;
+    sim.calculateReferenceForces(targets.data(), static_cast<int>(targets.size()), reference.data());
+
+    // 1. Largest admissible theta for each leaf size
+    std::vector<TuneCandidate> trees;
+    for (int leafSize : TUNE_LEAF_SIZES) {
+        TuneCandidate candidate;
+        candidate.leafSize = leafSize;
+        candidate.threads = maxThreads;
+        candidate.theta = TUNE_THETAS[0];
+        sim.leafSize = leafSize;
+        sim.buildTree();
+        candidate.errorP99 = treeError(sim, candidate.theta, targets, reference);
+        for (double theta : TUNE_THETAS) {
+            double error = treeError(sim, theta, targets, reference);
+            if (error > errorBudget) {
+                break;
+            }
+            candidate.theta = theta;
+            candidate.errorP99 = error;
+        }
+        trees.push_back(candidate);
+    }
+
+    // 2. Time each leaf size at its theta. A leaf size that is over the budget even
+    // at the smallest theta is not a candidate
+    TuneCandidate best;
+    best.forceMs = -1.0;
+    for (TuneCandidate& candidate : trees) {
+        if (candidate.errorP99 > errorBudget) {
+            continue;
+        }
+        apply(sim, candidate);
+        candidate.forceMs = timeForces(sim);
+        if (best.forceMs < 0.0 || candidate.forceMs < best.forceMs) {
+            best = candidate;
+        }
+    }
+
+    // 3. Thread count for the winner (spawning threads costs more than tiny N saves)
+    std::vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+    bool treeWithinBudget = (best.forceMs >= 0.0);
+    TuneCandidate bestTree = best;
+    for (int threads : threadCounts) {
+        if (!treeWithinBudget || threads == maxThreads) {
+            continue;
+        }
+        TuneCandidate candidate = bestTree;
+        candidate.threads = threads;
+        apply(sim, candidate);
+        candidate.forceMs = timeForces(sim);
+        if (candidate.forceMs < best.forceMs) {
+            best = candidate;
+        }
+    }
+
+    // 4. Direct sum for small N, and as the only choice within the budget when no
+    // tree setting is (then only at the maximum thread count, it is costly)
+    if (!treeWithinBudget && numBodies > DIRECT_MAX_BODIES) {
+        std::cerr << "Warning: no tree setting reaches autotune_error = " << errorBudget
+                  << ", using the direct sum" << std::endl;
+        threadCounts.assign(1, maxThreads);
+    }
+    if (numBodies <= DIRECT_MAX_BODIES || !treeWithinBudget) {
+        for (int threads : threadCounts) {
+            TuneCandidate candidate;
+            candidate.solver = ForceSolver::Direct;
+            candidate.theta = best.theta;
+            candidate.leafSize = best.leafSize;
+            candidate.threads = threads;
+            candidate.errorP99 = 0.0;
+            apply(sim, candidate);
+            candidate.forceMs = timeForces(sim);
+            if (best.forceMs < 0.0 || candidate.forceMs < best.forceMs) {
+                best = candidate;
+            }
+        }
+    }
+
+    choice = best;
+    apply(sim, choice);
+    tuned = true;
+    costSum = 0.0;
+    costSteps = 0;
+
+    os << choice << " (" << choice.forceMs << " ms per step, p99 force error "
+       << choice.errorP99 << ", budget " << errorBudget << ")" << std::endl;
+}
@@ -0,0 +1,751 @@
+// File: Project/src/bench.cpp
+// Benchmark driver: runs Simulation::step over generated inputs and sweeps size,
+// thread count, theta and (optionally) MPI rank count, plus the bare 2D and 3D
+// tree (build and force walk) at the same sizes, and the memory bandwidth between
+// each pair of NUMA nodes. Results go to a JSON file so runs can be compared
+// between commits.
+#include "simulation.h"
+#include "generator.h"
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct BenchOptions {
+    std::vector<int> sizes;
+    std::vector<int> threads;
+    std::vector<double> thetas;
+    std::vector<int> mpiRanks;
+    std::vector<int> dimensions; // tree-only dimension sweep (2 and/or 3)
+    int steps;
+    int strongSize;        // N for strong scaling and theta sweeps
+    int weakSizePerWorker; // N per thread/rank for weak scaling
+    int directMaxSize;     // largest N also run with the direct-sum solver
+    int errorSamples;      // bodies checked against the direct sum in the theta sweep
+    int bandwidthMiB;      // buffer of the bandwidth sweep, 0 = skip it
+    double theta;
+    std::string distribution;
+    std::string kernel;    // force_kernel of every run
+    std::string affinity;  // thread_affinity of every threaded run
+    std::string output;
+    std::string mpiCommand;
+
+    BenchOptions()
+        : sizes{1000, 10000, 100000, 1000000, 10000000},
+          thetas{0.3, 0.5, 0.7, 1.0},
+          dimensions{2, 3},
+          steps(5),
+          strongSize(100000),
+          weakSizePerWorker(20000),
+          directMaxSize(20000),
+          errorSamples(1000),
+          bandwidthMiB(256),
+          theta(0.5),
+          distribution("disk"),
+          kernel("exact"),
+          affinity("none"),
+          output("bench.json"),
+          mpiCommand("mpirun -np %d ./nbody_mpi") {
+        int hardware = std::max(1u, std::thread::hardware_concurrency());
+        for (int t = 1; t < hardware; t *= 2) {
+            threads.push_back(t);
+        }
+        threads.push_back(hardware);
+    }
+};
+
+struct BenchResult {
+    std::string sweep;
+    std::string solver;
+    int numBodies;
+    int dimensions;
+    int threads;
+    int ranks;
+    double theta;
+    int steps;
+    double secondsPerStep;
+    double interactionsPerStep;
+    long peakRssKiB;
+    double efficiency;  // scaling sweeps only, 0 otherwise
+    ForceErrorStats forceError;  // theta sweep only, 0 samples otherwise
+};
+
+// Read bandwidth of one node's CPUs from memory first touched on another node
+struct BandwidthResult {
+    int cpuNode;
+    int memoryNode;
+    int threads;
+    double gigabytesPerSecond;
+};
+
+// Peak RSS of one run: resetPeakRss() before it, peakRssKiB() after. Writing 5 to
+// clear_refs resets VmHWM to the current RSS (Linux 4.0 and later). Without it the
+// value is the process high-water mark, which only the largest run so far sets
+static void resetPeakRss() {
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    clearRefs.close();
+    static bool warned = false;
+    if (!clearRefs && !warned) {
+        std::cerr << "Warning: could not reset the peak RSS, peak_rss_kib is the process high-water mark"
+                  << std::endl;
+        warned = true;
+    }
+}
+
+static long peakRssKiB() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::stol(line.substr(6));
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// The launcher pattern with its single %d replaced by the rank count; false if the
+// pattern has no %d or more than one
+static bool expandMpiCommand(const std::string& pattern, int ranks, std::string& command) {
+    size_t at = pattern.find("%d");
+    if (at == std::string::npos || pattern.find("%d", at + 2) != std::string::npos) {
+        return false;
+    }
+    command = pattern.substr(0, at) + std::to_string(ranks) + pattern.substr(at + 2);
+    return true;
+}
+
+static BenchResult runThreaded(const std::string& sweep, int numBodies, int threads, double theta,
+                               const BenchOptions& options, ForceSolver solver = ForceSolver::Tree,
+                               bool measureError = false) {
+    resetPeakRss();
+    Simulation sim;
+    sim.solver = solver;
+    parseForceKernel(options.kernel, sim.forceKernel);
+    sim.timeStep = 0.001;
+    sim.theta = theta;
+    sim.softening = 0.1;
+    sim.gravitationalConstant = 1.0;
+    sim.numThreads = threads;
+    sim.placement.parse(options.affinity);
+    std::vector<Body> generated;
+    generateBodies(generated, numBodies, options.distribution, 42, sim.gravitationalConstant);
+    sim.placeBodies(generated);
+    sim.placeTree();
+
+    // Warm-up step with counters on gives the interaction count of the workload
+    sim.profiler.setEnabled(true);
+    sim.step(0);
+    double interactions = static_cast<double>(sim.profiler.getSteps().back().walk.interactions);
+    sim.profiler.setEnabled(false);
+
+    // Accuracy of the warm-up step's forces (not part of the timing)
+    ForceErrorStats forceError;
+    if (measureError) {
+        sim.forceErrorSamples = options.errorSamples;
+        forceError = sim.measureForceError();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int s = 1; s <= options.steps; s++) {
+        sim.step(s);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    BenchResult result;
+    result.sweep = sweep;
+    result.solver = forceSolverName(solver);
+    result.numBodies = numBodies;
+    result.dimensions = 2;
+    result.threads = threads;
+    result.ranks = 1;
+    result.theta = theta;
+    result.steps = options.steps;
+    result.secondsPerStep = elapsed.count() / options.steps;
+    result.interactionsPerStep = interactions;
+    result.peakRssKiB = peakRssKiB();
+    result.efficiency = 0.0;
+    result.forceError = forceError;
+    return result;
+}
+
+// Run nbody_mpi on a generated config and read back its CSV profile.
+// Step time is the slowest rank's compute + communication time (output excluded).
+static bool runMpi(const std::string& sweep, int numBodies, int ranks, const BenchOptions& options,
+                   BenchResult& result) {
+    std::string configName = "bench_mpi_config.txt";
+    std::string reportName = "bench_mpi_profile.csv";
+    {
+        std::ofstream config(configName);
+        config << "time_step = 0.001\n"
+               << "num_steps = " << options.steps << "\n"
+               << "theta = " << options.theta << "\n"
+               << "softening = 0.1\n"
+               << "gravitational_constant = 1.0\n"
+               << "num_threads = 1\n"
+               << "profile = true\n"
+               << "profile_report = " << reportName << "\n"
+               << "generate_bodies = " << numBodies << "\n"
+               << "generate_distribution = " << options.distribution << "\n"
+               << "force_kernel = " << options.kernel << "\n";
+    }
+    std::remove(reportName.c_str());
+
+    std::string command;
+    if (!expandMpiCommand(options.mpiCommand, ranks, command)) {
+        std::cerr << "--mpi-command needs exactly one %d: " << options.mpiCommand << std::endl;
+        return false;
+    }
+    std::string fullCommand = command + " " + configName + " /dev/null > /dev/null";
+    if (std::system(fullCommand.c_str()) != 0) {
+        std::cerr << "MPI run failed: " << fullCommand << std::endl;
+        return false;
+    }
+
+    std::ifstream report(reportName);
+    if (!report.is_open()) {
+        std::cerr << "No MPI profile report: " << reportName << std::endl;
+        return false;
+    }
+
+    // rank,step,<one column per phase>,nodes_visited,interactions,tree_depth,tree_nodes,peak_rss_kib,...
+    std::map<int, double> slowest;
+    std::map<int, double> interactions;
+    long peakRss = 0;
+    std::string line;
+    std::getline(report, line);
+    while (std::getline(report, line)) {
+        std::vector<double> fields;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, ',')) {
+            fields.push_back(std::stod(field));
+        }
+        if (fields.size() < static_cast<size_t>(2 + NUM_PHASES + 5)) {
+            continue;
+        }
+        int step = static_cast<int>(fields[1]);
+        double ms = 0.0;
+        for (int p = 0; p < NUM_PHASES; p++) {
+            if (static_cast<Phase>(p) != Phase::Output) {
+                ms += fields[2 + p];
+            }
+        }
+        slowest[step] = std::max(slowest[step], ms);
+        interactions[step] += fields[2 + NUM_PHASES + 1];
+        // Each rank is its own process, so its high-water mark belongs to this run
+        peakRss = std::max(peakRss, static_cast<long>(fields[2 + NUM_PHASES + 4]));
+    }
+    if (slowest.empty()) {
+        return false;
+    }
+
+    double totalMs = 0.0;
+    double totalInteractions = 0.0;
+    for (const auto& entry : slowest) {
+        totalMs += entry.second;
+        totalInteractions += interactions[entry.first];
+    }
+
+    result.sweep = sweep;
+    result.solver = "tree";
+    result.numBodies = numBodies;
+    result.dimensions = 2;
+    result.threads = 1;
+    result.ranks = ranks;
+    result.theta = options.theta;
+    result.steps = static_cast<int>(slowest.size());
+    result.secondsPerStep = totalMs / 1000.0 / slowest.size();
+    result.interactionsPerStep = totalInteractions / slowest.size();
+    result.peakRssKiB = peakRss;
+    result.efficiency = 0.0;
+    report.close();
+    std::remove(configName.c_str());
+    std::remove(reportName.c_str());
+    return true;
+}
+
+// Uniform bodies in the cube [-radius, radius]^D with the masses of generateBodies
+template <int D>
+static void generateCube(std::vector<BasicBody<D>>& bodies, int count, unsigned int seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_real_distribution<double> massDist(1.0, 5.0);
+    double radius = 100.0;
+    bodies.reserve(count);
+    for (int i = 0; i < count; i++) {
+        Vec<D> position;
+        for (int d = 0; d < D; d++) {
+            position[d] = (2.0 * unit(rng) - 1.0) * radius;
+        }
+        bodies.emplace_back(i, massDist(rng), position, Vec<D>());
+    }
+}
+
+// Relative error of the tree forces on sampled bodies against the softened direct sum
+template <int D>
+static ForceErrorStats treeForceError(const std::vector<BasicBody<D>>& bodies, int samples,
+                                      double G, double softening) {
+    int numBodies = static_cast<int>(bodies.size());
+    std::vector<int> targets;
+    sampleBodies(numBodies, samples, targets);
+    std::vector<double> errors;
+    for (int i : targets) {
+        Vec<D> reference;
+        for (int j = 0; j < numBodies; j++) {
+            if (j == i) {
+                continue;
+            }
+            Vec<D> diff = bodies[j].position - bodies[i].position;
+            double distSquared = diff.lengthSquared() + softening * softening;
+            double invDist = 1.0 / std::sqrt(distSquared);
+            reference += diff * (G * bodies[i].mass * bodies[j].mass * invDist * invDist * invDist);
+        }
+        if (reference.length() > 0.0) {
+            errors.push_back((bodies[i].force - reference).length() / reference.length());
+        }
+    }
+
+    ForceErrorStats stats;
+    if (errors.empty()) {
+        return stats;
+    }
+    std::sort(errors.begin(), errors.end());
+    // Nearest-rank percentile, as in computeForceError
+    auto percentile = [&errors](double p) {
+        size_t rank = static_cast<size_t>(std::ceil(p * errors.size()));
+        return errors[std::min(errors.size() - 1, rank > 0 ? rank - 1 : 0)];
+    };
+    stats.samples = static_cast<int>(errors.size());
+    stats.p50 = percentile(0.50);
+    stats.p90 = percentile(0.90);
+    stats.p99 = percentile(0.99);
+    stats.max = errors.back();
+    return stats;
+}
+
+// Build and walk of the D-dimensional tree alone (no integration), one thread.
+// Both dimensions use the same uniform cube so the 2D and 3D rows are comparable
+template <int D>
+static BenchResult runTree(int numBodies, const BenchOptions& options) {
+    resetPeakRss();
+    ForceKernel kernel = ForceKernel::Exact;
+    parseForceKernel(options.kernel, kernel);
+    double G = 1.0;
+    double softening = 0.1;
+    std::vector<BasicBody<D>> bodies;
+    generateCube<D>(bodies, numBodies, 42);
+    OrthTree<D> tree;
+
+    // Warm-up step with counters, then the accuracy of its forces (not timed)
+    WalkStats stats;
+    tree.build(bodies);
+    tree.calculateForces(bodies, 0, numBodies, options.theta, G, softening, &stats, kernel);
+    ForceErrorStats forceError = treeForceError(bodies, options.errorSamples, G, softening);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int s = 1; s <= options.steps; s++) {
+        tree.build(bodies);
+        tree.calculateForces(bodies, 0, numBodies, options.theta, G, softening, nullptr, kernel);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    BenchResult result;
+    result.sweep = "dimension";
+    result.solver = "tree";
+    result.numBodies = numBodies;
+    result.dimensions = D;
+    result.threads = 1;
+    result.ranks = 1;
+    result.theta = options.theta;
+    result.steps = options.steps;
+    result.secondsPerStep = elapsed.count() / options.steps;
+    result.interactionsPerStep = static_cast<double>(stats.interactions);
+    result.peakRssKiB = peakRssKiB();
+    result.efficiency = 0.0;
+    result.forceError = forceError;
+    return result;
+}
+
+// Run worker(k) on threads pinned to cpus[k] and wait for them. The main thread
+// only waits, so it stays unpinned for the sweeps that follow
+template <typename Worker>
+static void runPinned(const std::vector<int>& cpus, Worker worker) {
+    std::vector<std::thread> threads;
+    for (size_t k = 0; k < cpus.size(); k++) {
+        threads.emplace_back([&cpus, &worker, k]() {
+            pinCurrentThread(cpus[k]);
+            worker(static_cast<int>(k));
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Sum of values[start, end) with four chains, so the loads and not the adds bound it
+static double sumRange(const double* values, size_t start, size_t end) {
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    size_t i = start;
+    for (; i + 4 <= end; i += 4) {
+        s0 += values[i];
+        s1 += values[i + 1];
+        s2 += values[i + 2];
+        s3 += values[i + 3];
+    }
+    for (; i < end; i++) {
+        s0 += values[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+// For every pair of NUMA nodes: a buffer is first touched by all CPUs of the memory
+// node, then read by all CPUs of the CPU node, each thread streaming its own slice.
+// Best of several passes, in GB/s. The diagonal is the local bandwidth of a socket
+static std::vector<BandwidthResult> measureBandwidth(const BenchOptions& options) {
+    std::vector<BandwidthResult> results;
+    CpuTopology topology = CpuTopology::detect();
+    size_t count = static_cast<size_t>(options.bandwidthMiB) * 1024 * 1024 / sizeof(double);
+    const int passes = 5;
+
+    for (int memoryNode = 0; memoryNode < topology.numNodes(); memoryNode++) {
+        const std::vector<int>& owners = topology.nodeCpus[memoryNode];
+        // new[] leaves the pages unallocated, so the fill below places them
+        std::unique_ptr<double[]> buffer(new double[count]);
+        double* values = buffer.get();
+        int numOwners = static_cast<int>(owners.size());
+        runPinned(owners, [&](int k) {
+            size_t start = count * k / numOwners;
+            size_t end = count * (k + 1) / numOwners;
+            std::fill(values + start, values + end, 1.0);
+        });
+
+        for (int cpuNode = 0; cpuNode < topology.numNodes(); cpuNode++) {
+            const std::vector<int>& readers = topology.nodeCpus[cpuNode];
+            int numReaders = static_cast<int>(readers.size());
+            std::vector<double> sums(numReaders, 0.0);
+            double best = 0.0;
+            for (int pass = 0; pass < passes; pass++) {
+                auto start = std::chrono::steady_clock::now();
+                runPinned(readers, [&](int k) {
+                    sums[k] += sumRange(values, count * k / numReaders, count * (k + 1) / numReaders);
+                });
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                best = std::max(best, count * sizeof(double) / elapsed.count() / 1e9);
+            }
+            // Every element is 1.0, so the sums check that the reads happened
+            double total = 0.0;
+            for (double sum : sums) {
+                total += sum;
+            }
+            if (total != static_cast<double>(count) * passes) {
+                std::cerr << "Warning: bandwidth check sum mismatch" << std::endl;
+            }
+            results.push_back({cpuNode, memoryNode, numReaders, best});
+        }
+    }
+    return results;
+}
+
+static void printBandwidth(const BandwidthResult& r) {
+    std::cout << std::left << std::setw(15) << "bandwidth" << std::right
+              << " cpu_node=" << r.cpuNode
+              << " memory_node=" << r.memoryNode
+              << " threads=" << std::setw(3) << r.threads
+              << std::fixed << std::setprecision(2)
+              << "  GB/s=" << std::setw(8) << r.gigabytesPerSecond
+              << std::defaultfloat << std::endl;
+}
+
+static void printResult(const BenchResult& r) {
+    std::cout << std::left << std::setw(15) << r.sweep << std::setw(7) << r.solver << std::right
+              << " N=" << std::setw(9) << r.numBodies
+              << " D=" << r.dimensions
+              << " threads=" << std::setw(3) << r.threads
+              << " ranks=" << std::setw(3) << r.ranks
+              << " theta=" << std::setw(4) << r.theta
+              << std::fixed << std::setprecision(4)
+              << "  steps/s=" << std::setw(10) << 1.0 / r.secondsPerStep << std::setprecision(2)
+              << "  Minteractions/s=" << std::setw(9) << r.interactionsPerStep / r.secondsPerStep / 1e6;
+    if (r.efficiency > 0.0) {
+        std::cout << "  eff=" << std::setw(5) << r.efficiency;
+    }
+    if (r.forceError.samples > 0) {
+        std::cout << std::scientific << std::setprecision(2)
+                  << "  err p50=" << r.forceError.p50 << " p99=" << r.forceError.p99;
+    }
+    std::cout << std::defaultfloat << std::endl;
+}
+
+static bool writeResults(const std::string& filename, const std::vector<BenchResult>& results,
+                         const std::vector<BandwidthResult>& bandwidth, const BenchOptions& options) {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open benchmark output: " << filename << std::endl;
+        return false;
+    }
+
+    file << std::setprecision(9);
+    file << "{\n";
+    file << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    file << "  \"distribution\": \"" << options.distribution << "\",\n";
+    file << "  \"precision\": \"" << forcePrecisionName() << "\",\n";
+    file << "  \"force_kernel\": \"" << options.kernel << "\",\n";
+    file << "  \"thread_affinity\": \"" << options.affinity << "\",\n";
+    file << "  \"steps_per_run\": " << options.steps << ",\n";
+    file << "  \"runs\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        file << "    {\"sweep\": \"" << r.sweep << "\""
+             << ", \"solver\": \"" << r.solver << "\""
+             << ", \"n\": " << r.numBodies
+             << ", \"dimensions\": " << r.dimensions
+             << ", \"threads\": " << r.threads
+             << ", \"ranks\": " << r.ranks
+             << ", \"theta\": " << r.theta
+             << ", \"steps\": " << r.steps
+             << ", \"seconds_per_step\": " << r.secondsPerStep
+             << ", \"steps_per_second\": " << 1.0 / r.secondsPerStep
+             << ", \"interactions_per_step\": " << r.interactionsPerStep
+             << ", \"interactions_per_second\": " << r.interactionsPerStep / r.secondsPerStep
+             << ", \"peak_rss_kib\": " << r.peakRssKiB
+             << ", \"efficiency\": " << r.efficiency
+             << ", \"force_error_samples\": " << r.forceError.samples
+             << ", \"force_error_p50\": " << r.forceError.p50
+             << ", \"force_error_p90\": " << r.forceError.p90
+             << ", \"force_error_p99\": " << r.forceError.p99
+             << ", \"force_error_max\": " << r.forceError.max
+             << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ],\n";
+    file << "  \"bandwidth\": [\n";
+    for (size_t i = 0; i < bandwidth.size(); i++) {
+        const BandwidthResult& r = bandwidth[i];
+        file << "    {\"cpu_node\": " << r.cpuNode
+             << ", \"memory_node\": " << r.memoryNode
+             << ", \"threads\": " << r.threads
+             << ", \"mib\": " << options.bandwidthMiB
+             << ", \"gb_per_second\": " << r.gigabytesPerSecond
+             << "}" << (i + 1 < bandwidth.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    return true;
+}
+
+template <typename T>
+static std::vector<T> parseList(const std::string& text) {
+    std::vector<T> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            values.push_back(static_cast<T>(std::stod(item)));
+        }
+    }
+    return values;
+}
+
+void printUsage(const char* programName) {
+    std::cout << "Usage: " << programName << " [options]" << std::endl;
+    std::cout << "  --sizes N1,N2,...     Body counts for the size sweep (default: 1000,10000,100000,1000000,10000000)" << std::endl;
+    std::cout << "  --threads T1,T2,...   Thread counts for scaling sweeps (default: powers of two up to cores)" << std::endl;
+    std::cout << "  --thetas A,B,...      Opening angles for the theta sweep (default: 0.3,0.5,0.7,1.0)" << std::endl;
+    std::cout << "  --steps K             Timed steps per run (default: 5)" << std::endl;
+    std::cout << "  --strong-n N          N for strong scaling and theta sweeps (default: 100000)" << std::endl;
+    std::cout << "  --weak-n N            N per thread/rank for weak scaling (default: 20000)" << std::endl;
+    std::cout << "  --direct-max-n N      Also run the direct-sum solver for sizes up to N (default: 20000)" << std::endl;
+    std::cout << "  --error-samples S     Bodies checked against the direct sum in the theta sweep (default: 1000)" << std::endl;
+    std::cout << "  --distribution D     disk | uniform | plummer (default: disk)" << std::endl;
+    std::cout << "  --kernel K            exact | rsqrt (default: exact)" << std::endl;
+    std::cout << "  --affinity SPEC       thread_affinity of the threaded runs: none | compact | scatter | CPU list (default: none)" << std::endl;
+    std::cout << "  --bandwidth-mib M     Buffer of the per-node bandwidth sweep, 0 to skip it (default: 256)" << std::endl;
+    std::cout << "  --dims D1,D2          Dimensions of the tree-only sweep over --sizes (default: 2,3)" << std::endl;
+    std::cout << "  --mpi-ranks R1,R2,... Also sweep nbody_mpi over these rank counts" << std::endl;
+    std::cout << "  --mpi-command CMD     MPI launcher, one %d for the rank count (default: \"mpirun -np %d ./nbody_mpi\")" << std::endl;
+    std::cout << "  --output FILE         Results file (default: bench.json)" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--sizes") {
+            options.sizes = parseList<int>(value);
+        } else if (arg == "--threads") {
+            options.threads = parseList<int>(value);
+        } else if (arg == "--thetas") {
+            options.thetas = parseList<double>(value);
+        } else if (arg == "--steps") {
+            options.steps = std::max(1, std::stoi(value));
+        } else if (arg == "--strong-n") {
+            options.strongSize = std::stoi(value);
+        } else if (arg == "--weak-n") {
+            options.weakSizePerWorker = std::stoi(value);
+        } else if (arg == "--direct-max-n") {
+            options.directMaxSize = std::stoi(value);
+        } else if (arg == "--error-samples") {
+            options.errorSamples = std::stoi(value);
+        } else if (arg == "--distribution") {
+            options.distribution = value;
+        } else if (arg == "--kernel") {
+            ForceKernel kernel;
+            if (!parseForceKernel(value, kernel)) {
+                std::cerr << "Unknown kernel: " << value << std::endl;
+                return 1;
+            }
+            options.kernel = value;
+        } else if (arg == "--affinity") {
+            ThreadPlacement placement;
+            if (!placement.parse(value)) {
+                std::cerr << "Unknown or unavailable affinity: " << value << std::endl;
+                return 1;
+            }
+            options.affinity = value;
+        } else if (arg == "--bandwidth-mib") {
+            options.bandwidthMiB = std::max(0, std::stoi(value));
+        } else if (arg == "--dims") {
+            options.dimensions = parseList<int>(value);
+            for (int d : options.dimensions) {
+                if (d != 2 && d != 3) {
+                    std::cerr << "Unsupported dimension: " << d << " (2 or 3)" << std::endl;
+                    return 1;
+                }
+            }
+        } else if (arg == "--mpi-ranks") {
+            options.mpiRanks = parseList<int>(value);
+        } else if (arg == "--mpi-command") {
+            std::string command;
+            if (!expandMpiCommand(value, 1, command)) {
+                std::cerr << "--mpi-command needs exactly one %d for the rank count: " << value << std::endl;
+                return 1;
+            }
+            options.mpiCommand = value;
+        } else if (arg == "--output") {
+            options.output = value;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::sort(options.sizes.begin(), options.sizes.end());
+    std::sort(options.threads.begin(), options.threads.end());
+    int maxThreads = options.threads.empty() ? 1 : options.threads.back();
+
+    std::cout << "=== N-Body Benchmark ===" << std::endl;
+    std::vector<BenchResult> results;
+
+    // 1. Problem size
+    for (int n : options.sizes) {
+        results.push_back(runThreaded("size", n, maxThreads, options.theta, options));
+        printResult(results.back());
+    }
+
+    // 1b. Direct sum over the same sizes, to locate the crossover with the tree
+    for (int n : options.sizes) {
+        if (n <= options.directMaxSize) {
+            results.push_back(runThreaded("size", n, maxThreads, options.theta, options, ForceSolver::Direct));
+            printResult(results.back());
+        }
+    }
+
+    // 2. Strong scaling: fixed N, efficiency = (T_base * p_base) / (T_p * p)
+    size_t strongBase = results.size();
+    for (int t : options.threads) {
+        BenchResult r = runThreaded("strong_threads", options.strongSize, t, options.theta, options);
+        const BenchResult& base = (results.size() > strongBase) ? results[strongBase] : r;
+        r.efficiency = (base.secondsPerStep * base.threads) / (r.secondsPerStep * t);
+        results.push_back(r);
+        printResult(r);
+    }
+
+    // 3. Weak scaling: N grows with p, efficiency = T_base / T_p
+    size_t weakBase = results.size();
+    for (int t : options.threads) {
+        BenchResult r = runThreaded("weak_threads", options.weakSizePerWorker * t, t, options.theta, options);
+        const BenchResult& base = (results.size() > weakBase) ? results[weakBase] : r;
+        r.efficiency = base.secondsPerStep / r.secondsPerStep;
+        results.push_back(r);
+        printResult(r);
+    }
+
+    // 4. Opening angle, with the force error against the direct sum
+    for (double theta : options.thetas) {
+        results.push_back(runThreaded("theta", options.strongSize, maxThreads, theta, options,
+                                      ForceSolver::Tree, true));
+        printResult(results.back());
+    }
+
+    // 5. Bare tree in 2D and 3D over the same sizes
+    for (int n : options.sizes) {
+        for (int d : options.dimensions) {
+            results.push_back(d == 3 ? runTree<3>(n, options) : runTree<2>(n, options));
+            printResult(results.back());
+        }
+    }
+
+    // 6. MPI ranks (strong and weak), one process launch per run
+    size_t mpiStrongBase = results.size();
+    for (int ranks : options.mpiRanks) {
+        BenchResult r;
+        if (!runMpi("strong_ranks", options.strongSize, ranks, options, r)) {
+            continue;
+        }
+        const BenchResult& base = (results.size() > mpiStrongBase) ? results[mpiStrongBase] : r;
+        r.efficiency = (base.secondsPerStep * base.ranks) / (r.secondsPerStep * ranks);
+        results.push_back(r);
+        printResult(r);
+    }
+    size_t mpiWeakBase = results.size();
+    for (int ranks : options.mpiRanks) {
+        BenchResult r;
+        if (!runMpi("weak_ranks", options.weakSizePerWorker * ranks, ranks, options, r)) {
+            continue;
+        }
+        const BenchResult& base = (results.size() > mpiWeakBase) ? results[mpiWeakBase] : r;
+        r.efficiency = base.secondsPerStep / r.secondsPerStep;
+        results.push_back(r);
+        printResult(r);
+    }
+
+    // 7. Memory bandwidth per socket and between sockets
+    std::vector<BandwidthResult> bandwidth;
+    if (options.bandwidthMiB > 0) {
+        bandwidth = measureBandwidth(options);
+        for (const BandwidthResult& r : bandwidth) {
+            printBandwidth(r);
+        }
+    }
+
+    if (!writeResults(options.output, results, bandwidth, options)) {
+        return 1;
+    }
+    std::cout << "Results written to: " << options.output << std::endl;
+    return 0;
+}
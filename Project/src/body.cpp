@@ -1,30 +1,40 @@
 #include "body.h"
 #include <cmath>
 
-Body::Body() 
-    : id(0), mass(1.0), position(0, 0), velocity(0, 0), acceleration(0, 0), force(0, 0) {}
+template <int D>
+BasicBody<D>::BasicBody()
+    : id(0), mass(1.0), position(), velocity(), acceleration(), force() {}
 
-Body::Body(int id, double mass, const Vec2& position, const Vec2& velocity)
-    : id(id), mass(mass), position(position), velocity(velocity), acceleration(0, 0), force(0, 0) {}
+template <int D>
+BasicBody<D>::BasicBody(int id, double mass, const Vec<D>& position, const Vec<D>& velocity)
+    : id(id), mass(mass), position(position), velocity(velocity), acceleration(), force() {}
 
-void Body::resetForce() {
-    force = Vec2(0, 0);
+template <int D>
+void BasicBody<D>::resetForce() {
+    force = Vec<D>();
 }
 
-void Body::updateAcceleration() {
+template <int D>
+void BasicBody<D>::updateAcceleration() {
     if (mass > 0) {
         acceleration = force / mass;
     }
 }
 
-void Body::updateVelocity(double dt) {
+template <int D>
+void BasicBody<D>::updateVelocity(double dt) {
     velocity += acceleration * dt;
 }
 
-void Body::updatePosition(double dt) {
+template <int D>
+void BasicBody<D>::updatePosition(double dt) {
     position += velocity * dt;
 }
 
-double Body::getVisualRadius() const {
+template <int D>
+double BasicBody<D>::getVisualRadius() const {
     return std::sqrt(mass);
 }
+
+template class BasicBody<2>;
+template class BasicBody<3>;
@@ -1,4 +1,5 @@
 #include "config.h"
+#include "generator.h"
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -13,7 +14,49 @@ Config::Config()
       gravitationalConstant(1.0),
       windowWidth(800),
       windowHeight(800),
-      numThreads(4) {}
+      numThreads(4),
+      threadAffinity("none"),
+      hugePages(false),
+      solver("tree"),
+      forceKernel("exact"),
+      forceErrorInterval(0),
+      forceErrorSamples(0),
+      diagnosticsInterval(0),
+      deterministicReductions(false),
+      leafSize(1),
+      treeRefit(false),
+      treeRebuildFraction(0.1),
+      interactionLists(false),
+      interactionListSteps(4),
+      interactionListMargin(0.1),
+      interactionGroupSize(16),
+      blockTimesteps(false),
+      blockMaxLevel(6),
+      blockEta(0.025),
+      periodicBox(0.0),
+      mergers(false),
+      mergeRadius(0.0),
+      mergeRadiusScale(1.0),
+      autotune(false),
+      autotuneError(0.01),
+      autotuneInterval(200),
+      autotuneSamples(500),
+      outputFormat("text"),
+      trajectoryError(0.0),
+      analysisInterval(1),
+      analysisGrid(128),
+      analysisBins(64),
+      analysisExtent(0.0),
+      analysisPrefix("analysis"),
+      profile(false),
+      profileReport("profile.json"),
+      mpiWireFormat("double"),
+      mpiSharedTree(false),
+      ensembleSize(1),
+      ensemblePerturbation(0.0),
+      generateCount(0),
+      generateDistribution("disk"),
+      generateSeed(42) {}
 
 std::string Config::trim(const std::string& str) const {
     size_t first = str.find_first_not_of(" \t\r\n");
@@ -22,6 +65,12 @@ std::string Config::trim(const std::string& str) const {
     return str.substr(first, last - first + 1);
 }
 
+bool Config::parseBool(const std::string& value) const {
+    std::string v = value;
+    std::transform(v.begin(), v.end(), v.begin(), ::tolower);
+    return v == "true" || v == "yes" || v == "on" || v == "1";
+}
+
 void Config::parseKeyValue(const std::string& key, const std::string& value) {
     std::string k = trim(key);
     std::string v = trim(value);
@@ -46,6 +95,94 @@ void Config::parseKeyValue(const std::string& key, const std::string& value) {
         windowHeight = std::stoi(v);
     } else if (keyLower == "num_threads" || keyLower == "numthreads") {
         numThreads = std::stoi(v);
+    } else if (keyLower == "thread_affinity") {
+        threadAffinity = v;
+    } else if (keyLower == "huge_pages") {
+        hugePages = parseBool(v);
+    } else if (keyLower == "solver") {
+        solver = v;
+    } else if (keyLower == "force_kernel") {
+        forceKernel = v;
+    } else if (keyLower == "diagnostics_interval") {
+        diagnosticsInterval = std::stoi(v);
+    } else if (keyLower == "deterministic_reductions") {
+        deterministicReductions = parseBool(v);
+    } else if (keyLower == "force_error_interval") {
+        forceErrorInterval = std::stoi(v);
+    } else if (keyLower == "force_error_samples") {
+        forceErrorSamples = std::stoi(v);
+    } else if (keyLower == "leaf_size") {
+        leafSize = std::stoi(v);
+    } else if (keyLower == "tree_refit") {
+        treeRefit = parseBool(v);
+    } else if (keyLower == "tree_rebuild_fraction") {
+        treeRebuildFraction = std::stod(v);
+    } else if (keyLower == "interaction_lists") {
+        interactionLists = parseBool(v);
+    } else if (keyLower == "interaction_list_steps") {
+        interactionListSteps = std::stoi(v);
+    } else if (keyLower == "interaction_list_margin") {
+        interactionListMargin = std::stod(v);
+    } else if (keyLower == "interaction_group_size") {
+        interactionGroupSize = std::stoi(v);
+    } else if (keyLower == "block_timesteps") {
+        blockTimesteps = parseBool(v);
+    } else if (keyLower == "block_max_level") {
+        blockMaxLevel = std::stoi(v);
+    } else if (keyLower == "block_eta") {
+        blockEta = std::stod(v);
+    } else if (keyLower == "periodic_box") {
+        periodicBox = std::stod(v);
+    } else if (keyLower == "mergers") {
+        mergers = parseBool(v);
+    } else if (keyLower == "merge_radius") {
+        mergeRadius = std::stod(v);
+    } else if (keyLower == "merge_radius_scale") {
+        mergeRadiusScale = std::stod(v);
+    } else if (keyLower == "autotune") {
+        autotune = parseBool(v);
+    } else if (keyLower == "autotune_error") {
+        autotuneError = std::stod(v);
+    } else if (keyLower == "autotune_interval") {
+        autotuneInterval = std::stoi(v);
+    } else if (keyLower == "autotune_samples") {
+        autotuneSamples = std::stoi(v);
+    } else if (keyLower == "ensemble_size") {
+        ensembleSize = std::stoi(v);
+    } else if (keyLower == "ensemble_perturbation") {
+        ensemblePerturbation = std::stod(v);
+    } else if (keyLower == "ensemble_sweep") {
+        ensembleSweep = v;
+    } else if (keyLower == "generate_bodies") {
+        generateCount = std::stoi(v);
+    } else if (keyLower == "generate_distribution") {
+        generateDistribution = v;
+    } else if (keyLower == "generate_seed") {
+        generateSeed = static_cast<unsigned int>(std::stoul(v));
+    } else if (keyLower == "output_format") {
+        outputFormat = v;
+    } else if (keyLower == "trajectory_error") {
+        trajectoryError = std::stod(v);
+    } else if (keyLower == "analysis") {
+        analysis = (v == "none") ? "" : v;
+    } else if (keyLower == "analysis_interval") {
+        analysisInterval = std::stoi(v);
+    } else if (keyLower == "analysis_grid") {
+        analysisGrid = std::stoi(v);
+    } else if (keyLower == "analysis_bins") {
+        analysisBins = std::stoi(v);
+    } else if (keyLower == "analysis_extent") {
+        analysisExtent = std::stod(v);
+    } else if (keyLower == "analysis_prefix") {
+        analysisPrefix = v;
+    } else if (keyLower == "profile") {
+        profile = parseBool(v);
+    } else if (keyLower == "profile_report") {
+        profileReport = v;
+    } else if (keyLower == "mpi_wire_format") {
+        mpiWireFormat = v;
+    } else if (keyLower == "mpi_shared_tree") {
+        mpiSharedTree = parseBool(v);
     }
 }
 
@@ -102,6 +239,18 @@ bool Config::loadFromFile(const std::string& filename) {
     }
     
     file.close();
+
+    // Append generated bodies once all parameters (e.g. G) are known
+    if (generateCount > 0) {
+        int firstId = 1;
+        for (const auto& body : bodies) {
+            firstId = std::max(firstId, body.id + 1);
+        }
+        if (!generateBodies(bodies, generateCount, generateDistribution, generateSeed,
+                            gravitationalConstant, 300.0, firstId)) {
+            return false;
+        }
+    }
     return true;
 }
 
@@ -114,11 +263,81 @@ void Config::print() const {
     std::cout << "Gravitational Constant: " << gravitationalConstant << std::endl;
     std::cout << "Window: " << windowWidth << "x" << windowHeight << std::endl;
     std::cout << "Num Threads: " << numThreads << std::endl;
+    if (threadAffinity != "none" || hugePages) {
+        std::cout << "Thread Affinity: " << threadAffinity << (hugePages ? ", huge pages" : "") << std::endl;
+    }
+    std::cout << "Solver: " << solver << " (leaf size " << leafSize << ", " << forceKernel << " kernel)" << std::endl;
+    if (treeRefit) {
+        std::cout << "Tree Refit: rebuild after " << treeRebuildFraction * 100.0 << "% of bodies changed cell" << std::endl;
+    }
+    if (interactionLists) {
+        std::cout << "Interaction Lists: groups of " << interactionGroupSize << " bodies, reused for "
+                  << interactionListSteps << " steps, theta margin " << interactionListMargin << std::endl;
+    }
+    if (blockTimesteps) {
+        std::cout << "Block Timesteps: " << blockMaxLevel << " levels below time step, eta " << blockEta << std::endl;
+    }
+    if (periodicBox > 0.0) {
+        std::cout << "Periodic Box: " << periodicBox << " (Ewald-corrected images)" << std::endl;
+    }
+    if (mergers) {
+        std::cout << "Mergers: collision radius ";
+        if (mergeRadius > 0.0) {
+            std::cout << mergeRadius << std::endl;
+        } else {
+            std::cout << mergeRadiusScale << " * sqrt(mass)" << std::endl;
+        }
+    }
+    if (autotune) {
+        std::cout << "Autotune: error budget " << autotuneError << ", check every "
+                  << autotuneInterval << " steps" << std::endl;
+    }
+    if (diagnosticsInterval > 0) {
+        std::cout << "Diagnostics: every " << diagnosticsInterval << " steps"
+                  << (deterministicReductions ? ", deterministic sums" : "") << std::endl;
+    }
+    if (forceErrorInterval > 0) {
+        std::cout << "Force Error Check: every " << forceErrorInterval << " steps, "
+                  << (forceErrorSamples > 0 ? std::to_string(forceErrorSamples) : "all") << " bodies" << std::endl;
+    }
+    std::cout << "Output Format: " << outputFormat;
+    if (outputFormat == "compressed") {
+        std::cout << (trajectoryError > 0.0 ? ", error <= " + std::to_string(trajectoryError) : ", lossless");
+    }
+    std::cout << std::endl;
+    if (!analysis.empty()) {
+        std::cout << "Analysis: " << analysis << " every " << analysisInterval << " steps -> "
+                  << analysisPrefix << "_*" << std::endl;
+    }
+    std::cout << "Profile: " << (profile ? profileReport : "off") << std::endl;
+    std::cout << "MPI Wire Format: " << mpiWireFormat << std::endl;
+    std::cout << "MPI Shared Tree: " << (mpiSharedTree ? "yes" : "no") << std::endl;
+    if (ensembleSize > 1) {
+        std::cout << "Ensemble: " << ensembleSize << " members";
+        if (ensemblePerturbation > 0.0) {
+            std::cout << ", perturbation " << ensemblePerturbation;
+        }
+        if (!ensembleSweep.empty()) {
+            std::cout << ", sweep " << ensembleSweep;
+        }
+        std::cout << std::endl;
+    }
     std::cout << "Bodies: " << bodies.size() << std::endl;
     
-    for (const auto& body : bodies) {
+    if (generateCount > 0) {
+        std::cout << "Generated: " << generateCount << " (" << generateDistribution
+                  << ", seed " << generateSeed << ")" << std::endl;
+    }
+    
+    // Listing every body is only useful for small systems
+    const size_t maxListed = 100;
+    for (size_t i = 0; i < bodies.size() && i < maxListed; i++) {
+        const Body& body = bodies[i];
         std::cout << "  Body " << body.id << ": mass=" << body.mass 
                   << " pos=" << body.position << " vel=" << body.velocity << std::endl;
     }
+    if (bodies.size() > maxListed) {
+        std::cout << "  ... " << (bodies.size() - maxListed) << " more" << std::endl;
+    }
     std::cout << "=====================" << std::endl;
 }
@@ -0,0 +1,70 @@
+#include "diagnostics.h"
+#include <algorithm>
+#include <cmath>
+
+Diagnostics::Diagnostics()
+    : step(0), mass(0.0), kinetic(0.0), potential(0.0), momentum(0, 0), angularMomentum(0.0),
+      hasPotential(true) {}
+
+void Diagnostics::add(const Diagnostics& other) {
+    mass += other.mass;
+    kinetic += other.kinetic;
+    potential += other.potential;
+    momentum += other.momentum;
+    angularMomentum += other.angularMomentum;
+}
+
+void Diagnostics::toArray(double* fields) const {
+    fields[0] = mass;
+    fields[1] = kinetic;
+    fields[2] = potential;
+    fields[3] = momentum.x;
+    fields[4] = momentum.y;
+    fields[5] = angularMomentum;
+}
+
+void Diagnostics::fromArray(const double* fields) {
+    mass = fields[0];
+    kinetic = fields[1];
+    potential = fields[2];
+    momentum = Vec2(fields[3], fields[4]);
+    angularMomentum = fields[5];
+}
+
+Diagnostics measureBodies(const Body* bodies, int startIdx, int endIdx) {
+    Diagnostics result;
+    for (int i = startIdx; i < endIdx; i++) {
+        const Body& body = bodies[i];
+        result.mass += body.mass;
+        result.kinetic += 0.5 * body.mass * body.velocity.lengthSquared();
+        result.momentum += body.velocity * body.mass;
+        result.angularMomentum += body.mass * (body.position.x * body.velocity.y -
+                                               body.position.y * body.velocity.x);
+    }
+    return result;
+}
+
+double energyDrift(const Diagnostics& current, const Diagnostics& first) {
+    double reference = std::abs(first.energy());
+    return (reference > 0.0) ? std::abs(current.energy() - first.energy()) / reference : 0.0;
+}
+
+double maxEnergyDrift(const std::vector<Diagnostics>& records) {
+    double drift = 0.0;
+    for (const Diagnostics& record : records) {
+        drift = std::max(drift, energyDrift(record, records.front()));
+    }
+    return drift;
+}
+
+void printDiagnostics(std::ostream& os, const Diagnostics& current, const Diagnostics& first) {
+    os << "Diagnostics at step " << current.step << ": ";
+    if (current.hasPotential) {
+        os << "E=" << current.energy() << " (K=" << current.kinetic << " U=" << current.potential
+           << "), dE/E0=" << energyDrift(current, first);
+    } else {
+        os << "K=" << current.kinetic;
+    }
+    os << ", P=(" << current.momentum.x << ", " << current.momentum.y << ")"
+       << ", L=" << current.angularMomentum << std::endl;
+}
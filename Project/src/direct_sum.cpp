@@ -0,0 +1,247 @@
+#include "direct_sum.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+
+// Targets per tile. Fixed so the vectorised loop has a constant trip count and no
+// remainder; the last tile of a range is padded with far-away dummy targets.
+static const int TARGET_TILE = 64;
+
+// Sources per block: 3 doubles each, 24 KiB stays in L1 across all target tiles
+static const int SOURCE_BLOCK = 1024;
+
+bool parseForceSolver(const std::string& name, ForceSolver& solver) {
+    if (name == "tree") {
+        solver = ForceSolver::Tree;
+    } else if (name == "direct") {
+        solver = ForceSolver::Direct;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* forceSolverName(ForceSolver solver) {
+    switch (solver) {
+        case ForceSolver::Tree: return "tree";
+        case ForceSolver::Direct: return "direct";
+    }
+    return "unknown";
+}
+
+// Accumulate sum_j m_j * d / (|d|^2 + eps2)^(3/2) for one tile of targets over one
+// block of sources. Coincident points (the target itself) contribute nothing.
+NBODY_KERNEL_CLONES
+static void accumulateTile(const double* __restrict tx, const double* __restrict ty,
+                           double* __restrict ax, double* __restrict ay,
+                           const double* __restrict sx, const double* __restrict sy,
+                           const double* __restrict sm, int numSources, double eps2) {
+    for (int j = 0; j < numSources; j++) {
+        const double xj = sx[j];
+        const double yj = sy[j];
+        const double mj = sm[j];
+        for (int i = 0; i < TARGET_TILE; i++) {
+            double dx = xj - tx[i];
+            double dy = yj - ty[i];
+            double r2 = dx * dx + dy * dy;
+            double distSquared = r2 + eps2;
+            double dist = std::sqrt(distSquared);
+            // Computed unconditionally and then masked, so the loop stays branch-free
+            double scale = mj / (distSquared * dist);
+            scale = (r2 > 0.0) ? scale : 0.0;
+            ax[i] += dx * scale;
+            ay[i] += dy * scale;
+        }
+    }
+}
+
+// Field sum_j m_j * d / |d|^3 at each target position, tiled and blocked
+static void directField(const double* x, const double* y, const double* mass, int numSources,
+                        const Vec2* targets, int count, double eps2, Vec2* field) {
+    alignas(64) double tx[TARGET_TILE];
+    alignas(64) double ty[TARGET_TILE];
+    std::vector<double> ax(static_cast<size_t>(count + TARGET_TILE), 0.0);
+    std::vector<double> ay(static_cast<size_t>(count + TARGET_TILE), 0.0);
+
+    for (int blockStart = 0; blockStart < numSources; blockStart += SOURCE_BLOCK) {
+        int blockSize = std::min(SOURCE_BLOCK, numSources - blockStart);
+        for (int tileStart = 0; tileStart < count; tileStart += TARGET_TILE) {
+            int tileSize = std::min(TARGET_TILE, count - tileStart);
+            for (int i = 0; i < TARGET_TILE; i++) {
+                // Padding targets sit far away and their results are discarded
+                tx[i] = (i < tileSize) ? targets[tileStart + i].x : 1e30;
+                ty[i] = (i < tileSize) ? targets[tileStart + i].y : 1e30;
+            }
+            accumulateTile(tx, ty, &ax[tileStart], &ay[tileStart],
+                           x + blockStart, y + blockStart, mass + blockStart, blockSize, eps2);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        field[i] = Vec2(ax[i], ay[i]);
+    }
+}
+
+// Periodic field at each target position: nearest image (softened) plus the Ewald
+// correction, summed over the sources in index order
+static void periodicField(const double* x, const double* y, const double* mass, int numSources,
+                          const Vec2* targets, int count, double eps2, const PeriodicBox& box, Vec2* field) {
+    for (int i = 0; i < count; i++) {
+        Vec2 sum(0, 0);
+        for (int j = 0; j < numSources; j++) {
+            Vec2 d = box.minimumImage(Vec2(x[j] - targets[i].x, y[j] - targets[i].y));
+            double r2 = d.lengthSquared();
+            if (r2 == 0.0) {
+                continue;
+            }
+            double distSquared = r2 + eps2;
+            double invDistCubed = 1.0 / (distSquared * std::sqrt(distSquared));
+            sum += (d * invDistCubed + box.ewaldCorrection(d)) * mass[j];
+        }
+        field[i] = sum;
+    }
+}
+
+// ============================================================================
+// DirectSum Implementation
+// ============================================================================
+
+DirectSum::DirectSum() : periodic(nullptr), external(nullptr), numSources(0) {}
+
+void DirectSum::attach(double* storage, int numBodies) {
+    std::vector<double>().swap(owned);
+    external = storage;
+    numSources = numBodies;
+}
+
+void DirectSum::load(const Body* bodies, int numBodies) {
+    if (!external) {
+        owned.resize(3 * static_cast<size_t>(numBodies));
+        numSources = numBodies;
+    }
+    double* sx = external ? external : owned.data();
+    double* sy = sx + numSources;
+    double* sm = sy + numSources;
+    for (int i = 0; i < numBodies; i++) {
+        sx[i] = bodies[i].position.x;
+        sy[i] = bodies[i].position.y;
+        sm[i] = bodies[i].mass;
+    }
+}
+
+void DirectSum::calculateForces(Body* bodies, int startIdx, int endIdx, double G, double softening,
+                                WalkStats* stats) const {
+    int count = endIdx - startIdx;
+    if (count <= 0) {
+        return;
+    }
+
+    const double* sx = x();
+    const double* sy = y();
+    std::vector<Vec2> targets(count);
+    for (int i = 0; i < count; i++) {
+        targets[i] = Vec2(sx[startIdx + i], sy[startIdx + i]);
+    }
+    std::vector<Vec2> field(count);
+    if (periodic && periodic->isEnabled()) {
+        periodicField(sx, sy, mass(), getNumBodies(), targets.data(), count,
+                      softening * softening, *periodic, field.data());
+    } else {
+        directField(sx, sy, mass(), getNumBodies(), targets.data(), count,
+                    softening * softening, field.data());
+    }
+
+    for (int i = 0; i < count; i++) {
+        Body& body = bodies[startIdx + i];
+        body.force = field[i] * (G * body.mass);
+    }
+
+    if (stats) {
+        stats->nodesVisited += static_cast<long long>(count) * getNumBodies();
+        stats->interactions += static_cast<long long>(count) * (getNumBodies() - 1);
+    }
+}
+
+void DirectSum::calculateForces(const int* targets, int count, Vec2* forces, double G, double softening) const {
+    const double* sx = x();
+    const double* sy = y();
+    const double* sm = mass();
+    std::vector<Vec2> positions(count);
+    for (int k = 0; k < count; k++) {
+        positions[k] = Vec2(sx[targets[k]], sy[targets[k]]);
+    }
+    if (periodic && periodic->isEnabled()) {
+        periodicField(sx, sy, sm, getNumBodies(), positions.data(), count,
+                      softening * softening, *periodic, forces);
+    } else {
+        directField(sx, sy, sm, getNumBodies(), positions.data(), count,
+                    softening * softening, forces);
+    }
+
+    for (int k = 0; k < count; k++) {
+        forces[k] *= G * sm[targets[k]];
+    }
+}
+
+double DirectSum::calculatePotential(int startIdx, int endIdx, double G, double softening) const {
+    double eps2 = softening * softening;
+    const double* sx = x();
+    const double* sy = y();
+    const double* sm = mass();
+    double sum = 0.0;
+    for (int i = startIdx; i < endIdx; i++) {
+        double potential = 0.0;
+        for (int j = 0; j < numSources; j++) {
+            double dx = sx[j] - sx[i];
+            double dy = sy[j] - sy[i];
+            double r2 = dx * dx + dy * dy;
+            if (r2 > 0.0) {
+                potential += sm[j] / std::sqrt(r2 + eps2);
+            }
+        }
+        sum -= G * sm[i] * potential;
+    }
+    return sum;
+}
+
+// ============================================================================
+// Force error Implementation
+// ============================================================================
+
+void sampleBodies(int numBodies, int count, std::vector<int>& targets) {
+    if (count <= 0 || count > numBodies) {
+        count = numBodies;
+    }
+    targets.resize(count);
+    for (int k = 0; k < count; k++) {
+        targets[k] = static_cast<int>(static_cast<long long>(k) * numBodies / count);
+    }
+}
+
+ForceErrorStats computeForceError(const Vec2* forces, const Vec2* reference, int count) {
+    ForceErrorStats stats;
+    std::vector<double> errors;
+    errors.reserve(count);
+    for (int k = 0; k < count; k++) {
+        double refLength = reference[k].length();
+        if (refLength > 0.0) {
+            errors.push_back((forces[k] - reference[k]).length() / refLength);
+        }
+    }
+    if (errors.empty()) {
+        return stats;
+    }
+
+    std::sort(errors.begin(), errors.end());
+    // Nearest-rank percentile
+    auto percentile = [&errors](double p) {
+        size_t rank = static_cast<size_t>(std::ceil(p * errors.size()));
+        return errors[std::min(errors.size() - 1, rank > 0 ? rank - 1 : 0)];
+    };
+    stats.samples = static_cast<int>(errors.size());
+    stats.p50 = percentile(0.50);
+    stats.p90 = percentile(0.90);
+    stats.p99 = percentile(0.99);
+    stats.max = errors.back();
+    return stats;
+}
@@ -0,0 +1,327 @@
+#include "ensemble.h"
+#include "direct_sum.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+static const int LANES = Ensemble::LANES;
+
+EnsembleMember::EnsembleMember()
+    : index(0), numSteps(0), timeStep(0.0), softening(0.0), gravitationalConstant(0.0) {}
+
+// Exact energy and momenta of a member's current bodies
+static Diagnostics measureMember(const EnsembleMember& member) {
+    int numBodies = static_cast<int>(member.bodies.size());
+    Diagnostics result = measureBodies(member.bodies.data(), 0, numBodies);
+    DirectSum directSum;
+    directSum.load(member.bodies.data(), numBodies);
+    result.potential = 0.5 * directSum.calculatePotential(0, numBodies, member.gravitationalConstant,
+                                                          member.softening);
+    return result;
+}
+
+// Field sum_j m_j * d / (|d|^2 + eps2)^(3/2) on every body of every lane of a batch,
+// in the same source order as DirectSum. The lane loop is innermost: it has a
+// constant trip count and no reduction, so it vectorises across the ensemble.
+NBODY_KERNEL_CLONES
+static void accumulateBatch(const double* __restrict x, const double* __restrict y,
+                            const double* __restrict mass, const double* __restrict eps2,
+                            int numBodies, double* __restrict ax, double* __restrict ay) {
+    for (int i = 0; i < numBodies; i++) {
+        const double* xi = x + i * LANES;
+        const double* yi = y + i * LANES;
+        double* fx = ax + i * LANES;
+        double* fy = ay + i * LANES;
+        for (int k = 0; k < LANES; k++) {
+            fx[k] = 0.0;
+            fy[k] = 0.0;
+        }
+        for (int j = 0; j < numBodies; j++) {
+            const double* xj = x + j * LANES;
+            const double* yj = y + j * LANES;
+            const double* mj = mass + j * LANES;
+            for (int k = 0; k < LANES; k++) {
+                double dx = xj[k] - xi[k];
+                double dy = yj[k] - yi[k];
+                double r2 = dx * dx + dy * dy;
+                double distSquared = r2 + eps2[k];
+                double dist = std::sqrt(distSquared);
+                // Masked rather than skipped, so the loop stays branch-free
+                double scale = mj[k] / (distSquared * dist);
+                scale = (r2 > 0.0) ? scale : 0.0;
+                fx[k] += dx * scale;
+                fy[k] += dy * scale;
+            }
+        }
+    }
+}
+
+// Force, acceleration, kick and drift as Body does them, for every lane
+NBODY_KERNEL_CLONES
+static void integrateBatch(double* __restrict x, double* __restrict y,
+                           double* __restrict vx, double* __restrict vy,
+                           const double* __restrict mass, const double* __restrict ax,
+                           const double* __restrict ay, const double* __restrict g,
+                           const double* __restrict dt, int numBodies) {
+    for (int i = 0; i < numBodies; i++) {
+        for (int k = 0; k < LANES; k++) {
+            int idx = i * LANES + k;
+            double m = mass[idx];
+            double forceScale = g[k] * m;
+            double accelX = (ax[idx] * forceScale) / m;
+            double accelY = (ay[idx] * forceScale) / m;
+            // Massless bodies (and padding lanes) keep a zero acceleration
+            accelX = (m > 0.0) ? accelX : 0.0;
+            accelY = (m > 0.0) ? accelY : 0.0;
+            vx[idx] += accelX * dt[k];
+            vy[idx] += accelY * dt[k];
+            x[idx] += vx[idx] * dt[k];
+            y[idx] += vy[idx] * dt[k];
+        }
+    }
+}
+
+// ============================================================================
+// Ensemble Implementation
+// ============================================================================
+
+Ensemble::Ensemble() {}
+
+bool Ensemble::addConfig(const Config& config, const std::string& source) {
+    // ensemble_sweep = <key> <from> <to>
+    std::string sweepKey;
+    double sweepFrom = 0.0;
+    double sweepTo = 0.0;
+    if (!config.ensembleSweep.empty()) {
+        std::istringstream iss(config.ensembleSweep);
+        if (!(iss >> sweepKey >> sweepFrom >> sweepTo)) {
+            std::cerr << "Error: ensemble_sweep must be '<key> <from> <to>', got '"
+                      << config.ensembleSweep << "'" << std::endl;
+            return false;
+        }
+        std::transform(sweepKey.begin(), sweepKey.end(), sweepKey.begin(), ::tolower);
+        // The same aliases as the config keys
+        if (sweepKey == "g") {
+            sweepKey = "gravitational_constant";
+        } else if (sweepKey == "timestep") {
+            sweepKey = "time_step";
+        }
+        if (sweepKey != "gravitational_constant" && sweepKey != "softening" && sweepKey != "time_step") {
+            std::cerr << "Error: ensemble_sweep key must be gravitational_constant, softening or time_step, got '"
+                      << sweepKey << "'" << std::endl;
+            return false;
+        }
+    }
+
+    // Perturbation scales: rms position and rms velocity of the configured bodies
+    double rmsPosition = 0.0;
+    double rmsVelocity = 0.0;
+    for (const Body& body : config.bodies) {
+        rmsPosition += body.position.lengthSquared();
+        rmsVelocity += body.velocity.lengthSquared();
+    }
+    if (!config.bodies.empty()) {
+        rmsPosition = std::sqrt(rmsPosition / config.bodies.size());
+        rmsVelocity = std::sqrt(rmsVelocity / config.bodies.size());
+    }
+
+    int count = std::max(1, config.ensembleSize);
+    for (int m = 0; m < count; m++) {
+        EnsembleMember member;
+        member.source = source;
+        member.index = m;
+        member.numSteps = config.numSteps;
+        member.timeStep = config.timeStep;
+        member.softening = config.softening;
+        member.gravitationalConstant = config.gravitationalConstant;
+        member.bodies = config.bodies;
+
+        if (!sweepKey.empty()) {
+            double value = (count > 1) ? sweepFrom + (sweepTo - sweepFrom) * m / (count - 1) : sweepFrom;
+            if (sweepKey == "gravitational_constant") {
+                member.gravitationalConstant = value;
+            } else if (sweepKey == "softening") {
+                member.softening = value;
+            } else {
+                member.timeStep = value;
+            }
+        }
+
+        // Member 0 keeps the configured bodies, the others get their own noise
+        if (config.ensemblePerturbation > 0.0 && m > 0) {
+            std::mt19937_64 rng(config.generateSeed + static_cast<unsigned int>(m));
+            std::normal_distribution<double> gauss(0.0, 1.0);
+            double positionSigma = config.ensemblePerturbation * rmsPosition;
+            double velocitySigma = config.ensemblePerturbation * rmsVelocity;
+            for (Body& body : member.bodies) {
+                body.position += Vec2(gauss(rng), gauss(rng)) * positionSigma;
+                body.velocity += Vec2(gauss(rng), gauss(rng)) * velocitySigma;
+            }
+        }
+
+        members.push_back(member);
+    }
+    return true;
+}
+
+void Ensemble::buildBatches() {
+    batches.clear();
+
+    // Members of the same shape fill batches in the order they were added
+    std::map<std::pair<int, int>, int> openBatch;
+    for (int m = 0; m < static_cast<int>(members.size()); m++) {
+        const EnsembleMember& member = members[m];
+        std::pair<int, int> shape(static_cast<int>(member.bodies.size()), member.numSteps);
+        auto it = openBatch.find(shape);
+        if (it == openBatch.end() || batches[it->second].members.size() == static_cast<size_t>(LANES)) {
+            Batch batch;
+            batch.numBodies = shape.first;
+            batch.numSteps = shape.second;
+            size_t size = static_cast<size_t>(batch.numBodies) * LANES;
+            // Padding lanes: massless bodies at the origin, G = 0, dt = 0
+            batch.x.assign(size, 0.0);
+            batch.y.assign(size, 0.0);
+            batch.vx.assign(size, 0.0);
+            batch.vy.assign(size, 0.0);
+            batch.mass.assign(size, 0.0);
+            for (int k = 0; k < LANES; k++) {
+                batch.g[k] = 0.0;
+                batch.eps2[k] = 1.0;
+                batch.dt[k] = 0.0;
+            }
+            batches.push_back(batch);
+            openBatch[shape] = static_cast<int>(batches.size()) - 1;
+            it = openBatch.find(shape);
+        }
+
+        Batch& batch = batches[it->second];
+        int k = static_cast<int>(batch.members.size());
+        batch.members.push_back(m);
+        batch.g[k] = member.gravitationalConstant;
+        batch.eps2[k] = member.softening * member.softening;
+        batch.dt[k] = member.timeStep;
+        for (int i = 0; i < batch.numBodies; i++) {
+            const Body& body = member.bodies[i];
+            int idx = i * LANES + k;
+            batch.x[idx] = body.position.x;
+            batch.y[idx] = body.position.y;
+            batch.vx[idx] = body.velocity.x;
+            batch.vy[idx] = body.velocity.y;
+            batch.mass[idx] = body.mass;
+        }
+    }
+}
+
+void Ensemble::storeBatch(const Batch& batch) {
+    for (int k = 0; k < static_cast<int>(batch.members.size()); k++) {
+        EnsembleMember& member = members[batch.members[k]];
+        for (int i = 0; i < batch.numBodies; i++) {
+            Body& body = member.bodies[i];
+            int idx = i * LANES + k;
+            body.position = Vec2(batch.x[idx], batch.y[idx]);
+            body.velocity = Vec2(batch.vx[idx], batch.vy[idx]);
+        }
+    }
+}
+
+void Ensemble::run(int numThreads) {
+    buildBatches();
+
+    int numBatches = static_cast<int>(batches.size());
+    int totalThreads = std::max(1, std::min(numThreads, numBatches));
+    auto worker = [&](int t) {
+        int perThread = numBatches / totalThreads;
+        int remainder = numBatches % totalThreads;
+        int start = t * perThread + std::min(t, remainder);
+        int end = start + perThread + (t < remainder ? 1 : 0);
+
+        std::vector<double> ax;
+        std::vector<double> ay;
+        for (int b = start; b < end; b++) {
+            Batch& batch = batches[b];
+            for (int m : batch.members) {
+                members[m].initial = measureMember(members[m]);
+            }
+
+            ax.assign(batch.x.size(), 0.0);
+            ay.assign(batch.y.size(), 0.0);
+            for (int step = 0; step < batch.numSteps; step++) {
+                accumulateBatch(batch.x.data(), batch.y.data(), batch.mass.data(), batch.eps2,
+                                batch.numBodies, ax.data(), ay.data());
+                integrateBatch(batch.x.data(), batch.y.data(), batch.vx.data(), batch.vy.data(),
+                               batch.mass.data(), ax.data(), ay.data(), batch.g, batch.dt, batch.numBodies);
+            }
+
+            // Each member belongs to one batch, so threads write disjoint members
+            storeBatch(batch);
+            for (int m : batch.members) {
+                members[m].final = measureMember(members[m]);
+                members[m].final.step = batch.numSteps;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < totalThreads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+long long Ensemble::getMemberSteps() const {
+    long long total = 0;
+    for (const EnsembleMember& member : members) {
+        total += member.numSteps;
+    }
+    return total;
+}
+
+long long Ensemble::getBodySteps() const {
+    long long total = 0;
+    for (const EnsembleMember& member : members) {
+        total += static_cast<long long>(member.numSteps) * member.bodies.size();
+    }
+    return total;
+}
+
+void Ensemble::printSummary(std::ostream& os, size_t maxListed) const {
+    for (size_t m = 0; m < members.size() && m < maxListed; m++) {
+        const EnsembleMember& member = members[m];
+        os << "  Member " << m << " (" << member.source << " #" << member.index << "): "
+           << member.bodies.size() << " bodies, " << member.numSteps << " steps, G="
+           << member.gravitationalConstant << " softening=" << member.softening
+           << " dt=" << member.timeStep << ", dE/E0=" << energyDrift(member.final, member.initial)
+           << std::endl;
+    }
+    if (members.size() > maxListed) {
+        os << "  ... " << (members.size() - maxListed) << " more" << std::endl;
+    }
+}
+
+bool Ensemble::writeFinalStates(const std::string& filename) const {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open ensemble output file: " << filename << std::endl;
+        return false;
+    }
+    file.precision(17);
+    for (size_t m = 0; m < members.size(); m++) {
+        const EnsembleMember& member = members[m];
+        file << "member " << m << " " << member.source << std::endl;
+        for (const Body& body : member.bodies) {
+            file << body.id << " " << body.mass << " " << body.position.x << " " << body.position.y
+                 << " " << body.velocity.x << " " << body.velocity.y << std::endl;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+#include "generator.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+bool generateBodies(std::vector<Body>& bodies, int count, const std::string& distribution,
+                    unsigned int seed, double G, double radius, int firstId) {
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_real_distribution<double> massDist(1.0, 5.0);
+
+    bodies.reserve(bodies.size() + count);
+
+    if (distribution == "disk") {
+        // Masses average 3, so the mass inside radius r is ~3 * count * (r / radius)^2
+        double totalMass = 3.0 * count;
+        for (int i = 0; i < count; i++) {
+            double r = radius * std::sqrt(unit(rng)) + 1.0;
+            double angle = 2.0 * M_PI * unit(rng);
+            double enclosed = totalMass * std::min(1.0, (r * r) / (radius * radius));
+            double speed = std::sqrt(G * enclosed / r);
+            Vec2 position(r * std::cos(angle), r * std::sin(angle));
+            Vec2 velocity(-std::sin(angle) * speed, std::cos(angle) * speed);
+            bodies.emplace_back(firstId + i, massDist(rng), position, velocity);
+        }
+    } else if (distribution == "uniform") {
+        for (int i = 0; i < count; i++) {
+            Vec2 position((2.0 * unit(rng) - 1.0) * radius, (2.0 * unit(rng) - 1.0) * radius);
+            bodies.emplace_back(firstId + i, massDist(rng), position, Vec2(0, 0));
+        }
+    } else if (distribution == "plummer") {
+        double scale = radius / 10.0;
+        std::normal_distribution<double> gauss(0.0, 1.0);
+        for (int i = 0; i < count; i++) {
+            // Inverse CDF of the Plummer cumulative mass, truncated at 99.9%
+            double u = 0.999 * unit(rng) + 1e-9;
+            double r = scale / std::sqrt(std::pow(u, -2.0 / 3.0) - 1.0);
+            double angle = 2.0 * M_PI * unit(rng);
+            Vec2 position(r * std::cos(angle), r * std::sin(angle));
+            Vec2 velocity(gauss(rng), gauss(rng));
+            bodies.emplace_back(firstId + i, massDist(rng), position, velocity);
+        }
+    } else {
+        std::cerr << "Error: Unknown body distribution: " << distribution << std::endl;
+        return false;
+    }
+    return true;
+}
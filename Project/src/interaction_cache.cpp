@@ -0,0 +1,376 @@
+#include "interaction_cache.h"
+#include "simd.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+// Targets per tile of the list kernel. Fixed so the vectorised loop has a constant
+// trip count; the last tile of a group is padded with far-away dummy targets.
+static const int GROUP_TILE = 8;
+
+// Squared distance from point to the nearest point of box (0 inside it)
+static double boxDistanceSquared(const AABB& box, const Vec2& point) {
+    double dx = std::max(std::abs(point.x - box.center.x) - box.halfSize, 0.0);
+    double dy = std::max(std::abs(point.y - box.center.y) - box.halfSize, 0.0);
+    return dx * dx + dy * dy;
+}
+
+// Opening test of a group: the node passes for every point of the group's cell.
+// Nodes touching the cell are never accepted, so a group's own bodies are always
+// in its near list
+static bool acceptedForGroup(const QuadTreeNode& node, const AABB& groupBox, double theta, double soft2) {
+    double distSquared = boxDistanceSquared(groupBox, node.centerOfMass);
+    double regionSize = node.bounds.halfSize * 2.0;
+    return distSquared > 0.0 && regionSize * regionSize < theta * theta * (distSquared + soft2);
+}
+
+// Append the indices of the bodies in the subtree at nodeIdx
+static void appendBodies(const QuadTreeNode* nodes, const LeafBody* leafBodies, int nodeIdx,
+                         std::vector<int>& out) {
+    const QuadTreeNode& node = nodes[nodeIdx];
+    if (!node.isLeaf()) {
+        for (int i = 0; i < 4; i++) {
+            appendBodies(nodes, leafBodies, node.firstChild + i, out);
+        }
+    } else if (node.bodyCount == 1) {
+        out.push_back(node.body);
+    } else {
+        for (int k = 0; k < node.bodyCount; k++) {
+            out.push_back(leafBodies[node.body + k].index);
+        }
+    }
+}
+
+// Sources of the list kernel, structure-of-arrays
+struct ListSources {
+    std::vector<double> x, y, mass;
+
+    void clear() {
+        x.clear();
+        y.clear();
+        mass.clear();
+    }
+
+    void add(const Vec2& position, double m) {
+        x.push_back(position.x);
+        y.push_back(position.y);
+        mass.push_back(m);
+    }
+
+    // Every body of the subtree at nodeIdx (a single-body leaf's moments are its body)
+    void addBodies(const QuadTreeNode* nodes, const LeafBody* leafBodies, int nodeIdx) {
+        const QuadTreeNode& node = nodes[nodeIdx];
+        if (!node.isLeaf()) {
+            for (int i = 0; i < 4; i++) {
+                addBodies(nodes, leafBodies, node.firstChild + i);
+            }
+        } else if (node.bodyCount == 1) {
+            add(node.centerOfMass, node.totalMass);
+        } else {
+            for (int k = 0; k < node.bodyCount; k++) {
+                add(leafBodies[node.body + k].position, leafBodies[node.body + k].mass);
+            }
+        }
+    }
+};
+
+// Accumulate sum_j m_j * d / (|d|^2 + eps2)^(3/2) for one tile of targets over all
+// sources. Coincident points (the target itself) contribute nothing
+template <bool Rsqrt>
+NBODY_KERNEL_CLONES
+static void accumulateListTile(const double* __restrict tx, const double* __restrict ty,
+                               double* __restrict ax, double* __restrict ay,
+                               const double* __restrict sx, const double* __restrict sy,
+                               const double* __restrict sm, int numSources, double eps2) {
+    for (int j = 0; j < numSources; j++) {
+        const double xj = sx[j];
+        const double yj = sy[j];
+        const double mj = sm[j];
+        for (int i = 0; i < GROUP_TILE; i++) {
+            double dx = xj - tx[i];
+            double dy = yj - ty[i];
+            double r2 = dx * dx + dy * dy;
+            double distSquared = r2 + eps2;
+            double scale;
+            if (Rsqrt) {
+                double invDist = 1.0 / std::sqrt(distSquared);
+                scale = mj * invDist * invDist * invDist;
+            } else {
+                scale = mj / (distSquared * std::sqrt(distSquared));
+            }
+            scale = (r2 > 0.0) ? scale : 0.0;
+            ax[i] += dx * scale;
+            ay[i] += dy * scale;
+        }
+    }
+}
+
+// Group walk: far entries pass the opening test at recordTheta for the whole group
+// cell, near entries are the leaves that do not. Empty nodes go to the far list:
+// they cost nothing until a body moves in, and are tested like any other far node
+// from then on
+static void walkGroup(const QuadTreeNode* nodes, int nodeIdx, const AABB& groupBox,
+                      double recordTheta, double soft2,
+                      std::vector<int>& far, std::vector<int>& near, long long& visits) {
+    const QuadTreeNode& node = nodes[nodeIdx];
+    visits++;
+    if (node.isEmpty() || acceptedForGroup(node, groupBox, recordTheta, soft2)) {
+        far.push_back(nodeIdx);
+    } else if (node.isLeaf()) {
+        near.push_back(nodeIdx);
+    } else {
+        for (int i = 0; i < 4; i++) {
+            walkGroup(nodes, node.firstChild + i, groupBox, recordTheta, soft2, far, near, visits);
+        }
+    }
+}
+
+InteractionCache::InteractionCache()
+    : enabled(false),
+      maxReuse(4),
+      margin(0.1),
+      groupSize(16),
+      treeBuilds(-1),
+      listTheta(0.0),
+      listGroupSize(0),
+      numWalks(0),
+      numReuses(0),
+      numInvalidated(0),
+      walkVisits(0),
+      skippedVisits(0),
+      numRegroups(0) {}
+
+void InteractionCache::formGroups(const QuadTree& tree) {
+    const TreePool<QuadTreeNode>& nodes = tree.nodes;
+    int numNodes = tree.getNumNodes();
+
+    // Bodies per subtree; children are always stored after their parent
+    subtreeCount.assign(numNodes, 0);
+    for (int n = numNodes - 1; n >= 0; n--) {
+        const QuadTreeNode& node = nodes[n];
+        if (node.isLeaf()) {
+            subtreeCount[n] = node.bodyCount;
+        } else {
+            for (int i = 0; i < 4; i++) {
+                subtreeCount[n] += subtreeCount[node.firstChild + i];
+            }
+        }
+    }
+
+    numRegroups++;
+
+    // Largest subtrees with at most groupSize bodies, in depth-first order so that
+    // neighbouring groups (and their bodies) end up on the same thread. Empty
+    // subtrees are groups too: bodies may move into them later
+    groups.clear();
+    std::vector<int> stack(1, 0);
+    while (!stack.empty()) {
+        int n = stack.back();
+        stack.pop_back();
+        if (nodes[n].isLeaf() || subtreeCount[n] <= groupSize) {
+            groups.emplace_back();
+            groups.back().node = n;
+            continue;
+        }
+        for (int i = 3; i >= 0; i--) {
+            stack.push_back(nodes[n].firstChild + i);
+        }
+    }
+}
+
+void InteractionCache::recordGroup(const QuadTree& tree, Group& group, double recordTheta, double softening) {
+    group.far.clear();
+    group.near.clear();
+    group.visits = 0;
+    walkGroup(tree.nodes.data(), 0, tree.nodes[group.node].bounds, recordTheta, softening * softening,
+              group.far, group.near, group.visits);
+    group.age = 0;
+}
+
+void InteractionCache::evaluateGroup(const QuadTree& tree, Group& group, std::vector<Body>& bodies,
+                                     double theta, double G, double softening, ForceKernel kernel,
+                                     WalkStats* stats, Counters& counters) {
+    static thread_local std::vector<int> members;
+    static thread_local ListSources sources;
+
+    const QuadTreeNode* nodes = tree.nodes.data();
+    const LeafBody* leafBodies = tree.leafBodies.data();
+    members.clear();
+    appendBodies(nodes, leafBodies, group.node, members);
+    if (members.empty()) {
+        return;
+    }
+    counters.bodies += static_cast<long long>(members.size());
+
+    const AABB& groupBox = nodes[group.node].bounds;
+    const double soft2 = softening * softening;
+    bool walked = false;
+    if (group.age < 0 || group.age >= maxReuse) {
+        recordGroup(tree, group, theta * (1.0 - margin), softening);
+        walked = true;
+    }
+
+    // Far nodes at their current moments and the bodies of the near leaves. A list
+    // whose far node no longer passes the theta test for the group, or whose
+    // sources miss some of the mass, is recorded again
+    for (;;) {
+        sources.clear();
+        bool valid = true;
+        for (int n : group.far) {
+            const QuadTreeNode& node = nodes[n];
+            if (node.totalMass == 0.0) {
+                continue;
+            }
+            if (!walked && !acceptedForGroup(node, groupBox, theta, soft2)) {
+                valid = false;
+                break;
+            }
+            sources.add(node.centerOfMass, node.totalMass);
+        }
+        if (valid) {
+            for (int n : group.near) {
+                sources.addBodies(nodes, leafBodies, n);
+            }
+        }
+        if (valid && !walked) {
+            double mass = 0.0;
+            for (double m : sources.mass) {
+                mass += m;
+            }
+            // Both sums hold the same masses in a different order
+            valid = std::abs(mass - nodes[0].totalMass) <= 1e-9 * nodes[0].totalMass;
+        }
+        if (valid) {
+            break;
+        }
+        counters.invalidated++;
+        recordGroup(tree, group, theta * (1.0 - margin), softening);
+        walked = true;
+    }
+
+    if (walked) {
+        counters.walks++;
+        counters.walkVisits += group.visits;
+        if (stats) {
+            stats->nodesVisited += group.visits;
+        }
+    } else {
+        group.age++;
+        counters.reuses++;
+        counters.skippedVisits += group.visits;
+    }
+
+    int numSources = static_cast<int>(sources.x.size());
+    int count = static_cast<int>(members.size());
+    alignas(64) double tx[GROUP_TILE];
+    alignas(64) double ty[GROUP_TILE];
+    alignas(64) double ax[GROUP_TILE];
+    alignas(64) double ay[GROUP_TILE];
+    for (int tileStart = 0; tileStart < count; tileStart += GROUP_TILE) {
+        int tileSize = std::min(GROUP_TILE, count - tileStart);
+        for (int i = 0; i < GROUP_TILE; i++) {
+            // Padding targets sit far away and their results are discarded
+            tx[i] = (i < tileSize) ? bodies[members[tileStart + i]].position.x : 1e30;
+            ty[i] = (i < tileSize) ? bodies[members[tileStart + i]].position.y : 1e30;
+            ax[i] = 0.0;
+            ay[i] = 0.0;
+        }
+        if (kernel == ForceKernel::Rsqrt) {
+            accumulateListTile<true>(tx, ty, ax, ay, sources.x.data(), sources.y.data(), sources.mass.data(),
+                                     numSources, soft2);
+        } else {
+            accumulateListTile<false>(tx, ty, ax, ay, sources.x.data(), sources.y.data(), sources.mass.data(),
+                                      numSources, soft2);
+        }
+        for (int i = 0; i < tileSize; i++) {
+            Body& body = bodies[members[tileStart + i]];
+            body.force = Vec2(ax[i], ay[i]) * (G * body.mass);
+        }
+    }
+    if (stats) {
+        // Every source of the list, less the target itself among the near bodies
+        stats->interactions += static_cast<long long>(count) * (numSources - 1);
+    }
+}
+
+void InteractionCache::calculateForces(const QuadTree& tree, std::vector<Body>& bodies,
+                                       double theta, double G, double softening, ForceKernel kernel,
+                                       int numThreads, const ThreadPlacement& placement, Profiler& profiler) {
+    if (tree.empty()) {
+        return;
+    }
+    // Rebuilt trees and new parameters start from fresh groups
+    if (groups.empty() || tree.getNumBuilds() != treeBuilds || theta != listTheta || groupSize != listGroupSize) {
+        formGroups(tree);
+        treeBuilds = tree.getNumBuilds();
+        listTheta = theta;
+        listGroupSize = groupSize;
+    }
+    if (evaluateGroups(tree, bodies, theta, G, softening, kernel, numThreads, placement, profiler) <
+        static_cast<long long>(bodies.size())) {
+        // Bodies moved into a region whose group was dropped with an emptied
+        // subtree: form the groups again, which covers every body
+        formGroups(tree);
+        evaluateGroups(tree, bodies, theta, G, softening, kernel, numThreads, placement, profiler);
+    }
+}
+
+long long InteractionCache::evaluateGroups(const QuadTree& tree, std::vector<Body>& bodies,
+                                           double theta, double G, double softening, ForceKernel kernel,
+                                           int numThreads, const ThreadPlacement& placement,
+                                           Profiler& profiler) {
+    int numGroups = static_cast<int>(groups.size());
+    int totalThreads = std::max(1, std::min(numThreads, numGroups));
+    std::vector<Counters> counters(totalThreads);
+    auto worker = [&](int t) {
+        int perThread = numGroups / totalThreads;
+        int remainder = numGroups % totalThreads;
+        int start = t * perThread + std::min(t, remainder);
+        int end = start + perThread + (t < remainder ? 1 : 0);
+        placement.pin(t);
+        if (!profiler.isEnabled()) {
+            for (int g = start; g < end; g++) {
+                evaluateGroup(tree, groups[g], bodies, theta, G, softening, kernel, nullptr, counters[t]);
+            }
+            return;
+        }
+        ThreadRecord& record = profiler.thread(t);
+        auto begin = std::chrono::steady_clock::now();
+        for (int g = start; g < end; g++) {
+            evaluateGroup(tree, groups[g], bodies, theta, G, softening, kernel, &record.walk, counters[t]);
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+        record.forceMs += elapsed.count();
+    };
+
+    ScopedThreadAffinity restoreAffinity(placement);
+    std::vector<std::thread> threads;
+    for (int t = 1; t < totalThreads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    long long covered = 0;
+    for (const Counters& c : counters) {
+        numWalks += c.walks;
+        numReuses += c.reuses;
+        numInvalidated += c.invalidated;
+        walkVisits += c.walkVisits;
+        skippedVisits += c.skippedVisits;
+        covered += c.bodies;
+    }
+    return covered;
+}
+
+void InteractionCache::printSummary(std::ostream& os) const {
+    long long evaluations = numWalks + numReuses;
+    long long visits = walkVisits + skippedVisits;
+    os << "Interaction lists: " << evaluations << " group evaluations, " << numReuses << " from a cached list ("
+       << numInvalidated << " lists invalidated, " << numRegroups << " groupings), " << walkVisits << " node visits walked, "
+       << skippedVisits << " skipped (" << (visits > 0 ? 100.0 * skippedVisits / visits : 0.0)
+       << "% of the traversal saved)" << std::endl;
+}
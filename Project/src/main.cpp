@@ -60,7 +60,9 @@ int main(int argc, char* argv[]) {
     simulation.closeOutput();
     
     std::cout << std::endl;
-    std::cout << "Output written to: " << outputFile << std::endl;
+    if (simulation.outputFormat != OutputFormat::None) {
+        std::cout << "Output written to: " << outputFile << std::endl;
+    }
     std::cout << "=== Simulation Complete ===" << std::endl;
     
     return 0;
@@ -0,0 +1,92 @@
+#include "config.h"
+#include "ensemble.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+void printUsage(const char* programName) {
+    std::cout << "Usage: " << programName << " [--threads T] [--output FILE] [config_file ...]" << std::endl;
+    std::cout << "  config_file: Configuration files, ensemble_size members each (default: config.txt)" << std::endl;
+    std::cout << "  --threads T: Worker threads (default: num_threads of the first config)" << std::endl;
+    std::cout << "  --output FILE: Write the final state of every member to FILE" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> configFiles;
+    std::string outputFile;
+    int numThreads = 0;
+
+    // Parse command line arguments
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            numThreads = std::stoi(argv[++i]);
+        } else if (arg == "--output" && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else {
+            configFiles.push_back(arg);
+        }
+    }
+    if (configFiles.empty()) {
+        configFiles.push_back("config.txt");
+    }
+
+    std::cout << "=== N-Body Ensemble ===" << std::endl;
+
+    Ensemble ensemble;
+    for (const std::string& configFile : configFiles) {
+        Config config;
+        if (!config.loadFromFile(configFile)) {
+            std::cerr << "Failed to load configuration from " << configFile << std::endl;
+            return 1;
+        }
+        if (config.bodies.empty()) {
+            std::cerr << "Error: No bodies defined in configuration file " << configFile << std::endl;
+            return 1;
+        }
+        if (config.solver != "direct" || config.periodicBox > 0.0 || config.blockTimesteps || config.mergers) {
+            std::cout << "Note: " << configFile << " runs with the direct solver, open boundaries, "
+                      << "a fixed time step and no mergers" << std::endl;
+        }
+        if (numThreads <= 0) {
+            numThreads = config.numThreads;
+        }
+        std::cout << "Config file: " << configFile << " (" << std::max(1, config.ensembleSize) << " members, "
+                  << config.bodies.size() << " bodies, " << config.numSteps << " steps)" << std::endl;
+        if (!ensemble.addConfig(config, configFile)) {
+            return 1;
+        }
+    }
+    numThreads = std::max(1, numThreads);
+
+    std::cout << "Starting " << ensemble.getMembers().size() << " simulations on "
+              << numThreads << " threads..." << std::endl;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    ensemble.run(numThreads);
+    auto endTime = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+    std::cout << std::endl;
+    ensemble.printSummary(std::cout, 20);
+    std::cout << std::endl;
+    std::cout << "Batches: " << ensemble.getNumBatches() << " of up to " << Ensemble::LANES << " members" << std::endl;
+    std::cout << "Ensemble completed in " << seconds * 1000.0 << " ms" << std::endl;
+    std::cout << "Throughput: " << ensemble.getMemberSteps() / seconds << " simulation-steps/s, "
+              << ensemble.getBodySteps() / seconds << " body-steps/s" << std::endl;
+
+    if (!outputFile.empty()) {
+        if (!ensemble.writeFinalStates(outputFile)) {
+            return 1;
+        }
+        std::cout << "Final states written to: " << outputFile << std::endl;
+    }
+    std::cout << "=== Ensemble Complete ===" << std::endl;
+
+    return 0;
+}
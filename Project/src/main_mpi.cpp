@@ -1,6 +1,9 @@
 #include <mpi.h>
 #include "simulation.h"
 #include "config.h"
+#include "mpi_exchange.h"
+#include "mpi_io.h"
+#include "mpi_shared.h"
 #include <iostream>
 #include <vector>
 #include <string>
@@ -14,6 +17,435 @@ void printUsage(const char* programName) {
     std::cout << "  output_file: Path to output file (default: output.txt)" << std::endl;
 }
 
+static void printProgress(int step, int numSteps) {
+    // Progress indicator (matching the standard version)
+    if (numSteps >= 10 && (step + 1) % (numSteps / 10) == 0) {
+        std::cout << "Progress: " << ((step + 1) * 100 / numSteps) << "% (step " << (step + 1) << ")" << std::endl;
+    }
+}
+
+// Sum each rank's partial diagnostics over all ranks and log them on every rank
+// (rank 0 prints them). With pieces (deterministic_reductions) every rank gathers
+// all ranks' pieces and adds them in the fixed order instead; local then only
+// supplies hasPotential
+static void recordReduced(Simulation& sim, Diagnostics local, const PairwiseSum* pieces, int stateStep,
+                          int rank) {
+    double fields[Diagnostics::NUM_FIELDS];
+    double total[Diagnostics::NUM_FIELDS];
+    if (pieces != nullptr) {
+        int numRanks;
+        MPI_Comm_size(MPI_COMM_WORLD, &numRanks);
+        int localSize = static_cast<int>(pieces->getPieces().size());
+        std::vector<int> sizes(numRanks);
+        MPI_Allgather(&localSize, 1, MPI_INT, sizes.data(), 1, MPI_INT, MPI_COMM_WORLD);
+        std::vector<int> offsets(numRanks, 0);
+        for (int r = 1; r < numRanks; r++) {
+            offsets[r] = offsets[r - 1] + sizes[r - 1];
+        }
+        std::vector<double> all(offsets.back() + sizes.back());
+        MPI_Allgatherv(pieces->getPieces().data(), localSize, MPI_DOUBLE,
+                       all.data(), sizes.data(), offsets.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+        PairwiseSum gathered(pieces->getCount(), pieces->getWidth());
+        gathered.addPieces(all.data(), all.size());
+        gathered.total(total);
+    } else {
+        local.toArray(fields);
+        MPI_Allreduce(fields, total, Diagnostics::NUM_FIELDS, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    }
+    local.fromArray(total);
+    local.step = stateStep;
+    if (rank == 0) {
+        sim.recordDiagnostics(local);
+    } else {
+        sim.diagnosticsLog.push_back(local);
+    }
+}
+
+// Diagnostics of this rank's bodies[startIdx, endIdx), reduced over all ranks and logged
+static void recordRankDiagnostics(Simulation& sim, int startIdx, int endIdx, int stateStep, int rank) {
+    if (sim.deterministicReductions) {
+        PairwiseSum pieces(static_cast<long long>(sim.getBodies().size()), Diagnostics::NUM_FIELDS);
+        sim.addDiagnosticsPieces(pieces, startIdx, endIdx);
+        recordReduced(sim, sim.measureDiagnosticsRange(startIdx, startIdx), &pieces, stateStep, rank);
+    } else {
+        recordReduced(sim, sim.measureDiagnosticsRange(startIdx, endIdx), nullptr, stateStep, rank);
+    }
+}
+
+// Force error check of force_error_interval on the forces just computed. Each rank
+// compares the sampled bodies it owns against reference, a direct sum loaded with the
+// positions the forces came from; rank 0 gathers the pairs and prints the result
+static void checkRankForceError(Simulation& sim, const DirectSum& reference, const Body* bodies,
+                                int numBodies, int startIdx, int endIdx, int stepNumber, int rank) {
+    std::vector<int> targets;
+    sampleBodies(numBodies, sim.forceErrorSamples, targets);
+    std::vector<int> local;
+    for (int i : targets) {
+        if (i >= startIdx && i < endIdx) {
+            local.push_back(i);
+        }
+    }
+    int count = static_cast<int>(local.size());
+    std::vector<Vec2> exact(count);
+    reference.calculateForces(local.data(), count, exact.data(), sim.gravitationalConstant, sim.softening);
+
+    // fx, fy, reference fx, reference fy per sampled body
+    std::vector<double> pairs(4 * static_cast<size_t>(count));
+    for (int k = 0; k < count; k++) {
+        pairs[4 * k] = bodies[local[k]].force.x;
+        pairs[4 * k + 1] = bodies[local[k]].force.y;
+        pairs[4 * k + 2] = exact[k].x;
+        pairs[4 * k + 3] = exact[k].y;
+    }
+
+    int numRanks;
+    MPI_Comm_size(MPI_COMM_WORLD, &numRanks);
+    int localSize = static_cast<int>(pairs.size());
+    std::vector<int> sizes(numRanks);
+    MPI_Gather(&localSize, 1, MPI_INT, sizes.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    std::vector<int> offsets(numRanks, 0);
+    std::vector<double> all;
+    if (rank == 0) {
+        for (int r = 1; r < numRanks; r++) {
+            offsets[r] = offsets[r - 1] + sizes[r - 1];
+        }
+        all.resize(offsets.back() + sizes.back());
+    }
+    MPI_Gatherv(pairs.data(), localSize, MPI_DOUBLE, all.data(), sizes.data(), offsets.data(), MPI_DOUBLE,
+                0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        int total = static_cast<int>(all.size() / 4);
+        std::vector<Vec2> forces(total);
+        std::vector<Vec2> exactAll(total);
+        for (int k = 0; k < total; k++) {
+            forces[k] = Vec2(all[4 * k], all[4 * k + 1]);
+            exactAll[k] = Vec2(all[4 * k + 2], all[4 * k + 3]);
+        }
+        sim.recordForceError(stepNumber, computeForceError(forces.data(), exactAll.data(), total));
+    }
+}
+
+static bool forceErrorDue(const Simulation& sim, int stepNumber) {
+    return sim.forceErrorInterval > 0 && stepNumber % sim.forceErrorInterval == 0;
+}
+
+// Every rank holds a full copy of the bodies and builds its own tree.
+// Each rank owns the velocities of its block and integrates it locally;
+// only positions travel between ranks.
+static bool runReplicated(Simulation& sim, const Config& config, const std::string& outputFile,
+                          bool parallelOutput, WireFormat wireFormat, int rank, int size) {
+    auto& bodies = sim.getBodies();
+    int numBodies = static_cast<int>(bodies.size());
+
+    // Calculate work distribution
+    int startIdx, endIdx;
+    blockRange(numBodies, size, rank, startIdx, endIdx);
+    int localNumBodies = endIdx - startIdx;
+
+    // Binary output is written by all ranks with MPI-IO
+    MpiTrajectoryWriter trajectoryWriter(MPI_COMM_WORLD);
+    if (parallelOutput && !trajectoryWriter.open(outputFile, bodies.data(), numBodies, startIdx, endIdx)) {
+        return false;
+    }
+
+    PositionExchange positionExchange(MPI_COMM_WORLD, bodies, wireFormat);
+
+    if (rank == 0) {
+        std::cout << "  Wire format: " << wireFormatName(wireFormat)
+            << " (" << positionExchange.bytesPerBody() << " bytes per body per step)" << std::endl;
+        std::cout << "  Bodies per rank distribution:" << std::endl;
+        for (int r = 0; r < size; r++) {
+            int rStart, rEnd;
+            blockRange(numBodies, size, r, rStart, rEnd);
+            std::cout << "    Rank " << r << ": bodies " << rStart << "-" << (rEnd - 1)
+                << " (" << (rEnd - rStart) << " bodies)" << std::endl;
+        }
+        std::cout << std::endl;
+    }
+
+    Profiler& profiler = sim.profiler;
+
+    // Main simulation loop
+    for (int step = 0; step <= config.numSteps; step++) {
+        // Write output for this step (timed into the previous step's record)
+        {
+            ScopedTimer timer(profiler, Phase::Output);
+            if (parallelOutput) {
+                trajectoryWriter.writeFrame(step, bodies.data());
+            } else if (rank == 0) {
+                sim.writeState(step);
+            }
+        }
+
+        // Don't perform simulation step for the last iteration (just write final state)
+        if (step >= config.numSteps) {
+            if (sim.diagnosticsInterval > 0) {
+                sim.prepareForces();
+                ScopedTimer timer(profiler, Phase::Diagnostics);
+                recordRankDiagnostics(sim, startIdx, endIdx, step, rank);
+            }
+            break;
+        }
+
+        profiler.beginStep(step + 1, 1);
+
+        // Build tree (or load the direct-sum sources) on all ranks
+        {
+            ScopedTimer timer(profiler, Phase::TreeBuild);
+            sim.prepareForces();
+        }
+        profiler.setTreeStats(sim.tree.getDepth(), sim.tree.getNumNodes());
+
+        if (sim.diagnosticsDue(step)) {
+            ScopedTimer timer(profiler, Phase::Diagnostics);
+            recordRankDiagnostics(sim, startIdx, endIdx, step, rank);
+        }
+
+        // Each rank calculates forces for its assigned bodies and integrates them
+        if (localNumBodies > 0) {
+            {
+                ScopedTimer timer(profiler, Phase::ForceWalk);
+                sim.calculateForcesRange(startIdx, endIdx,
+                    profiler.isEnabled() ? &profiler.thread(0).walk : nullptr);
+            }
+        }
+
+        // Accuracy check against the direct sum (not timed); every rank takes part
+        if (forceErrorDue(sim, step + 1)) {
+            sim.directSum.load(bodies.data(), numBodies);
+            checkRankForceError(sim, sim.directSum, bodies.data(), numBodies, startIdx, endIdx, step + 1, rank);
+        }
+
+        if (localNumBodies > 0) {
+            ScopedTimer timer(profiler, Phase::Integration);
+            sim.updateBodiesRange(startIdx, endIdx);
+        }
+
+        // Share updated positions with all ranks
+        {
+            ScopedTimer timer(profiler, Phase::Communication);
+            positionExchange.exchange(bodies);
+        }
+
+        profiler.endStep();
+
+        if (rank == 0) {
+            printProgress(step, config.numSteps);
+        }
+    }
+
+    trajectoryWriter.close();
+    return true;
+}
+
+// One body array and one flattened tree per host in MPI shared windows
+// (mpi_shared_tree = true). The host leader builds the tree in the windows, every
+// rank walks it. Only rank 0 holds the bodies in sim; they go straight to the windows
+static bool runSharedTree(Simulation& sim, const Config& config, const std::string& outputFile,
+                          bool parallelOutput, int numBodies, int rank) {
+    NodeSharedState shared(MPI_COMM_WORLD, numBodies);
+    shared.loadBodies(rank == 0 ? sim.getBodies().data() : nullptr);
+
+    // The private copy is no longer needed: all ranks of the host use the window
+    std::vector<Body>().swap(sim.getBodies());
+
+    Body* bodies = shared.getBodies();
+    int startIdx = shared.getStartIdx();
+    int endIdx = shared.getEndIdx();
+
+    MpiTrajectoryWriter trajectoryWriter(MPI_COMM_WORLD);
+    if (parallelOutput && !trajectoryWriter.open(outputFile, bodies, numBodies, startIdx, endIdx)) {
+        return false;
+    }
+
+    // The host leader builds and refits sim.tree in place in the windows; the direct
+    // solver's sources are loaded once per host
+    QuadTree& tree = sim.tree;
+    tree.setPeriodicBox(&sim.periodicBox);
+    tree.setLeafSize(sim.leafSize);
+    Profiler& profiler = sim.profiler;
+    bool direct = (sim.solver == ForceSolver::Direct);
+    if (direct) {
+        shared.shareDirectSum(sim.directSum);
+    } else {
+        shared.shareTree(tree);
+        // Reference of the force error check, loaded by the leader on check steps
+        if (sim.forceErrorInterval > 0) {
+            shared.shareDirectSum(sim.directSum);
+        }
+    }
+
+    if (rank == 0) {
+        std::cout << "  Shared tree: " << shared.getNumHosts() << " host(s), "
+            << shared.getRanksPerHost() << " rank(s) on host 0" << std::endl;
+        std::cout << "  Shared window: " << shared.sharedBytes() / 1024 << " KiB per host" << std::endl;
+        std::cout << std::endl;
+    }
+
+    // Make the force sources of the current positions visible to every rank of the host
+    auto prepareForces = [&]() {
+        if (direct) {
+            if (shared.isLeader()) {
+                ScopedTimer timer(profiler, Phase::TreeBuild);
+                sim.directSum.load(bodies, numBodies);
+            }
+            // Every rank must see the snapshot before any rank moves its bodies
+            ScopedTimer timer(profiler, Phase::Communication);
+            shared.synchronize();
+        } else {
+            if (shared.isLeader()) {
+                ScopedTimer timer(profiler, Phase::TreeBuild);
+                if (sim.treeRefit) {
+                    tree.refit(bodies, numBodies, sim.treeRebuildFraction);
+                } else {
+                    tree.build(bodies, numBodies);
+                }
+            }
+            profiler.setTreeStats(tree.getDepth(), tree.getNumNodes());
+            ScopedTimer timer(profiler, Phase::Communication);
+            shared.publishTree(shared.isLeader() ? &tree : nullptr);
+        }
+    };
+
+    // Diagnostics of the state whose force sources were just prepared
+    auto diagnoseState = [&](int stateStep) {
+        ScopedTimer timer(profiler, Phase::Diagnostics);
+        auto measure = [&](int start, int end) {
+            Diagnostics local = measureBodies(bodies, start, end);
+            double potential = direct
+                ? sim.directSum.calculatePotential(start, end, sim.gravitationalConstant, sim.softening)
+                : QuadTree::calculatePotential(shared.getNodes(), shared.getNumNodes(), shared.getLeafBodies(),
+                    bodies, start, end, sim.theta, sim.gravitationalConstant, sim.softening);
+            local.potential = 0.5 * potential;
+            local.hasPotential = !sim.periodicBox.isEnabled();
+            return local;
+        };
+        if (sim.deterministicReductions) {
+            PairwiseSum pieces(numBodies, Diagnostics::NUM_FIELDS);
+            pieces.addRange(startIdx, endIdx, [&](long long i, double* fields) {
+                measure(static_cast<int>(i), static_cast<int>(i) + 1).toArray(fields);
+            });
+            recordReduced(sim, measure(startIdx, startIdx), &pieces, stateStep, rank);
+        } else {
+            recordReduced(sim, measure(startIdx, endIdx), nullptr, stateStep, rank);
+        }
+    };
+
+    for (int step = 0; step <= config.numSteps; step++) {
+        {
+            ScopedTimer timer(profiler, Phase::Output);
+            if (parallelOutput) {
+                trajectoryWriter.writeFrame(step, bodies);
+            } else if (rank == 0) {
+                sim.writeBodies(step, bodies, numBodies);
+            }
+        }
+
+        if (step >= config.numSteps) {
+            if (sim.diagnosticsInterval > 0) {
+                prepareForces();
+                diagnoseState(step);
+            }
+            break;
+        }
+
+        profiler.beginStep(step + 1, 1);
+
+        prepareForces();
+        if (sim.diagnosticsDue(step)) {
+            diagnoseState(step);
+        }
+
+        // Walk the host's tree for this rank's bodies, then integrate them.
+        // Ranks only write their own bodies, so the host needs no locking here.
+        {
+            ScopedTimer timer(profiler, Phase::ForceWalk);
+            WalkStats* stats = profiler.isEnabled() ? &profiler.thread(0).walk : nullptr;
+            if (direct) {
+                sim.directSum.calculateForces(bodies, startIdx, endIdx,
+                    sim.gravitationalConstant, sim.softening, stats);
+            } else {
+                QuadTree::calculateForces(shared.getNodes(), shared.getNumNodes(), shared.getLeafBodies(),
+                    bodies, startIdx, endIdx,
+                    sim.theta, sim.gravitationalConstant, sim.softening, stats, sim.forceKernel,
+                    &sim.periodicBox);
+            }
+        }
+
+        // Accuracy check against the host's direct-sum snapshot (not timed). The
+        // direct solver loaded it in prepareForces
+        if (forceErrorDue(sim, step + 1)) {
+            if (!direct && shared.isLeader()) {
+                sim.directSum.load(bodies, numBodies);
+            }
+            shared.synchronize();
+            checkRankForceError(sim, sim.directSum, bodies, numBodies, startIdx, endIdx, step + 1, rank);
+        }
+        {
+            ScopedTimer timer(profiler, Phase::Integration);
+            for (int i = startIdx; i < endIdx; i++) {
+                bodies[i].updateAcceleration();
+                bodies[i].updateVelocity(sim.timeStep);
+                bodies[i].updatePosition(sim.timeStep);
+                if (sim.periodicBox.isEnabled()) {
+                    bodies[i].position = sim.periodicBox.wrap(bodies[i].position);
+                }
+            }
+        }
+
+        {
+            ScopedTimer timer(profiler, Phase::Communication);
+            shared.exchangePositions();
+        }
+
+        profiler.endStep();
+
+        if (rank == 0) {
+            printProgress(step, config.numSteps);
+        }
+    }
+
+    trajectoryWriter.close();
+    return true;
+}
+
+// Gather every rank's step records on rank 0 and write one report
+static void writeProfileReport(const Profiler& profiler, const std::string& filename,
+                               const std::vector<Diagnostics>& diagnostics, int rank, int size) {
+    std::vector<double> local = profiler.flatten();
+    int localCount = static_cast<int>(local.size());
+
+    std::vector<int> counts(size);
+    MPI_Gather(&localCount, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    std::vector<int> displs(size, 0);
+    std::vector<double> all;
+    if (rank == 0) {
+        for (int r = 1; r < size; r++) {
+            displs[r] = displs[r - 1] + counts[r - 1];
+        }
+        all.resize(displs[size - 1] + counts[size - 1]);
+    }
+    MPI_Gatherv(local.data(), localCount, MPI_DOUBLE,
+        all.data(), counts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    if (rank != 0) {
+        return;
+    }
+
+    std::vector<std::vector<StepRecord>> ranks(size);
+    for (int r = 0; r < size; r++) {
+        std::vector<double> data(all.begin() + displs[r], all.begin() + displs[r] + counts[r]);
+        ranks[r] = Profiler::unflatten(data);
+    }
+
+    profiler.printSummary(std::cout);
+    if (Profiler::writeReport(filename, ranks, diagnostics)) {
+        std::cout << "Profile report written to: " << filename << " (" << size << " ranks)" << std::endl;
+    }
+}
+
 int main(int argc, char** argv) {
     MPI_Init(&argc, &argv);
     int rank, size;
@@ -89,6 +521,96 @@ int main(int argc, char** argv) {
     MPI_Bcast(&config.gravitationalConstant, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
     MPI_Bcast(&config.numSteps, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&config.numThreads, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&config.leafSize, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&config.treeRebuildFraction, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&config.periodicBox, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&config.diagnosticsInterval, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&config.forceErrorInterval, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&config.forceErrorSamples, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    int deterministicValue = config.deterministicReductions ? 1 : 0;
+    MPI_Bcast(&deterministicValue, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    config.deterministicReductions = (deterministicValue != 0);
+    int treeRefitValue = config.treeRefit ? 1 : 0;
+    MPI_Bcast(&treeRefitValue, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    config.treeRefit = (treeRefitValue != 0);
+    broadcastString(config.outputFormat, 0, MPI_COMM_WORLD);
+    broadcastString(config.profileReport, 0, MPI_COMM_WORLD);
+    broadcastString(config.solver, 0, MPI_COMM_WORLD);
+    broadcastString(config.forceKernel, 0, MPI_COMM_WORLD);
+    int profileValue = config.profile ? 1 : 0;
+    MPI_Bcast(&profileValue, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    config.profile = (profileValue != 0);
+
+    // Resolve the wire format on rank 0 and broadcast it
+    int wireFormatValue = static_cast<int>(WireFormat::Double);
+    if (rank == 0) {
+        WireFormat format;
+        if (parseWireFormat(config.mpiWireFormat, format)) {
+            wireFormatValue = static_cast<int>(format);
+        } else {
+            std::cerr << "Warning: Unknown mpi_wire_format '" << config.mpiWireFormat
+                << "', using double" << std::endl;
+        }
+    }
+    MPI_Bcast(&wireFormatValue, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    WireFormat wireFormat = static_cast<WireFormat>(wireFormatValue);
+
+    int sharedTreeValue = config.mpiSharedTree ? 1 : 0;
+    MPI_Bcast(&sharedTreeValue, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    bool sharedTree = (sharedTreeValue != 0);
+    // Shared-tree ranks publish positions in the host window, only hosts exchange them
+    if (rank == 0 && sharedTree && wireFormat != WireFormat::Double) {
+        std::cerr << "Warning: mpi_wire_format is not used with mpi_shared_tree, positions stay double"
+                  << std::endl;
+    }
+
+    // Each rank holds current velocities for its own block only
+    if (rank == 0 && !config.analysis.empty()) {
+        std::cerr << "Warning: analysis is not supported by nbody_mpi, use nbody_sim" << std::endl;
+    }
+    config.analysis.clear();
+
+    // The rank loops never run the merge stage, and a body count that changes would
+    // break the block distribution. Cleared on every rank before the output format is
+    // chosen, so all ranks agree on the collective binary writes
+    if (rank == 0 && config.mergers) {
+        std::cerr << "Warning: mergers is not supported by nbody_mpi, use nbody_sim" << std::endl;
+    }
+    config.mergers = false;
+
+    // Ranks walk their own bodies through calculateForcesRange, which has no
+    // interaction lists. Cleared before initialize, which would otherwise switch
+    // tree_refit on for rank 0 only
+    if (rank == 0 && config.interactionLists) {
+        std::cerr << "Warning: interaction_lists is not supported by nbody_mpi, using the tree walk" << std::endl;
+    }
+    config.interactionLists = false;
+
+    // Tuning runs inside Simulation::step, which the rank loops do not call; a
+    // per-rank choice of solver or theta would also split the ranks' trees
+    if (rank == 0 && config.autotune) {
+        std::cerr << "Warning: autotune is not supported by nbody_mpi, using the configured solver"
+                  << std::endl;
+    }
+    config.autotune = false;
+
+    // The rank loops take one shared step for every body; block timesteps only live
+    // in Simulation::step. Cleared before initialize so the run does not report them
+    if (rank == 0 && config.blockTimesteps) {
+        std::cerr << "Warning: block_timesteps is not supported by nbody_mpi, using the shared time step"
+                  << std::endl;
+    }
+    config.blockTimesteps = false;
+
+    // Ranks compute on their main thread, so placing them is the launcher's job
+    if (rank == 0 && config.threadAffinity != "none") {
+        std::cerr << "Warning: thread_affinity is not used by nbody_mpi, bind the ranks with "
+                  << "the MPI launcher (e.g. mpirun --bind-to core)" << std::endl;
+    }
+    config.threadAffinity = "none";
+    int hugePagesValue = config.hugePages ? 1 : 0;
+    MPI_Bcast(&hugePagesValue, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    config.hugePages = (hugePagesValue != 0);
 
     // Broadcast bodies using simple serialization
     int numBodies = (rank == 0) ? config.bodies.size() : 0;
@@ -101,36 +623,16 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    // Use simple data array for broadcasting bodies
-    std::vector<double> bodyData(numBodies * 8); // id, mass, px, py, vx, vy, ax, ay
-
-    if (rank == 0) {
-        for (int i = 0; i < numBodies; ++i) {
-            bodyData[i * 8 + 0] = config.bodies[i].id;
-            bodyData[i * 8 + 1] = config.bodies[i].mass;
-            bodyData[i * 8 + 2] = config.bodies[i].position.x;
-            bodyData[i * 8 + 3] = config.bodies[i].position.y;
-            bodyData[i * 8 + 4] = config.bodies[i].velocity.x;
-            bodyData[i * 8 + 5] = config.bodies[i].velocity.y;
-            bodyData[i * 8 + 6] = config.bodies[i].acceleration.x;
-            bodyData[i * 8 + 7] = config.bodies[i].acceleration.y;
-        }
-    }
-
-    MPI_Bcast(bodyData.data(), numBodies * 8, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-
-    if (rank != 0) {
-        config.bodies.resize(numBodies);
-        for (int i = 0; i < numBodies; ++i) {
-            config.bodies[i].id = static_cast<int>(bodyData[i * 8 + 0]);
-            config.bodies[i].mass = bodyData[i * 8 + 1];
-            config.bodies[i].position.x = bodyData[i * 8 + 2];
-            config.bodies[i].position.y = bodyData[i * 8 + 3];
-            config.bodies[i].velocity.x = bodyData[i * 8 + 4];
-            config.bodies[i].velocity.y = bodyData[i * 8 + 5];
-            config.bodies[i].acceleration.x = bodyData[i * 8 + 6];
-            config.bodies[i].acceleration.y = bodyData[i * 8 + 7];
+    // Broadcast bodies once: id and mass never change, so later steps only
+    // exchange positions (see PositionExchange). With the shared tree only rank 0
+    // keeps them; runSharedTree sends them to the host windows
+    if (!sharedTree) {
+        if (rank != 0) {
+            config.bodies.resize(numBodies);
         }
+        MPI_Datatype bodyInitType = createBodyInitType();
+        MPI_Bcast(config.bodies.data(), numBodies, bodyInitType, 0, MPI_COMM_WORLD);
+        MPI_Type_free(&bodyInitType);
     }
 
     if (rank == 0) {
@@ -140,7 +642,7 @@ int main(int argc, char** argv) {
     }
 
     // Check for empty bodies on all ranks
-    bool hasBodies = !config.bodies.empty();
+    int hasBodies = (config.bodies.empty() && (rank == 0 || !sharedTree)) ? 0 : 1;
     int allHaveBodies = 0;
     MPI_Allreduce(&hasBodies, &allHaveBodies, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
     if (!allHaveBodies) {
@@ -148,146 +650,35 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    // Initialize simulation on all ranks
+    // Initialize simulation on all ranks. sim now holds its own copy of the bodies
     Simulation sim;
     sim.initialize(config);
+    std::vector<Body>().swap(config.bodies);
 
-    // Only rank 0 handles file output
-    if (rank == 0) {
+    bool parallelOutput = (sim.outputFormat == OutputFormat::Binary);
+    if (!parallelOutput && rank == 0) {
         sim.setOutputFile(outputFile);
     }
 
-    // Calculate work distribution
-    int bodiesPerRank = numBodies / size;
-    int remainder = numBodies % size;
-    int startIdx = rank * bodiesPerRank + std::min(rank, remainder);
-    int endIdx = startIdx + bodiesPerRank + (rank < remainder ? 1 : 0);
-    int localNumBodies = endIdx - startIdx;
-
     if (rank == 0) {
         std::cout << "Starting simulation for " << config.numSteps << " steps..." << std::endl;
         std::cout << "MPI Configuration:" << std::endl;
         std::cout << "  Total MPI ranks: " << size << std::endl;
-        std::cout << "  Bodies per rank distribution:" << std::endl;
-        for (int r = 0; r < size; r++) {
-            int rStart = r * bodiesPerRank + std::min(r, remainder);
-            int rEnd = rStart + bodiesPerRank + (r < remainder ? 1 : 0);
-            std::cout << "    Rank " << r << ": bodies " << rStart << "-" << (rEnd - 1)
-                << " (" << (rEnd - rStart) << " bodies)" << std::endl;
-        }
-        std::cout << std::endl;
+        std::cout << "  Output: " << (parallelOutput ? "binary, MPI-IO collective writes"
+                                      : config.outputFormat + ", rank 0") << std::endl;
     }
 
     // Start timing
     auto startTime = std::chrono::high_resolution_clock::now();
 
-    // Main simulation loop
-    for (int step = 0; step <= config.numSteps; step++) {
-        auto& bodies = sim.getBodies();
-
-        // Synchronize body data across all ranks
-        if (rank == 0) {
-            // Pack data from bodies to bodyData
-            for (int i = 0; i < numBodies; ++i) {
-                bodyData[i * 8 + 0] = bodies[i].id;
-                bodyData[i * 8 + 1] = bodies[i].mass;
-                bodyData[i * 8 + 2] = bodies[i].position.x;
-                bodyData[i * 8 + 3] = bodies[i].position.y;
-                bodyData[i * 8 + 4] = bodies[i].velocity.x;
-                bodyData[i * 8 + 5] = bodies[i].velocity.y;
-                bodyData[i * 8 + 6] = bodies[i].acceleration.x;
-                bodyData[i * 8 + 7] = bodies[i].acceleration.y;
-            }
-        }
-
-        // Broadcast current state to all ranks
-        MPI_Bcast(bodyData.data(), numBodies * 8, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-
-        // Unpack data on all ranks
-        for (int i = 0; i < numBodies; ++i) {
-            bodies[i].id = static_cast<int>(bodyData[i * 8 + 0]);
-            bodies[i].mass = bodyData[i * 8 + 1];
-            bodies[i].position.x = bodyData[i * 8 + 2];
-            bodies[i].position.y = bodyData[i * 8 + 3];
-            bodies[i].velocity.x = bodyData[i * 8 + 4];
-            bodies[i].velocity.y = bodyData[i * 8 + 5];
-            bodies[i].acceleration.x = bodyData[i * 8 + 6];
-            bodies[i].acceleration.y = bodyData[i * 8 + 7];
-        }
-
-        // Only rank 0 writes output for this step
-        if (rank == 0) {
-            sim.writeState(step);
-        }
-
-        // Don't perform simulation step for the last iteration (just write final state)
-        if (step >= config.numSteps) {
-            break;
-        }
-
-        // Build tree on all ranks (needed for force calculations)
-        sim.buildTree();
-
-        // Each rank calculates forces for its assigned bodies
-        if (localNumBodies > 0) {
-            sim.calculateForcesRange(startIdx, endIdx);
-        }
-
-        // Gather force results back to rank 0
-        std::vector<double> localForceData(localNumBodies * 4); // ax, ay, fx, fy
-        for (int i = 0; i < localNumBodies; ++i) {
-            int bodyIdx = startIdx + i;
-            localForceData[i * 4 + 0] = bodies[bodyIdx].acceleration.x;
-            localForceData[i * 4 + 1] = bodies[bodyIdx].acceleration.y;
-            localForceData[i * 4 + 2] = bodies[bodyIdx].force.x;
-            localForceData[i * 4 + 3] = bodies[bodyIdx].force.y;
-        }
-
-        // Gather all force data to rank 0
-        std::vector<int> recvCounts(size);
-        std::vector<int> displs(size);
-        for (int r = 0; r < size; r++) {
-            int rStart = r * bodiesPerRank + std::min(r, remainder);
-            int rEnd = rStart + bodiesPerRank + (r < remainder ? 1 : 0);
-            recvCounts[r] = (rEnd - rStart) * 4;
-            displs[r] = (r == 0) ? 0 : displs[r - 1] + recvCounts[r - 1];
-        }
-
-        std::vector<double> allForceData;
-        if (rank == 0) {
-            allForceData.resize(numBodies * 4);
-        }
-
-        MPI_Gatherv(localForceData.data(), localNumBodies * 4, MPI_DOUBLE,
-            allForceData.data(), recvCounts.data(), displs.data(), MPI_DOUBLE,
-            0, MPI_COMM_WORLD);
-
-        // Rank 0 updates all body forces and accelerations
-        if (rank == 0) {
-            for (int r = 0; r < size; r++) {
-                int rStart = r * bodiesPerRank + std::min(r, remainder);
-                int rEnd = rStart + bodiesPerRank + (r < remainder ? 1 : 0);
-                int dataOffset = displs[r] / 4;
-
-                for (int i = rStart; i < rEnd; ++i) {
-                    int idx = i - rStart + dataOffset;
-                    bodies[i].acceleration.x = allForceData[idx * 4 + 0];
-                    bodies[i].acceleration.y = allForceData[idx * 4 + 1];
-                    bodies[i].force.x = allForceData[idx * 4 + 2];
-                    bodies[i].force.y = allForceData[idx * 4 + 3];
-                }
-            }
-
-            // Update positions and velocities for all bodies on rank 0
-            sim.updateBodiesRange(0, numBodies);
-        }
-
-        // Progress indicator (matching the standard version)
-        if (rank == 0) {
-            if (config.numSteps >= 10 && (step + 1) % (config.numSteps / 10) == 0) {
-                std::cout << "Progress: " << ((step + 1) * 100 / config.numSteps) << "% (step " << (step + 1) << ")" << std::endl;
-            }
-        }
+    bool completed = sharedTree
+        ? runSharedTree(sim, config, outputFile, parallelOutput, numBodies, rank)
+        : runReplicated(sim, config, outputFile, parallelOutput, wireFormat, rank, size);
+    if (!completed) {
+        // Every rank agreed that the output could not be opened. A rank that did open
+        // it still holds the handle, which MPI_Finalize may not see open
+        MPI_Abort(MPI_COMM_WORLD, 1);
+        return 1;
     }
 
     // End timing
@@ -300,11 +691,16 @@ int main(int argc, char** argv) {
 
         std::cout << "Simulation completed in " << duration.count() << " ms" << std::endl;
         std::cout << "Average time per step: " << (duration.count() / static_cast<double>(config.numSteps)) << " ms" << std::endl;
+        sim.printDiagnosticsSummary(std::cout);
         std::cout << std::endl;
         std::cout << "Output written to: " << outputFile << std::endl;
         std::cout << "=== Simulation Complete ===" << std::endl;
     }
 
+    if (sim.profiler.isEnabled()) {
+        writeProfileReport(sim.profiler, sim.profileReport, sim.diagnosticsLog, rank, size);
+    }
+
     MPI_Finalize();
     return 0;
 }
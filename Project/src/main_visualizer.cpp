@@ -1,31 +1,86 @@
 // File: Project/src/main_visualizer.cpp
 #include "visualizer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <string>
 
 void printUsage(const char* programName) {
-    std::cout << "Usage: " << programName << " [threaded_output] [mpi_output]" << std::endl;
+    std::cout << "Usage: " << programName << " [options] [threaded_output] [mpi_output]" << std::endl;
     std::cout << "  threaded_output: Output file from threaded simulation (default: output.txt)" << std::endl;
     std::cout << "  mpi_output: Output file from MPI simulation (default: output_mpi.txt)" << std::endl;
+    std::cout << "  --lod-pixels N: Crowded bodies drawn with a smaller radius become a density map (default: 8)" << std::endl;
+    std::cout << "  --no-lod: Draw every body as a circle" << std::endl;
+    std::cout << "  --follow: Keep loading frames the simulation appends to the files" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Headless export (no window or display needed):" << std::endl;
+    std::cout << "  --export PREFIX   Render every frame to PREFIX_000000.png, ..." << std::endl;
+    std::cout << "  --format png|ppm  Image format (default: png)" << std::endl;
+    std::cout << "  --fps N           Video frame rate (default: 30)" << std::endl;
+    std::cout << "  --speed N         Trajectory frames per second of video (default: 5)" << std::endl;
+    std::cout << "  --size WxH        Frame size (default: 1600x800)" << std::endl;
+    std::cout << "  --encoders N      Encoder threads (default: 4)" << std::endl;
     std::cout << std::endl;
     std::cout << "Example: " << programName << " output_thr.txt output_mpi.txt" << std::endl;
+    std::cout << "         " << programName << " --export movie/frame output_thr.txt output_mpi.txt" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
     std::string threadedFile = "output_thr.txt";
     std::string mpiFile = "output_mpi.txt";
+    bool headless = false;
+    bool levelOfDetail = true;
+    bool follow = false;
+    double lodPixels = 8.0;
+    ExportSettings exportSettings;
+    int width = 1600;
+    int height = 800;
     
     // Parse command line arguments
-    if (argc >= 2) {
-        std::string arg = argv[1];
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
         if (arg == "-h" || arg == "--help") {
             printUsage(argv[0]);
             return 0;
+        } else if (arg == "--lod-pixels" && hasValue) {
+            lodPixels = std::atof(argv[++i]);
+        } else if (arg == "--follow") {
+            follow = true;
+        } else if (arg == "--no-lod") {
+            levelOfDetail = false;
+        } else if (arg == "--export" && hasValue) {
+            headless = true;
+            exportSettings.prefix = argv[++i];
+        } else if (arg == "--format" && hasValue) {
+            std::string name = argv[++i];
+            if (!parseImageFormat(name, exportSettings.format)) {
+                std::cerr << "Unknown image format: " << name << std::endl;
+                return -1;
+            }
+        } else if (arg == "--fps" && hasValue) {
+            exportSettings.fps = std::atof(argv[++i]);
+        } else if (arg == "--speed" && hasValue) {
+            exportSettings.speed = std::atof(argv[++i]);
+        } else if (arg == "--size" && hasValue) {
+            if (std::sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                std::cerr << "Invalid size: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--encoders" && hasValue) {
+            exportSettings.encoderThreads = std::max(1, std::atoi(argv[++i]));
+        } else if (positional == 0) {
+            threadedFile = arg;
+            positional++;
+        } else if (positional == 1) {
+            mpiFile = arg;
+            positional++;
+        } else {
+            printUsage(argv[0]);
+            return -1;
         }
-        threadedFile = arg;
-    }
-    if (argc >= 3) {
-        mpiFile = argv[2];
     }
     
     std::cout << "=== N-Body Simulation Visualizer ===" << std::endl;
@@ -34,9 +89,11 @@ int main(int argc, char* argv[]) {
     std::cout << std::endl;
     
     // Create and initialize visualizer
-    Visualizer visualizer(1600, 800);
+    Visualizer visualizer(width, height);
+    visualizer.setLevelOfDetail(levelOfDetail, lodPixels);
+    visualizer.setFollow(follow && !headless);
     
-    if (!visualizer.initialize()) {
+    if (!(headless ? visualizer.initializeHeadless() : visualizer.initialize())) {
         std::cerr << "Failed to initialize visualizer" << std::endl;
         return -1;
     }
@@ -47,6 +104,10 @@ int main(int argc, char* argv[]) {
         return -1;
     }
     
+    if (headless) {
+        return visualizer.exportFrames(exportSettings) ? 0 : -1;
+    }
+
     std::cout << "Visualization initialized successfully!" << std::endl;
     
     // Run visualization
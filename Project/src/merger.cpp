@@ -0,0 +1,187 @@
+#include "merger.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+Merger::Merger() : enabled(false), radius(0.0), radiusScale(1.0), numRemoved(0), numEvents(0) {}
+
+double Merger::bodyRadius(const Body& body) const {
+    return radius > 0.0 ? radius : radiusScale * body.getVisualRadius();
+}
+
+// Run work(t) for t in [0, totalThreads), thread 0 on the caller
+template <typename Work>
+static void runThreads(int totalThreads, Work work) {
+    std::vector<std::thread> threads;
+    for (int t = 1; t < totalThreads; t++) {
+        threads.emplace_back(work, t);
+    }
+    work(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Contiguous range of thread t out of totalThreads over count items
+static void threadRange(int count, int totalThreads, int t, int& start, int& end) {
+    int perThread = count / totalThreads;
+    int remainder = count % totalThreads;
+    start = t * perThread + std::min(t, remainder);
+    end = start + perThread + (t < remainder ? 1 : 0);
+}
+
+int Merger::findRoot(int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+int Merger::apply(std::vector<Body>& bodies, const QuadTree& tree, int numThreads) {
+    int numBodies = static_cast<int>(bodies.size());
+    if (numBodies < 2) {
+        return 0;
+    }
+
+    // 1. Colliding pairs; each thread scans a contiguous range of i. A pair closer
+    // than ri + rj is closer than twice the larger radius, so it is found by the
+    // query of its larger body (the lower index on ties) and only kept there
+    // In a periodic box (the tree's) separations are taken to the nearest image
+    const PeriodicBox* box = tree.getPeriodicBox();
+    bool periodic = box && box->isEnabled();
+    int totalThreads = std::max(1, std::min(numThreads, numBodies));
+    threadPairs.resize(totalThreads);
+    runThreads(totalThreads, [&](int t) {
+        int start, end;
+        threadRange(numBodies, totalThreads, t, start, end);
+        std::vector<int>& pairs = threadPairs[t];
+        pairs.clear();
+        std::vector<int> neighbours;
+        for (int i = start; i < end; i++) {
+            double ri = bodyRadius(bodies[i]);
+            neighbours.clear();
+            tree.findNeighbours(bodies[i].position, 2.0 * ri, neighbours);
+            for (int j : neighbours) {
+                double rj = bodyRadius(bodies[j]);
+                if (rj > ri || (rj == ri && j <= i)) {
+                    continue;
+                }
+                double contact = ri + rj;
+                Vec2 separation = bodies[j].position - bodies[i].position;
+                if (periodic) {
+                    separation = box->minimumImage(separation);
+                }
+                if (separation.lengthSquared() < contact * contact) {
+                    pairs.push_back(i);
+                    pairs.push_back(j);
+                }
+            }
+        }
+    });
+
+    bool anyPairs = false;
+    for (const std::vector<int>& pairs : threadPairs) {
+        anyPairs = anyPairs || !pairs.empty();
+    }
+    if (!anyPairs) {
+        return 0;
+    }
+
+    // 2. Groups: union-find with the lowest index as the root
+    parent.resize(numBodies);
+    for (int i = 0; i < numBodies; i++) {
+        parent[i] = i;
+    }
+    for (const std::vector<int>& pairs : threadPairs) {
+        for (size_t k = 0; k < pairs.size(); k += 2) {
+            int a = findRoot(pairs[k]);
+            int b = findRoot(pairs[k + 1]);
+            if (a != b) {
+                parent[std::max(a, b)] = std::min(a, b);
+            }
+        }
+    }
+
+    // 3. Survivor of each group (heaviest, then lowest index) and the group totals,
+    // summed in index order. parent is flattened to the roots on the way, so the
+    // parallel stage below only reads it. In a periodic box each member's position is
+    // taken at its image nearest the root, and the centre of mass is wrapped back
+    survivor.assign(numBodies, -1);
+    std::vector<double> groupMass(numBodies, 0.0);
+    std::vector<Vec2> groupMoment(numBodies, Vec2(0, 0));
+    std::vector<Vec2> groupMomentum(numBodies, Vec2(0, 0));
+    std::vector<int> groupSize(numBodies, 0);
+    for (int i = 0; i < numBodies; i++) {
+        int root = findRoot(i);
+        parent[i] = root;
+        const Body& body = bodies[i];
+        if (survivor[root] < 0 || body.mass > bodies[survivor[root]].mass) {
+            survivor[root] = i;
+        }
+        groupMass[root] += body.mass;
+        Vec2 position = body.position;
+        if (periodic) {
+            position = bodies[root].position + box->minimumImage(body.position - bodies[root].position);
+        }
+        groupMoment[root] += position * body.mass;
+        groupMomentum[root] += body.velocity * body.mass;
+        groupSize[root]++;
+    }
+
+    // 4. Survivors take the group totals; the other members are dropped. Each thread
+    // counts the survivors of its range, an exclusive prefix sum over the counts gives
+    // its first output slot, and the threads then scatter their survivors in order into
+    // the scratch array and copy them back, so bodies keeps its storage (and placement)
+    std::vector<int> threadKept(totalThreads + 1, 0);
+    std::vector<long long> threadEvents(totalThreads, 0);
+    runThreads(totalThreads, [&](int t) {
+        int start, end;
+        threadRange(numBodies, totalThreads, t, start, end);
+        int kept = 0;
+        for (int i = start; i < end; i++) {
+            kept += (survivor[parent[i]] == i) ? 1 : 0;
+        }
+        threadKept[t + 1] = kept;
+    });
+    for (int t = 0; t < totalThreads; t++) {
+        threadKept[t + 1] += threadKept[t];
+    }
+
+    int write = threadKept[totalThreads];
+    compacted.resize(write);
+    runThreads(totalThreads, [&](int t) {
+        int start, end;
+        threadRange(numBodies, totalThreads, t, start, end);
+        int out = threadKept[t];
+        for (int i = start; i < end; i++) {
+            int root = parent[i];
+            if (survivor[root] != i) {
+                continue;
+            }
+            Body body = bodies[i];
+            if (groupSize[root] > 1) {
+                threadEvents[t]++;
+                body.mass = groupMass[root];
+                body.position = groupMoment[root] / body.mass;
+                if (periodic) {
+                    body.position = box->wrap(body.position);
+                }
+                body.velocity = groupMomentum[root] / body.mass;
+            }
+            compacted[out++] = body;
+        }
+    });
+    runThreads(totalThreads, [&](int t) {
+        std::copy(compacted.begin() + threadKept[t], compacted.begin() + threadKept[t + 1],
+                  bodies.begin() + threadKept[t]);
+    });
+
+    int removed = numBodies - write;
+    bodies.resize(write);
+    for (long long events : threadEvents) {
+        numEvents += events;
+    }
+    numRemoved += removed;
+    return removed;
+}
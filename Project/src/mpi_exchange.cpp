@@ -0,0 +1,159 @@
+#include "mpi_exchange.h"
+#include <algorithm>
+
+bool parseWireFormat(const std::string& name, WireFormat& format) {
+    if (name == "double") {
+        format = WireFormat::Double;
+    } else if (name == "float32" || name == "float") {
+        format = WireFormat::Float32;
+    } else if (name == "delta32" || name == "delta") {
+        format = WireFormat::Delta32;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* wireFormatName(WireFormat format) {
+    switch (format) {
+        case WireFormat::Double: return "double";
+        case WireFormat::Float32: return "float32";
+        case WireFormat::Delta32: return "delta32";
+    }
+    return "unknown";
+}
+
+void blockRange(int n, int parts, int index, int& startIdx, int& endIdx) {
+    int perPart = n / parts;
+    int remainder = n % parts;
+    startIdx = index * perPart + std::min(index, remainder);
+    endIdx = startIdx + perPart + (index < remainder ? 1 : 0);
+}
+
+void broadcastString(std::string& value, int root, MPI_Comm comm) {
+    int length = static_cast<int>(value.size());
+    MPI_Bcast(&length, 1, MPI_INT, root, comm);
+    value.resize(length);
+    MPI_Bcast(&value[0], length, MPI_CHAR, root, comm);
+}
+
+// Resize a datatype so consecutive elements are one Body apart
+static MPI_Datatype resizeToBody(MPI_Datatype type) {
+    MPI_Datatype resized;
+    MPI_Type_create_resized(type, 0, sizeof(Body), &resized);
+    MPI_Type_free(&type);
+    MPI_Type_commit(&resized);
+    return resized;
+}
+
+MPI_Datatype createBodyInitType() {
+    int blockLengths[4] = {1, 1, 2, 2};
+    MPI_Aint offsets[4] = {
+        offsetof(Body, id),
+        offsetof(Body, mass),
+        offsetof(Body, position),
+        offsetof(Body, velocity)
+    };
+    MPI_Datatype types[4] = {MPI_INT, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE};
+
+    MPI_Datatype type;
+    MPI_Type_create_struct(4, blockLengths, offsets, types, &type);
+    return resizeToBody(type);
+}
+
+MPI_Datatype createBodyPositionType() {
+    int blockLength = 2;
+    MPI_Aint offset = offsetof(Body, position);
+    MPI_Datatype doubleType = MPI_DOUBLE;
+
+    MPI_Datatype type;
+    MPI_Type_create_struct(1, &blockLength, &offset, &doubleType, &type);
+    return resizeToBody(type);
+}
+
+PositionExchange::PositionExchange(MPI_Comm comm, const std::vector<Body>& bodies, WireFormat format)
+    : comm(comm), numBodies(static_cast<int>(bodies.size())), format(format) {
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    blockRange(numBodies, size, rank, startIdx, endIdx);
+
+    // Counts are in bodies for the derived datatype, in floats otherwise
+    int unit = (format == WireFormat::Double) ? 1 : 2;
+    recvCounts.resize(size);
+    displs.resize(size);
+    for (int r = 0; r < size; r++) {
+        int rStart, rEnd;
+        blockRange(numBodies, size, r, rStart, rEnd);
+        recvCounts[r] = (rEnd - rStart) * unit;
+        displs[r] = rStart * unit;
+    }
+
+    positionType = createBodyPositionType();
+
+    if (format != WireFormat::Double) {
+        wireData.resize(numBodies * 2);
+    }
+    if (format == WireFormat::Delta32) {
+        // All ranks start from the same exactly broadcast initial positions
+        reference.resize(numBodies);
+        for (int i = 0; i < numBodies; i++) {
+            reference[i] = bodies[i].position;
+        }
+    }
+}
+
+PositionExchange::~PositionExchange() {
+    // The exchange may outlive MPI_Finalize at the end of main
+    int finalized = 0;
+    MPI_Finalized(&finalized);
+    if (!finalized) {
+        MPI_Type_free(&positionType);
+    }
+}
+
+size_t PositionExchange::bytesPerBody() const {
+    return (format == WireFormat::Double) ? 2 * sizeof(double) : 2 * sizeof(float);
+}
+
+void PositionExchange::exchange(std::vector<Body>& bodies) {
+    if (format == WireFormat::Double) {
+        // Positions go straight into the Body array, no packing
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+            bodies.data(), recvCounts.data(), displs.data(), positionType, comm);
+        return;
+    }
+
+    // Encode own block
+    for (int i = startIdx; i < endIdx; i++) {
+        if (format == WireFormat::Float32) {
+            wireData[i * 2 + 0] = static_cast<float>(bodies[i].position.x);
+            wireData[i * 2 + 1] = static_cast<float>(bodies[i].position.y);
+        } else {
+            float dx = static_cast<float>(bodies[i].position.x - reference[i].x);
+            float dy = static_cast<float>(bodies[i].position.y - reference[i].y);
+            wireData[i * 2 + 0] = dx;
+            wireData[i * 2 + 1] = dy;
+            // Track the decoded value so the reference stays identical on all ranks
+            reference[i].x += dx;
+            reference[i].y += dy;
+        }
+    }
+
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+        wireData.data(), recvCounts.data(), displs.data(), MPI_FLOAT, comm);
+
+    // Decode the other blocks; owned bodies keep their exact positions
+    for (int i = 0; i < numBodies; i++) {
+        if (i >= startIdx && i < endIdx) {
+            continue;
+        }
+        if (format == WireFormat::Float32) {
+            bodies[i].position.x = wireData[i * 2 + 0];
+            bodies[i].position.y = wireData[i * 2 + 1];
+        } else {
+            reference[i].x += wireData[i * 2 + 0];
+            reference[i].y += wireData[i * 2 + 1];
+            bodies[i].position = reference[i];
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#include "mpi_io.h"
+#include "trajectory.h"
+#include <cstring>
+#include <iostream>
+
+MpiTrajectoryWriter::MpiTrajectoryWriter(MPI_Comm comm)
+    : comm(comm), fileHandle(MPI_FILE_NULL), opened(false), rank(0),
+      numBodies(0), startIdx(0), endIdx(0), frameIndex(0) {
+    MPI_Comm_rank(comm, &rank);
+}
+
+MpiTrajectoryWriter::~MpiTrajectoryWriter() {
+    int finalized = 0;
+    MPI_Finalized(&finalized);
+    if (!finalized) {
+        close();
+    }
+}
+
+bool MpiTrajectoryWriter::open(const std::string& filename, const Body* bodies, int numBodies,
+                               int startIdx, int endIdx) {
+    this->numBodies = numBodies;
+    this->startIdx = startIdx;
+    this->endIdx = endIdx;
+    frameIndex = 0;
+
+    int result = MPI_File_open(comm, filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+        MPI_INFO_NULL, &fileHandle);
+    // The outcome is per rank: agree on it before any collective write, or the ranks
+    // that did open the file would wait in the header write for the others
+    int localOpened = (result == MPI_SUCCESS) ? 1 : 0;
+    int allOpened = 0;
+    MPI_Allreduce(&localOpened, &allOpened, 1, MPI_INT, MPI_MIN, comm);
+    if (!allOpened) {
+        if (rank == 0) {
+            std::cerr << "Error: Could not open output file: " << filename << std::endl;
+        }
+        return false;
+    }
+    MPI_File_set_size(fileHandle, 0);
+    opened = true;
+
+    // Rank 0 writes the header, the others join the collective with nothing
+    std::vector<char> header;
+    if (rank == 0) {
+        makeTrajectoryHeader(bodies, numBodies, header);
+    }
+    MPI_File_write_at_all(fileHandle, 0, header.data(), static_cast<int>(header.size()),
+        MPI_BYTE, MPI_STATUS_IGNORE);
+
+    // Rank 0's block directly follows the frame's step field, so it writes both
+    int64_t stepBytes = (rank == 0) ? sizeof(int64_t) : 0;
+    buffer.resize(stepBytes + static_cast<int64_t>(endIdx - startIdx) * 2 * sizeof(double));
+    return true;
+}
+
+void MpiTrajectoryWriter::writeFrame(int stepNumber, const Body* bodies) {
+    if (!opened) {
+        return;
+    }
+
+    char* ptr = buffer.data();
+    MPI_Offset offset = trajectoryFrameOffset(numBodies, frameIndex);
+    if (rank == 0) {
+        int64_t step = stepNumber;
+        std::memcpy(ptr, &step, sizeof(step));
+        ptr += sizeof(step);
+    } else {
+        offset += sizeof(int64_t) + static_cast<MPI_Offset>(startIdx) * 2 * sizeof(double);
+    }
+
+    double* xy = reinterpret_cast<double*>(ptr);
+    for (int i = startIdx; i < endIdx; i++) {
+        xy[(i - startIdx) * 2 + 0] = bodies[i].position.x;
+        xy[(i - startIdx) * 2 + 1] = bodies[i].position.y;
+    }
+
+    MPI_File_write_at_all(fileHandle, offset, buffer.data(), static_cast<int>(buffer.size()),
+        MPI_BYTE, MPI_STATUS_IGNORE);
+    frameIndex++;
+}
+
+void MpiTrajectoryWriter::close() {
+    if (opened) {
+        MPI_File_close(&fileHandle);
+        opened = false;
+    }
+}
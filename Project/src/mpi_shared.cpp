@@ -0,0 +1,222 @@
+#include "mpi_shared.h"
+#include "mpi_exchange.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+NodeSharedState::NodeSharedState(MPI_Comm world, int numBodies)
+    : nodeComm(MPI_COMM_NULL), leaderComm(MPI_COMM_NULL), nodeRank(0), nodeSize(1),
+      hostIndex(0), numHosts(1), numBodies(numBodies),
+      bodyWindow(MPI_WIN_NULL), bodies(nullptr),
+      treeWindow(MPI_WIN_NULL), nodes(nullptr), numNodes(0), nodeCapacity(0),
+      leafWindow(MPI_WIN_NULL), leafBodies(nullptr), numLeafBodies(0), leafCapacity(0),
+      sourceWindow(MPI_WIN_NULL), sources(nullptr),
+      positionType(MPI_DATATYPE_NULL) {
+    int worldRank;
+    MPI_Comm_rank(world, &worldRank);
+
+    // One communicator per host, and one communicator joining the host leaders
+    MPI_Comm_split_type(world, MPI_COMM_TYPE_SHARED, worldRank, MPI_INFO_NULL, &nodeComm);
+    MPI_Comm_rank(nodeComm, &nodeRank);
+    MPI_Comm_size(nodeComm, &nodeSize);
+    MPI_Comm_split(world, isLeader() ? 0 : MPI_UNDEFINED, worldRank, &leaderComm);
+
+    if (isLeader()) {
+        MPI_Comm_rank(leaderComm, &hostIndex);
+        MPI_Comm_size(leaderComm, &numHosts);
+    }
+    MPI_Bcast(&hostIndex, 1, MPI_INT, 0, nodeComm);
+    MPI_Bcast(&numHosts, 1, MPI_INT, 0, nodeComm);
+
+    // Host block first, then this rank's share of it
+    blockRange(numBodies, numHosts, hostIndex, hostStartIdx, hostEndIdx);
+    int localStart, localEnd;
+    blockRange(hostEndIdx - hostStartIdx, nodeSize, nodeRank, localStart, localEnd);
+    startIdx = hostStartIdx + localStart;
+    endIdx = hostStartIdx + localEnd;
+
+    if (isLeader()) {
+        hostCounts.resize(numHosts);
+        hostDispls.resize(numHosts);
+        for (int h = 0; h < numHosts; h++) {
+            int hStart, hEnd;
+            blockRange(numBodies, numHosts, h, hStart, hEnd);
+            hostCounts[h] = hEnd - hStart;
+            hostDispls[h] = hStart;
+        }
+        positionType = createBodyPositionType();
+    }
+
+    bodies = static_cast<Body*>(allocateWindow(static_cast<size_t>(numBodies) * sizeof(Body), sizeof(Body),
+                                               bodyWindow));
+
+    // Empty until shareTree() or shareDirectSum()
+    allocateTreeWindow(0);
+    allocateLeafWindow(0);
+    allocateWindow(0, sizeof(double), sourceWindow);
+}
+
+NodeSharedState::~NodeSharedState() {
+    int finalized = 0;
+    MPI_Finalized(&finalized);
+    if (finalized) {
+        return;
+    }
+
+    freeWindow(sourceWindow);
+    freeLeafWindow();
+    freeTreeWindow();
+    freeWindow(bodyWindow);
+    if (positionType != MPI_DATATYPE_NULL) {
+        MPI_Type_free(&positionType);
+    }
+    if (leaderComm != MPI_COMM_NULL) {
+        MPI_Comm_free(&leaderComm);
+    }
+    MPI_Comm_free(&nodeComm);
+}
+
+void* NodeSharedState::allocateWindow(size_t bytes, int unit, MPI_Win& window) {
+    // The leader owns all of the window memory, the others attach to it
+    MPI_Aint localBytes = isLeader() ? static_cast<MPI_Aint>(bytes) : 0;
+    void* base = nullptr;
+    MPI_Win_allocate_shared(localBytes, unit, MPI_INFO_NULL, nodeComm, &base, &window);
+    MPI_Aint querySize;
+    int queryDisp;
+    MPI_Win_shared_query(window, 0, &querySize, &queryDisp, &base);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+    return base;
+}
+
+void NodeSharedState::freeWindow(MPI_Win& window) {
+    if (window != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(window);
+        MPI_Win_free(&window);
+    }
+}
+
+void NodeSharedState::allocateTreeWindow(int capacity) {
+    nodes = static_cast<QuadTreeNode*>(allocateWindow(static_cast<size_t>(capacity) * sizeof(QuadTreeNode),
+                                                      sizeof(QuadTreeNode), treeWindow));
+    nodeCapacity = capacity;
+}
+
+void NodeSharedState::freeTreeWindow() {
+    freeWindow(treeWindow);
+    nodes = nullptr;
+    nodeCapacity = 0;
+}
+
+void NodeSharedState::allocateLeafWindow(int capacity) {
+    leafBodies = static_cast<LeafBody*>(allocateWindow(static_cast<size_t>(capacity) * sizeof(LeafBody),
+                                                       sizeof(LeafBody), leafWindow));
+    leafCapacity = capacity;
+}
+
+void NodeSharedState::freeLeafWindow() {
+    freeWindow(leafWindow);
+    leafBodies = nullptr;
+    leafCapacity = 0;
+}
+
+void NodeSharedState::synchronize() {
+    // Unified memory model: sync, barrier, sync orders the local stores of every
+    // rank on the host before the loads that follow
+    MPI_Win_sync(bodyWindow);
+    MPI_Win_sync(treeWindow);
+    MPI_Win_sync(leafWindow);
+    MPI_Win_sync(sourceWindow);
+    MPI_Barrier(nodeComm);
+    MPI_Win_sync(bodyWindow);
+    MPI_Win_sync(treeWindow);
+    MPI_Win_sync(leafWindow);
+    MPI_Win_sync(sourceWindow);
+}
+
+void NodeSharedState::loadBodies(const Body* source) {
+    if (isLeader()) {
+        // Force and acceleration are not sent; they start at zero as in Body()
+        std::uninitialized_fill_n(bodies, numBodies, Body());
+        if (source) {
+            std::memcpy(static_cast<void*>(bodies), source, static_cast<size_t>(numBodies) * sizeof(Body));
+        }
+        // World rank 0 is rank 0 of leaderComm
+        MPI_Datatype bodyInitType = createBodyInitType();
+        MPI_Bcast(bodies, numBodies, bodyInitType, 0, leaderComm);
+        MPI_Type_free(&bodyInitType);
+    }
+    synchronize();
+}
+
+void NodeSharedState::attachTree(QuadTree& tree) {
+    tree.nodes.attach(nodes, static_cast<size_t>(nodeCapacity));
+    tree.leafBodies.attach(leafBodies, static_cast<size_t>(leafCapacity));
+}
+
+void NodeSharedState::shareTree(QuadTree& tree) {
+    // Room for the first build (see OrthTree::build); a body sits in at most one leaf
+    int leafSize = tree.getLeafSize();
+    MPI_Bcast(&leafSize, 1, MPI_INT, 0, nodeComm);
+    freeTreeWindow();
+    allocateTreeWindow(2 * numBodies / leafSize + 1);
+    freeLeafWindow();
+    allocateLeafWindow(leafSize > 1 ? numBodies : 0);
+    if (isLeader()) {
+        attachTree(tree);
+    }
+}
+
+void NodeSharedState::publishTree(QuadTree* tree) {
+    // Node and leaf body counts, and whether either pool spilled out of its window
+    int counts[4] = {0, 0, 0, 0};
+    if (isLeader() && tree) {
+        counts[0] = tree->getNumNodes();
+        counts[1] = static_cast<int>(tree->leafBodies.size());
+        counts[2] = tree->nodes.spilled() ? 1 : 0;
+        counts[3] = tree->leafBodies.spilled() ? 1 : 0;
+    }
+    MPI_Bcast(counts, 4, MPI_INT, 0, nodeComm);
+
+    // A spilled pool holds the whole tree in the leader's private memory; grow its
+    // window (collectively) and move it back in. This is the only copy
+    if (counts[2]) {
+        freeTreeWindow();
+        allocateTreeWindow(counts[0] + counts[0] / 2);
+    }
+    if (counts[3]) {
+        freeLeafWindow();
+        allocateLeafWindow(counts[1] + counts[1] / 2);
+    }
+    if (isLeader() && tree && (counts[2] || counts[3])) {
+        attachTree(*tree);
+    }
+    numNodes = counts[0];
+    numLeafBodies = counts[1];
+    synchronize();
+}
+
+void NodeSharedState::shareDirectSum(DirectSum& directSum) {
+    freeWindow(sourceWindow);
+    sources = static_cast<double*>(allocateWindow(3 * static_cast<size_t>(numBodies) * sizeof(double),
+                                                  sizeof(double), sourceWindow));
+    directSum.attach(sources, numBodies);
+}
+
+void NodeSharedState::exchangePositions() {
+    // All ranks of the host must have finished integrating their bodies
+    synchronize();
+
+    if (isLeader() && numHosts > 1) {
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+            bodies, hostCounts.data(), hostDispls.data(), positionType, leaderComm);
+    }
+
+    synchronize();
+}
+
+size_t NodeSharedState::sharedBytes() const {
+    return static_cast<size_t>(numBodies) * sizeof(Body) +
+           static_cast<size_t>(nodeCapacity) * sizeof(QuadTreeNode) +
+           static_cast<size_t>(leafCapacity) * sizeof(LeafBody) +
+           (sources ? 3 * static_cast<size_t>(numBodies) * sizeof(double) : 0);
+}
@@ -0,0 +1,203 @@
+#include "offscreen.h"
+#include <EGL/eglext.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// ============================================================================
+// OffscreenContext Implementation
+// ============================================================================
+
+OffscreenContext::OffscreenContext()
+    : display(EGL_NO_DISPLAY), surface(EGL_NO_SURFACE), context(EGL_NO_CONTEXT) {}
+
+OffscreenContext::~OffscreenContext() {
+    destroy();
+}
+
+bool OffscreenContext::create(int width, int height) {
+    destroy();
+
+    // EGL_EXT_device_enumeration: render on a device without any display server
+    auto queryDevices = reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(eglGetProcAddress("eglQueryDevicesEXT"));
+    auto platformDisplay =
+        reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (queryDevices && platformDisplay) {
+        EGLDeviceEXT devices[8];
+        EGLint numDevices = 0;
+        if (queryDevices(8, devices, &numDevices)) {
+            for (EGLint d = 0; d < numDevices; d++) {
+                if (createOn(platformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[d], nullptr), width, height)) {
+                    return true;
+                }
+            }
+        }
+    }
+    if (createOn(eglGetDisplay(EGL_DEFAULT_DISPLAY), width, height)) {
+        return true;
+    }
+    std::cerr << "Failed to create an offscreen EGL context" << std::endl;
+    return false;
+}
+
+bool OffscreenContext::createOn(EGLDisplay candidate, int width, int height) {
+    EGLint major = 0, minor = 0;
+    if (candidate == EGL_NO_DISPLAY || !eglInitialize(candidate, &major, &minor)) {
+        return false;
+    }
+
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(candidate, configAttributes, &config, 1, &numConfigs) || numConfigs < 1 ||
+        !eglBindAPI(EGL_OPENGL_API)) {
+        eglTerminate(candidate);
+        return false;
+    }
+
+    const EGLint surfaceAttributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    EGLSurface newSurface = eglCreatePbufferSurface(candidate, config, surfaceAttributes);
+    // The renderer draws with the fixed-function pipeline, so no core profile is requested
+    EGLContext newContext = eglCreateContext(candidate, config, EGL_NO_CONTEXT, nullptr);
+    if (newSurface == EGL_NO_SURFACE || newContext == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(candidate, newSurface, newSurface, newContext)) {
+        if (newContext != EGL_NO_CONTEXT) {
+            eglDestroyContext(candidate, newContext);
+        }
+        if (newSurface != EGL_NO_SURFACE) {
+            eglDestroySurface(candidate, newSurface);
+        }
+        eglTerminate(candidate);
+        return false;
+    }
+
+    display = candidate;
+    surface = newSurface;
+    context = newContext;
+    std::cout << "EGL " << major << "." << minor << " offscreen context (" << width << "x" << height << ")"
+              << std::endl;
+    return true;
+}
+
+void OffscreenContext::destroy() {
+    if (display == EGL_NO_DISPLAY) {
+        return;
+    }
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (context != EGL_NO_CONTEXT) {
+        eglDestroyContext(display, context);
+    }
+    if (surface != EGL_NO_SURFACE) {
+        eglDestroySurface(display, surface);
+    }
+    eglTerminate(display);
+    display = EGL_NO_DISPLAY;
+    surface = EGL_NO_SURFACE;
+    context = EGL_NO_CONTEXT;
+}
+
+// ============================================================================
+// PixelReadback Implementation
+// ============================================================================
+
+PixelReadback::PixelReadback()
+    : width(0), height(0), ringSize(0), head(0), pending(0), syncWaits(0) {}
+
+PixelReadback::~PixelReadback() {
+    release();
+}
+
+bool PixelReadback::initialize(int newWidth, int newHeight, int newRingSize) {
+    release();
+    width = newWidth;
+    height = newHeight;
+    ringSize = std::max(1, newRingSize);
+    head = 0;
+    pending = 0;
+    syncWaits = 0;
+
+    GLsizeiptr bytes = static_cast<GLsizeiptr>(width) * height * 4;
+    buffers.assign(ringSize, 0);
+    fences.assign(ringSize, nullptr);
+    tags.assign(ringSize, 0);
+    glGenBuffers(ringSize, buffers.data());
+    for (GLuint buffer : buffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    return glGetError() == GL_NO_ERROR;
+}
+
+void PixelReadback::release() {
+    if (buffers.empty()) {
+        return;
+    }
+    for (GLsync fence : fences) {
+        if (fence) {
+            glDeleteSync(fence);
+        }
+    }
+    glDeleteBuffers(static_cast<GLsizei>(buffers.size()), buffers.data());
+    buffers.clear();
+    fences.clear();
+    tags.clear();
+    pending = 0;
+}
+
+bool PixelReadback::read(int64_t tag, std::vector<uint8_t>& pixels, int64_t& readyTag) {
+    bool ready = false;
+    if (pending == ringSize) {
+        ready = collect(pixels, readyTag);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[head]);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fences[head] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Submit the copy now, so it runs while the next frame is being drawn
+    glFlush();
+    tags[head] = tag;
+    head = (head + 1) % ringSize;
+    pending++;
+    return ready;
+}
+
+bool PixelReadback::drain(std::vector<uint8_t>& pixels, int64_t& readyTag) {
+    return pending > 0 && collect(pixels, readyTag);
+}
+
+bool PixelReadback::collect(std::vector<uint8_t>& pixels, int64_t& readyTag) {
+    int slot = (head - pending + ringSize) % ringSize;
+    pending--;
+
+    if (glClientWaitSync(fences[slot], 0, 0) == GL_TIMEOUT_EXPIRED) {
+        syncWaits++;
+        while (glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+        }
+    }
+    glDeleteSync(fences[slot]);
+    fences[slot] = nullptr;
+
+    size_t bytes = static_cast<size_t>(width) * height * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[slot]);
+    const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    bool mappedOk = (mapped != nullptr);
+    if (mappedOk) {
+        pixels.resize(bytes);
+        std::memcpy(pixels.data(), mapped, bytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readyTag = tags[slot];
+    return mappedOk;
+}
@@ -0,0 +1,106 @@
+#include "periodic.h"
+#include <algorithm>
+
+// Ewald splitting parameter for the unit box, and the image / wave-vector ranges
+// summed with it (both neglected tails are below 1e-18 of the leading terms)
+static const double EWALD_ALPHA = 2.0;
+static const int EWALD_REAL_RANGE = 4;
+static const int EWALD_RECIPROCAL_RANGE = 5;
+
+PeriodicBox::PeriodicBox() : size(0.0), halfSize(0.0), invSize(0.0), tableScale(0.0), fieldScale(0.0) {}
+
+void PeriodicBox::setSize(double boxSize) {
+    size = std::max(0.0, boxSize);
+    table.clear();
+    if (size <= 0.0) {
+        halfSize = invSize = tableScale = fieldScale = 0.0;
+        return;
+    }
+    halfSize = 0.5 * size;
+    invSize = 1.0 / size;
+    tableScale = 2.0 * TABLE_CELLS / size;
+    fieldScale = 1.0 / (size * size);
+
+    // Unit box, one quadrant
+    int points = TABLE_CELLS + 1;
+    table.resize(2 * static_cast<size_t>(points) * points);
+    for (int i = 0; i < points; i++) {
+        for (int j = 0; j < points; j++) {
+            Vec2 d(0.5 * i / TABLE_CELLS, 0.5 * j / TABLE_CELLS);
+            Vec2 correction = ewaldCorrectionExact(d, 1.0);
+            table[2 * (i * points + j)] = correction.x;
+            table[2 * (i * points + j) + 1] = correction.y;
+        }
+    }
+}
+
+Vec2 PeriodicBox::ewaldCorrection(const Vec2& d) const {
+    double ax = std::abs(d.x) * tableScale;
+    double ay = std::abs(d.y) * tableScale;
+    int i = std::min(static_cast<int>(ax), TABLE_CELLS - 1);
+    int j = std::min(static_cast<int>(ay), TABLE_CELLS - 1);
+    double fx = ax - i;
+    double fy = ay - j;
+
+    const int row = 2 * (TABLE_CELLS + 1);
+    const double* c = &table[2 * (i * (TABLE_CELLS + 1) + j)];
+    double w00 = (1.0 - fx) * (1.0 - fy);
+    double w01 = (1.0 - fx) * fy;
+    double w10 = fx * (1.0 - fy);
+    double w11 = fx * fy;
+    double cx = w00 * c[0] + w01 * c[2] + w10 * c[row] + w11 * c[row + 2];
+    double cy = w00 * c[1] + w01 * c[3] + w10 * c[row + 1] + w11 * c[row + 3];
+
+    // Odd in each component
+    cx = (d.x < 0.0) ? -cx : cx;
+    cy = (d.y < 0.0) ? -cy : cy;
+    return Vec2(cx, cy) * fieldScale;
+}
+
+Vec2 PeriodicBox::ewaldCorrectionExact(const Vec2& d, double boxSize) {
+    // Computed for the unit box, then scaled by 1 / size^2
+    Vec2 u = d / boxSize;
+    const double alpha = EWALD_ALPHA;
+    const double pi = 3.14159265358979323846;
+    const double twoAlphaOverSqrtPi = 2.0 * alpha / std::sqrt(pi);
+
+    // Real space: screened images, sum_n r / |r|^3 * (erfc(a r) + 2 a r / sqrt(pi) exp(-a^2 r^2)),
+    // with the nearest image's bare d / |d|^3 taken out
+    Vec2 field(0, 0);
+    for (int nx = -EWALD_REAL_RANGE; nx <= EWALD_REAL_RANGE; nx++) {
+        for (int ny = -EWALD_REAL_RANGE; ny <= EWALD_REAL_RANGE; ny++) {
+            Vec2 r(u.x + nx, u.y + ny);
+            double dist = r.length();
+            if (nx == 0 && ny == 0) {
+                // erfc(x) - 1 = -erf(x); tends to 0 with d
+                if (dist > 1e-8) {
+                    double screen = twoAlphaOverSqrtPi * dist * std::exp(-alpha * alpha * dist * dist)
+                                  - std::erf(alpha * dist);
+                    field += r * (screen / (dist * dist * dist));
+                }
+                continue;
+            }
+            double screen = std::erfc(alpha * dist) +
+                            twoAlphaOverSqrtPi * dist * std::exp(-alpha * alpha * dist * dist);
+            field += r * (screen / (dist * dist * dist));
+        }
+    }
+
+    // Fourier space: the smooth remainder of the image sum in the plane, without
+    // the k = 0 term (cancelled by the background):
+    // sum_k 2 pi / |k| * erfc(|k| / 2a) * k * sin(k . d)
+    for (int mx = -EWALD_RECIPROCAL_RANGE; mx <= EWALD_RECIPROCAL_RANGE; mx++) {
+        for (int my = -EWALD_RECIPROCAL_RANGE; my <= EWALD_RECIPROCAL_RANGE; my++) {
+            if (mx == 0 && my == 0) {
+                continue;
+            }
+            Vec2 k(2.0 * pi * mx, 2.0 * pi * my);
+            double kLength = k.length();
+            double weight = 2.0 * pi / kLength * std::erfc(kLength / (2.0 * alpha)) *
+                            std::sin(k.x * u.x + k.y * u.y);
+            field += k * weight;
+        }
+    }
+
+    return field / (boxSize * boxSize);
+}
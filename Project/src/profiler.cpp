@@ -0,0 +1,336 @@
+#include "profiler.h"
+#include <sys/resource.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+const char* phaseName(Phase phase) {
+    switch (phase) {
+        case Phase::TreeBuild: return "tree_build";
+        case Phase::ForceWalk: return "force_walk";
+        case Phase::Integration: return "integration";
+        case Phase::Output: return "output";
+        case Phase::Communication: return "communication";
+        case Phase::Merge: return "merge";
+        case Phase::Diagnostics: return "diagnostics";
+    }
+    return "unknown";
+}
+
+StepRecord::StepRecord() : step(0), treeDepth(0), treeNodes(0), peakRssKiB(0) {
+    for (int p = 0; p < NUM_PHASES; p++) {
+        phaseMs[p] = 0.0;
+    }
+}
+
+Profiler::Profiler() : enabled(false) {}
+
+void Profiler::beginStep(int step, int numThreads) {
+    if (!enabled) {
+        return;
+    }
+    steps.emplace_back();
+    steps.back().step = step;
+    steps.back().threads.resize(std::max(1, numThreads));
+}
+
+void Profiler::endStep() {
+    if (!enabled || steps.empty()) {
+        return;
+    }
+    StepRecord& record = steps.back();
+    record.walk = WalkStats();
+    for (const auto& thread : record.threads) {
+        record.walk.add(thread.walk);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    record.peakRssKiB = usage.ru_maxrss;
+}
+
+void Profiler::addPhaseTime(Phase phase, double ms) {
+    if (!enabled || steps.empty()) {
+        return;
+    }
+    steps.back().phaseMs[static_cast<int>(phase)] += ms;
+}
+
+void Profiler::setTreeStats(int depth, int numNodes) {
+    if (!enabled || steps.empty()) {
+        return;
+    }
+    steps.back().treeDepth = depth;
+    steps.back().treeNodes = numNodes;
+}
+
+// Sum of a list of steps (tree depth and peak RSS are the maximum, tree nodes the mean)
+static StepRecord sumSteps(const std::vector<StepRecord>& steps) {
+    StepRecord total;
+    total.step = static_cast<int>(steps.size());
+    long long nodeSum = 0;
+    size_t numThreads = 0;
+    for (const auto& record : steps) {
+        numThreads = std::max(numThreads, record.threads.size());
+    }
+    total.threads.resize(numThreads);
+
+    for (const auto& record : steps) {
+        for (int p = 0; p < NUM_PHASES; p++) {
+            total.phaseMs[p] += record.phaseMs[p];
+        }
+        total.walk.add(record.walk);
+        total.treeDepth = std::max(total.treeDepth, record.treeDepth);
+        total.peakRssKiB = std::max(total.peakRssKiB, record.peakRssKiB);
+        nodeSum += record.treeNodes;
+        for (size_t t = 0; t < record.threads.size(); t++) {
+            total.threads[t].forceMs += record.threads[t].forceMs;
+            total.threads[t].walk.add(record.threads[t].walk);
+        }
+    }
+    if (!steps.empty()) {
+        total.treeNodes = static_cast<int>(nodeSum / static_cast<long long>(steps.size()));
+    }
+    return total;
+}
+
+StepRecord Profiler::totals() const {
+    return sumSteps(steps);
+}
+
+void Profiler::printSummary(std::ostream& os) const {
+    StepRecord total = totals();
+    double sum = 0.0;
+    for (int p = 0; p < NUM_PHASES; p++) {
+        sum += total.phaseMs[p];
+    }
+
+    os << "=== Timing breakdown (" << total.step << " steps) ===" << std::endl;
+    for (int p = 0; p < NUM_PHASES; p++) {
+        double percent = (sum > 0.0) ? 100.0 * total.phaseMs[p] / sum : 0.0;
+        os << "  " << std::left << std::setw(14) << phaseName(static_cast<Phase>(p)) << std::right
+           << std::fixed << std::setprecision(3) << std::setw(12) << total.phaseMs[p] << " ms"
+           << std::setprecision(1) << std::setw(7) << percent << "%" << std::endl;
+    }
+    os << "  Nodes visited: " << total.walk.nodesVisited << std::endl;
+    os << "  Interactions: " << total.walk.interactions << std::endl;
+    os << "  Max tree depth: " << total.treeDepth << ", mean tree nodes: " << total.treeNodes << std::endl;
+    os << std::defaultfloat;
+}
+
+std::vector<double> Profiler::flatten() const {
+    std::vector<double> data;
+    data.reserve(steps.size() * FLAT_FIELDS);
+    for (const auto& record : steps) {
+        double forceMs = 0.0;
+        for (const auto& thread : record.threads) {
+            forceMs += thread.forceMs;
+        }
+        data.push_back(record.step);
+        for (int p = 0; p < NUM_PHASES; p++) {
+            data.push_back(record.phaseMs[p]);
+        }
+        data.push_back(static_cast<double>(record.walk.nodesVisited));
+        data.push_back(static_cast<double>(record.walk.interactions));
+        data.push_back(record.treeDepth);
+        data.push_back(record.treeNodes);
+        data.push_back(static_cast<double>(record.peakRssKiB));
+        data.push_back(forceMs);
+    }
+    return data;
+}
+
+std::vector<StepRecord> Profiler::unflatten(const std::vector<double>& data) {
+    std::vector<StepRecord> records(data.size() / FLAT_FIELDS);
+    for (size_t i = 0; i < records.size(); i++) {
+        const double* field = &data[i * FLAT_FIELDS];
+        StepRecord& record = records[i];
+        record.step = static_cast<int>(*field++);
+        for (int p = 0; p < NUM_PHASES; p++) {
+            record.phaseMs[p] = *field++;
+        }
+        record.walk.nodesVisited = static_cast<long long>(*field++);
+        record.walk.interactions = static_cast<long long>(*field++);
+        record.treeDepth = static_cast<int>(*field++);
+        record.treeNodes = static_cast<int>(*field++);
+        record.peakRssKiB = static_cast<long>(*field++);
+        record.threads.resize(1);
+        record.threads[0].forceMs = *field++;
+        record.threads[0].walk = record.walk;
+    }
+    return records;
+}
+
+static void writeJsonPhases(std::ostream& os, const double* phaseMs) {
+    os << "{";
+    for (int p = 0; p < NUM_PHASES; p++) {
+        os << (p ? ", " : "") << "\"" << phaseName(static_cast<Phase>(p)) << "\": " << phaseMs[p];
+    }
+    os << "}";
+}
+
+// Energies can be large and their drift tiny, so diagnostics use scientific notation
+static void writeJsonDiagnostics(std::ostream& os, const std::vector<Diagnostics>& diagnostics) {
+    os << std::scientific << std::setprecision(10);
+    os << "  \"diagnostics\": [\n";
+    for (size_t i = 0; i < diagnostics.size(); i++) {
+        const Diagnostics& record = diagnostics[i];
+        os << "    {\"step\": " << record.step
+           << ", \"mass\": " << record.mass
+           << ", \"kinetic\": " << record.kinetic;
+        if (record.hasPotential) {
+            os << ", \"potential\": " << record.potential
+               << ", \"energy\": " << record.energy()
+               << ", \"energy_drift\": " << energyDrift(record, diagnostics.front());
+        }
+        os << ", \"momentum\": [" << record.momentum.x << ", " << record.momentum.y << "]"
+           << ", \"angular_momentum\": " << record.angularMomentum
+           << "}" << (i + 1 < diagnostics.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n";
+}
+
+static void writeJson(std::ostream& os, const std::vector<std::vector<StepRecord>>& ranks,
+                      const std::vector<Diagnostics>& diagnostics) {
+    os << std::setprecision(6) << std::fixed;
+    os << "{\n  \"ranks\": [\n";
+    for (size_t r = 0; r < ranks.size(); r++) {
+        const std::vector<StepRecord>& steps = ranks[r];
+        StepRecord total = sumSteps(steps);
+
+        os << "    {\n      \"rank\": " << r << ",\n";
+        os << "      \"total\": {\"steps\": " << total.step << ", \"phase_ms\": ";
+        writeJsonPhases(os, total.phaseMs);
+        os << ", \"nodes_visited\": " << total.walk.nodesVisited
+           << ", \"interactions\": " << total.walk.interactions
+           << ", \"max_tree_depth\": " << total.treeDepth
+           << ", \"mean_tree_nodes\": " << total.treeNodes
+           << ", \"peak_rss_kib\": " << total.peakRssKiB
+           << "},\n";
+
+        os << "      \"threads\": [";
+        for (size_t t = 0; t < total.threads.size(); t++) {
+            os << (t ? ", " : "") << "{\"thread\": " << t
+               << ", \"force_ms\": " << total.threads[t].forceMs
+               << ", \"nodes_visited\": " << total.threads[t].walk.nodesVisited
+               << ", \"interactions\": " << total.threads[t].walk.interactions << "}";
+        }
+        os << "],\n";
+
+        os << "      \"steps\": [\n";
+        for (size_t i = 0; i < steps.size(); i++) {
+            const StepRecord& record = steps[i];
+            os << "        {\"step\": " << record.step << ", \"phase_ms\": ";
+            writeJsonPhases(os, record.phaseMs);
+            os << ", \"nodes_visited\": " << record.walk.nodesVisited
+               << ", \"interactions\": " << record.walk.interactions
+               << ", \"tree_depth\": " << record.treeDepth
+               << ", \"tree_nodes\": " << record.treeNodes
+               << ", \"peak_rss_kib\": " << record.peakRssKiB
+               << ", \"thread_force_ms\": [";
+            for (size_t t = 0; t < record.threads.size(); t++) {
+                os << (t ? ", " : "") << record.threads[t].forceMs;
+            }
+            os << "]}" << (i + 1 < steps.size() ? "," : "") << "\n";
+        }
+        os << "      ]\n    }" << (r + 1 < ranks.size() ? "," : "") << "\n";
+    }
+    if (diagnostics.empty()) {
+        os << "  ]\n}\n";
+        return;
+    }
+    os << "  ],\n";
+    writeJsonDiagnostics(os, diagnostics);
+    os << "}\n";
+}
+
+// Diagnostics columns of one CSV row: the state produced by the row's step, nan if
+// it was not measured
+static void writeCsvDiagnostics(std::ostream& os, const std::vector<Diagnostics>& diagnostics, int step) {
+    const Diagnostics* record = nullptr;
+    for (const Diagnostics& candidate : diagnostics) {
+        if (candidate.step == step) {
+            record = &candidate;
+        }
+    }
+    if (!record) {
+        os << ",nan,nan,nan,nan,nan,nan,nan";
+        return;
+    }
+    os << std::scientific << std::setprecision(10) << "," << record->kinetic;
+    if (record->hasPotential) {
+        os << "," << record->potential << "," << record->energy() << ","
+           << energyDrift(*record, diagnostics.front());
+    } else {
+        os << ",nan,nan,nan";
+    }
+    os << "," << record->momentum.x << "," << record->momentum.y << "," << record->angularMomentum
+       << std::fixed << std::setprecision(6);
+}
+
+static void writeCsv(std::ostream& os, const std::vector<std::vector<StepRecord>>& ranks,
+                     const std::vector<Diagnostics>& diagnostics) {
+    os << std::setprecision(6) << std::fixed;
+    os << "rank,step";
+    for (int p = 0; p < NUM_PHASES; p++) {
+        os << "," << phaseName(static_cast<Phase>(p)) << "_ms";
+    }
+    os << ",nodes_visited,interactions,tree_depth,tree_nodes,peak_rss_kib";
+
+    // One group of per-thread columns for the widest step; ranks gathered over MPI
+    // carry a single summed slot, and missing slots are written as zero
+    size_t numThreads = 0;
+    for (const auto& steps : ranks) {
+        for (const auto& record : steps) {
+            numThreads = std::max(numThreads, record.threads.size());
+        }
+    }
+    for (size_t t = 0; t < numThreads; t++) {
+        os << ",thread" << t << "_force_ms,thread" << t << "_nodes,thread" << t << "_interactions";
+    }
+    if (!diagnostics.empty()) {
+        os << ",kinetic,potential,energy,energy_drift,momentum_x,momentum_y,angular_momentum";
+    }
+    os << "\n";
+    for (size_t r = 0; r < ranks.size(); r++) {
+        for (const auto& record : ranks[r]) {
+            os << r << "," << record.step;
+            for (int p = 0; p < NUM_PHASES; p++) {
+                os << "," << record.phaseMs[p];
+            }
+            os << "," << record.walk.nodesVisited << "," << record.walk.interactions
+               << "," << record.treeDepth << "," << record.treeNodes << "," << record.peakRssKiB;
+            for (size_t t = 0; t < numThreads; t++) {
+                if (t < record.threads.size()) {
+                    const ThreadRecord& thread = record.threads[t];
+                    os << "," << thread.forceMs << "," << thread.walk.nodesVisited
+                       << "," << thread.walk.interactions;
+                } else {
+                    os << ",0,0,0";
+                }
+            }
+            if (!diagnostics.empty()) {
+                writeCsvDiagnostics(os, diagnostics, record.step);
+            }
+            os << "\n";
+        }
+    }
+}
+
+bool Profiler::writeReport(const std::string& filename,
+                           const std::vector<std::vector<StepRecord>>& ranks,
+                           const std::vector<Diagnostics>& diagnostics) {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open profile report: " << filename << std::endl;
+        return false;
+    }
+
+    bool csv = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".csv") == 0;
+    if (csv) {
+        writeCsv(file, ranks, diagnostics);
+    } else {
+        writeJson(file, ranks, diagnostics);
+    }
+    return true;
+}
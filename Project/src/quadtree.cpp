@@ -1,212 +1,981 @@
 #include "quadtree.h"
+#include "simd.h"
 #include <algorithm>
 #include <limits>
 #include <cmath>
 
+bool parseForceKernel(const std::string& name, ForceKernel& kernel) {
+    if (name == "exact") {
+        kernel = ForceKernel::Exact;
+    } else if (name == "rsqrt") {
+        kernel = ForceKernel::Rsqrt;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* forceKernelName(ForceKernel kernel) {
+    switch (kernel) {
+        case ForceKernel::Exact: return "exact";
+        case ForceKernel::Rsqrt: return "rsqrt";
+    }
+    return "unknown";
+}
+
 // ============================================================================
-// AABB Implementation
+// BoundingBox Implementation
 // ============================================================================
 
-AABB::AABB() : center(0, 0), halfSize(1.0) {}
+template <int D>
+BoundingBox<D>::BoundingBox() : center(), halfSize(1.0) {}
 
-AABB::AABB(const Vec2& center, double halfSize) : center(center), halfSize(halfSize) {}
+template <int D>
+BoundingBox<D>::BoundingBox(const Vec<D>& center, double halfSize) : center(center), halfSize(halfSize) {}
 
-bool AABB::contains(const Vec2& point) const {
-    return (point.x >= center.x - halfSize && point.x <= center.x + halfSize &&
-            point.y >= center.y - halfSize && point.y <= center.y + halfSize);
+template <int D>
+bool BoundingBox<D>::contains(const Vec<D>& point) const {
+    bool inside = true;
+    for (int d = 0; d < D; d++) {
+        inside = inside && point[d] >= center[d] - halfSize && point[d] <= center[d] + halfSize;
+    }
+    return inside;
 }
 
-int AABB::getQuadrant(const Vec2& point) const {
+template <int D>
+int BoundingBox<D>::getChildIndex(const Vec<D>& point) const {
+    // In 2D, bit 0 = west and bit 1 = south:
     // 0 = NE (x >= center, y >= center)
     // 1 = NW (x < center, y >= center)
     // 2 = SW (x < center, y < center)
     // 3 = SE (x >= center, y < center)
-    
-    bool east = point.x >= center.x;
-    bool north = point.y >= center.y;
-    
-    if (east && north) return 0;      // NE
-    if (!east && north) return 1;     // NW
-    if (!east && !north) return 2;    // SW
-    return 3;                          // SE
+    int gray = 0;
+    for (int d = 0; d < D; d++) {
+        gray |= (point[d] < center[d] ? 1 : 0) << d;
+    }
+    // Gray code to index: prefix XOR of the bits
+    int index = gray;
+    for (int shift = 1; shift < D; shift <<= 1) {
+        index ^= index >> shift;
+    }
+    return index;
 }
 
-AABB AABB::getChildAABB(int quadrant) const {
+template <int D>
+BoundingBox<D> BoundingBox<D>::getChildBox(int index) const {
     double newHalfSize = halfSize / 2.0;
-    Vec2 newCenter;
-    
-    switch (quadrant) {
-        case 0: // NE
-            newCenter = Vec2(center.x + newHalfSize, center.y + newHalfSize);
-            break;
-        case 1: // NW
-            newCenter = Vec2(center.x - newHalfSize, center.y + newHalfSize);
-            break;
-        case 2: // SW
-            newCenter = Vec2(center.x - newHalfSize, center.y - newHalfSize);
-            break;
-        case 3: // SE
-            newCenter = Vec2(center.x + newHalfSize, center.y - newHalfSize);
-            break;
+    int gray = index ^ (index >> 1);
+    Vec<D> newCenter;
+    for (int d = 0; d < D; d++) {
+        newCenter[d] = ((gray >> d) & 1) ? center[d] - newHalfSize : center[d] + newHalfSize;
     }
-    
-    return AABB(newCenter, newHalfSize);
+    return BoundingBox(newCenter, newHalfSize);
 }
 
 // ============================================================================
-// QuadTreeNode Implementation
+// TreeNode Implementation
 // ============================================================================
 
-QuadTreeNode::QuadTreeNode(const AABB& bounds) 
-    : bounds(bounds), centerOfMass(0, 0), totalMass(0), body(nullptr), 
-      isLeaf(true), isEmpty(true) {
-    for (int i = 0; i < 4; i++) {
-        children[i] = nullptr;
-    }
-}
+template <int D>
+TreeNode<D>::TreeNode(const BoundingBox<D>& bounds)
+    : bounds(bounds), centerOfMass(), totalMass(0), body(-1), bodyCount(0), firstChild(-1) {}
 
-void QuadTreeNode::subdivide() {
-    for (int i = 0; i < 4; i++) {
-        children[i] = std::make_unique<QuadTreeNode>(bounds.getChildAABB(i));
-    }
-    isLeaf = false;
-}
+// ============================================================================
+// OrthTree Implementation
+// ============================================================================
+
+template <int D>
+OrthTree<D>::OrthTree() : depth(0), leafSize(1), periodic(nullptr), migratedSinceBuild(0), numBuilds(0), numRefits(0) {}
 
-bool QuadTreeNode::isExternal() const {
-    return isLeaf && !isEmpty && body != nullptr;
+template <int D>
+void OrthTree<D>::subdivide(int nodeIdx) {
+    int first = static_cast<int>(nodes.size());
+    BoundingBox<D> bounds = nodes[nodeIdx].bounds;
+    for (int i = 0; i < BoundingBox<D>::NUM_CHILDREN; i++) {
+        nodes.emplace_back(bounds.getChildBox(i));
+    }
+    leafHead.resize(nodes.size(), -1);
+    // Note: emplace_back may reallocate, so index again
+    nodes[nodeIdx].firstChild = first;
 }
 
-void QuadTreeNode::insert(Body* newBody) {
-    if (!bounds.contains(newBody->position)) {
+template <int D>
+void OrthTree<D>::insert(int nodeIdx, const BodyType* bodies, int bodyIdx, int nodeDepth) {
+    const BodyType& newBody = bodies[bodyIdx];
+    if (!nodes[nodeIdx].bounds.contains(newBody.position)) {
         return; // Body is outside this node's bounds
     }
+    depth = std::max(depth, nodeDepth);
     
-    if (isEmpty) {
+    if (nodes[nodeIdx].isEmpty()) {
         // First body in this node
-        body = newBody;
-        isEmpty = false;
-        centerOfMass = newBody->position;
-        totalMass = newBody->mass;
+        Node& node = nodes[nodeIdx];
+        leafHead[nodeIdx] = bodyIdx;
+        node.bodyCount = 1;
+        nextInLeaf[bodyIdx] = -1;
+        bodyLeaf[bodyIdx] = nodeIdx;
+        node.centerOfMass = newBody.position;
+        node.totalMass = newBody.mass;
         return;
     }
     
-    if (isLeaf) {
+    if (nodes[nodeIdx].isLeaf() && nodes[nodeIdx].bodyCount < leafSize) {
+        // Room left in this leaf: append to its list
+        Node& node = nodes[nodeIdx];
+        int last = leafHead[nodeIdx];
+        while (nextInLeaf[last] >= 0) {
+            last = nextInLeaf[last];
+        }
+        nextInLeaf[last] = bodyIdx;
+        nextInLeaf[bodyIdx] = -1;
+        bodyLeaf[bodyIdx] = nodeIdx;
+        node.bodyCount++;
+
+        double newTotalMass = node.totalMass + newBody.mass;
+        node.centerOfMass = (node.centerOfMass * node.totalMass + newBody.position * newBody.mass) / newTotalMass;
+        node.totalMass = newTotalMass;
+        return;
+    }
+    
+    if (nodes[nodeIdx].isLeaf()) {
         // Need to subdivide and redistribute
-        Body* existingBody = body;
-        body = nullptr;
-        subdivide();
+        int existingBody = leafHead[nodeIdx];
+        leafHead[nodeIdx] = -1;
+        nodes[nodeIdx].bodyCount = 0;
+        subdivide(nodeIdx);
         
-        // Reinsert existing body
-        int quadrant = bounds.getQuadrant(existingBody->position);
-        children[quadrant]->insert(existingBody);
+        // Reinsert existing bodies in insertion order
+        while (existingBody >= 0) {
+            int next = nextInLeaf[existingBody];
+            int child = nodes[nodeIdx].bounds.getChildIndex(bodies[existingBody].position);
+            insert(nodes[nodeIdx].firstChild + child, bodies, existingBody, nodeDepth + 1);
+            existingBody = next;
+        }
     }
     
     // Insert new body into appropriate child
-    int quadrant = bounds.getQuadrant(newBody->position);
-    children[quadrant]->insert(newBody);
+    int child = nodes[nodeIdx].bounds.getChildIndex(newBody.position);
+    insert(nodes[nodeIdx].firstChild + child, bodies, bodyIdx, nodeDepth + 1);
     
     // Update center of mass and total mass
-    double newTotalMass = totalMass + newBody->mass;
-    centerOfMass = (centerOfMass * totalMass + newBody->position * newBody->mass) / newTotalMass;
-    totalMass = newTotalMass;
+    Node& node = nodes[nodeIdx];
+    double newTotalMass = node.totalMass + newBody.mass;
+    node.centerOfMass = (node.centerOfMass * node.totalMass + newBody.position * newBody.mass) / newTotalMass;
+    node.totalMass = newTotalMass;
 }
 
-void QuadTreeNode::calculateForce(Body* target, double theta, double G, double softening) const {
-    if (isEmpty) {
+// Far-field entries per vectorised chunk. Fixed so the loop has a constant trip
+// count; the last chunk is padded with massless entries.
+static const int FAR_FIELD_CHUNK = 16;
+
+// m * d / (|d|^2 + eps2)^(3/2) for one chunk of far-field entries. Component d of
+// entry k is diff[d * stride + k] (and force[d * stride + k])
+template <int D, typename Far>
+NBODY_KERNEL_CLONES
+static void evaluateFarFieldChunk(const Far* __restrict diff, const Far* __restrict gm,
+                                  Far* __restrict force, int stride, Far soft2) {
+    for (int k = 0; k < FAR_FIELD_CHUNK; k++) {
+        Far distSquared = diff[k] * diff[k];
+        for (int d = 1; d < D; d++) {
+            distSquared += diff[d * stride + k] * diff[d * stride + k];
+        }
+        distSquared += soft2;
+        Far dist = std::sqrt(distSquared);
+        Far scale = gm[k] / (distSquared * dist);
+        for (int d = 0; d < D; d++) {
+            force[d * stride + k] = diff[d * stride + k] * scale;
+        }
+    }
+}
+
+// Rsqrt kernel for one chunk: F = m * d * rsqrt(|d|^2 + eps2)^3. The generic
+// version is only instantiated for a double Far, which never batches
+template <int D, typename Far>
+struct FarFieldChunkRsqrt {
+    static void evaluate(const Far* diff, const Far* gm, Far* force, int stride, Far soft2) {
+        for (int k = 0; k < FAR_FIELD_CHUNK; k++) {
+            Far distSquared = diff[k] * diff[k];
+            for (int d = 1; d < D; d++) {
+                distSquared += diff[d * stride + k] * diff[d * stride + k];
+            }
+            Far invDist = Far(1) / std::sqrt(distSquared + soft2);
+            Far scale = gm[k] * invDist * invDist * invDist;
+            for (int d = 0; d < D; d++) {
+                force[d * stride + k] = diff[d * stride + k] * scale;
+            }
+        }
+    }
+};
+
+// float chunks use the hardware estimate plus one Newton step (simd.h)
+template <int D>
+struct FarFieldChunkRsqrt<D, float> {
+    static void evaluate(const float* diff, const float* gm, float* force, int stride, float soft2) {
+#ifdef NBODY_HAVE_SSE2
+        const __m128 eps = _mm_set1_ps(soft2);
+        for (int k = 0; k < FAR_FIELD_CHUNK; k += 4) {
+            __m128 x = _mm_loadu_ps(diff + k);
+            __m128 distSquared = _mm_mul_ps(x, x);
+            for (int d = 1; d < D; d++) {
+                __m128 c = _mm_loadu_ps(diff + d * stride + k);
+                distSquared = _mm_add_ps(distSquared, _mm_mul_ps(c, c));
+            }
+            distSquared = _mm_add_ps(distSquared, eps);
+            __m128 invDist = rsqrtNewton(distSquared);
+            __m128 scale = _mm_mul_ps(_mm_loadu_ps(gm + k), _mm_mul_ps(invDist, _mm_mul_ps(invDist, invDist)));
+            for (int d = 0; d < D; d++) {
+                _mm_storeu_ps(force + d * stride + k, _mm_mul_ps(_mm_loadu_ps(diff + d * stride + k), scale));
+            }
+        }
+#else
+        for (int k = 0; k < FAR_FIELD_CHUNK; k++) {
+            float distSquared = diff[k] * diff[k];
+            for (int d = 1; d < D; d++) {
+                distSquared += diff[d * stride + k] * diff[d * stride + k];
+            }
+            float invDist = 1.0f / std::sqrt(distSquared + soft2);
+            float scale = gm[k] * invDist * invDist * invDist;
+            for (int d = 0; d < D; d++) {
+                force[d * stride + k] = diff[d * stride + k] * scale;
+            }
+        }
+#endif
+    }
+};
+
+// Far-field interactions of one target, collected during a mixed-precision walk and
+// evaluated afterwards in chunks the compiler vectorises at the width of Far
+template <int D, typename Far>
+struct FarFieldList {
+    // Entries [0, count) are in use. Components are stored one after the other:
+    // component d of entry k is diff[d * capacity + k]. The arrays only ever grow
+    std::vector<Far> diff;
+    std::vector<Far> gm;    // G * m_target * m_node
+    std::vector<Far> force;
+    int capacity;
+    int count;
+
+    FarFieldList() : capacity(0), count(0) {}
+
+    void clear() { count = 0; }
+
+    void add(const Vec<D>& separation, double massProduct) {
+        if (count == capacity) {
+            grow();
+        }
+        for (int d = 0; d < D; d++) {
+            diff[d * capacity + count] = static_cast<Far>(separation[d]);
+        }
+        gm[count] = static_cast<Far>(massProduct);
+        count++;
+    }
+
+    // Add the collected forces to target.force, summed in double
+    void apply(BasicBody<D>& target, double softening, ForceKernel kernel) {
+        int padded = (count + FAR_FIELD_CHUNK - 1) / FAR_FIELD_CHUNK * FAR_FIELD_CHUNK;
+        for (int k = count; k < padded; k++) {
+            for (int d = 0; d < D; d++) {
+                diff[d * capacity + k] = (d == 0) ? Far(1) : Far(0);
+            }
+            gm[k] = Far(0);
+        }
+        Far soft2 = static_cast<Far>(softening * softening);
+        for (int k = 0; k < padded; k += FAR_FIELD_CHUNK) {
+            if (kernel == ForceKernel::Rsqrt) {
+                FarFieldChunkRsqrt<D, Far>::evaluate(&diff[k], &gm[k], &force[k], capacity, soft2);
+            } else {
+                evaluateFarFieldChunk<D, Far>(&diff[k], &gm[k], &force[k], capacity, soft2);
+            }
+        }
+
+        Vec<D> sum;
+        for (int d = 0; d < D; d++) {
+            double component = 0.0;
+            const Far* f = &force[d * capacity];
+            for (int k = 0; k < count; k++) {
+                component += f[k];
+            }
+            sum[d] = component;
+        }
+        target.force += sum;
+    }
+
+    // Capacity stays a multiple of FAR_FIELD_CHUNK, so apply() can always pad.
+    // The components move to their new offsets
+    void grow() {
+        int newCapacity = std::max(1024, capacity * 2);
+        std::vector<Far> newDiff(static_cast<size_t>(D) * newCapacity);
+        for (int d = 0; d < D; d++) {
+            std::copy(diff.begin() + d * capacity, diff.begin() + d * capacity + count,
+                      newDiff.begin() + d * newCapacity);
+        }
+        diff.swap(newDiff);
+        gm.resize(newCapacity);
+        force.assign(static_cast<size_t>(D) * newCapacity, Far(0));
+        capacity = newCapacity;
+    }
+};
+
+// Force walk. The bool parameters specialise it at compile time, so each
+// instantiation carries only the work its configuration needs:
+// - CountStats: work counters (the uninstrumented walk has no counter updates)
+// - Rsqrt: ForceKernel::Rsqrt, the squared opening test and one square root and
+//   one division per interaction instead of a square root and three divisions
+// - Softened: softening != 0 (otherwise the + eps^2 terms are dropped)
+// - UnitG: G == 1 (otherwise every mass product is scaled by G)
+// - SingleBodyLeaves: no leaf holds more than one body (the multi-body leaf
+//   branch is compiled out)
+// Dropping "+ 0.0" and "1.0 *" is exact, so every instantiation gives the same
+// bits as the general one (for the same kernel). With a float Precision::Far, accepted nodes go to
+// farField instead of being applied on the spot; the opening test and all
+// body-body interactions stay in double
+template <int D, typename Precision, bool CountStats, bool Rsqrt, bool Softened, bool UnitG, bool SingleBodyLeaves>
+static void walkForce(const TreeNode<D>* nodes, const TreeLeafBody<D>* leafBodies, int nodeIdx,
+                      BasicBody<D>& target, int targetIdx,
+                      double theta, double G, double softening, WalkStats& stats,
+                      FarFieldList<D, typename Precision::Far>& farField) {
+    const TreeNode<D>& node = nodes[nodeIdx];
+    if (CountStats) {
+        stats.nodesVisited++;
+    }
+    if (node.isEmpty()) {
         return;
     }
     
     // Don't calculate force on itself
-    if (isExternal() && body == target) {
+    if (node.bodyCount == 1 && node.body == targetIdx) {
         return;
     }
     
-    Vec2 diff = centerOfMass - target->position;
-    double distSquared = diff.lengthSquared() + softening * softening;
-    double dist = std::sqrt(distSquared);
+    const double soft2 = softening * softening;
+    const double targetMass = UnitG ? target.mass : G * target.mass;
+    Vec<D> diff = node.centerOfMass - target.position;
+    double distSquared = Softened ? diff.lengthSquared() + soft2 : diff.lengthSquared();
     
-    // Barnes-Hut criterion: s/d < theta (where s is the width of the region)
-    double regionSize = bounds.halfSize * 2.0;
+    // Barnes-Hut criterion: s/d < theta (where s is the width of the region). The
+    // batched walk tests the squared form and leaves the square root to the
+    // vectorised far-field loop
+    double regionSize = node.bounds.halfSize * 2.0;
+    double dist = 0.0;
+    bool farEnough;
+    if (Rsqrt || Precision::BatchFarField) {
+        farEnough = regionSize * regionSize < theta * theta * distSquared;
+    } else {
+        dist = std::sqrt(distSquared);
+        farEnough = regionSize / dist < theta;
+    }
+
+    if (!SingleBodyLeaves && node.bodyCount > 1 && !farEnough) {
+        // Opened leaf with several bodies: interact with each of them
+        const TreeLeafBody<D>* leaf = leafBodies + node.body;
+        for (int k = 0; k < node.bodyCount; k++) {
+            if (leaf[k].index == targetIdx) {
+                continue;
+            }
+            Vec<D> bodyDiff = leaf[k].position - target.position;
+            double bodyDistSquared = Softened ? bodyDiff.lengthSquared() + soft2 : bodyDiff.lengthSquared();
+            if (Rsqrt) {
+                double invDist = 1.0 / std::sqrt(bodyDistSquared);
+                target.force += bodyDiff * (targetMass * leaf[k].mass * invDist * invDist * invDist);
+            } else {
+                double bodyDist = std::sqrt(bodyDistSquared);
+                double forceMagnitude = targetMass * leaf[k].mass / bodyDistSquared;
+                target.force += (bodyDiff / bodyDist) * forceMagnitude;
+            }
+            if (CountStats) {
+                stats.interactions++;
+            }
+        }
+        return;
+    }
     
-    if (isExternal() || (regionSize / dist < theta)) {
+    if (node.isExternal() || farEnough) {
         // Treat this node as a single body (or it is a single body)
         // F = G * m1 * m2 / r^2 * r_hat
         // We accumulate force: F = G * m_target * m_node / r^2 * direction
-        double forceMagnitude = G * target->mass * totalMass / distSquared;
-        Vec2 forceDir = diff / dist;
-        target->force += forceDir * forceMagnitude;
+        if (Precision::BatchFarField && node.bodyCount != 1) {
+            farField.add(diff, targetMass * node.totalMass);
+        } else if (Rsqrt) {
+            double invDist = 1.0 / std::sqrt(distSquared);
+            target.force += diff * (targetMass * node.totalMass * invDist * invDist * invDist);
+        } else {
+            if (Precision::BatchFarField) {
+                dist = std::sqrt(distSquared);
+            }
+            double forceMagnitude = targetMass * node.totalMass / distSquared;
+            Vec<D> forceDir = diff / dist;
+            target.force += forceDir * forceMagnitude;
+        }
+        if (CountStats) {
+            stats.interactions++;
+        }
     } else {
         // Recurse into children
+        for (int i = 0; i < BoundingBox<D>::NUM_CHILDREN; i++) {
+            walkForce<D, Precision, CountStats, Rsqrt, Softened, UnitG, SingleBodyLeaves>(
+                nodes, leafBodies, node.firstChild + i, target, targetIdx,
+                theta, G, softening, stats, farField);
+        }
+    }
+}
+
+// Complete walk for one target (force accumulated on top of target.force)
+template <int D, typename Precision, bool CountStats, bool Rsqrt, bool Softened, bool UnitG, bool SingleBodyLeaves>
+static void walkTarget(const TreeNode<D>* nodes, const TreeLeafBody<D>* leafBodies, int nodeIdx,
+                       BasicBody<D>& target, int targetIdx,
+                       double theta, double G, double softening, WalkStats& stats) {
+    static thread_local FarFieldList<D, typename Precision::Far> farField;
+    if (Precision::BatchFarField) {
+        farField.clear();
+    }
+    walkForce<D, Precision, CountStats, Rsqrt, Softened, UnitG, SingleBodyLeaves>(
+        nodes, leafBodies, nodeIdx, target, targetIdx, theta, G, softening, stats, farField);
+    if (Precision::BatchFarField) {
+        farField.apply(target, softening, Rsqrt ? ForceKernel::Rsqrt : ForceKernel::Exact);
+    }
+}
+
+// Reset and walk bodies[indices[k]] (or bodies[startIdx + k] if indices is null)
+// for k in [0, count)
+template <int D, typename Precision, bool CountStats, bool Rsqrt, bool Softened, bool UnitG, bool SingleBodyLeaves>
+static void walkTargets(const TreeNode<D>* nodes, const TreeLeafBody<D>* leafBodies, BasicBody<D>* bodies,
+                        int startIdx, const int* indices, int count,
+                        double theta, double G, double softening, WalkStats& stats) {
+    for (int k = 0; k < count; k++) {
+        int i = indices ? indices[k] : startIdx + k;
+        bodies[i].resetForce();
+        walkTarget<D, Precision, CountStats, Rsqrt, Softened, UnitG, SingleBodyLeaves>(
+            nodes, leafBodies, 0, bodies[i], i, theta, G, softening, stats);
+    }
+}
+
+// Nearest-image interaction in a periodic box: the softened pair force plus the
+// Ewald correction for all other images
+static inline void addPeriodicInteraction(Body& target, const Vec2& diff, double massProduct, double soft2,
+                                          bool rsqrt, const PeriodicBox& box) {
+    double distSquared = diff.lengthSquared() + soft2;
+    double invDistCubed;
+    if (rsqrt) {
+        double invDist = 1.0 / std::sqrt(distSquared);
+        invDistCubed = invDist * invDist * invDist;
+    } else {
+        invDistCubed = 1.0 / (distSquared * std::sqrt(distSquared));
+    }
+    target.force += (diff * invDistCubed + box.ewaldCorrection(diff)) * massProduct;
+}
+
+// Force walk in a periodic box. Every separation is taken to its nearest image, so
+// a node that passes the opening test stands for its cell in every image at once;
+// the correction table adds the images beyond the nearest one. Uses the squared
+// opening test for both kernels. Not specialised beyond CountStats: the table
+// lookup dominates what the other flags would save
+template <bool CountStats>
+static void walkForcePeriodic(const QuadTreeNode* nodes, const LeafBody* leafBodies, int nodeIdx,
+                              Body& target, int targetIdx,
+                              double theta, double G, double softening, bool rsqrt,
+                              const PeriodicBox& box, WalkStats& stats) {
+    const QuadTreeNode& node = nodes[nodeIdx];
+    if (CountStats) {
+        stats.nodesVisited++;
+    }
+    if (node.isEmpty() || (node.bodyCount == 1 && node.body == targetIdx)) {
+        return;
+    }
+
+    const double soft2 = softening * softening;
+    const double targetMass = G * target.mass;
+    Vec2 diff = box.minimumImage(node.centerOfMass - target.position);
+    double regionSize = node.bounds.halfSize * 2.0;
+    bool farEnough = regionSize * regionSize < theta * theta * (diff.lengthSquared() + soft2);
+
+    if (node.bodyCount > 1 && !farEnough) {
+        const LeafBody* leaf = leafBodies + node.body;
+        for (int k = 0; k < node.bodyCount; k++) {
+            if (leaf[k].index == targetIdx) {
+                continue;
+            }
+            addPeriodicInteraction(target, box.minimumImage(leaf[k].position - target.position),
+                                   targetMass * leaf[k].mass, soft2, rsqrt, box);
+            if (CountStats) {
+                stats.interactions++;
+            }
+        }
+        return;
+    }
+
+    if (node.isExternal() || farEnough) {
+        addPeriodicInteraction(target, diff, targetMass * node.totalMass, soft2, rsqrt, box);
+        if (CountStats) {
+            stats.interactions++;
+        }
+    } else {
         for (int i = 0; i < 4; i++) {
-            if (children[i]) {
-                children[i]->calculateForce(target, theta, G, softening);
+            walkForcePeriodic<CountStats>(nodes, leafBodies, node.firstChild + i, target, targetIdx,
+                                          theta, G, softening, rsqrt, box, stats);
+        }
+    }
+}
+
+template <bool CountStats>
+static void walkTargetsPeriodic(const QuadTreeNode* nodes, const LeafBody* leafBodies, Body* bodies,
+                                int startIdx, const int* indices, int count,
+                                double theta, double G, double softening, bool rsqrt,
+                                const PeriodicBox& box, WalkStats& stats) {
+    for (int k = 0; k < count; k++) {
+        int i = indices ? indices[k] : startIdx + k;
+        bodies[i].resetForce();
+        walkForcePeriodic<CountStats>(nodes, leafBodies, 0, bodies[i], i, theta, G, softening, rsqrt, box, stats);
+    }
+}
+
+template <int D>
+struct WalkTargets {
+    typedef void (*Function)(const TreeNode<D>*, const TreeLeafBody<D>*, BasicBody<D>*, int, const int*, int,
+                             double, double, double, WalkStats&);
+};
+
+// Runtime dispatch to the specialised walk, once per call rather than per node
+template <int D, bool CountStats>
+static typename WalkTargets<D>::Function selectWalk(ForceKernel kernel, double G, double softening,
+                                                    bool singleBodyLeaves) {
+    static const typename WalkTargets<D>::Function table[16] = {
+        &walkTargets<D, ForcePrecision, CountStats, false, false, false, false>,
+        &walkTargets<D, ForcePrecision, CountStats, false, false, false, true>,
+        &walkTargets<D, ForcePrecision, CountStats, false, false, true, false>,
+        &walkTargets<D, ForcePrecision, CountStats, false, false, true, true>,
+        &walkTargets<D, ForcePrecision, CountStats, false, true, false, false>,
+        &walkTargets<D, ForcePrecision, CountStats, false, true, false, true>,
+        &walkTargets<D, ForcePrecision, CountStats, false, true, true, false>,
+        &walkTargets<D, ForcePrecision, CountStats, false, true, true, true>,
+        &walkTargets<D, ForcePrecision, CountStats, true, false, false, false>,
+        &walkTargets<D, ForcePrecision, CountStats, true, false, false, true>,
+        &walkTargets<D, ForcePrecision, CountStats, true, false, true, false>,
+        &walkTargets<D, ForcePrecision, CountStats, true, false, true, true>,
+        &walkTargets<D, ForcePrecision, CountStats, true, true, false, false>,
+        &walkTargets<D, ForcePrecision, CountStats, true, true, false, true>,
+        &walkTargets<D, ForcePrecision, CountStats, true, true, true, false>,
+        &walkTargets<D, ForcePrecision, CountStats, true, true, true, true>,
+    };
+    int index = (kernel == ForceKernel::Rsqrt ? 8 : 0) + (softening != 0.0 ? 4 : 0) +
+                (G == 1.0 ? 2 : 0) + (singleBodyLeaves ? 1 : 0);
+    return table[index];
+}
+
+// Walk for count targets with the instantiation matching the kernel, G, softening
+// and the tree's leaves (leafBodies is null when no leaf holds more than one body)
+template <int D>
+static void dispatchWalk(const TreeNode<D>* nodes, const TreeLeafBody<D>* leafBodies, BasicBody<D>* bodies,
+                         int startIdx, const int* indices, int count,
+                         double theta, double G, double softening, WalkStats* stats, ForceKernel kernel,
+                         const PeriodicBox* periodic) {
+    if constexpr (D == 2) {
+        if (periodic && periodic->isEnabled()) {
+            bool rsqrt = (kernel == ForceKernel::Rsqrt);
+            if (stats) {
+                walkTargetsPeriodic<true>(nodes, leafBodies, bodies, startIdx, indices, count,
+                                          theta, G, softening, rsqrt, *periodic, *stats);
+            } else {
+                WalkStats unused;
+                walkTargetsPeriodic<false>(nodes, leafBodies, bodies, startIdx, indices, count,
+                                           theta, G, softening, rsqrt, *periodic, unused);
             }
+            return;
         }
     }
+    if (stats) {
+        selectWalk<D, true>(kernel, G, softening, leafBodies == nullptr)(
+            nodes, leafBodies, bodies, startIdx, indices, count, theta, G, softening, *stats);
+    } else {
+        WalkStats unused;
+        selectWalk<D, false>(kernel, G, softening, leafBodies == nullptr)(
+            nodes, leafBodies, bodies, startIdx, indices, count, theta, G, softening, unused);
+    }
 }
 
-// ============================================================================
-// QuadTree Implementation
-// ============================================================================
+template <int D>
+void OrthTree<D>::calculateForce(const Node* nodes, const LeafBodyType* leafBodies, int nodeIdx,
+                                 BodyType& target, int targetIdx,
+                                 double theta, double G, double softening,
+                                 ForceKernel kernel, const PeriodicBox* periodic) {
+    // Only used for sampled probes: the general instantiations are enough
+    WalkStats unused;
+    if constexpr (D == 2) {
+        if (periodic && periodic->isEnabled()) {
+            walkForcePeriodic<false>(nodes, leafBodies, nodeIdx, target, targetIdx, theta, G, softening,
+                                     kernel == ForceKernel::Rsqrt, *periodic, unused);
+            return;
+        }
+    }
+    if (kernel == ForceKernel::Rsqrt) {
+        walkTarget<D, ForcePrecision, false, true, true, false, false>(nodes, leafBodies, nodeIdx, target,
+                                                                      targetIdx, theta, G, softening, unused);
+    } else {
+        walkTarget<D, ForcePrecision, false, false, true, false, false>(nodes, leafBodies, nodeIdx, target,
+                                                                       targetIdx, theta, G, softening, unused);
+    }
+}
+
+// Root cell of a build: the periodic box (2D only) or the bodies' bounds
+template <int D>
+static bool periodicRoot(const PeriodicBox* periodic, BoundingBox<D>& root) {
+    if constexpr (D == 2) {
+        if (periodic && periodic->isEnabled()) {
+            root = BoundingBox<D>(Vec<D>(), 0.5 * periodic->getSize());
+            return true;
+        }
+    }
+    return false;
+}
 
-QuadTree::QuadTree() : root(nullptr) {}
+template <int D>
+void OrthTree<D>::build(const std::vector<BodyType>& bodies) {
+    build(bodies.data(), static_cast<int>(bodies.size()));
+}
 
-void QuadTree::build(std::vector<Body>& bodies) {
-    if (bodies.empty()) {
-        root = nullptr;
+template <int D>
+void OrthTree<D>::build(const BodyType* bodies, int numBodies) {
+    nodes.clear();
+    leafBodies.clear();
+    depth = 0;
+    migratedSinceBuild = 0;
+    numBuilds++;
+    if (numBodies == 0) {
+        bodyLeaf.clear();
         return;
     }
     
-    AABB bounds = calculateBounds(bodies);
-    root = std::make_unique<QuadTreeNode>(bounds);
+    BoundingBox<D> bounds;
+    if (!periodicRoot(periodic, bounds)) {
+        bounds = calculateBounds(bodies, numBodies);
+    }
+    nodes.reserve(2 * numBodies / leafSize + 1);
+    nodes.emplace_back(bounds);
+    leafHead.assign(1, -1);
+    nextInLeaf.resize(numBodies);
+    bodyLeaf.assign(numBodies, 0);
     
-    for (auto& body : bodies) {
-        root->insert(&body);
+    for (int i = 0; i < numBodies; i++) {
+        insert(0, bodies, i, 0);
+    }
+
+    flattenLeaves(bodies);
+}
+
+template <int D>
+void OrthTree<D>::flattenLeaves(const BodyType* bodies) {
+    leafBodies.clear();
+    for (size_t n = 0; n < nodes.size(); n++) {
+        Node& node = nodes[n];
+        if (node.bodyCount < 2) {
+            node.body = node.isLeaf() ? leafHead[n] : -1;
+            continue;
+        }
+        node.body = static_cast<int>(leafBodies.size());
+        for (int b = leafHead[n]; b >= 0; b = nextInLeaf[b]) {
+            leafBodies.push_back({bodies[b].position, bodies[b].mass, b});
+        }
+    }
+}
+
+template <int D>
+bool OrthTree<D>::refit(const BodyType* bodies, int numBodies, double rebuildFraction) {
+    if (nodes.empty() || numBodies != static_cast<int>(bodyLeaf.size())) {
+        build(bodies, numBodies);
+        return false;
+    }
+
+    // 1. Bodies that left their leaf cell; leaving the root needs new root bounds
+    moved.clear();
+    for (int i = 0; i < numBodies; i++) {
+        const Vec<D>& position = bodies[i].position;
+        if (nodes[bodyLeaf[i]].bounds.contains(position)) {
+            continue;
+        }
+        if (!nodes[0].bounds.contains(position)) {
+            build(bodies, numBodies);
+            return false;
+        }
+        moved.push_back(i);
+    }
+
+    // Cells split for bodies that have since moved on are never merged back, so the
+    // tree only gets worse with every migration
+    migratedSinceBuild += static_cast<long long>(moved.size());
+    if (migratedSinceBuild > rebuildFraction * numBodies) {
+        build(bodies, numBodies);
+        return false;
+    }
+
+    // 2. Unlink the movers, then insert them again from the root
+    for (int b : moved) {
+        removeFromLeaf(bodyLeaf[b], b);
+    }
+    for (int b : moved) {
+        insert(0, bodies, b, 0);
+    }
+
+    // 3. Mass and centre of mass bottom-up; children are always stored after their parent
+    for (int n = getNumNodes() - 1; n >= 0; n--) {
+        refitNode(n, bodies);
+    }
+    flattenLeaves(bodies);
+    numRefits++;
+    return true;
+}
+
+template <int D>
+void OrthTree<D>::removeFromLeaf(int nodeIdx, int bodyIdx) {
+    int* link = &leafHead[nodeIdx];
+    while (*link != bodyIdx) {
+        link = &nextInLeaf[*link];
+    }
+    *link = nextInLeaf[bodyIdx];
+    nodes[nodeIdx].bodyCount--;
+}
+
+template <int D>
+void OrthTree<D>::refitNode(int nodeIdx, const BodyType* bodies) {
+    Node& node = nodes[nodeIdx];
+    if (node.isLeaf()) {
+        // Same accumulation order as insert()
+        int b = leafHead[nodeIdx];
+        node.totalMass = 0.0;
+        node.centerOfMass = Vec<D>();
+        if (b >= 0) {
+            node.centerOfMass = bodies[b].position;
+            node.totalMass = bodies[b].mass;
+            for (b = nextInLeaf[b]; b >= 0; b = nextInLeaf[b]) {
+                double newTotalMass = node.totalMass + bodies[b].mass;
+                node.centerOfMass = (node.centerOfMass * node.totalMass + bodies[b].position * bodies[b].mass) / newTotalMass;
+                node.totalMass = newTotalMass;
+            }
+        }
+        return;
+    }
+
+    double mass = 0.0;
+    Vec<D> weighted;
+    bool allEmpty = true;
+    for (int i = 0; i < BoundingBox<D>::NUM_CHILDREN; i++) {
+        const Node& child = nodes[node.firstChild + i];
+        mass += child.totalMass;
+        weighted += child.centerOfMass * child.totalMass;
+        allEmpty = allEmpty && child.isEmpty();
     }
+    if (allEmpty) {
+        // Every body has left: the node becomes an empty leaf and its children are
+        // dropped (they stay in the array, unreachable, until the next build)
+        node.firstChild = -1;
+        node.totalMass = 0.0;
+        node.centerOfMass = Vec<D>();
+        return;
+    }
+    node.totalMass = mass;
+    node.centerOfMass = weighted / mass;
+}
+
+// Leaf bodies as the walk expects them: null when every leaf holds at most one body
+template <int D>
+static const TreeLeafBody<D>* multiBodyLeaves(const TreePool<TreeLeafBody<D>>& leafBodies) {
+    return leafBodies.empty() ? nullptr : leafBodies.data();
+}
+
+template <int D>
+void OrthTree<D>::calculateForces(std::vector<BodyType>& bodies, int startIdx, int endIdx,
+                                  double theta, double G, double softening,
+                                  WalkStats* stats, ForceKernel kernel) const {
+    calculateForces(nodes.data(), getNumNodes(), multiBodyLeaves(leafBodies), bodies.data(), startIdx, endIdx,
+                    theta, G, softening, stats, kernel, periodic);
+}
+
+template <int D>
+void OrthTree<D>::calculateForces(std::vector<BodyType>& bodies, const int* indices, int count,
+                                  double theta, double G, double softening,
+                                  WalkStats* stats, ForceKernel kernel) const {
+    if (nodes.empty()) return;
+
+    dispatchWalk(nodes.data(), multiBodyLeaves(leafBodies), bodies.data(), 0, indices, count,
+                 theta, G, softening, stats, kernel, periodic);
 }
 
-void QuadTree::calculateForces(std::vector<Body>& bodies, int startIdx, int endIdx,
-                               double theta, double G, double softening) const {
-    if (!root) return;
+template <int D>
+void OrthTree<D>::calculateForces(const Node* nodes, int numNodes, const LeafBodyType* leafBodies,
+                                  BodyType* bodies,
+                                  int startIdx, int endIdx,
+                                  double theta, double G, double softening,
+                                  WalkStats* stats, ForceKernel kernel, const PeriodicBox* periodic) {
+    if (numNodes == 0) return;
     
     // This function calculates forces for bodies[startIdx] to bodies[endIdx-1]
     // Designed to be easily parallelizable with threads or MPI
+    dispatchWalk(nodes, leafBodies, bodies, startIdx, nullptr, endIdx - startIdx,
+                 theta, G, softening, stats, kernel, periodic);
+}
+
+// sum_j m_j / sqrt(d^2 + eps^2) of the subtree at nodeIdx at the position of body
+// targetIdx, with the opening test of the exact force walk
+template <int D>
+static double walkPotential(const TreeNode<D>* nodes, const TreeLeafBody<D>* leafBodies, int nodeIdx,
+                            const Vec<D>& position, int targetIdx, double theta, double soft2) {
+    const TreeNode<D>& node = nodes[nodeIdx];
+    if (node.isEmpty() || (node.bodyCount == 1 && node.body == targetIdx)) {
+        return 0.0;
+    }
+
+    double dist = std::sqrt((node.centerOfMass - position).lengthSquared() + soft2);
+    bool farEnough = node.bounds.halfSize * 2.0 / dist < theta;
+
+    if (node.bodyCount > 1 && !farEnough) {
+        double sum = 0.0;
+        const TreeLeafBody<D>* leaf = leafBodies + node.body;
+        for (int k = 0; k < node.bodyCount; k++) {
+            if (leaf[k].index != targetIdx) {
+                sum += leaf[k].mass / std::sqrt((leaf[k].position - position).lengthSquared() + soft2);
+            }
+        }
+        return sum;
+    }
+    if (node.isExternal() || farEnough) {
+        return node.totalMass / dist;
+    }
+
+    double sum = 0.0;
+    for (int i = 0; i < BoundingBox<D>::NUM_CHILDREN; i++) {
+        sum += walkPotential(nodes, leafBodies, node.firstChild + i, position, targetIdx, theta, soft2);
+    }
+    return sum;
+}
+
+template <int D>
+double OrthTree<D>::calculatePotential(const BodyType* bodies, int startIdx, int endIdx,
+                                       double theta, double G, double softening) const {
+    return calculatePotential(nodes.data(), getNumNodes(), multiBodyLeaves(leafBodies), bodies, startIdx, endIdx,
+                              theta, G, softening);
+}
+
+template <int D>
+double OrthTree<D>::calculatePotential(const Node* nodes, int numNodes, const LeafBodyType* leafBodies,
+                                       const BodyType* bodies, int startIdx, int endIdx,
+                                       double theta, double G, double softening) {
+    if (numNodes == 0) {
+        return 0.0;
+    }
+    double sum = 0.0;
     for (int i = startIdx; i < endIdx; i++) {
-        bodies[i].resetForce();
-        root->calculateForce(&bodies[i], theta, G, softening);
+        sum -= G * bodies[i].mass *
+               walkPotential(nodes, leafBodies, 0, bodies[i].position, i, theta, softening * softening);
     }
+    return sum;
 }
 
-void QuadTree::clear() {
-    root.reset();
+// Distance along one axis; with period > 0 to the nearest image
+static double axisDistance(double a, double b, double period) {
+    double distance = std::abs(a - b);
+    return (period > 0.0 && distance > 0.5 * period) ? period - distance : distance;
 }
 
-AABB QuadTree::calculateBounds(const std::vector<Body>& bodies) const {
-    if (bodies.empty()) {
-        return AABB(Vec2(0, 0), 1.0);
+template <int D>
+static double distanceSquared(const Vec<D>& a, const Vec<D>& b, double period) {
+    double sum = 0.0;
+    for (int d = 0; d < D; d++) {
+        double distance = axisDistance(a[d], b[d], period);
+        sum += distance * distance;
+    }
+    return sum;
+}
+
+// Recursive part of OrthTree::findNeighbours (period 0 for open boundaries)
+template <int D>
+static void collectNeighbours(const TreeNode<D>* nodes, const TreeLeafBody<D>* leafBodies, int nodeIdx,
+                              const Vec<D>& center, double radiusSquared, double period, std::vector<int>& out) {
+    const TreeNode<D>& node = nodes[nodeIdx];
+    if (node.isEmpty()) {
+        return;
+    }
+
+    // Squared distance from center to the cell, 0 inside it
+    double cellDistSquared = 0.0;
+    for (int d = 0; d < D; d++) {
+        double gap = std::max(axisDistance(center[d], node.bounds.center[d], period) - node.bounds.halfSize, 0.0);
+        cellDistSquared += gap * gap;
+    }
+    if (cellDistSquared > radiusSquared) {
+        return;
+    }
+
+    if (node.bodyCount == 1) {
+        // A single-body leaf's centre of mass is the body's position
+        if (distanceSquared(node.centerOfMass, center, period) <= radiusSquared) {
+            out.push_back(node.body);
+        }
+    } else if (node.bodyCount > 1) {
+        const TreeLeafBody<D>* leaf = &leafBodies[node.body];
+        for (int k = 0; k < node.bodyCount; k++) {
+            if (distanceSquared(leaf[k].position, center, period) <= radiusSquared) {
+                out.push_back(leaf[k].index);
+            }
+        }
+    } else {
+        for (int i = 0; i < BoundingBox<D>::NUM_CHILDREN; i++) {
+            collectNeighbours(nodes, leafBodies, node.firstChild + i, center, radiusSquared, period, out);
+        }
+    }
+}
+
+template <int D>
+void OrthTree<D>::findNeighbours(const Vec<D>& center, double radius, std::vector<int>& out) const {
+    if (nodes.empty()) {
+        return;
+    }
+    double period = (periodic && periodic->isEnabled()) ? periodic->getSize() : 0.0;
+    collectNeighbours(nodes.data(), multiBodyLeaves(leafBodies), 0, center, radius * radius, period, out);
+}
+
+template <int D>
+void OrthTree<D>::clear() {
+    nodes.clear();
+    leafBodies.clear();
+}
+
+template <int D>
+BoundingBox<D> OrthTree<D>::calculateBounds(const BodyType* bodies, int numBodies) const {
+    if (numBodies == 0) {
+        return BoundingBox<D>(Vec<D>(), 1.0);
     }
     
-    double minX = std::numeric_limits<double>::max();
-    double maxX = std::numeric_limits<double>::lowest();
-    double minY = std::numeric_limits<double>::max();
-    double maxY = std::numeric_limits<double>::lowest();
+    double minCorner[D];
+    double maxCorner[D];
+    for (int d = 0; d < D; d++) {
+        minCorner[d] = std::numeric_limits<double>::max();
+        maxCorner[d] = std::numeric_limits<double>::lowest();
+    }
     
-    for (const auto& body : bodies) {
-        minX = std::min(minX, body.position.x);
-        maxX = std::max(maxX, body.position.x);
-        minY = std::min(minY, body.position.y);
-        maxY = std::max(maxY, body.position.y);
+    for (int i = 0; i < numBodies; i++) {
+        const BodyType& body = bodies[i];
+        for (int d = 0; d < D; d++) {
+            minCorner[d] = std::min(minCorner[d], body.position[d]);
+            maxCorner[d] = std::max(maxCorner[d], body.position[d]);
+        }
     }
     
-    // Add some padding
+    // Add some padding; the cell is a cube over the widest extent
     double padding = 10.0;
-    minX -= padding;
-    maxX += padding;
-    minY -= padding;
-    maxY += padding;
-    
-    Vec2 center((minX + maxX) / 2.0, (minY + maxY) / 2.0);
-    double halfSize = std::max(maxX - minX, maxY - minY) / 2.0;
+    Vec<D> center;
+    double extent = 0.0;
+    for (int d = 0; d < D; d++) {
+        minCorner[d] -= padding;
+        maxCorner[d] += padding;
+        center[d] = (minCorner[d] + maxCorner[d]) / 2.0;
+        extent = std::max(extent, maxCorner[d] - minCorner[d]);
+    }
     
-    return AABB(center, halfSize);
+    return BoundingBox<D>(center, extent / 2.0);
 }
+
+// The 2D quadtree of the simulation and the 3D octree
+template class BoundingBox<2>;
+template class BoundingBox<3>;
+template class TreeNode<2>;
+template class TreeNode<3>;
+template class OrthTree<2>;
+template class OrthTree<3>;
@@ -0,0 +1,111 @@
+#include "reduction.h"
+#include <algorithm>
+#include <map>
+#include <utility>
+
+PairwiseSum::PairwiseSum(long long count, int width)
+    : count(std::max(0LL, count)), width(std::max(1, width)), levels(0) {
+    while ((1LL << levels) < this->count) {
+        levels++;
+    }
+}
+
+void PairwiseSum::addRange(long long start, long long end,
+                           const std::function<void(long long, double*)>& value) {
+    start = std::max(0LL, start);
+    end = std::min(count, end);
+
+    // Stack of finished subtrees, largest (leftmost) at the bottom
+    std::vector<double> stack((levels + 2) * width);
+    std::vector<int> stackLevels(levels + 2);
+
+    long long s = start;
+    while (s < end) {
+        // Largest node starting at s that ends inside [start, end)
+        int k = 0;
+        while (k < levels && s % (2LL << k) == 0 && std::min(s + (2LL << k), count) <= end) {
+            k++;
+        }
+        long long nodeEnd = std::min(s + (1LL << k), count);
+
+        // Elements pushed one by one; equal-sized neighbours merge into their parent
+        int top = -1;
+        for (long long i = s; i < nodeEnd; i++) {
+            top++;
+            value(i, &stack[top * width]);
+            stackLevels[top] = 0;
+            while (top > 0 && stackLevels[top - 1] == stackLevels[top]) {
+                for (int f = 0; f < width; f++) {
+                    stack[(top - 1) * width + f] += stack[top * width + f];
+                }
+                stackLevels[top - 1]++;
+                top--;
+            }
+        }
+        // A node cut off by count leaves smaller subtrees on the right; each parent
+        // is its left child plus everything to its right
+        for (; top > 0; top--) {
+            for (int f = 0; f < width; f++) {
+                stack[(top - 1) * width + f] += stack[top * width + f];
+            }
+        }
+
+        pieces.push_back(k);
+        pieces.push_back(static_cast<double>(s >> k));
+        pieces.insert(pieces.end(), stack.begin(), stack.begin() + width);
+        s = nodeEnd;
+    }
+}
+
+void PairwiseSum::merge(const PairwiseSum& other) {
+    addPieces(other.pieces.data(), other.pieces.size());
+}
+
+void PairwiseSum::addPieces(const double* data, size_t size) {
+    pieces.insert(pieces.end(), data, data + size);
+}
+
+// Value of node (level, index) from the pieces; false if it holds no elements.
+// Sets missing when an element is not covered
+static bool nodeValue(const std::map<std::pair<int, long long>, const double*>& found, long long count,
+                      int width, int level, long long index, double* out, bool& missing) {
+    if ((index << level) >= count) {
+        return false;
+    }
+    auto it = found.find(std::make_pair(level, index));
+    if (it != found.end()) {
+        std::copy(it->second, it->second + width, out);
+        return true;
+    }
+    if (level == 0) {
+        missing = true;
+        std::fill(out, out + width, 0.0);
+        return true;
+    }
+    nodeValue(found, count, width, level - 1, 2 * index, out, missing);
+    std::vector<double> right(width);
+    if (nodeValue(found, count, width, level - 1, 2 * index + 1, right.data(), missing)) {
+        for (int f = 0; f < width; f++) {
+            out[f] += right[f];
+        }
+    }
+    return true;
+}
+
+bool PairwiseSum::total(double* out) const {
+    std::fill(out, out + width, 0.0);
+    if (count == 0) {
+        return true;
+    }
+    std::map<std::pair<int, long long>, const double*> found;
+    size_t record = 2 + width;
+    for (size_t p = 0; p + record <= pieces.size(); p += record) {
+        found[std::make_pair(static_cast<int>(pieces[p]), static_cast<long long>(pieces[p + 1]))] = &pieces[p + 2];
+    }
+    bool missing = false;
+    nodeValue(found, count, width, levels, 0, out, missing);
+    if (missing) {
+        std::fill(out, out + width, 0.0);
+    }
+    return !missing;
+}
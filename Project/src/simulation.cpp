@@ -3,6 +3,10 @@
 #include <iomanip>
 #include <chrono>
 #include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+#include <sstream>
 
 Simulation::Simulation()
     : timeStep(0.01),
@@ -10,7 +14,27 @@ Simulation::Simulation()
       softening(0.01),
       gravitationalConstant(1.0),
       numThreads(4),
-      outputFilename("output.txt") {}
+      hugePages(false),
+      solver(ForceSolver::Tree),
+      forceKernel(ForceKernel::Exact),
+      leafSize(1),
+      treeRefit(false),
+      treeRebuildFraction(0.1),
+      blockTimesteps(false),
+      blockMaxLevel(6),
+      blockEta(0.025),
+      blockForceEvaluations(0),
+      blockSubsteps(0),
+      forceErrorInterval(0),
+      forceErrorSamples(0),
+      diagnosticsInterval(0),
+      deterministicReductions(false),
+      outputFilename("output.txt"),
+      outputFormat(OutputFormat::Text),
+      trajectoryError(0.0) {
+    tree.setPeriodicBox(&periodicBox);
+    directSum.setPeriodicBox(&periodicBox);
+}
 
 Simulation::~Simulation() {
     closeOutput();
@@ -22,21 +46,207 @@ void Simulation::initialize(const Config& config) {
     softening = config.softening;
     gravitationalConstant = config.gravitationalConstant;
     numThreads = config.numThreads;
+    if (!placement.parse(config.threadAffinity)) {
+        std::cerr << "Warning: Unknown or unavailable thread_affinity '" << config.threadAffinity
+                  << "', threads are not pinned" << std::endl;
+        placement.parse("none");
+    }
+    hugePages = config.hugePages;
+    profiler.setEnabled(config.profile);
+    profileReport = config.profileReport;
+    if (!parseOutputFormat(config.outputFormat, outputFormat)) {
+        std::cerr << "Warning: Unknown output_format '" << config.outputFormat
+                  << "', using text" << std::endl;
+        outputFormat = OutputFormat::Text;
+    }
+    trajectoryError = std::max(0.0, config.trajectoryError);
+    if (!parseForceSolver(config.solver, solver)) {
+        std::cerr << "Warning: Unknown solver '" << config.solver << "', using tree" << std::endl;
+        solver = ForceSolver::Tree;
+    }
+    if (!parseForceKernel(config.forceKernel, forceKernel)) {
+        std::cerr << "Warning: Unknown force_kernel '" << config.forceKernel << "', using exact" << std::endl;
+        forceKernel = ForceKernel::Exact;
+    }
+    leafSize = config.leafSize;
+    treeRefit = config.treeRefit;
+    treeRebuildFraction = config.treeRebuildFraction;
+    interactionCache.enabled = config.interactionLists;
+    interactionCache.maxReuse = std::max(0, config.interactionListSteps);
+    interactionCache.margin = std::max(0.0, std::min(config.interactionListMargin, 0.9));
+    interactionCache.groupSize = std::max(1, config.interactionGroupSize);
+    blockTimesteps = config.blockTimesteps;
+    blockMaxLevel = std::max(0, std::min(config.blockMaxLevel, 20));
+    blockEta = config.blockEta;
+    forceErrorInterval = config.forceErrorInterval;
+    merger.enabled = config.mergers;
+    merger.radius = config.mergeRadius;
+    merger.radiusScale = config.mergeRadiusScale;
+    if (merger.enabled && (outputFormat == OutputFormat::Binary || outputFormat == OutputFormat::Compressed)) {
+        // Binary and compressed frames have a fixed body count
+        std::cerr << "Warning: output_format = " << config.outputFormat << " does not support mergers, using text"
+                  << std::endl;
+        outputFormat = OutputFormat::Text;
+    }
+    autotuner.enabled = config.autotune;
+    autotuner.errorBudget = config.autotuneError;
+    autotuner.interval = config.autotuneInterval;
+    autotuner.samples = config.autotuneSamples;
+    forceErrorSamples = config.forceErrorSamples;
+    diagnosticsInterval = config.diagnosticsInterval;
+    deterministicReductions = config.deterministicReductions;
     
     // Copy bodies from config
-    bodies = config.bodies;
+    placeBodies(config.bodies);
+
+    if (!config.analysis.empty()) {
+        AnalysisSettings settings;
+        settings.prefix = config.analysisPrefix;
+        settings.grid = config.analysisGrid;
+        settings.bins = config.analysisBins;
+        settings.extent = config.analysisExtent;
+        analysis.configure(settings, bodies);
+        analysis.interval = std::max(1, config.analysisInterval);
+        std::stringstream names(config.analysis);
+        std::string name;
+        while (std::getline(names, name, ',')) {
+            name.erase(std::remove_if(name.begin(), name.end(), ::isspace), name.end());
+            if (name.empty()) {
+                continue;
+            }
+            std::unique_ptr<Analysis> plugin = createAnalysis(name);
+            if (!plugin) {
+                std::cerr << "Warning: Unknown analysis '" << name << "', skipped" << std::endl;
+            } else if (!analysis.add(std::move(plugin))) {
+                std::cerr << "Warning: Could not open the output of analysis '" << name << "', skipped"
+                          << std::endl;
+            }
+        }
+    }
+
+    periodicBox.setSize(config.periodicBox);
+    if (interactionCache.enabled && periodicBox.isEnabled()) {
+        std::cerr << "Warning: interaction_lists does not support periodic_box, using the tree walk" << std::endl;
+        interactionCache.enabled = false;
+    }
+    if (interactionCache.enabled && blockTimesteps) {
+        // Substeps only compute the forces of the active bodies, walked one by one
+        std::cerr << "Warning: interaction_lists does not support block_timesteps, using the tree walk"
+                  << std::endl;
+        interactionCache.enabled = false;
+    }
+    if (interactionCache.enabled && !treeRefit) {
+        // The lists refer to cells, which only a refitted tree keeps between steps
+        std::cerr << "Warning: interaction_lists needs tree_refit, enabling it" << std::endl;
+        treeRefit = true;
+    }
+    if (periodicBox.isEnabled()) {
+        for (Body& body : bodies) {
+            body.position = periodicBox.wrap(body.position);
+        }
+    }
     
     std::cout << "Simulation initialized with " << bodies.size() << " bodies" << std::endl;
-    std::cout << "Using " << numThreads << " threads" << std::endl;
+    std::cout << "Using " << numThreads << " threads, " << forceSolverName(solver) << " solver, "
+              << forcePrecisionName() << " precision, " << forceKernelName(forceKernel) << " kernel" << std::endl;
+    if (placement.isEnabled()) {
+        std::cout << "Thread affinity: " << placement.describe() << std::endl;
+    }
+    placeTree();
+}
+
+// Pages of [data, data + bytes) split into numThreads contiguous parts, each faulted
+// in by worker t pinned to its CPU
+static void touchInParallel(const ThreadPlacement& placement, char* data, size_t bytes, int numThreads,
+                            size_t unit) {
+    size_t count = bytes / unit;
+    int totalThreads = std::max(1, numThreads);
+    std::vector<char> failed(totalThreads, 0);
+    auto worker = [&](int t) {
+        size_t perThread = count / totalThreads;
+        size_t remainder = count % totalThreads;
+        size_t start = t * perThread + std::min<size_t>(t, remainder);
+        size_t end = start + perThread + (static_cast<size_t>(t) < remainder ? 1 : 0);
+        placement.pin(t);
+        failed[t] = !touchPages(data + start * unit, (end - start) * unit);
+    };
+
+    ScopedThreadAffinity restoreAffinity(placement);
+    std::vector<std::thread> threads;
+    for (int t = 1; t < totalThreads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    static bool warned = false;
+    if (!warned && std::find(failed.begin(), failed.end(), 1) != failed.end()) {
+        std::cerr << "Warning: first-touch placement is not supported by this kernel" << std::endl;
+        warned = true;
+    }
+}
+
+void Simulation::placeBodies(const std::vector<Body>& source) {
+    if (!placement.isEnabled() && !hugePages) {
+        bodies = source;
+        return;
+    }
+    // A fresh allocation has no pages yet, so its pages land where they are first
+    // touched. Worker t later integrates and walks exactly these bodies
+    std::vector<Body> placed;
+    placed.reserve(source.size());
+    size_t bytes = source.size() * sizeof(Body);
+    if (hugePages && !adviseHugePages(placed.data(), bytes)) {
+        std::cerr << "Warning: huge_pages: madvise failed, using normal pages" << std::endl;
+    }
+    if (placement.isEnabled()) {
+        touchInParallel(placement, reinterpret_cast<char*>(placed.data()), bytes, numThreads, sizeof(Body));
+    }
+    placed.assign(source.begin(), source.end());
+    bodies.swap(placed);
+}
+
+void Simulation::placeTree() {
+    if ((!placement.isEnabled() && !hugePages) || bodies.empty() || solver != ForceSolver::Tree) {
+        return;
+    }
+    // Same size as the first build reserves. Every worker reads the whole tree, so
+    // the pool is spread evenly over the workers' nodes rather than owned by one
+    tree.clear();
+    tree.setLeafSize(leafSize);
+    tree.nodes.reserve(2 * bodies.size() / leafSize + 1);
+    tree.leafBodies.reserve(bodies.size());
+    size_t nodeBytes = tree.nodes.capacity() * sizeof(QuadTreeNode);
+    size_t leafBytes = tree.leafBodies.capacity() * sizeof(LeafBody);
+    if (hugePages) {
+        adviseHugePages(tree.nodes.data(), nodeBytes);
+        adviseHugePages(tree.leafBodies.data(), leafBytes);
+    }
+    if (placement.isEnabled()) {
+        touchInParallel(placement, reinterpret_cast<char*>(tree.nodes.data()), nodeBytes, numThreads,
+                        sizeof(QuadTreeNode));
+        touchInParallel(placement, reinterpret_cast<char*>(tree.leafBodies.data()), leafBytes, numThreads,
+                        sizeof(LeafBody));
+    }
 }
 
 void Simulation::setOutputFile(const std::string& filename) {
     outputFilename = filename;
-    if (outputFile.is_open()) {
-        outputFile.close();
+    closeOutput();
+    bool opened;
+    if (outputFormat == OutputFormat::None) {
+        return;
+    } else if (outputFormat == OutputFormat::Binary) {
+        opened = trajectoryWriter.open(filename, bodies.data(), static_cast<int>(bodies.size()));
+    } else if (outputFormat == OutputFormat::Compressed) {
+        opened = compressedWriter.open(filename, bodies.data(), static_cast<int>(bodies.size()),
+                                       trajectoryError, numThreads);
+    } else {
+        outputFile.open(filename);
+        opened = outputFile.is_open();
     }
-    outputFile.open(filename);
-    if (!outputFile.is_open()) {
+    if (!opened) {
         std::cerr << "Error: Could not open output file: " << filename << std::endl;
     }
 }
@@ -45,6 +255,8 @@ void Simulation::closeOutput() {
     if (outputFile.is_open()) {
         outputFile.close();
     }
+    trajectoryWriter.close();
+    compressedWriter.close();
 }
 
 std::vector<Body>& Simulation::getBodies() {
@@ -56,14 +268,197 @@ void Simulation::setBodies(const std::vector<Body>& newBodies) {
 }
 
 void Simulation::buildTree() {
+    if (treeRefit && tree.getLeafSize() == leafSize) {
+        tree.refit(bodies.data(), static_cast<int>(bodies.size()), treeRebuildFraction);
+        return;
+    }
     tree.clear();
+    tree.setLeafSize(leafSize);
     tree.build(bodies);
 }
 
-void Simulation::calculateForcesRange(int startIdx, int endIdx) {
+void Simulation::prepareForces() {
+    if (solver == ForceSolver::Direct) {
+        directSum.load(bodies.data(), static_cast<int>(bodies.size()));
+    } else {
+        buildTree();
+    }
+}
+
+Diagnostics Simulation::measureDiagnosticsRange(int startIdx, int endIdx) const {
+    Diagnostics result = measureBodies(bodies.data(), startIdx, endIdx);
+    if (periodicBox.isEnabled()) {
+        result.hasPotential = false;
+    } else if (solver == ForceSolver::Direct) {
+        result.potential = 0.5 * directSum.calculatePotential(startIdx, endIdx, gravitationalConstant, softening);
+    } else {
+        result.potential = 0.5 * tree.calculatePotential(bodies.data(), startIdx, endIdx,
+                                                         theta, gravitationalConstant, softening);
+    }
+    return result;
+}
+
+void Simulation::addDiagnosticsPieces(PairwiseSum& sum, int startIdx, int endIdx) const {
+    sum.addRange(startIdx, endIdx, [this](long long i, double* fields) {
+        int body = static_cast<int>(i);
+        measureDiagnosticsRange(body, body + 1).toArray(fields);
+    });
+}
+
+Diagnostics Simulation::measureDiagnostics() {
+    int numBodies = static_cast<int>(bodies.size());
+    int totalThreads = std::max(1, std::min(numThreads, numBodies));
+    std::vector<Diagnostics> partial(totalThreads);
+    std::vector<PairwiseSum> pieces(totalThreads, PairwiseSum(numBodies, Diagnostics::NUM_FIELDS));
+    auto worker = [&](int t) {
+        int perThread = numBodies / totalThreads;
+        int remainder = numBodies % totalThreads;
+        int start = t * perThread + std::min(t, remainder);
+        int end = start + perThread + (t < remainder ? 1 : 0);
+        placement.pin(t);
+        if (deterministicReductions) {
+            addDiagnosticsPieces(pieces[t], start, end);
+        } else {
+            partial[t] = measureDiagnosticsRange(start, end);
+        }
+    };
+
+    ScopedThreadAffinity restoreAffinity(placement);
+    std::vector<std::thread> threads;
+    for (int t = 1; t < totalThreads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (deterministicReductions) {
+        for (int t = 1; t < totalThreads; t++) {
+            pieces[0].merge(pieces[t]);
+        }
+        double fields[Diagnostics::NUM_FIELDS];
+        pieces[0].total(fields);
+        Diagnostics total = measureDiagnosticsRange(0, 0);
+        total.fromArray(fields);
+        return total;
+    }
+
+    // Partial sums are added in thread order
+    Diagnostics total = partial[0];
+    for (int t = 1; t < totalThreads; t++) {
+        total.add(partial[t]);
+    }
+    return total;
+}
+
+void Simulation::analyseState(int stateStep) {
+    if (analysis.isDue(stateStep)) {
+        analysis.submit(stateStep, stateStep * timeStep, bodies);
+    }
+}
+
+void Simulation::diagnoseState(int stateStep) {
+    ScopedTimer timer(profiler, Phase::Diagnostics);
+    Diagnostics diagnostics = measureDiagnostics();
+    diagnostics.step = stateStep;
+    recordDiagnostics(diagnostics);
+}
+
+void Simulation::recordDiagnostics(const Diagnostics& diagnostics) {
+    diagnosticsLog.push_back(diagnostics);
+    printDiagnostics(std::cout, diagnostics, diagnosticsLog.front());
+}
+
+void Simulation::printDiagnosticsSummary(std::ostream& os) const {
+    if (diagnosticsLog.empty()) {
+        return;
+    }
+    const Diagnostics& first = diagnosticsLog.front();
+    const Diagnostics& last = diagnosticsLog.back();
+    os << "Conservation over " << diagnosticsLog.size() << " records: ";
+    if (first.hasPotential) {
+        os << "max |dE/E0| = " << maxEnergyDrift(diagnosticsLog) << ", ";
+    }
+    os << "|dP| = " << (last.momentum - first.momentum).length()
+       << ", dL = " << (last.angularMomentum - first.angularMomentum) << std::endl;
+}
+
+int Simulation::mergeBodies() {
+    ScopedTimer timer(profiler, Phase::Merge);
+    if (solver == ForceSolver::Direct) {
+        buildTree();
+    }
+    return merger.apply(bodies, tree, numThreads);
+}
+
+void Simulation::calculateForcesRange(int startIdx, int endIdx, WalkStats* stats) {
     // This function calculates forces for bodies[startIdx] to bodies[endIdx-1]
     // Can be called by threads or MPI workers
-    tree.calculateForces(bodies, startIdx, endIdx, theta, gravitationalConstant, softening);
+    if (solver == ForceSolver::Direct) {
+        directSum.calculateForces(bodies.data(), startIdx, endIdx, gravitationalConstant, softening, stats);
+        return;
+    }
+    tree.calculateForces(bodies, startIdx, endIdx, theta, gravitationalConstant, softening, stats, forceKernel);
+}
+
+ForceErrorStats Simulation::measureForceError() {
+    int numBodies = static_cast<int>(bodies.size());
+    if (numBodies == 0) {
+        return ForceErrorStats();
+    }
+
+    std::vector<int> targets;
+    sampleBodies(numBodies, forceErrorSamples, targets);
+    int count = static_cast<int>(targets.size());
+    std::vector<Vec2> forces(count);
+    for (int k = 0; k < count; k++) {
+        forces[k] = bodies[targets[k]].force;
+    }
+
+    std::vector<Vec2> reference(count);
+    calculateReferenceForces(targets.data(), count, reference.data());
+    return computeForceError(forces.data(), reference.data(), count);
+}
+
+void Simulation::calculateReferenceForces(const int* targets, int count, Vec2* forces) {
+    directSum.load(bodies.data(), static_cast<int>(bodies.size()));
+    int totalThreads = std::max(1, std::min(numThreads, count));
+    auto worker = [&](int t) {
+        int perThread = count / totalThreads;
+        int remainder = count % totalThreads;
+        int start = t * perThread + std::min(t, remainder);
+        int end = start + perThread + (t < remainder ? 1 : 0);
+        placement.pin(t);
+        directSum.calculateForces(targets + start, end - start, forces + start,
+                                  gravitationalConstant, softening);
+    };
+
+    ScopedThreadAffinity restoreAffinity(placement);
+    std::vector<std::thread> threads;
+    for (int t = 1; t < totalThreads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void Simulation::calculateForcesList(const int* indices, int count, WalkStats* stats) {
+    if (solver == ForceSolver::Direct) {
+        std::vector<Vec2> forces(count);
+        directSum.calculateForces(indices, count, forces.data(), gravitationalConstant, softening);
+        for (int k = 0; k < count; k++) {
+            bodies[indices[k]].force = forces[k];
+        }
+        if (stats) {
+            stats->nodesVisited += static_cast<long long>(count) * directSum.getNumBodies();
+            stats->interactions += static_cast<long long>(count) * (directSum.getNumBodies() - 1);
+        }
+        return;
+    }
+    tree.calculateForces(bodies, indices, count, theta, gravitationalConstant, softening, stats, forceKernel);
 }
 
 void Simulation::updateBodiesRange(int startIdx, int endIdx) {
@@ -73,6 +468,9 @@ void Simulation::updateBodiesRange(int startIdx, int endIdx) {
         bodies[i].updateAcceleration();
         bodies[i].updateVelocity(timeStep);
         bodies[i].updatePosition(timeStep);
+        if (periodicBox.isEnabled()) {
+            bodies[i].position = periodicBox.wrap(bodies[i].position);
+        }
     }
 }
 
@@ -86,14 +484,31 @@ void Simulation::threadWorker(int threadId, int totalThreads) {
     int startIdx = threadId * bodiesPerThread + std::min(threadId, remainder);
     int endIdx = startIdx + bodiesPerThread + (threadId < remainder ? 1 : 0);
     
+    placement.pin(threadId);
+
     // Calculate forces for this range
-    calculateForcesRange(startIdx, endIdx);
+    if (!profiler.isEnabled()) {
+        calculateForcesRange(startIdx, endIdx);
+        return;
+    }
+
+    ThreadRecord& record = profiler.thread(threadId);
+    auto start = std::chrono::steady_clock::now();
+    calculateForcesRange(startIdx, endIdx, &record.walk);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    record.forceMs = elapsed.count();
 }
 
 void Simulation::calculateForcesParallel() {
+    if (interactionCache.enabled && solver == ForceSolver::Tree) {
+        interactionCache.calculateForces(tree, bodies, theta, gravitationalConstant, softening, forceKernel,
+                                         numThreads, placement, profiler);
+        return;
+    }
     if (numThreads <= 1 || bodies.size() < static_cast<size_t>(numThreads)) {
         // Serial execution
-        calculateForcesRange(0, static_cast<int>(bodies.size()));
+        ScopedThreadAffinity restoreAffinity(placement);
+        threadWorker(0, 1);
         return;
     }
     
@@ -128,7 +543,10 @@ void Simulation::updateBodiesParallel() {
         int startIdx = t * bodiesPerThread + std::min(t, remainder);
         int endIdx = startIdx + bodiesPerThread + (t < remainder ? 1 : 0);
         
-        threads.emplace_back(&Simulation::updateBodiesRange, this, startIdx, endIdx);
+        threads.emplace_back([this, t, startIdx, endIdx]() {
+            placement.pin(t);
+            updateBodiesRange(startIdx, endIdx);
+        });
     }
     
     for (auto& thread : threads) {
@@ -136,19 +554,251 @@ void Simulation::updateBodiesParallel() {
     }
 }
 
+void Simulation::calculateActiveForcesParallel() {
+    int count = static_cast<int>(activeBodies.size());
+    int totalThreads = std::max(1, std::min(numThreads, count));
+    auto worker = [&](int t) {
+        int perThread = count / totalThreads;
+        int remainder = count % totalThreads;
+        int start = t * perThread + std::min(t, remainder);
+        int end = start + perThread + (t < remainder ? 1 : 0);
+        placement.pin(t);
+        if (!profiler.isEnabled()) {
+            calculateForcesList(activeBodies.data() + start, end - start);
+            return;
+        }
+        ThreadRecord& record = profiler.thread(t);
+        auto begin = std::chrono::steady_clock::now();
+        calculateForcesList(activeBodies.data() + start, end - start, &record.walk);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+        record.forceMs += elapsed.count();
+    };
+
+    ScopedThreadAffinity restoreAffinity(placement);
+    std::vector<std::thread> threads;
+    for (int t = 1; t < totalThreads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+int Simulation::chooseLevel(int i, int substep) const {
+    // dt_i = eta * min(sqrt(softening / |a|), |v| / |a|): the softening criterion
+    // resolves close encounters, the velocity one keeps the step a small fraction of
+    // the local dynamical time
+    const Body& body = bodies[i];
+    double accel = body.acceleration.length();
+    double dt = timeStep;
+    if (accel > 0.0) {
+        if (softening > 0.0) {
+            dt = std::min(dt, blockEta * std::sqrt(softening / accel));
+        }
+        double speed = body.velocity.length();
+        if (speed > 0.0) {
+            dt = std::min(dt, blockEta * speed / accel);
+        }
+    }
+
+    int level = 0;
+    while (level < blockMaxLevel && timeStep / (1 << level) > dt) {
+        level++;
+    }
+    // A body may only move to a larger step where that step begins
+    int substeps = 1 << blockMaxLevel;
+    while (substep % (substeps >> level) != 0) {
+        level++;
+    }
+    return level;
+}
+
+void Simulation::recordForceError(int stepNumber, const ForceErrorStats& stats) {
+    lastForceError = stats;
+    std::cout << "Force error at step " << stepNumber << " (" << lastForceError.samples << " bodies): "
+              << "p50=" << lastForceError.p50 << " p90=" << lastForceError.p90
+              << " p99=" << lastForceError.p99 << " max=" << lastForceError.max << std::endl;
+}
+
+void Simulation::checkForceError(int stepNumber) {
+    if (forceErrorInterval > 0 && stepNumber % forceErrorInterval == 0) {
+        recordForceError(stepNumber, measureForceError());
+    }
+}
+
+void Simulation::stepBlock(int stepNumber) {
+    // Kick-drift with power-of-two steps. A body is active at the substep where its
+    // own step begins: its force is computed from the current (drifted) positions
+    // and it is kicked by its full step. Every body is active at substep 0, so a full
+    // step ends with all bodies synchronised.
+    // Velocities only change at kicks, so positions are brought forward lazily: all
+    // bodies drift in one go to the next substep that computes forces (and to the end
+    // of the step), instead of by one substep each time. Within the step the tree of
+    // substep 0 is refitted rather than rebuilt.
+    // Substep 0 computes every body's force on a fresh tree, like a shared step, so
+    // the autotuner's cost and the force error are taken there.
+    // With blockMaxLevel = 0 this is exactly updateBodiesRange.
+    int numBodies = static_cast<int>(bodies.size());
+    int substeps = 1 << blockMaxLevel;
+    double dtMin = timeStep / substeps;
+    if (static_cast<int>(bodyLevel.size()) != numBodies) {
+        bodyLevel.assign(numBodies, 0);
+    }
+    // Bodies whose own step begins at each substep; all of them at substep 0
+    dueBodies.resize(substeps);
+    for (std::vector<int>& due : dueBodies) {
+        due.clear();
+    }
+    for (int i = 0; i < numBodies; i++) {
+        dueBodies[0].push_back(i);
+    }
+
+    // Substep the positions belong to
+    int drifted = 0;
+    auto driftTo = [&](int substep) {
+        if (substep == drifted) {
+            return;
+        }
+        ScopedTimer timer(profiler, Phase::Integration);
+        double dt = (substep - drifted) * dtMin;
+        for (int i = 0; i < numBodies; i++) {
+            bodies[i].updatePosition(dt);
+            if (periodicBox.isEnabled()) {
+                bodies[i].position = periodicBox.wrap(bodies[i].position);
+            }
+        }
+        drifted = substep;
+    };
+
+    for (int s = 0; s < substeps; s++) {
+        if (dueBodies[s].empty()) {
+            continue;
+        }
+        activeBodies.swap(dueBodies[s]);
+        dueBodies[s].clear();
+        // Index order, as the bodies are stored
+        std::sort(activeBodies.begin(), activeBodies.end());
+
+        driftTo(s);
+        auto forceStart = std::chrono::steady_clock::now();
+        // The tree (or direct-sum snapshot) is only refreshed for substeps that
+        // evaluate forces. Bodies move little within a step, so after substep 0 the
+        // tree is refitted (it is still rebuilt if too many bodies changed cell)
+        {
+            ScopedTimer timer(profiler, Phase::TreeBuild);
+            if (s == 0 || solver == ForceSolver::Direct) {
+                prepareForces();
+            } else {
+                tree.refit(bodies.data(), numBodies, treeRebuildFraction);
+            }
+        }
+        {
+            ScopedTimer timer(profiler, Phase::ForceWalk);
+            calculateActiveForcesParallel();
+        }
+        if (s == 0) {
+            if (autotuner.enabled) {
+                std::chrono::duration<double, std::milli> forceTime = std::chrono::steady_clock::now() - forceStart;
+                autotuner.recordStep(forceTime.count());
+            }
+            checkForceError(stepNumber);
+        }
+        ScopedTimer timer(profiler, Phase::Integration);
+        for (int i : activeBodies) {
+            bodies[i].updateAcceleration();
+            bodyLevel[i] = chooseLevel(i, s);
+            bodies[i].updateVelocity(timeStep / (1 << bodyLevel[i]));
+            int next = s + (substeps >> bodyLevel[i]);
+            if (next < substeps) {
+                dueBodies[next].push_back(i);
+            }
+        }
+        blockForceEvaluations += static_cast<long long>(activeBodies.size());
+        blockSubsteps++;
+    }
+    driftTo(substeps);
+}
+
 void Simulation::step(int stepNumber) {
+    // May change solver, theta, leaf size and thread count for this and later steps
+    autotuner.maybeTune(*this, stepNumber);
+
+    profiler.beginStep(stepNumber, numThreads);
+    if (blockTimesteps) {
+        if (diagnosticsDue(stepNumber - 1)) {
+            {
+                ScopedTimer timer(profiler, Phase::TreeBuild);
+                prepareForces();
+            }
+            diagnoseState(stepNumber - 1);
+        }
+        if (merger.enabled) {
+            {
+                ScopedTimer timer(profiler, Phase::TreeBuild);
+                buildTree();
+            }
+            mergeBodies();
+        }
+        stepBlock(stepNumber);
+        profiler.setTreeStats(tree.getDepth(), tree.getNumNodes());
+        {
+            ScopedTimer timer(profiler, Phase::Output);
+            writeState(stepNumber);
+            analyseState(stepNumber);
+        }
+        profiler.endStep();
+        return;
+    }
+    auto forceStart = std::chrono::steady_clock::now();
+
     // Barnes-Hut simulation step:
     // 1. Build quadtree (serial - could be parallelized in future)
-    buildTree();
+    {
+        ScopedTimer timer(profiler, Phase::TreeBuild);
+        prepareForces();
+    }
+    // The solver now holds the state written at the end of the previous step
+    if (diagnosticsDue(stepNumber - 1)) {
+        // Not part of the force cost the autotuner tracks
+        auto diagnosticsStart = std::chrono::steady_clock::now();
+        diagnoseState(stepNumber - 1);
+        forceStart += std::chrono::steady_clock::now() - diagnosticsStart;
+    }
+    // Collisions are resolved before forces; the merged bodies need a new tree
+    if (merger.enabled && mergeBodies() > 0) {
+        ScopedTimer timer(profiler, Phase::TreeBuild);
+        prepareForces();
+    }
+    profiler.setTreeStats(tree.getDepth(), tree.getNumNodes());
     
     // 2. Calculate forces (parallel)
-    calculateForcesParallel();
+    {
+        ScopedTimer timer(profiler, Phase::ForceWalk);
+        calculateForcesParallel();
+    }
+    if (autotuner.enabled) {
+        std::chrono::duration<double, std::milli> forceTime = std::chrono::steady_clock::now() - forceStart;
+        autotuner.recordStep(forceTime.count());
+    }
+
+    // Accuracy check against the direct sum (not timed)
+    checkForceError(stepNumber);
     
     // 3. Update positions and velocities (parallel)
-    updateBodiesParallel();
+    {
+        ScopedTimer timer(profiler, Phase::Integration);
+        updateBodiesParallel();
+    }
     
-    // 4. Write state to output file
-    writeState(stepNumber);
+    // 4. Write state to output file and start the analyses of it
+    {
+        ScopedTimer timer(profiler, Phase::Output);
+        writeState(stepNumber);
+        analyseState(stepNumber);
+    }
+
+    profiler.endStep();
 }
 
 void Simulation::run(int numSteps) {
@@ -158,6 +808,7 @@ void Simulation::run(int numSteps) {
     
     // Write initial state
     writeState(0);
+    analyseState(0);
     
     for (int s = 1; s <= numSteps; s++) {
         step(s);
@@ -173,18 +824,83 @@ void Simulation::run(int numSteps) {
     
     std::cout << "Simulation completed in " << duration.count() << " ms" << std::endl;
     std::cout << "Average time per step: " << (duration.count() / static_cast<double>(numSteps)) << " ms" << std::endl;
+    if (treeRefit) {
+        std::cout << "Tree: " << tree.getNumBuilds() << " full builds, " << tree.getNumRefits() << " refits" << std::endl;
+    }
+    if (interactionCache.enabled) {
+        interactionCache.printSummary(std::cout);
+    }
+    if (diagnosticsInterval > 0 && !bodies.empty()) {
+        // Steps measure the state they start from, so the final state is measured here
+        prepareForces();
+        diagnoseState(numSteps);
+        printDiagnosticsSummary(std::cout);
+    }
+    if (compressedWriter.isOpen() && compressedWriter.getBytesWritten() > 0) {
+        std::cout << "Compressed trajectory: " << compressedWriter.getBytesWritten() << " bytes, "
+                  << std::fixed << std::setprecision(2)
+                  << static_cast<double>(compressedWriter.getRawBytes()) / compressedWriter.getBytesWritten()
+                  << "x smaller than binary" << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+    if (analysis.isEnabled()) {
+        analysis.finish();
+        std::cout << "Analysis: " << analysis.getNumSnapshots() << " snapshots, " << std::fixed
+                  << std::setprecision(1) << analysis.getWaitMs() << " ms waiting for analyses"
+                  << std::defaultfloat << std::setprecision(6) << " (" << analysis.getSettings().prefix
+                  << "_*)" << std::endl;
+    }
+    if (merger.enabled) {
+        std::cout << "Mergers: " << merger.getNumEvents() << " collisions absorbed "
+                  << merger.getNumRemoved() << " bodies, " << bodies.size() << " left" << std::endl;
+    }
+    if (blockTimesteps && !bodies.empty()) {
+        // Against every body stepping at the finest substep
+        double shared = static_cast<double>(numSteps) * (1 << blockMaxLevel) * bodies.size();
+        std::vector<int> histogram(blockMaxLevel + 1, 0);
+        for (int level : bodyLevel) {
+            histogram[level]++;
+        }
+        std::cout << "Block timesteps: " << blockForceEvaluations << " force evaluations in "
+                  << blockSubsteps << " substeps (" << (100.0 * blockForceEvaluations / shared)
+                  << "% of a shared finest step)" << std::endl;
+        std::cout << "Bodies per level:";
+        for (int level = 0; level <= blockMaxLevel; level++) {
+            std::cout << " " << level << ":" << histogram[level];
+        }
+        std::cout << std::endl;
+    }
+
+    if (profiler.isEnabled()) {
+        profiler.printSummary(std::cout);
+        if (Profiler::writeReport(profileReport, {profiler.getSteps()}, diagnosticsLog)) {
+            std::cout << "Profile report written to: " << profileReport << std::endl;
+        }
+    }
 }
 
 void Simulation::writeState(int stepNumber) {
+    writeBodies(stepNumber, bodies.data(), static_cast<int>(bodies.size()));
+}
+
+void Simulation::writeBodies(int stepNumber, const Body* stateBodies, int count) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+
+    if (trajectoryWriter.isOpen()) {
+        trajectoryWriter.writeFrame(stepNumber, stateBodies, count);
+        return;
+    }
+    if (compressedWriter.isOpen()) {
+        compressedWriter.writeFrame(stepNumber, stateBodies, count);
+        return;
+    }
     if (!outputFile.is_open()) {
         return;
     }
     
-    std::lock_guard<std::mutex> lock(outputMutex);
-    
     outputFile << "step " << stepNumber << std::endl;
     
-    for (const auto& body : bodies) {
+    for (int i = 0; i < count; i++) {
+        const Body& body = stateBodies[i];
         outputFile << body.id << " " 
                    << std::fixed << std::setprecision(6) 
                    << body.position.x << " " << body.position.y << std::endl;
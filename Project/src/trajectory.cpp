@@ -0,0 +1,182 @@
+#include "trajectory.h"
+#include <cstring>
+#include <iostream>
+
+static const char TRAJECTORY_MAGIC[4] = {'N', 'B', 'T', 'R'};
+static const int32_t TRAJECTORY_VERSION = 1;
+
+bool parseOutputFormat(const std::string& name, OutputFormat& format) {
+    if (name == "text") {
+        format = OutputFormat::Text;
+    } else if (name == "binary") {
+        format = OutputFormat::Binary;
+    } else if (name == "compressed") {
+        format = OutputFormat::Compressed;
+    } else if (name == "none") {
+        format = OutputFormat::None;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int64_t trajectoryHeaderBytes(int numBodies) {
+    int64_t idBytes = static_cast<int64_t>(numBodies) * sizeof(int32_t);
+    idBytes = (idBytes + 7) / 8 * 8;
+    return static_cast<int64_t>(sizeof(TrajectoryHeader)) + idBytes;
+}
+
+int64_t trajectoryFrameBytes(int numBodies) {
+    return static_cast<int64_t>(sizeof(int64_t)) + static_cast<int64_t>(numBodies) * 2 * sizeof(double);
+}
+
+int64_t trajectoryFrameOffset(int numBodies, int64_t frameIndex) {
+    return trajectoryHeaderBytes(numBodies) + frameIndex * trajectoryFrameBytes(numBodies);
+}
+
+void makeTrajectoryHeader(const Body* bodies, int numBodies, std::vector<char>& buffer) {
+    buffer.assign(trajectoryHeaderBytes(numBodies), 0);
+
+    TrajectoryHeader header;
+    std::memcpy(header.magic, TRAJECTORY_MAGIC, 4);
+    header.version = TRAJECTORY_VERSION;
+    header.numBodies = numBodies;
+    header.reserved = 0;
+    std::memcpy(buffer.data(), &header, sizeof(header));
+
+    char* idPtr = buffer.data() + sizeof(header);
+    for (int i = 0; i < numBodies; i++) {
+        int32_t id = bodies[i].id;
+        std::memcpy(idPtr + i * sizeof(int32_t), &id, sizeof(id));
+    }
+}
+
+bool isBinaryTrajectory(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[4] = {0, 0, 0, 0};
+    if (!file.read(magic, 4)) {
+        return false;
+    }
+    return std::memcmp(magic, TRAJECTORY_MAGIC, 4) == 0;
+}
+
+// ============================================================================
+// TrajectoryWriter Implementation
+// ============================================================================
+
+TrajectoryWriter::TrajectoryWriter() {}
+
+bool TrajectoryWriter::open(const std::string& filename, const Body* bodies, int numBodies) {
+    close();
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::vector<char> header;
+    makeTrajectoryHeader(bodies, numBodies, header);
+    file.write(header.data(), header.size());
+    frameBuffer.resize(trajectoryFrameBytes(numBodies));
+    return true;
+}
+
+void TrajectoryWriter::writeFrame(int stepNumber, const Body* bodies, int numBodies) {
+    if (!file.is_open()) {
+        return;
+    }
+
+    int64_t step = stepNumber;
+    std::memcpy(frameBuffer.data(), &step, sizeof(step));
+    double* xy = reinterpret_cast<double*>(frameBuffer.data() + sizeof(step));
+    for (int i = 0; i < numBodies; i++) {
+        xy[i * 2 + 0] = bodies[i].position.x;
+        xy[i * 2 + 1] = bodies[i].position.y;
+    }
+    file.write(frameBuffer.data(), frameBuffer.size());
+}
+
+void TrajectoryWriter::close() {
+    if (file.is_open()) {
+        file.close();
+    }
+}
+
+bool TrajectoryWriter::isOpen() const {
+    return file.is_open();
+}
+
+// ============================================================================
+// TrajectoryReader Implementation
+// ============================================================================
+
+TrajectoryReader::TrajectoryReader() : numBodies(0) {}
+
+bool TrajectoryReader::open(const std::string& filename) {
+    close();
+    file.open(filename, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    TrajectoryHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, TRAJECTORY_MAGIC, 4) != 0) {
+        std::cerr << "Not a binary trajectory: " << filename << std::endl;
+        close();
+        return false;
+    }
+    if (header.version != TRAJECTORY_VERSION || header.numBodies < 0) {
+        std::cerr << "Unsupported trajectory version " << header.version << " in " << filename << std::endl;
+        close();
+        return false;
+    }
+
+    numBodies = header.numBodies;
+    std::vector<int32_t> rawIds(numBodies);
+    file.read(reinterpret_cast<char*>(rawIds.data()), numBodies * sizeof(int32_t));
+    ids.assign(rawIds.begin(), rawIds.end());
+    frameBuffer.resize(trajectoryFrameBytes(numBodies));
+    return static_cast<bool>(file);
+}
+
+void TrajectoryReader::close() {
+    if (file.is_open()) {
+        file.close();
+    }
+    file.clear();
+    numBodies = 0;
+    ids.clear();
+}
+
+int64_t TrajectoryReader::getNumFrames() {
+    if (!file.is_open()) {
+        return 0;
+    }
+    file.clear();
+    file.seekg(0, std::ios::end);
+    int64_t fileBytes = static_cast<int64_t>(file.tellg());
+    int64_t dataBytes = fileBytes - trajectoryHeaderBytes(numBodies);
+    if (dataBytes <= 0) {
+        return 0;
+    }
+    return dataBytes / trajectoryFrameBytes(numBodies);
+}
+
+bool TrajectoryReader::readFrame(int64_t frameIndex, int64_t& stepNumber, std::vector<Vec2>& positions) {
+    if (!file.is_open()) {
+        return false;
+    }
+    file.clear();
+    file.seekg(trajectoryFrameOffset(numBodies, frameIndex));
+    if (!file.read(frameBuffer.data(), frameBuffer.size())) {
+        return false;
+    }
+
+    std::memcpy(&stepNumber, frameBuffer.data(), sizeof(stepNumber));
+    const double* xy = reinterpret_cast<const double*>(frameBuffer.data() + sizeof(int64_t));
+    positions.resize(numBodies);
+    for (int i = 0; i < numBodies; i++) {
+        positions[i] = Vec2(xy[i * 2 + 0], xy[i * 2 + 1]);
+    }
+    return true;
+}
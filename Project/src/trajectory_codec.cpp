@@ -0,0 +1,635 @@
+#include "trajectory_codec.h"
+#include "trajectory.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+static const char CODEC_MAGIC[4] = {'N', 'B', 'T', 'Z'};
+static const int32_t CODEC_VERSION = 1;
+static const int32_t CODEC_BLOCK_SIZE = 4096;
+static const int32_t CODEC_KEYFRAME_INTERVAL = 64;
+
+// Quantised coordinates are kept well inside int64_t so residuals cannot overflow
+static const double CODEC_MAX_QUANTA = 4503599627370496.0;  // 2^52
+
+bool isCompressedTrajectory(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[4] = {0, 0, 0, 0};
+    if (!file.read(magic, 4)) {
+        return false;
+    }
+    return std::memcmp(magic, CODEC_MAGIC, 4) == 0;
+}
+
+static int64_t codecHeaderBytes(int numBodies) {
+    int64_t idBytes = static_cast<int64_t>(numBodies) * sizeof(int32_t);
+    idBytes = (idBytes + 7) / 8 * 8;
+    return static_cast<int64_t>(sizeof(CompressedTrajectoryHeader)) + idBytes;
+}
+
+void CodecHistory::resize(int numBodies) {
+    x0.assign(numBodies, 0.0);
+    y0.assign(numBodies, 0.0);
+    x1.assign(numBodies, 0.0);
+    y1.assign(numBodies, 0.0);
+    qx0.assign(numBodies, 0);
+    qy0.assign(numBodies, 0);
+    qx1.assign(numBodies, 0);
+    qy1.assign(numBodies, 0);
+    frames = 0;
+}
+
+// Run work(block) for blocks [0, numBlocks) on up to numThreads threads, each thread
+// taking a contiguous range of blocks; thread 0 runs on the caller
+template <typename Work>
+static void forEachBlock(int numBlocks, int numThreads, Work work) {
+    int totalThreads = std::max(1, std::min(numThreads, numBlocks));
+    auto worker = [&](int t) {
+        int perThread = numBlocks / totalThreads;
+        int remainder = numBlocks % totalThreads;
+        int start = t * perThread + std::min(t, remainder);
+        int end = start + perThread + (t < remainder ? 1 : 0);
+        for (int b = start; b < end; b++) {
+            work(b);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < totalThreads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// ============================================================================
+// Bit and byte streams
+// ============================================================================
+
+namespace {
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : out(out), acc(0), used(0) {}
+
+    // Append the low bits of value, most significant first (bits = 1..64)
+    void write(uint64_t value, int bits) {
+        if (bits > 32) {
+            write(value >> 32, bits - 32);
+            write(value & 0xffffffffULL, 32);
+            return;
+        }
+        acc = (acc << bits) | (value & ((1ULL << bits) - 1));
+        used += bits;
+        while (used >= 8) {
+            used -= 8;
+            out.push_back(static_cast<uint8_t>(acc >> used));
+        }
+    }
+
+    void flush() {
+        if (used > 0) {
+            out.push_back(static_cast<uint8_t>(acc << (8 - used)));
+            used = 0;
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out;
+    uint64_t acc;
+    int used;
+};
+
+class BitReader {
+public:
+    BitReader(const uint8_t* data, size_t size) : data(data), size(size), pos(0), acc(0), avail(0) {}
+
+    uint64_t read(int bits) {
+        if (bits > 32) {
+            uint64_t high = read(bits - 32);
+            return (high << 32) | read(32);
+        }
+        while (avail < bits) {
+            acc = (acc << 8) | (pos < size ? data[pos++] : 0);
+            avail += 8;
+        }
+        avail -= bits;
+        return (acc >> avail) & ((1ULL << bits) - 1);
+    }
+
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+    uint64_t acc;
+    int avail;
+};
+
+// Window of the last explicitly coded XOR of one coordinate stream
+struct XorWindow {
+    int leading;
+    int trailing;
+    bool valid;
+
+    XorWindow() : leading(0), trailing(0), valid(false) {}
+};
+
+void putXor(BitWriter& writer, XorWindow& window, uint64_t bits) {
+    if (bits == 0) {
+        writer.write(0, 1);
+        return;
+    }
+    int leading = std::min(31, __builtin_clzll(bits));
+    int trailing = __builtin_ctzll(bits);
+    if (window.valid && leading >= window.leading && trailing >= window.trailing) {
+        writer.write(2, 2);
+        writer.write(bits >> window.trailing, 64 - window.leading - window.trailing);
+        return;
+    }
+    int length = 64 - leading - trailing;
+    writer.write(3, 2);
+    writer.write(leading, 5);
+    writer.write(length & 63, 6);
+    writer.write(bits >> trailing, length);
+    window.leading = leading;
+    window.trailing = trailing;
+    window.valid = true;
+}
+
+uint64_t getXor(BitReader& reader, XorWindow& window) {
+    if (reader.read(1) == 0) {
+        return 0;
+    }
+    if (reader.read(1) == 0) {
+        return reader.read(64 - window.leading - window.trailing) << window.trailing;
+    }
+    int leading = static_cast<int>(reader.read(5));
+    int length = static_cast<int>(reader.read(6));
+    if (length == 0) {
+        length = 64;
+    }
+    window.leading = leading;
+    window.trailing = 64 - leading - length;
+    window.valid = true;
+    return reader.read(length) << window.trailing;
+}
+
+inline uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+inline int bitLength(uint64_t value) {
+    return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+
+// Exp-Golomb code of order k: Elias gamma of (value >> k) + 1, then the low k bits.
+// Residuals are below 2^54 (CODEC_MAX_QUANTA), so (value >> k) + 1 cannot overflow
+void putGolomb(BitWriter& writer, uint64_t value, int k) {
+    uint64_t high = (value >> k) + 1;
+    int length = bitLength(high);
+    if (length > 1) {
+        writer.write(0, length - 1);
+    }
+    writer.write(high, length);
+    if (k > 0) {
+        writer.write(value, k);
+    }
+}
+
+uint64_t getGolomb(BitReader& reader, int k) {
+    int zeros = 0;
+    while (reader.read(1) == 0 && zeros < 63) {
+        zeros++;
+    }
+    uint64_t high = (1ULL << zeros) | (zeros > 0 ? reader.read(zeros) : 0);
+    uint64_t value = (high - 1) << k;
+    return (k > 0) ? value | reader.read(k) : value;
+}
+
+int golombBits(uint64_t value, int k) {
+    return 2 * bitLength((value >> k) + 1) - 1 + k;
+}
+
+// Order with the fewest bits for these values, searched around log2 of their mean
+int chooseGolombOrder(const std::vector<uint64_t>& values) {
+    if (values.empty()) {
+        return 0;
+    }
+    double mean = 0.0;
+    for (uint64_t value : values) {
+        mean += static_cast<double>(value);
+    }
+    mean /= values.size();
+    int guess = std::max(0, bitLength(static_cast<uint64_t>(mean)) - 1);
+    int best = 0;
+    int64_t bestBits = -1;
+    for (int k = std::max(0, guess - 2); k <= std::min(63, guess + 2); k++) {
+        int64_t bits = 0;
+        for (uint64_t value : values) {
+            bits += golombBits(value, k);
+        }
+        if (bestBits < 0 || bits < bestBits) {
+            best = k;
+            bestBits = bits;
+        }
+    }
+    return best;
+}
+
+uint64_t doubleBits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double bitsDouble(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Prediction of body i from its history, or from the previous body on keyframes
+inline double predict(int frames, const std::vector<double>& h0, const std::vector<double>& h1, int i,
+                      double previous) {
+    if (frames == 0) {
+        return previous;
+    }
+    return (frames == 1) ? h1[i] : h1[i] + (h1[i] - h0[i]);
+}
+
+inline int64_t predict(int frames, const std::vector<int64_t>& h0, const std::vector<int64_t>& h1, int i,
+                       int64_t previous) {
+    if (frames == 0) {
+        return previous;
+    }
+    return (frames == 1) ? h1[i] : 2 * h1[i] - h0[i];
+}
+
+inline int64_t quantise(double value, double quantum) {
+    double quanta = std::round(value / quantum);
+    if (!(quanta > -CODEC_MAX_QUANTA)) {
+        quanta = -CODEC_MAX_QUANTA;  // also NaN
+    } else if (quanta > CODEC_MAX_QUANTA) {
+        quanta = CODEC_MAX_QUANTA;
+    }
+    return static_cast<int64_t>(quanta);
+}
+
+// ----------------------------------------------------------------------------
+// Block coders: bodies [start, end) of one frame, history updated in place
+// ----------------------------------------------------------------------------
+
+void encodeLossless(const double* xs, const double* ys, int start, int end, CodecHistory& h,
+                    std::vector<uint8_t>& out) {
+    out.clear();
+    BitWriter writer(out);
+    XorWindow windowX, windowY;
+    double previousX = 0.0, previousY = 0.0;
+    for (int i = start; i < end; i++) {
+        double px = predict(h.frames, h.x0, h.x1, i, previousX);
+        double py = predict(h.frames, h.y0, h.y1, i, previousY);
+        putXor(writer, windowX, doubleBits(xs[i]) ^ doubleBits(px));
+        putXor(writer, windowY, doubleBits(ys[i]) ^ doubleBits(py));
+        h.x0[i] = h.x1[i];
+        h.y0[i] = h.y1[i];
+        h.x1[i] = previousX = xs[i];
+        h.y1[i] = previousY = ys[i];
+    }
+    writer.flush();
+}
+
+void decodeLossless(const uint8_t* data, size_t size, int start, int end, CodecHistory& h,
+                    double* xs, double* ys) {
+    BitReader reader(data, size);
+    XorWindow windowX, windowY;
+    double previousX = 0.0, previousY = 0.0;
+    for (int i = start; i < end; i++) {
+        double px = predict(h.frames, h.x0, h.x1, i, previousX);
+        double py = predict(h.frames, h.y0, h.y1, i, previousY);
+        xs[i] = bitsDouble(getXor(reader, windowX) ^ doubleBits(px));
+        ys[i] = bitsDouble(getXor(reader, windowY) ^ doubleBits(py));
+        h.x0[i] = h.x1[i];
+        h.y0[i] = h.y1[i];
+        h.x1[i] = previousX = xs[i];
+        h.y1[i] = previousY = ys[i];
+    }
+}
+
+void encodeLossy(const double* xs, const double* ys, int start, int end, double quantum, CodecHistory& h,
+                 std::vector<uint8_t>& out) {
+    std::vector<uint64_t> residuals;
+    residuals.reserve(2 * (end - start));
+    int64_t previousX = 0, previousY = 0;
+    for (int i = start; i < end; i++) {
+        int64_t qx = quantise(xs[i], quantum);
+        int64_t qy = quantise(ys[i], quantum);
+        residuals.push_back(zigzag(qx - predict(h.frames, h.qx0, h.qx1, i, previousX)));
+        residuals.push_back(zigzag(qy - predict(h.frames, h.qy0, h.qy1, i, previousY)));
+        h.qx0[i] = h.qx1[i];
+        h.qy0[i] = h.qy1[i];
+        h.qx1[i] = previousX = qx;
+        h.qy1[i] = previousY = qy;
+    }
+
+    out.clear();
+    BitWriter writer(out);
+    int k = chooseGolombOrder(residuals);
+    writer.write(k, 6);
+    for (uint64_t residual : residuals) {
+        putGolomb(writer, residual, k);
+    }
+    writer.flush();
+}
+
+void decodeLossy(const uint8_t* data, size_t size, int start, int end, double quantum, CodecHistory& h,
+                 double* xs, double* ys) {
+    BitReader reader(data, size);
+    int k = static_cast<int>(reader.read(6));
+    int64_t previousX = 0, previousY = 0;
+    for (int i = start; i < end; i++) {
+        int64_t qx = unzigzag(getGolomb(reader, k)) + predict(h.frames, h.qx0, h.qx1, i, previousX);
+        int64_t qy = unzigzag(getGolomb(reader, k)) + predict(h.frames, h.qy0, h.qy1, i, previousY);
+        xs[i] = static_cast<double>(qx) * quantum;
+        ys[i] = static_cast<double>(qy) * quantum;
+        h.qx0[i] = h.qx1[i];
+        h.qy0[i] = h.qy1[i];
+        h.qx1[i] = previousX = qx;
+        h.qy1[i] = previousY = qy;
+    }
+}
+
+}  // namespace
+
+// ============================================================================
+// CompressedTrajectoryWriter Implementation
+// ============================================================================
+
+CompressedTrajectoryWriter::CompressedTrajectoryWriter()
+    : numBodies(0), numThreads(1), quantum(0.0), numFrames(0), bytesWritten(0) {}
+
+bool CompressedTrajectoryWriter::open(const std::string& filename, const Body* bodies, int count,
+                                      double errorBound, int threads) {
+    close();
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    numBodies = count;
+    numThreads = std::max(1, threads);
+    quantum = (errorBound > 0.0) ? 2.0 * errorBound : 0.0;
+    numFrames = 0;
+
+    std::vector<char> buffer(codecHeaderBytes(numBodies), 0);
+    CompressedTrajectoryHeader header;
+    std::memcpy(header.magic, CODEC_MAGIC, 4);
+    header.version = CODEC_VERSION;
+    header.numBodies = numBodies;
+    header.blockSize = CODEC_BLOCK_SIZE;
+    header.keyframeInterval = CODEC_KEYFRAME_INTERVAL;
+    header.reserved = 0;
+    header.quantum = quantum;
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    for (int i = 0; i < numBodies; i++) {
+        int32_t id = bodies[i].id;
+        std::memcpy(buffer.data() + sizeof(header) + i * sizeof(int32_t), &id, sizeof(id));
+    }
+    file.write(buffer.data(), buffer.size());
+    bytesWritten = static_cast<int64_t>(buffer.size());
+
+    history.resize(numBodies);
+    blockStreams.resize((numBodies + CODEC_BLOCK_SIZE - 1) / CODEC_BLOCK_SIZE);
+    xs.resize(numBodies);
+    ys.resize(numBodies);
+    return true;
+}
+
+void CompressedTrajectoryWriter::writeFrame(int stepNumber, const Body* bodies, int count) {
+    if (!file.is_open()) {
+        return;
+    }
+    if (count != numBodies) {
+        std::cerr << "Warning: compressed trajectory frame has " << count << " bodies, expected "
+                  << numBodies << "; frame skipped" << std::endl;
+        return;
+    }
+
+    for (int i = 0; i < numBodies; i++) {
+        xs[i] = bodies[i].position.x;
+        ys[i] = bodies[i].position.y;
+    }
+    if (numFrames % CODEC_KEYFRAME_INTERVAL == 0) {
+        history.frames = 0;
+    }
+    int numBlocks = static_cast<int>(blockStreams.size());
+    forEachBlock(numBlocks, numThreads, [&](int b) {
+        int start = b * CODEC_BLOCK_SIZE;
+        int end = std::min(numBodies, start + CODEC_BLOCK_SIZE);
+        if (quantum > 0.0) {
+            encodeLossy(xs.data(), ys.data(), start, end, quantum, history, blockStreams[b]);
+        } else {
+            encodeLossless(xs.data(), ys.data(), start, end, history, blockStreams[b]);
+        }
+    });
+    history.frames = std::min(2, history.frames + 1);
+
+    std::vector<uint32_t> blockBytes(numBlocks);
+    uint64_t frameBytes = sizeof(int64_t) + sizeof(int32_t) + numBlocks * sizeof(uint32_t);
+    for (int b = 0; b < numBlocks; b++) {
+        blockBytes[b] = static_cast<uint32_t>(blockStreams[b].size());
+        frameBytes += blockBytes[b];
+    }
+    int64_t step = stepNumber;
+    int32_t blocks = numBlocks;
+    file.write(reinterpret_cast<const char*>(&frameBytes), sizeof(frameBytes));
+    file.write(reinterpret_cast<const char*>(&step), sizeof(step));
+    file.write(reinterpret_cast<const char*>(&blocks), sizeof(blocks));
+    file.write(reinterpret_cast<const char*>(blockBytes.data()), numBlocks * sizeof(uint32_t));
+    for (int b = 0; b < numBlocks; b++) {
+        file.write(reinterpret_cast<const char*>(blockStreams[b].data()), blockStreams[b].size());
+    }
+    bytesWritten += static_cast<int64_t>(sizeof(frameBytes) + frameBytes);
+    numFrames++;
+}
+
+void CompressedTrajectoryWriter::close() {
+    if (file.is_open()) {
+        file.close();
+    }
+}
+
+bool CompressedTrajectoryWriter::isOpen() const {
+    return file.is_open();
+}
+
+int64_t CompressedTrajectoryWriter::getRawBytes() const {
+    return trajectoryHeaderBytes(numBodies) + numFrames * trajectoryFrameBytes(numBodies);
+}
+
+// ============================================================================
+// CompressedTrajectoryReader Implementation
+// ============================================================================
+
+CompressedTrajectoryReader::CompressedTrajectoryReader()
+    : numThreads(1), scanOffset(0), decodedFrame(-1), decodedStep(0) {
+    std::memset(&header, 0, sizeof(header));
+}
+
+bool CompressedTrajectoryReader::open(const std::string& filename, int threads) {
+    close();
+    file.open(filename, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, CODEC_MAGIC, 4) != 0) {
+        std::cerr << "Not a compressed trajectory: " << filename << std::endl;
+        close();
+        return false;
+    }
+    if (header.version != CODEC_VERSION || header.numBodies < 0 || header.blockSize <= 0 ||
+        header.keyframeInterval <= 0) {
+        std::cerr << "Unsupported compressed trajectory version " << header.version << " in " << filename
+                  << std::endl;
+        close();
+        return false;
+    }
+
+    std::vector<int32_t> rawIds(header.numBodies);
+    file.read(reinterpret_cast<char*>(rawIds.data()), header.numBodies * sizeof(int32_t));
+    ids.assign(rawIds.begin(), rawIds.end());
+    numThreads = std::max(1, threads);
+    scanOffset = codecHeaderBytes(header.numBodies);
+    history.resize(header.numBodies);
+    xs.resize(header.numBodies);
+    ys.resize(header.numBodies);
+    return static_cast<bool>(file);
+}
+
+void CompressedTrajectoryReader::close() {
+    if (file.is_open()) {
+        file.close();
+    }
+    file.clear();
+    std::memset(&header, 0, sizeof(header));
+    ids.clear();
+    frameOffsets.clear();
+    scanOffset = 0;
+    decodedFrame = -1;
+}
+
+int64_t CompressedTrajectoryReader::getNumFrames() {
+    if (!file.is_open()) {
+        return 0;
+    }
+    file.clear();
+    file.seekg(0, std::ios::end);
+    int64_t fileBytes = static_cast<int64_t>(file.tellg());
+    while (scanOffset + static_cast<int64_t>(sizeof(uint64_t)) <= fileBytes) {
+        uint64_t frameBytes;
+        file.seekg(scanOffset);
+        if (!file.read(reinterpret_cast<char*>(&frameBytes), sizeof(frameBytes))) {
+            file.clear();
+            break;
+        }
+        int64_t next = scanOffset + static_cast<int64_t>(sizeof(frameBytes) + frameBytes);
+        if (next > fileBytes) {
+            break;
+        }
+        frameOffsets.push_back(scanOffset);
+        scanOffset = next;
+    }
+    return static_cast<int64_t>(frameOffsets.size());
+}
+
+bool CompressedTrajectoryReader::decodeFrame(int64_t frameIndex) {
+    uint64_t frameBytes;
+    file.clear();
+    file.seekg(frameOffsets[frameIndex]);
+    if (!file.read(reinterpret_cast<char*>(&frameBytes), sizeof(frameBytes))) {
+        return false;
+    }
+    frameBuffer.resize(frameBytes);
+    if (!file.read(frameBuffer.data(), frameBytes)) {
+        return false;
+    }
+
+    const char* cursor = frameBuffer.data();
+    int64_t step;
+    int32_t numBlocks;
+    std::memcpy(&step, cursor, sizeof(step));
+    std::memcpy(&numBlocks, cursor + sizeof(step), sizeof(numBlocks));
+    int numBodies = header.numBodies;
+    int blockSize = header.blockSize;
+    if (numBlocks != (numBodies + blockSize - 1) / blockSize) {
+        return false;
+    }
+    std::vector<uint32_t> blockBytes(numBlocks);
+    std::memcpy(blockBytes.data(), cursor + sizeof(step) + sizeof(numBlocks), numBlocks * sizeof(uint32_t));
+    std::vector<size_t> blockOffsets(numBlocks + 1);
+    blockOffsets[0] = sizeof(step) + sizeof(numBlocks) + numBlocks * sizeof(uint32_t);
+    for (int b = 0; b < numBlocks; b++) {
+        blockOffsets[b + 1] = blockOffsets[b] + blockBytes[b];
+    }
+    if (blockOffsets[numBlocks] > frameBytes) {
+        return false;
+    }
+
+    if (frameIndex % header.keyframeInterval == 0) {
+        history.frames = 0;
+    }
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(frameBuffer.data());
+    double quantum = header.quantum;
+    forEachBlock(numBlocks, numThreads, [&](int b) {
+        int start = b * blockSize;
+        int end = std::min(numBodies, start + blockSize);
+        if (quantum > 0.0) {
+            decodeLossy(data + blockOffsets[b], blockBytes[b], start, end, quantum, history,
+                        xs.data(), ys.data());
+        } else {
+            decodeLossless(data + blockOffsets[b], blockBytes[b], start, end, history, xs.data(), ys.data());
+        }
+    });
+    history.frames = std::min(2, history.frames + 1);
+    decodedFrame = frameIndex;
+    decodedStep = step;
+    return true;
+}
+
+bool CompressedTrajectoryReader::readFrame(int64_t frameIndex, int64_t& stepNumber, std::vector<Vec2>& positions) {
+    if (!file.is_open() || frameIndex < 0) {
+        return false;
+    }
+    if (frameIndex >= static_cast<int64_t>(frameOffsets.size()) && frameIndex >= getNumFrames()) {
+        return false;
+    }
+
+    if (decodedFrame != frameIndex) {
+        // Continue from the frame in history when it lies between the keyframe and
+        // the target, otherwise start at the keyframe
+        int64_t keyframe = frameIndex - frameIndex % header.keyframeInterval;
+        int64_t first = (decodedFrame >= keyframe && decodedFrame < frameIndex) ? decodedFrame + 1 : keyframe;
+        for (int64_t f = first; f <= frameIndex; f++) {
+            if (!decodeFrame(f)) {
+                decodedFrame = -1;
+                return false;
+            }
+        }
+    }
+
+    stepNumber = decodedStep;
+    positions.resize(header.numBodies);
+    for (int i = 0; i < header.numBodies; i++) {
+        positions[i] = Vec2(xs[i], ys[i]);
+    }
+    return true;
+}